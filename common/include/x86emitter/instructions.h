@@ -170,6 +170,8 @@ extern void xCWD();
 extern void xCDQ();
 extern void xCWDE();
 
+extern void xRDTSC();
+
 extern void xLAHF();
 extern void xSAHF();
 
@@ -1012,6 +1012,8 @@ __fi void xCWD() { xWrite8(0x98); }
 __fi void xCDQ() { xWrite8(0x99); }
 __fi void xCWDE() { xWrite8(0x98); }
 
+__fi void xRDTSC() { xWrite16(0x310F); }
+
 __fi void xLAHF() { xWrite8(0x9f); }
 __fi void xSAHF() { xWrite8(0x9e); }
 
@@ -53,6 +53,13 @@ public:
 	virtual void SetBlockSize(uint bytes) {}
 	virtual void SetDataOffset(int bytes) {}
 
+	// Readers that have the image mapped in memory return the sectors in
+	// place, valid until Close. Returns NULL when they have to be read.
+	virtual const u8* GetBlockPointer(uint sector, uint count) { return NULL; }
+	// Hints that the sectors returned by GetBlockPointer are wanted soon, and
+	// whether the drive is reading sequentially.
+	virtual void AdviseRead(uint sector, uint count, bool sequential) {}
+
 	uint GetBlockSize() const { return m_blocksize; }
 
 	const wxString& GetFilename() const
@@ -76,6 +83,13 @@ class FlatFileReader : public AsyncFileReader
 #elif defined(__linux__)
 	int m_fd; // FIXME don't know if overlap as an equivalent on linux
 	io_context_t m_aio_context;
+	int m_aio_requests; // requests submitted by the last BeginRead
+	int m_aio_requested; // requests the last BeginRead split its read into
+
+	// The image mapped in memory; reads come from here unless mmap failed
+	u8* m_mapping;
+	size_t m_mapping_size;
+	bool m_mapping_sequential;
 #elif defined(__POSIX__)
 	int m_fd; // TODO OSX don't know if overlap as an equivalent on OSX
 	struct aiocb m_aiocb;
@@ -102,6 +116,11 @@ public:
 
 	virtual void SetBlockSize(uint bytes) { m_blocksize = bytes; }
 	virtual void SetDataOffset(int bytes) { m_dataoffset = bytes; }
+
+#ifdef __linux__
+	virtual const u8* GetBlockPointer(uint sector, uint count);
+	virtual void AdviseRead(uint sector, uint count, bool sequential);
+#endif
 };
 
 class MultipartFileReader : public AsyncFileReader
@@ -139,6 +158,9 @@ public:
 
 	virtual void SetBlockSize(uint bytes);
 
+	virtual const u8* GetBlockPointer(uint sector, uint count);
+	virtual void AdviseRead(uint sector, uint count, bool sequential);
+
 	static AsyncFileReader* DetectMultipart(AsyncFileReader* reader);
 };
 
@@ -0,0 +1,331 @@
+/*  PCSX2 - PS2 Emulator for PCs
+*  Copyright (C) 2002-2014  PCSX2 Dev Team
+*
+*  PCSX2 is free software: you can redistribute it and/or modify it under the terms
+*  of the GNU Lesser General Public License as published by the Free Software Found-
+*  ation, either version 3 of the License, or (at your option) any later version.
+*
+*  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+*  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+*  PURPOSE.  See the GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License along with PCSX2.
+*  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PrecompiledHeader.h"
+#include "BciFormat.h"
+#include <algorithm>
+#include <queue>
+
+// Block codec of BCI images. The compressed data is in the LZ4 block format
+// (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md): sequences of
+// literals followed by a match of at least 4 bytes, 16-bit match offsets, the
+// last 5 bytes of a block always literals and the last match starting at
+// least 12 bytes before its end. The compressor walks hash chains, since
+// images are compressed once and read many times.
+
+static const u32 MIN_MATCH = 4;
+static const u32 LAST_LITERALS = 5;
+static const u32 MF_LIMIT = 12;
+static const u32 MAX_OFFSET = 65535;
+static const int HASH_LOG = 15;
+static const int MAX_ATTEMPTS = 64;
+
+static inline u32 Hash4(const u8* p) {
+	u32 v;
+	memcpy(&v, p, sizeof(v));
+	return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+bool BciValidateHeader(const BciHeader& hdr) {
+	if (hdr.magic[0] != 'B' || hdr.magic[1] != 'C' || hdr.magic[2] != 'I' || hdr.magic[3] != 0x1a) {
+		// Invalid magic, definitely a bad file.
+		return false;
+	}
+	if (hdr.ver != BCI_VERSION || hdr.header_size != sizeof(BciHeader)) {
+		Console.Error(L"Only BCIv1 files are supported.");
+		return false;
+	}
+	if (hdr.codec != BCI_CODEC_LZ4) {
+		Console.Error(L"Unknown BCI codec %u.", hdr.codec);
+		return false;
+	}
+	if (hdr.block_size < 2048 || hdr.block_size > 1024 * 1024) {
+		Console.Error(L"BCI block size must be between one sector and 1 MB.");
+		return false;
+	}
+	if (hdr.dict_size > MAX_OFFSET) {
+		Console.Error(L"BCI dictionary is larger than a match can reach.");
+		return false;
+	}
+
+	// All checks passed, this is a good BCI header.
+	return true;
+}
+
+BciCompressor::BciCompressor(const u8* dict, u32 dictSize)
+	: m_dictSize(dictSize)
+	, m_window(dictSize + BCI_BLOCK_SIZE)
+	, m_head(1 << HASH_LOG, -1)
+	, m_chain(dictSize + BCI_BLOCK_SIZE, -1) {
+	if (dictSize)
+		memcpy(m_window.data(), dict, dictSize);
+	for (u32 pos = 0; pos + MIN_MATCH <= dictSize; pos++)
+		Insert(pos);
+	m_dictHead = m_head;
+}
+
+void BciCompressor::Insert(u32 pos) {
+	u32 h = Hash4(&m_window[pos]);
+	m_chain[pos] = m_head[h];
+	m_head[h] = pos;
+}
+
+u32 BciCompressor::MatchLength(u32 candidate, u32 pos, u32 limit) const {
+	const u8* window = m_window.data();
+	u32 len = 0;
+	while (pos + len < limit && window[candidate + len] == window[pos + len])
+		len++;
+	return len;
+}
+
+static u8* WriteLength(u8* op, u32 len) {
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (u8)len;
+	return op;
+}
+
+// Literals from anchor, then a match unless len is 0. NULL if it doesn't fit.
+static u8* WriteSequence(u8* op, u8* oend, const u8* literals, u32 litLen, u32 offset, u32 len) {
+	u32 needed = 1 + (litLen / 255 + 1) + litLen + (len ? 2 + len / 255 + 1 : 0);
+	if ((u32)(oend - op) < needed)
+		return NULL;
+
+	u8* token = op++;
+	if (litLen >= 15) {
+		*token = 15 << 4;
+		op = WriteLength(op, litLen - 15);
+	} else {
+		*token = (u8)(litLen << 4);
+	}
+	memcpy(op, literals, litLen);
+	op += litLen;
+
+	if (!len)
+		return op;
+
+	*op++ = (u8)offset;
+	*op++ = (u8)(offset >> 8);
+	len -= MIN_MATCH;
+	if (len >= 15) {
+		*token |= 15;
+		op = WriteLength(op, len - 15);
+	} else {
+		*token |= (u8)len;
+	}
+	return op;
+}
+
+u32 BciCompressor::Compress(const u8* src, u32 size, u8* dst, u32 dstCapacity) {
+	pxAssert(size <= BCI_BLOCK_SIZE);
+
+	// Positions of the last block are stale, but none is reachable from the
+	// dictionary's hash heads: the chains only ever lead to earlier positions.
+	memcpy(&m_window[m_dictSize], src, size);
+	std::copy(m_dictHead.begin(), m_dictHead.end(), m_head.begin());
+
+	const u32 end = m_dictSize + size;
+	u8* op = dst;
+	u8* const oend = dst + dstCapacity;
+	u32 anchor = m_dictSize;
+	u32 pos = m_dictSize;
+
+	if (size > MF_LIMIT) {
+		const u32 matchLimit = end - LAST_LITERALS;
+		const u32 mfLimit = end - MF_LIMIT;
+		while (pos < mfLimit) {
+			u32 bestLen = 0;
+			u32 bestPos = 0;
+			s32 candidate = m_head[Hash4(&m_window[pos])];
+			for (int attempts = MAX_ATTEMPTS; candidate >= 0 && attempts > 0; candidate = m_chain[candidate], attempts--) {
+				if (pos - candidate > MAX_OFFSET)
+					break;
+				u32 len = MatchLength(candidate, pos, matchLimit);
+				if (len > bestLen) {
+					bestLen = len;
+					bestPos = candidate;
+				}
+			}
+			Insert(pos);
+
+			if (bestLen < MIN_MATCH) {
+				pos++;
+				continue;
+			}
+
+			op = WriteSequence(op, oend, &m_window[anchor], pos - anchor, pos - bestPos, bestLen);
+			if (!op)
+				return 0;
+
+			for (u32 i = 1; i < bestLen && pos + i + MIN_MATCH <= end; i++)
+				Insert(pos + i);
+			pos += bestLen;
+			anchor = pos;
+		}
+	}
+
+	op = WriteSequence(op, oend, &m_window[anchor], end - anchor, 0, 0);
+	if (!op)
+		return 0;
+	return (u32)(op - dst);
+}
+
+static bool ReadLength(const u8*& ip, const u8* iend, u32& len) {
+	u32 s;
+	do {
+		if (ip >= iend)
+			return false;
+		s = *ip++;
+		len += s;
+	} while (s == 255);
+	return true;
+}
+
+bool BciDecompressBlock(const u8* dict, u32 dictSize, const u8* src, u32 srcSize, u8* dst, u32 dstSize) {
+	const u8* ip = src;
+	const u8* const iend = src + srcSize;
+	u8* op = dst;
+	u8* const oend = dst + dstSize;
+
+	while (ip < iend) {
+		const u32 token = *ip++;
+
+		u32 litLen = token >> 4;
+		if (litLen == 15 && !ReadLength(ip, iend, litLen))
+			return false;
+		if ((u32)(iend - ip) < litLen || (u32)(oend - op) < litLen)
+			return false;
+		memcpy(op, ip, litLen);
+		ip += litLen;
+		op += litLen;
+
+		// The last sequence has no match.
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return false;
+		const u32 offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		u32 len = token & 15;
+		if (len == 15 && !ReadLength(ip, iend, len))
+			return false;
+		len += MIN_MATCH;
+		if (offset == 0 || (u32)(oend - op) < len)
+			return false;
+
+		const u32 produced = (u32)(op - dst);
+		const u8* match = op - offset;
+		if (offset > produced) {
+			// Starts in the dictionary, and may run on into the block.
+			const u32 back = offset - produced;
+			if (back > dictSize)
+				return false;
+			const u32 fromDict = std::min(back, len);
+			memcpy(op, dict + dictSize - back, fromDict);
+			op += fromDict;
+			len -= fromDict;
+			match = dst;
+		}
+
+		if (offset == 1) {
+			memset(op, *match, len);
+			op += len;
+			continue;
+		}
+		// Overlapping matches repeat the last offset bytes; copy them a
+		// period at a time.
+		while (len) {
+			const u32 n = std::min(len, (u32)(op - match));
+			memcpy(op, match, n);
+			op += n;
+			match += n;
+			len -= n;
+		}
+	}
+
+	return op == oend;
+}
+
+std::vector<u8> BciTrainDictionary(const std::vector<u8>& samples, u32 dictSize) {
+	// A simplified COVER: segments are scored by how often the 8-byte strings
+	// in them occur over all the samples, each string counted once per
+	// dictionary, so segments that only repeat the ones already in score low.
+	static const u32 K = 8;
+	static const u32 SEGMENT = 256;
+	static const int TABLE_LOG = 20;
+
+	std::vector<u8> dict;
+	if (samples.size() < SEGMENT)
+		return dict;
+
+	auto hashK = [&](size_t pos) {
+		u64 v;
+		memcpy(&v, &samples[pos], sizeof(v));
+		return (u32)((v * 0x9E3779B97F4A7C15ULL) >> (64 - TABLE_LOG));
+	};
+
+	std::vector<u32> freq(1 << TABLE_LOG, 0);
+	for (size_t i = 0; i + K <= samples.size(); i++)
+		freq[hashK(i)]++;
+
+	std::vector<u32> seen(1 << TABLE_LOG, 0);
+	u32 epoch = 0;
+	auto score = [&](size_t segment) {
+		epoch++;
+		u64 total = 0;
+		for (size_t i = segment; i + K <= segment + SEGMENT; i++) {
+			u32 h = hashK(i);
+			if (seen[h] == epoch)
+				continue;
+			seen[h] = epoch;
+			// strings seen once are of no use to any other block
+			total += freq[h] - 1;
+		}
+		return total;
+	};
+
+	// Scores only go down as segments are taken, so a segment whose fresh
+	// score still tops the queue is the best one left.
+	typedef std::pair<u64, size_t> Candidate;
+	std::priority_queue<Candidate> queue;
+	for (size_t seg = 0; seg + SEGMENT <= samples.size(); seg += SEGMENT)
+		queue.push(Candidate(score(seg), seg));
+
+	std::vector<size_t> chosen;
+	while (!queue.empty() && (chosen.size() + 1) * SEGMENT <= dictSize) {
+		const size_t seg = queue.top().second;
+		queue.pop();
+
+		const u64 fresh = score(seg);
+		if (fresh == 0)
+			break;
+		if (!queue.empty() && fresh < queue.top().first) {
+			queue.push(Candidate(fresh, seg));
+			continue;
+		}
+
+		chosen.push_back(seg);
+		for (size_t i = seg; i + K <= seg + SEGMENT; i++)
+			freq[hashK(i)] = 1;
+	}
+
+	for (auto it = chosen.rbegin(); it != chosen.rend(); ++it)
+		dict.insert(dict.end(), samples.begin() + *it, samples.begin() + *it + SEGMENT);
+	return dict;
+}
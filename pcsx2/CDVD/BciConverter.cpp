@@ -0,0 +1,231 @@
+/*  PCSX2 - PS2 Emulator for PCs
+*  Copyright (C) 2002-2014  PCSX2 Dev Team
+*
+*  PCSX2 is free software: you can redistribute it and/or modify it under the terms
+*  of the GNU Lesser General Public License as published by the Free Software Found-
+*  ation, either version 3 of the License, or (at your option) any later version.
+*
+*  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+*  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+*  PURPOSE.  See the GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License along with PCSX2.
+*  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PrecompiledHeader.h"
+#include "BciConverter.h"
+#include "BciFormat.h"
+#include "CompressedFileReaderUtils.h"
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+static bool ReadAt(FILE* fp, u64 offset, u8* dest, size_t size) {
+	return PX_fseeko(fp, offset, SEEK_SET) == 0 && fread(dest, 1, size, fp) == size;
+}
+
+static bool IsZero(const u8* data, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		if (data[i])
+			return false;
+	}
+	return true;
+}
+
+// Samples blocks evenly over the image; padding isn't worth a place.
+static std::vector<u8> TrainDictionary(FILE* in, u64 totalSize, u32 numBlocks) {
+	std::vector<u8> samples;
+	std::vector<u8> block(BCI_BLOCK_SIZE);
+	const u32 step = std::max(1u, numBlocks / BCI_SAMPLE_BLOCKS);
+
+	for (u32 b = 0; b < numBlocks; b += step) {
+		const u64 start = (u64)b * BCI_BLOCK_SIZE;
+		const size_t size = (size_t)std::min<u64>(BCI_BLOCK_SIZE, totalSize - start);
+		if (!ReadAt(in, start, block.data(), size))
+			break;
+		if (!IsZero(block.data(), size))
+			samples.insert(samples.end(), block.begin(), block.begin() + size);
+	}
+
+	return BciTrainDictionary(samples, BCI_DICT_SIZE);
+}
+
+// Threads that live for the whole conversion and run work(thread) once per batch.
+class BciWorkers {
+public:
+	BciWorkers(uint threads, const std::function<void(uint)>& work)
+		: m_work(work), m_batch(0), m_running(0), m_quit(false) {
+		for (uint t = 0; t < threads; t++)
+			m_threads.emplace_back(&BciWorkers::Loop, this, t);
+	}
+
+	~BciWorkers() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		m_start.notify_all();
+		for (std::thread& thread : m_threads)
+			thread.join();
+	}
+
+	// Returns once every thread is done with the batch.
+	void Run() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_running = (uint)m_threads.size();
+		m_batch++;
+		m_start.notify_all();
+		m_done.wait(lock, [&] { return m_running == 0; });
+	}
+
+private:
+	void Loop(uint t) {
+		u64 batch = 0;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;) {
+			m_start.wait(lock, [&] { return m_quit || m_batch != batch; });
+			if (m_quit)
+				return;
+			batch = m_batch;
+			lock.unlock();
+			m_work(t);
+			lock.lock();
+			if (--m_running == 0)
+				m_done.notify_one();
+		}
+	}
+
+	std::function<void(uint)> m_work;
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_start;
+	std::condition_variable m_done;
+	u64 m_batch;
+	uint m_running;
+	bool m_quit;
+};
+
+static bool ConvertBlocks(FILE* in, FILE* out, u64 totalSize, const std::vector<u8>& dict, std::vector<u64>& index, u64 offset) {
+	const u32 numBlocks = (u32)(index.size() - 1);
+	const uint threads = std::max(1u, std::thread::hardware_concurrency());
+	const u32 batch = threads * BCI_BATCH_BLOCKS;
+
+	std::vector<std::unique_ptr<BciCompressor>> compressors;
+	for (uint t = 0; t < threads; t++)
+		compressors.emplace_back(new BciCompressor(dict.data(), (u32)dict.size()));
+
+	std::vector<u8> input((size_t)batch * BCI_BLOCK_SIZE);
+	std::vector<u8> output((size_t)batch * BCI_BLOCK_SIZE);
+	std::vector<u32> sizes(batch);
+	int lastPercent = -1;
+
+	// the batch being compressed, read by the workers while Run() waits for them
+	u32 count = 0;
+	u64 bytes = 0;
+	auto length = [&](u32 i) {
+		return (u32)std::min<u64>(BCI_BLOCK_SIZE, bytes - (u64)i * BCI_BLOCK_SIZE);
+	};
+
+	BciWorkers workers(threads, [&](uint t) {
+		for (u32 i = t; i < count; i += threads) {
+			// blocks that don't shrink are stored as they are
+			sizes[i] = compressors[t]->Compress(&input[(size_t)i * BCI_BLOCK_SIZE], length(i),
+				&output[(size_t)i * BCI_BLOCK_SIZE], length(i) - 1);
+		}
+	});
+
+	for (u32 first = 0; first < numBlocks; first += batch) {
+		count = std::min(batch, numBlocks - first);
+		const u64 start = (u64)first * BCI_BLOCK_SIZE;
+		bytes = std::min<u64>((u64)count * BCI_BLOCK_SIZE, totalSize - start);
+		if (!ReadAt(in, start, input.data(), (size_t)bytes)) {
+			Console.Error(L"BCI: unable to read the source image.");
+			return false;
+		}
+
+		workers.Run();
+
+		for (u32 i = 0; i < count; i++) {
+			const u8* data = sizes[i] ? &output[(size_t)i * BCI_BLOCK_SIZE] : &input[(size_t)i * BCI_BLOCK_SIZE];
+			const u32 size = sizes[i] ? sizes[i] : length(i);
+			index[first + i] = sizes[i] ? offset : offset | BCI_INDEX_STORED;
+			if (fwrite(data, 1, size, out) != size) {
+				Console.Error(L"BCI: unable to write the compressed image.");
+				return false;
+			}
+			offset += size;
+		}
+
+		const int percent = (int)((u64)(first + count) * 100 / numBlocks);
+		if (percent / 10 != lastPercent / 10) {
+			Console.WriteLn(L"BCI: %d%%", percent);
+			lastPercent = percent;
+		}
+	}
+
+	index[numBlocks] = offset;
+	return true;
+}
+
+bool BciConverter::Convert(const wxString& srcFile, const wxString& dstFile) {
+	FILE* in = PX_fopen_rb(srcFile);
+	if (!in) {
+		Console.Error(L"BCI: unable to open %s.", WX_STR(srcFile));
+		return false;
+	}
+
+	PX_fseeko(in, 0, SEEK_END);
+	const u64 totalSize = PX_ftello(in);
+	if (totalSize == 0) {
+		Console.Error(L"BCI: %s is empty.", WX_STR(srcFile));
+		fclose(in);
+		return false;
+	}
+	const u32 numBlocks = (u32)((totalSize + BCI_BLOCK_SIZE - 1) / BCI_BLOCK_SIZE);
+
+	FILE* out = PX_fopen_wb(dstFile);
+	if (!out) {
+		Console.Error(L"BCI: unable to create %s.", WX_STR(dstFile));
+		fclose(in);
+		return false;
+	}
+
+	Console.WriteLn(Color_StrongBlue, L"BCI: compressing %s", WX_STR(srcFile));
+
+	std::vector<u8> dict = TrainDictionary(in, totalSize, numBlocks);
+
+	BciHeader hdr = {};
+	memcpy(hdr.magic, "BCI\x1a", 4);
+	hdr.header_size = sizeof(BciHeader);
+	hdr.total_bytes = totalSize;
+	hdr.block_size = BCI_BLOCK_SIZE;
+	hdr.dict_size = (u32)dict.size();
+	hdr.ver = BCI_VERSION;
+	hdr.codec = BCI_CODEC_LZ4;
+
+	// The index is written again once the blocks are.
+	std::vector<u64> index(numBlocks + 1);
+	const u64 indexOffset = sizeof(hdr) + dict.size();
+	bool success = fwrite(&hdr, sizeof(hdr), 1, out) == 1
+		&& (dict.empty() || fwrite(dict.data(), dict.size(), 1, out) == 1)
+		&& fwrite(index.data(), sizeof(u64), index.size(), out) == index.size()
+		&& ConvertBlocks(in, out, totalSize, dict, index, indexOffset + index.size() * sizeof(u64))
+		&& PX_fseeko(out, indexOffset, SEEK_SET) == 0
+		&& fwrite(index.data(), sizeof(u64), index.size(), out) == index.size();
+
+	fclose(in);
+	success = fclose(out) == 0 && success;
+
+	if (!success) {
+		Console.Error(L"BCI: conversion of %s failed.", WX_STR(srcFile));
+		wxRemoveFile(dstFile);
+		return false;
+	}
+
+	Console.WriteLn(Color_StrongBlue, L"BCI: wrote %s, %u KB dictionary, %.1f%% of the original size.",
+		WX_STR(dstFile), (uint)(dict.size() / 1024), index[numBlocks] * 100.0 / totalSize);
+	return true;
+}
@@ -0,0 +1,30 @@
+/*  PCSX2 - PS2 Emulator for PCs
+*  Copyright (C) 2002-2014  PCSX2 Dev Team
+*
+*  PCSX2 is free software: you can redistribute it and/or modify it under the terms
+*  of the GNU Lesser General Public License as published by the Free Software Found-
+*  ation, either version 3 of the License, or (at your option) any later version.
+*
+*  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+*  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+*  PURPOSE.  See the GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License along with PCSX2.
+*  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+// Blocks compressed by each thread per pass over the image.
+static const uint BCI_BATCH_BLOCKS = 256;
+// Blocks spread over the image that the dictionary is trained on.
+static const uint BCI_SAMPLE_BLOCKS = 1024;
+
+// Writes uncompressed images as block-compressed ones (see BciFormat.h),
+// compressing on every core.
+class BciConverter
+{
+public:
+	// Returns false, after logging why, if the image could not be converted.
+	static bool Convert(const wxString& srcFile, const wxString& dstFile);
+};
@@ -0,0 +1,232 @@
+/*  PCSX2 - PS2 Emulator for PCs
+*  Copyright (C) 2002-2014  PCSX2 Dev Team
+*
+*  PCSX2 is free software: you can redistribute it and/or modify it under the terms
+*  of the GNU Lesser General Public License as published by the Free Software Found-
+*  ation, either version 3 of the License, or (at your option) any later version.
+*
+*  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+*  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+*  PURPOSE.  See the GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License along with PCSX2.
+*  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PrecompiledHeader.h"
+#include "AsyncFileReader.h"
+#include "CompressedFileReaderUtils.h"
+#include "BciFileReader.h"
+
+bool BciFileReader::CanHandle(const wxString& fileName) {
+	bool supported = false;
+	if (wxFileName::FileExists(fileName) && fileName.Lower().EndsWith(L".bci")) {
+		FILE* fp = PX_fopen_rb(fileName);
+		BciHeader hdr;
+		if (fp) {
+			if (fread(&hdr, 1, sizeof(hdr), fp) == sizeof(hdr)) {
+				supported = BciValidateHeader(hdr);
+			}
+			fclose(fp);
+		}
+	}
+	return supported;
+}
+
+bool BciFileReader::Open(const wxString& fileName) {
+	Close();
+	m_filename = fileName;
+	m_src = PX_fopen_rb(m_filename);
+
+	if (!m_src || !ReadFileHeader()) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+bool BciFileReader::ReadFileHeader() {
+	BciHeader hdr = {};
+
+	if (fread(&hdr, 1, sizeof(hdr), m_src) != sizeof(hdr)) {
+		Console.Error(L"Failed to read BCI file header.");
+		return false;
+	}
+
+	if (!BciValidateHeader(hdr)) {
+		Console.Error(L"BCI has invalid header.");
+		return false;
+	}
+
+	// The header is all we know the file size from, check it against the
+	// actual file before sizing anything after it.
+	if (PX_fseeko(m_src, 0, SEEK_END) != 0) {
+		Console.Error(L"Unable to get the size of BCI.");
+		return false;
+	}
+	const u64 fileSize = PX_ftello(m_src);
+	// Round up, since part of a block requires a full block.
+	const u64 numBlocks = (hdr.total_bytes + hdr.block_size - 1) / hdr.block_size;
+	const u64 dataOffset = sizeof(hdr) + (u64)hdr.dict_size;
+	if (hdr.total_bytes == 0 || numBlocks >= 0xFFFFFFFFULL
+		|| dataOffset > fileSize || (numBlocks + 1) > (fileSize - dataOffset) / sizeof(u64)) {
+		Console.Error(L"BCI header doesn't match the size of the file.");
+		return false;
+	}
+	if (PX_fseeko(m_src, sizeof(hdr), SEEK_SET) != 0) {
+		Console.Error(L"Failed to read BCI file header.");
+		return false;
+	}
+
+	m_totalSize = hdr.total_bytes;
+	m_frameSize = hdr.block_size;
+	m_numBlocks = (u32)numBlocks;
+
+	m_dict.resize(hdr.dict_size);
+	if (hdr.dict_size && fread(m_dict.data(), 1, hdr.dict_size, m_src) != hdr.dict_size) {
+		Console.Error(L"Unable to read the dictionary of BCI.");
+		return false;
+	}
+
+	m_index.resize(m_numBlocks + 1);
+	if (fread(m_index.data(), sizeof(u64), m_index.size(), m_src) != m_index.size()) {
+		Console.Error(L"Unable to read index data from BCI.");
+		return false;
+	}
+
+	// Offsets of single blocks are checked as they're read, the ends here.
+	const u64 indexEnd = dataOffset + m_index.size() * sizeof(u64);
+	if ((m_index[0] & ~BCI_INDEX_STORED) < indexEnd || (m_index[m_numBlocks] & ~BCI_INDEX_STORED) > fileSize) {
+		Console.Error(L"BCI index points outside of the file.");
+		return false;
+	}
+
+	m_readBuffer.resize(m_frameSize);
+	m_cache.reset(new ChunksCache(BCI_CACHE_SIZE_MB, m_frameSize));
+	return true;
+}
+
+void BciFileReader::Close() {
+	m_filename.Empty();
+
+	if (m_cache) {
+		ChunksCache::Stats stats = m_cache->GetStats();
+		if (stats.hits + stats.misses)
+			DevCon.WriteLn("BCI: block cache %llu hits, %llu misses", stats.hits, stats.misses);
+		m_cache.reset();
+	}
+	m_dict.clear();
+	m_index.clear();
+	m_readBuffer.clear();
+	m_pendingBuffer = NULL;
+
+	if (m_src) {
+		fclose(m_src);
+		m_src = NULL;
+	}
+}
+
+int BciFileReader::ReadSync(void* pBuffer, uint sector, uint count) {
+	if (!m_src) {
+		return 0;
+	}
+
+	u8* dest = (u8*)pBuffer;
+	// Sectors needn't be aligned to blocks, read a block at a time.
+	u64 pos = (u64)sector * (u64)m_blocksize;
+	int remaining = count * m_blocksize;
+	int bytes = 0;
+
+	while (remaining > 0) {
+		int readBytes = ReadFromBlock(dest + bytes, pos + bytes, remaining);
+		if (readBytes < 0) {
+			return -1;
+		}
+		if (readBytes == 0) {
+			// We hit EOF.
+			break;
+		}
+
+		bytes += readBytes;
+		remaining -= readBytes;
+	}
+
+	return bytes;
+}
+
+int BciFileReader::ReadFromBlock(u8* dest, u64 pos, int maxBytes) {
+	if (pos >= m_totalSize) {
+		// Can't read anything passed the end.
+		return 0;
+	}
+
+	const u32 block = (u32)(pos / m_frameSize);
+	const u64 blockStart = (u64)block * m_frameSize;
+	// This is how many bytes we will actually be reading from this block.
+	const int bytes = (int)std::min<u64>(maxBytes, std::min<u64>(m_frameSize, m_totalSize - blockStart) - (pos - blockStart));
+
+	int res = m_cache->Read(dest, pos, bytes);
+	if (res >= 0) {
+		return res;
+	}
+
+	u8* data = (u8*)m_cache->Acquire();
+	if (!DecompressBlock(block, data)) {
+		m_cache->Release(data);
+		return -1;
+	}
+
+	const int length = (int)std::min<u64>(m_frameSize, m_totalSize - blockStart);
+	int copied = ChunksCache::CopyAvailable(data, blockStart, length, dest, pos, bytes);
+	m_cache->Take(data, blockStart, length, m_frameSize);
+	return copied;
+}
+
+bool BciFileReader::DecompressBlock(u32 block, u8* dest) {
+	const bool stored = (m_index[block] & BCI_INDEX_STORED) != 0;
+	const u64 start = m_index[block] & ~BCI_INDEX_STORED;
+	const u64 end = m_index[block + 1] & ~BCI_INDEX_STORED;
+	const u32 length = (u32)std::min<u64>(m_frameSize, m_totalSize - (u64)block * m_frameSize);
+
+	if (end < start || end - start > m_frameSize) {
+		Console.Error("BCI index is corrupt at block %u.", block);
+		return false;
+	}
+	const u32 size = (u32)(end - start);
+
+	// Stored blocks are read straight into the cache buffer.
+	u8* src = stored ? dest : m_readBuffer.data();
+	if (PX_fseeko(m_src, start, SEEK_SET) != 0 || fread(src, 1, size, m_src) != size) {
+		Console.Error("Unable to read BCI block %u.", block);
+		return false;
+	}
+	if (stored) {
+		return size == length;
+	}
+
+	if (!BciDecompressBlock(m_dict.data(), (u32)m_dict.size(), src, size, dest, length)) {
+		Console.Error("Unable to decompress BCI block %u.", block);
+		return false;
+	}
+	return true;
+}
+
+void BciFileReader::BeginRead(void* pBuffer, uint sector, uint count) {
+	// No async support yet, implement as sync.
+	m_pendingBuffer = pBuffer;
+	m_pendingSector = sector;
+	m_pendingCount = count;
+}
+
+int BciFileReader::FinishRead() {
+	if (!m_pendingBuffer) {
+		return -1;
+	}
+	int res = ReadSync(m_pendingBuffer, m_pendingSector, m_pendingCount);
+	m_pendingBuffer = NULL;
+	return res;
+}
+
+void BciFileReader::CancelRead() {
+	m_pendingBuffer = NULL;
+}
@@ -0,0 +1,85 @@
+/*  PCSX2 - PS2 Emulator for PCs
+*  Copyright (C) 2002-2014  PCSX2 Dev Team
+*
+*  PCSX2 is free software: you can redistribute it and/or modify it under the terms
+*  of the GNU Lesser General Public License as published by the Free Software Found-
+*  ation, either version 3 of the License, or (at your option) any later version.
+*
+*  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+*  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+*  PURPOSE.  See the GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License along with PCSX2.
+*  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "AsyncFileReader.h"
+#include "BciFormat.h"
+#include "ChunksCache.h"
+#include <memory>
+#include <vector>
+
+// cache size for decompressed blocks (in MB)
+static const uint BCI_CACHE_SIZE_MB = 64;
+
+// Reads block-compressed images, see BciFormat.h. Blocks decompress fast
+// enough that reads are served synchronously; decompressed blocks are kept
+// in a ChunksCache for the sectors next to the one asked for.
+class BciFileReader : public AsyncFileReader
+{
+	DeclareNoncopyableObject(BciFileReader);
+public:
+	BciFileReader(void) :
+		m_totalSize(0),
+		m_frameSize(0),
+		m_numBlocks(0),
+		m_src(0),
+		m_pendingBuffer(0),
+		m_pendingSector(0),
+		m_pendingCount(0) {
+		m_blocksize = 2048;
+	};
+
+	virtual ~BciFileReader(void) { Close(); };
+
+	static  bool CanHandle(const wxString& fileName);
+	virtual bool Open(const wxString& fileName);
+
+	virtual int ReadSync(void* pBuffer, uint sector, uint count);
+
+	virtual void BeginRead(void* pBuffer, uint sector, uint count);
+	virtual int FinishRead(void);
+	virtual void CancelRead(void);
+
+	virtual void Close(void);
+
+	virtual uint GetBlockCount(void) const {
+		return (m_totalSize - m_dataoffset) / m_blocksize;
+	};
+
+	virtual void SetBlockSize(uint bytes) { m_blocksize = bytes; }
+	virtual void SetDataOffset(int bytes) { m_dataoffset = bytes; }
+
+private:
+	bool ReadFileHeader();
+	int ReadFromBlock(u8* dest, u64 pos, int maxBytes);
+	bool DecompressBlock(u32 block, u8* dest);
+
+	u64 m_totalSize;
+	// uncompressed bytes per compressed block, unlike m_blocksize which is the sector size
+	u32 m_frameSize;
+	u32 m_numBlocks;
+	std::vector<u8> m_dict;
+	std::vector<u64> m_index;
+	// compressed data of the block being read
+	std::vector<u8> m_readBuffer;
+	std::unique_ptr<ChunksCache> m_cache;
+	// The actual source bci file handle.
+	FILE* m_src;
+
+	void* m_pendingBuffer;
+	uint m_pendingSector;
+	uint m_pendingCount;
+};
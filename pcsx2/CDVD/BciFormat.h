@@ -0,0 +1,81 @@
+/*  PCSX2 - PS2 Emulator for PCs
+*  Copyright (C) 2002-2014  PCSX2 Dev Team
+*
+*  PCSX2 is free software: you can redistribute it and/or modify it under the terms
+*  of the GNU Lesser General Public License as published by the Free Software Found-
+*  ation, either version 3 of the License, or (at your option) any later version.
+*
+*  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+*  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+*  PURPOSE.  See the GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License along with PCSX2.
+*  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "Pcsx2Types.h"
+#include <vector>
+
+// Block-compressed images (.bci): the image is cut into blocks of a fixed size,
+// each compressed on its own in the LZ4 block format, so any sector can be
+// read by decompressing one small block, and that takes a fraction of the
+// time inflate does. A dictionary trained on the disc is shared by all the
+// blocks; matches may reach back into it as if it came right before every
+// block, which wins back most of what small blocks lose on ratio.
+//
+// Layout, all little endian:
+//   BciHeader
+//   dictionary     dict_size bytes
+//   index          u64 file offset of each block, and one past the last block.
+//                  BCI_INDEX_STORED is set on blocks kept uncompressed.
+//   blocks
+struct BciHeader {
+	u8 magic[4];		// "BCI\x1a"
+	u32 header_size;	// sizeof(BciHeader)
+	u64 total_bytes;	// size of the uncompressed image
+	u32 block_size;		// uncompressed bytes per block, the last one may be short
+	u32 dict_size;
+	u8 ver;
+	u8 codec;
+	u8 reserved[6];
+};
+
+static const u8  BCI_VERSION = 1;
+static const u8  BCI_CODEC_LZ4 = 1;
+static const u64 BCI_INDEX_STORED = 1ULL << 63;
+
+static const u32 BCI_BLOCK_SIZE = 16 * 1024;
+// Small enough that a match from the end of a block can still reach all of
+// it, LZ4 offsets being 16 bits.
+static const u32 BCI_DICT_SIZE = 32 * 1024;
+
+bool BciValidateHeader(const BciHeader& hdr);
+
+// Compresses blocks of up to BCI_BLOCK_SIZE against a fixed dictionary. The
+// dictionary is hashed once, so one compressor per thread serves a whole image.
+class BciCompressor {
+public:
+	BciCompressor(const u8* dict, u32 dictSize);
+
+	// Returns the compressed size, or 0 if it would not fit in dstCapacity.
+	u32 Compress(const u8* src, u32 size, u8* dst, u32 dstCapacity);
+
+private:
+	void Insert(u32 pos);
+	u32 MatchLength(u32 candidate, u32 pos, u32 limit) const;
+
+	u32 m_dictSize;
+	std::vector<u8> m_window;		// dictionary then block
+	std::vector<s32> m_head;		// last position of each hash
+	std::vector<s32> m_dictHead;	// m_head after hashing the dictionary
+	std::vector<s32> m_chain;		// previous position with the same hash
+};
+
+// Decompresses a block of exactly dstSize bytes. Returns false if src is corrupt.
+bool BciDecompressBlock(const u8* dict, u32 dictSize, const u8* src, u32 srcSize, u8* dst, u32 dstSize);
+
+// Picks the segments of the samples that recur the most across them, the
+// most useful last, where matches are cheapest to reach.
+std::vector<u8> BciTrainDictionary(const std::vector<u8>& samples, u32 dictSize);
@@ -32,6 +32,7 @@
 #include "IsoFS/IsoFS.h"
 #include "IsoFS/IsoFSCDVD.h"
 #include "CDVDisoReader.h"
+#include "SectorTrace.h"
 
 #include "DebugTools/SymbolMap.h"
 #include "AppConfig.h"
@@ -62,6 +63,7 @@ u32 lastLSN;		// needed for block dumping
 //static int plsn = 0;
 
 static OutputIsoFile blockDumpFile;
+static SectorTraceWriter sectorTrace;
 
 // Assertion check for CDVD != NULL (in devel and debug builds), because its handier than
 // relying on DEP exceptions -- and a little more reliable too.
@@ -364,12 +366,6 @@ bool DoCDVDopen()
 
 	int cdtype = DoCDVDdetectDiskType();
 
-	if (!EmuConfig.CdvdDumpBlocks || (cdtype == CDVD_TYPE_NODISC))
-	{
-		blockDumpFile.Close();
-		return true;
-	}
-
 	wxString somepick( Path::GetFilenameWithoutExt( m_SourceFilename[CurrentSourceType] )  );
 	//FWIW Disc serial availability doesn't seem reliable enough, sometimes it's there and sometime it's just null
 	//Shouldn't the serial be available all time? Potentially need to look into Elfreloadinfo() reliability
@@ -379,6 +375,20 @@ bool DoCDVDopen()
 	else if (somepick.IsEmpty())
 		somepick = L"Untitled";
 
+	sectorTrace.Close();
+	if (EmuConfig.CdvdTraceReads && (cdtype != CDVD_TYPE_NODISC))
+	{
+		wxString tracefile( Path::Combine(GetLogFolder(), somepick + L".cdtrace") );
+		if (!sectorTrace.Open(tracefile))
+			Console.Warning(L"CDVD: unable to create the read trace %s", WX_STR(tracefile));
+	}
+
+	if (!EmuConfig.CdvdDumpBlocks || (cdtype == CDVD_TYPE_NODISC))
+	{
+		blockDumpFile.Close();
+		return true;
+	}
+
 	if (g_Conf->CurrentBlockdump.IsEmpty())
 		g_Conf->CurrentBlockdump = wxGetCwd();
 
@@ -428,6 +438,7 @@ void DoCDVDclose()
 {
 	CheckNullCDVD();
 	//blockDumpFile.Close();
+	sectorTrace.Close();
 
 	if( CDVD->close != NULL )
 		CDVD->close();
@@ -438,8 +449,12 @@ void DoCDVDclose()
 s32 DoCDVDreadSector(u8* buffer, u32 lsn, int mode)
 {
 	CheckNullCDVD();
+	u64 start = GetCPUTicks();
 	int ret = CDVD->readSector(buffer,lsn,mode);
 
+	if (sectorTrace.IsOpened())
+		sectorTrace.Record(SectorTrace_Sector, lsn, mode, GetCPUTicks() - start);
+
 	if (ret == 0 && blockDumpFile.IsOpened())
 	{
 		if (blockDumpFile.GetBlockSize() == CD_FRAMESIZE_RAW && mode != CDVD_MODE_2352)
@@ -480,14 +495,25 @@ s32 DoCDVDreadTrack(u32 lsn, int mode)
 
 	//DevCon.Warning("CDVD readTrack(lsn=%d,mode=%d)",params lsn, lastReadSize);
 	lastLSN = lsn;
-	return CDVD->readTrack(lsn,mode);
+
+	u64 start = GetCPUTicks();
+	s32 ret = CDVD->readTrack(lsn,mode);
+
+	if (sectorTrace.IsOpened())
+		sectorTrace.BeginTrack(lsn, mode, GetCPUTicks() - start);
+
+	return ret;
 }
 
 s32 DoCDVDgetBuffer(u8* buffer)
 {
 	CheckNullCDVD();
+	u64 start = GetCPUTicks();
 	int ret = CDVD->getBuffer2(buffer);
 
+	if (sectorTrace.IsOpened())
+		sectorTrace.FinishTrack(GetCPUTicks() - start);
+
 	if (ret == 0 && blockDumpFile.IsOpened())
 	{
 		cdvdTD td;
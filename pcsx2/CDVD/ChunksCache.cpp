@@ -16,37 +16,114 @@
 #include "PrecompiledHeader.h"
 #include "ChunksCache.h"
 
+// Chunk buffers are allocated this many at a time.
+static const int SLAB_CHUNKS = 16;
+
+ChunksCache::ChunksCache(uint initialLimitMb, uint chunkSize) :
+	m_chunkSize(chunkSize),
+	m_size(0),
+	m_limit((PX_off_t)initialLimitMb * 1024 * 1024) {
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+ChunksCache::~ChunksCache() {
+	Clear();
+	for (void* slab : m_slabs)
+		free(slab);
+}
+
 void ChunksCache::SetLimit(uint megabytes) {
 	m_limit = (PX_off_t)megabytes * 1024 * 1024;
 	MatchLimit();
 }
 
+// Keeps the slabs for the next use.
+void ChunksCache::Clear() {
+	MatchLimit(true);
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void* ChunksCache::Acquire() {
+	if (m_free.empty()) {
+		char* slab = (char*)malloc((size_t)m_chunkSize * SLAB_CHUNKS);
+		m_slabs.push_back(slab);
+		for (int i = SLAB_CHUNKS - 1; i >= 0; i--)
+			m_free.push_back(slab + (size_t)m_chunkSize * i);
+	}
+	void* chunk = m_free.back();
+	m_free.pop_back();
+	return chunk;
+}
+
+void ChunksCache::Release(void* pChunk) {
+	if (pChunk)
+		m_free.push_back(pChunk);
+}
+
+void ChunksCache::Evict(EntryList::iterator it) {
+	m_size -= it->size;
+	Release(it->data);
+	m_index.erase(it->offset / m_chunkSize);
+	m_entries.erase(it);
+}
+
 void ChunksCache::MatchLimit(bool removeAll) {
-	std::list<CacheEntry*>::reverse_iterator rit;
 	while (!m_entries.empty() && (removeAll || m_size > m_limit)) {
-		rit = m_entries.rbegin();
-		m_size -= (*rit)->size;
-		delete(*rit);
-		m_entries.pop_back();
+		if (!removeAll)
+			m_stats.evictions++;
+		Evict(--m_entries.end());
 	}
 }
 
-void ChunksCache::Take(void* pMallocedSrc, PX_off_t offset, int length, int coverage) {
-	m_entries.push_front(new CacheEntry(pMallocedSrc, offset, length, coverage));
+void ChunksCache::Take(void* pChunk, PX_off_t offset, int length, int coverage) {
+	pxAssert(offset % m_chunkSize == 0 && length <= (int)m_chunkSize && coverage <= (int)m_chunkSize);
+
+	auto old = m_index.find(offset / m_chunkSize);
+	if (old != m_index.end())
+		Evict(old->second);
+
+	CacheEntry e = { pChunk, offset, coverage, length };
+	m_entries.push_front(e);
+	m_index[offset / m_chunkSize] = m_entries.begin();
 	m_size += length;
+	m_stats.peakSize = std::max(m_stats.peakSize, m_size);
 	MatchLimit();
 }
 
+const ChunksCache::CacheEntry* ChunksCache::Find(PX_off_t offset, int length, EntryList::iterator* it) const {
+	auto found = m_index.find(offset / m_chunkSize);
+	if (found == m_index.end())
+		return NULL;
+	const CacheEntry& e = *found->second;
+	if ((offset + length) > (e.offset + e.coverage))
+		return NULL;
+	if (it)
+		*it = found->second;
+	return &e;
+}
+
 // By design, succeed only if the entire request is in a single cached chunk
 int ChunksCache::Read(void* pDest, PX_off_t offset, int length) {
-	for (auto it = m_entries.begin(); it != m_entries.end(); it++) {
-		CacheEntry* e = *it;
-		if (e && offset >= e->offset && (offset + length) <= (e->offset + e->coverage)) {
-			if (it != m_entries.begin())
-				m_entries.splice(m_entries.begin(), m_entries, it); // Move to top (MRU)
-			return CopyAvailable(e->data, e->offset, e->size, pDest, offset, length);
-		}
+	EntryList::iterator it;
+	const CacheEntry* e = Find(offset, length, &it);
+	if (!e) {
+		m_stats.misses++;
+		return -1;
 	}
-	return -1;
+
+	m_stats.hits++;
+	if (it != m_entries.begin())
+		m_entries.splice(m_entries.begin(), m_entries, it); // Move to top (MRU)
+	return CopyAvailable(e->data, e->offset, e->size, pDest, offset, length);
 }
 
+bool ChunksCache::Contains(PX_off_t offset, int length) const {
+	return Find(offset, length, NULL) != NULL;
+}
+
+ChunksCache::Stats ChunksCache::GetStats() const {
+	Stats stats = m_stats;
+	stats.size = m_size;
+	stats.limit = m_limit;
+	return stats;
+}
@@ -16,48 +16,71 @@
 #pragma once
 
 #include "zlib_indexed.h"
+#include <list>
+#include <unordered_map>
+#include <vector>
 
-#define CLAMP(val, minval, maxval) (std::min(maxval, std::max(minval, val)))
-
+// Cache of extracted data in chunks of a fixed size, at offsets which are
+// multiples of it. Chunks are found by offset in O(1), evicted least recently
+// used first, and their buffers come from slabs which are recycled rather
+// than freed: fill a buffer from Acquire() and hand it over with Take().
 class ChunksCache {
 public:
-	ChunksCache(uint initialLimitMb) : m_entries(0), m_size(0), m_limit(initialLimitMb * 1024 * 1024) {};
-	~ChunksCache() { Clear(); };
+	ChunksCache(uint initialLimitMb, uint chunkSize);
+	~ChunksCache();
 	void SetLimit(uint megabytes);
-	void Clear() { MatchLimit(true); };
+	void Clear();
+
+	// A buffer of chunkSize bytes for Take(), or to give back with Release().
+	void* Acquire();
+	void  Release(void* pChunk);
 
-	void Take(void* pMallocedSrc, PX_off_t offset, int length, int coverage);
-	int  Read(void* pDest,        PX_off_t offset, int length);
+	// Caches length bytes at offset (a multiple of chunkSize), stored in
+	// pChunk (from Acquire(), or NULL if length is 0). coverage is the part
+	// of the chunk the data stands for, more than length at the end of file.
+	void Take(void* pChunk, PX_off_t offset, int length, int coverage);
+	int  Read(void* pDest,  PX_off_t offset, int length);
+	// Whether Read() would succeed, without counting as a hit or a miss.
+	bool Contains(PX_off_t offset, int length) const;
+
+	struct Stats {
+		u64 hits;
+		u64 misses;
+		u64 evictions;
+		PX_off_t size;
+		PX_off_t peakSize;
+		PX_off_t limit;
+	};
+	Stats GetStats() const;
 
 	static int CopyAvailable(void* pSrc, PX_off_t srcOffset, int srcSize,
 							 void* pDst, PX_off_t dstOffset, int maxCopySize) {
-		int available = CLAMP(maxCopySize, 0, (int)(srcOffset + srcSize - dstOffset));
+		// nothing to copy past the end of a short chunk
+		int available = std::max(0, std::min(maxCopySize, (int)(srcOffset + srcSize - dstOffset)));
 		memcpy(pDst, (char*)pSrc + (dstOffset - srcOffset), available);
 		return available;
 	};
 
 private:
-	class CacheEntry {
-	public:
-		CacheEntry(void* pMallocedSrc, PX_off_t offset, int length, int coverage) :
-			data(pMallocedSrc),
-			offset(offset),
-			coverage(coverage),
-			size(length)
-		{};
-
-		~CacheEntry() { if (data) free(data); };
-
+	struct CacheEntry {
 		void* data;
 		PX_off_t offset;
 		int coverage;
 		int size;
 	};
+	typedef std::list<CacheEntry> EntryList;
 
-	std::list<CacheEntry*> m_entries;
+	// the entry holding the whole request, or NULL
+	const CacheEntry* Find(PX_off_t offset, int length, EntryList::iterator* it) const;
+	void Evict(EntryList::iterator it);
 	void MatchLimit(bool removeAll = false);
+
+	EntryList m_entries; // most recently used first
+	std::unordered_map<PX_off_t, EntryList::iterator> m_index; // by offset / m_chunkSize
+	std::vector<void*> m_free;
+	std::vector<void*> m_slabs;
+	uint m_chunkSize;
 	PX_off_t m_size;
 	PX_off_t m_limit;
+	Stats m_stats;
 };
-
-#undef CLAMP
@@ -16,6 +16,7 @@
 #include "PrecompiledHeader.h"
 #include "AsyncFileReader.h"
 #include "CompressedFileReader.h"
+#include "BciFileReader.h"
 #include "CsoFileReader.h"
 #include "GzippedFileReader.h"
 
@@ -27,6 +28,9 @@ AsyncFileReader* CompressedFileReader::GetNewReader(const wxString& fileName) {
 	if (CsoFileReader::CanHandle(fileName)) {
 		return new CsoFileReader();
 	}
+	if (BciFileReader::CanHandle(fileName)) {
+		return new BciFileReader();
+	}
 	// This is the one which will fail on open.
 	return NULL;
 }
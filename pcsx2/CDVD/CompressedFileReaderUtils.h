@@ -26,9 +26,11 @@
 #ifdef _WIN32
 #   define PX_wfilename(name_wxstr) (name_wxstr.wc_str())
 #   define PX_fopen_rb(name_wxstr) (_wfopen(PX_wfilename(name_wxstr), L"rb"))
+#   define PX_fopen_wb(name_wxstr) (_wfopen(PX_wfilename(name_wxstr), L"wb"))
 #else
 #   define PX_wfilename(name_wxstr) (name_wxstr.mbc_str())
 #   define PX_fopen_rb(name_wxstr) (fopen(PX_wfilename(name_wxstr), "rb"))
+#   define PX_fopen_wb(name_wxstr) (fopen(PX_wfilename(name_wxstr), "wb"))
 #endif
 
 #ifdef _WIN32
@@ -122,43 +122,119 @@ bool CsoFileReader::ReadFileHeader() {
 
 bool CsoFileReader::InitializeBuffers() {
 	// Round up, since part of a frame requires a full frame.
-	u32 numFrames = (u32)((m_totalSize + m_frameSize - 1) / m_frameSize);
+	m_numFrames = (u32)((m_totalSize + m_frameSize - 1) / m_frameSize);
 
 	// We might read a bit of alignment too, so be prepared.
-	if (m_frameSize + (1 << m_indexShift) < CSO_READ_BUFFER_SIZE) {
-		m_readBuffer = new u8[CSO_READ_BUFFER_SIZE];
-	} else {
-		m_readBuffer = new u8[m_frameSize + (1 << m_indexShift)];
-	}
-
-	// This is a buffer for the most recently decompressed frame.
-	m_zlibBuffer = new u8[m_frameSize + (1 << m_indexShift)];
-	m_zlibBufferFrame = numFrames;
+	m_readBufferSize = std::max(CSO_READ_BUFFER_SIZE, m_frameSize + (1 << m_indexShift));
+	m_readBuffer = new u8[m_readBufferSize];
 
-	const u32 indexSize = numFrames + 1;
+	const u32 indexSize = m_numFrames + 1;
 	m_index = new u32[indexSize];
 	if (fread(m_index, sizeof(u32), indexSize, m_src) != indexSize) {
 		Console.Error(L"Unable to read index data from CSO.");
 		return false;
 	}
 
-	m_z_stream = new z_stream;
-	m_z_stream->zalloc = Z_NULL;
-	m_z_stream->zfree = Z_NULL;
-	m_z_stream->opaque = Z_NULL;
-	if (inflateInit2(m_z_stream, -15) != Z_OK) {
-		Console.Error("Unable to initialize zlib for CSO decompression.");
+	if (!InitializeStream(m_z_stream)) {
 		return false;
 	}
 
+	m_readAheadFrames = std::max(1u, CSO_READ_AHEAD_SIZE >> m_frameShift);
+	// Keep well more than a read-ahead window, or frames would be evicted before they're read.
+	m_cacheFrames = std::max(m_readAheadFrames * 4, (CSO_FRAMECACHE_SIZE_MB * 1024 * 1024) >> m_frameShift);
+	StartWorkers();
+
 	return true;
 }
 
+bool CsoFileReader::InitializeStream(z_stream*& stream) {
+	stream = new z_stream;
+	stream->zalloc = Z_NULL;
+	stream->zfree = Z_NULL;
+	stream->opaque = Z_NULL;
+	if (inflateInit2(stream, -15) != Z_OK) {
+		Console.Error("Unable to initialize zlib for CSO decompression.");
+		delete stream;
+		stream = NULL;
+		return false;
+	}
+	return true;
+}
+
+void CsoFileReader::StartWorkers() {
+	for (uint i = 0; i < CSO_DECOMPRESS_THREADS; i++) {
+		Worker* worker = new Worker;
+		worker->src = PX_fopen_rb(m_filename);
+		if (!worker->src || !InitializeStream(worker->stream)) {
+			// Reading still works with fewer workers, or none.
+			Console.Warning("Unable to start a CSO decompression thread.");
+			if (worker->src) {
+				fclose(worker->src);
+			}
+			delete worker;
+			break;
+		}
+		worker->readBuffer = new u8[m_readBufferSize];
+		worker->thread = std::thread(&CsoFileReader::WorkerLoop, this, worker);
+		m_workers.push_back(worker);
+	}
+}
+
+void CsoFileReader::StopWorkers() {
+	{
+		std::lock_guard<std::mutex> lock(m_cacheMutex);
+		m_quit = true;
+	}
+	m_work.notify_all();
+
+	for (Worker* worker : m_workers) {
+		worker->thread.join();
+		fclose(worker->src);
+		inflateEnd(worker->stream);
+		delete worker->stream;
+		delete[] worker->readBuffer;
+		delete worker;
+	}
+	m_workers.clear();
+	m_quit = false;
+}
+
+void CsoFileReader::WorkerLoop(Worker* worker) {
+	std::unique_lock<std::mutex> lock(m_cacheMutex);
+	while (true) {
+		m_work.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+		if (m_quit) {
+			break;
+		}
+
+		const u32 frame = m_queue.front();
+		m_queue.pop_front();
+		lock.unlock();
+
+		u8* data = new u8[m_frameSize];
+		if (!DecompressFrame(worker->src, worker->stream, worker->readBuffer, frame, data)) {
+			delete[] data;
+			data = NULL;
+		}
+
+		lock.lock();
+		FinishFrame(frame, data);
+	}
+}
+
 void CsoFileReader::Close() {
+	StopWorkers();
 	m_filename.Empty();
-#if CSO_USE_CHUNKSCACHE
-	m_cache.Clear();
-#endif
+
+	for (auto& entry : m_frames) {
+		delete[] entry.second.data;
+	}
+	m_frames.clear();
+	m_lru.clear();
+	m_queue.clear();
+	m_readAheadStart = 0;
+	m_readAheadEnd = 0;
+	m_pendingBuffer = NULL;
 
 	if (m_src) {
 		fclose(m_src);
@@ -166,6 +242,7 @@ void CsoFileReader::Close() {
 	}
 	if (m_z_stream) {
 		inflateEnd(m_z_stream);
+		delete m_z_stream;
 		m_z_stream = NULL;
 	}
 
@@ -173,10 +250,6 @@ void CsoFileReader::Close() {
 		delete[] m_readBuffer;
 		m_readBuffer = NULL;
 	}
-	if (m_zlibBuffer) {
-		delete[] m_zlibBuffer;
-		m_zlibBuffer = NULL;
-	}
 	if (m_index) {
 		delete[] m_index;
 		m_index = NULL;
@@ -198,27 +271,10 @@ int CsoFileReader::ReadSync(void* pBuffer, uint sector, uint count) {
 	int bytes = 0;
 
 	while (remaining > 0) {
-		int readBytes;
-
-#if CSO_USE_CHUNKSCACHE
-		// Try first to read from the cache.
-		readBytes = m_cache.Read(dest + bytes, pos + bytes, remaining);
-#else
-		readBytes = -1;
-#endif
-		if (readBytes < 0) {
-			readBytes = ReadFromFrame(dest + bytes, pos + bytes, remaining);
-			if (readBytes == 0) {
-				// We hit EOF.
-				break;
-			}
-
-#if CSO_USE_CHUNKSCACHE
-			// Add the bytes into the cache.  We need to allocate a buffer for it.
-			void *cached = malloc(readBytes);
-			memcpy(cached, dest + bytes, readBytes);
-			m_cache.Take(cached, pos + bytes, readBytes, readBytes);
-#endif
+		int readBytes = ReadFromFrame(dest + bytes, pos + bytes, remaining);
+		if (readBytes == 0) {
+			// We hit EOF.
+			break;
 		}
 
 		bytes += readBytes;
@@ -242,11 +298,7 @@ int CsoFileReader::ReadFromFrame(u8 *dest, u64 pos, int maxBytes) {
 	// Grab the index data for the frame we're about to read.
 	const bool compressed = (m_index[frame + 0] & 0x80000000) == 0;
 	const u32 index0 = m_index[frame + 0] & 0x7FFFFFFF;
-	const u32 index1 = m_index[frame + 1] & 0x7FFFFFFF;
-
-	// Calculate where the compressed payload is (if compressed.)
 	const u64 frameRawPos = (u64)index0 << m_indexShift;
-	const u64 frameRawSize = (u64)(index1 - index0) << m_indexShift;
 
 	if (!compressed) {
 		// Just read directly, easy.
@@ -255,59 +307,173 @@ int CsoFileReader::ReadFromFrame(u8 *dest, u64 pos, int maxBytes) {
 			return 0;
 		}
 		return fread(dest, 1, bytes, m_src);
-	} else {
-		// We don't need to decompress if we already did this same frame last time.
-		if (m_zlibBufferFrame != frame) {
-			if (PX_fseeko(m_src, m_dataoffset + frameRawPos, SEEK_SET) != 0) {
-				Console.Error("Unable to seek to compressed CSO data.");
-				return 0;
-			}
-			// This might be less bytes than frameRawSize in case of padding on the last frame.
-			// This is because the index positions must be aligned.
-			const u32 readRawBytes = fread(m_readBuffer, 1, frameRawSize, m_src);
-			if (!DecompressFrame(frame, readRawBytes)) {
-				return 0;
+	} else if (!ReadCachedFrame(dest, frame, offset, bytes)) {
+		return 0;
+	}
+
+	return bytes;
+}
+
+bool CsoFileReader::ReadCachedFrame(u8 *dest, u32 frame, u32 offset, u32 bytes) {
+	std::unique_lock<std::mutex> lock(m_cacheMutex);
+
+	// Claim the frame if nobody has started on it, so that ReadAhead() leaves it
+	// to us: inflating it right here beats waiting behind the queue.
+	bool inflateHere = m_frames.find(frame) == m_frames.end();
+	if (inflateHere) {
+		m_frames[frame] = CachedFrame();
+	}
+	ReadAhead(frame);
+
+	while (true) {
+		if (inflateHere) {
+			lock.unlock();
+			u8* data = new u8[m_frameSize];
+			if (!DecompressFrame(m_src, m_z_stream, m_readBuffer, frame, data)) {
+				delete[] data;
+				data = NULL;
 			}
+			lock.lock();
+			FinishFrame(frame, data);
+			inflateHere = false;
+		}
+
+		auto it = m_frames.find(frame);
+		if (it == m_frames.end()) {
+			// Dropped from the queue by a jump before a worker got to it.
+			m_frames[frame] = CachedFrame();
+			inflateHere = true;
+			continue;
+		}
+		if (!it->second.ready) {
+			m_frameDone.wait(lock);
+			continue;
+		}
+		if (!it->second.data) {
+			// Forget the failure, so that the next read tries again.
+			m_frames.erase(it);
+			return false;
 		}
 
-		// Now we just copy the offset data from the cache.
-		memcpy(dest, m_zlibBuffer + offset, bytes);
+		m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+		memcpy(dest, it->second.data + offset, bytes);
+		return true;
 	}
+}
 
-	return bytes;
+// Queues the compressed frames from this one up to the read-ahead distance
+// that aren't cached or queued yet.  Called with m_cacheMutex held.
+void CsoFileReader::ReadAhead(u32 frame) {
+	if (m_workers.empty()) {
+		return;
+	}
+
+	if (frame < m_readAheadStart || frame > m_readAheadEnd) {
+		// The read jumped elsewhere, the frames still queued won't be wanted soon.
+		for (u32 queued : m_queue) {
+			m_frames.erase(queued);
+		}
+		m_queue.clear();
+		m_readAheadEnd = frame;
+	}
+	m_readAheadStart = frame;
+
+	const u32 end = std::min(frame + m_readAheadFrames, m_numFrames);
+	for (u32 f = std::max(frame, m_readAheadEnd); f < end; f++) {
+		const bool compressed = (m_index[f] & 0x80000000) == 0;
+		if (compressed && m_frames.find(f) == m_frames.end()) {
+			m_frames[f] = CachedFrame();
+			m_queue.push_back(f);
+		}
+	}
+	m_readAheadEnd = std::max(m_readAheadEnd, end);
+
+	if (!m_queue.empty()) {
+		m_work.notify_all();
+	}
+}
+
+// Stores a decompressed frame (NULL if it failed) and wakes up whoever waits
+// for it.  Called with m_cacheMutex held.
+void CsoFileReader::FinishFrame(u32 frame, u8* data) {
+	auto it = m_frames.find(frame);
+	if (it == m_frames.end()) {
+		delete[] data;
+		return;
+	}
+
+	it->second.data = data;
+	it->second.ready = true;
+	if (data) {
+		m_lru.push_front(frame);
+		it->second.lru = m_lru.begin();
+
+		while (m_lru.size() > m_cacheFrames) {
+			auto evicted = m_frames.find(m_lru.back());
+			delete[] evicted->second.data;
+			m_frames.erase(evicted);
+			m_lru.pop_back();
+		}
+	}
+
+	m_frameDone.notify_all();
 }
 
-bool CsoFileReader::DecompressFrame(u32 frame, u32 readBufferSize) {
-	m_z_stream->next_in = m_readBuffer;
-	m_z_stream->avail_in = readBufferSize;
-	m_z_stream->next_out = m_zlibBuffer;
-	m_z_stream->avail_out = m_frameSize;
-
-	int status = inflate(m_z_stream, Z_FINISH);
-	bool success = status == Z_STREAM_END && m_z_stream->total_out == m_frameSize;
-	if (success) {
-		// Our buffer now contains this frame.
-		m_zlibBufferFrame = frame;
-	} else {
+bool CsoFileReader::DecompressFrame(FILE* src, z_stream* stream, u8* readBuffer, u32 frame, u8* dest) const {
+	const u32 index0 = m_index[frame + 0] & 0x7FFFFFFF;
+	const u32 index1 = m_index[frame + 1] & 0x7FFFFFFF;
+
+	// Calculate where the compressed payload is.
+	const u64 frameRawPos = (u64)index0 << m_indexShift;
+	const u64 frameRawSize = std::min((u64)(index1 - index0) << m_indexShift, (u64)m_readBufferSize);
+
+	if (PX_fseeko(src, m_dataoffset + frameRawPos, SEEK_SET) != 0) {
+		Console.Error("Unable to seek to compressed CSO data.");
+		return false;
+	}
+	// This might be less bytes than frameRawSize in case of padding on the last frame.
+	// This is because the index positions must be aligned.
+	const u32 readRawBytes = fread(readBuffer, 1, frameRawSize, src);
+
+	stream->next_in = readBuffer;
+	stream->avail_in = readRawBytes;
+	stream->next_out = dest;
+	stream->avail_out = m_frameSize;
+
+	int status = inflate(stream, Z_FINISH);
+	bool success = status == Z_STREAM_END && stream->total_out == m_frameSize;
+	if (!success) {
 		Console.Error("Unable to decompress CSO frame using zlib.");
-		m_zlibBufferFrame = (u32)-1;
 	}
 
-	inflateReset(m_z_stream);
+	inflateReset(stream);
 	return success;
 }
 
 void CsoFileReader::BeginRead(void* pBuffer, uint sector, uint count) {
-	// TODO: No async support yet, implement as sync.
-	m_bytesRead = ReadSync(pBuffer, sector, count);
+	m_pendingBuffer = pBuffer;
+	m_pendingSector = sector;
+	m_pendingCount = count;
+
+	// Get the workers started on the frames of the read; FinishRead() does the
+	// rest, which is usually only copying them out of the cache by then.
+	const u64 pos = (u64)sector * (u64)m_blocksize;
+	if (m_src && pos < m_totalSize) {
+		std::lock_guard<std::mutex> lock(m_cacheMutex);
+		ReadAhead((u32)(pos >> m_frameShift));
+	}
 }
 
 int CsoFileReader::FinishRead() {
-	int res = m_bytesRead;
-	m_bytesRead = -1;
+	if (!m_pendingBuffer) {
+		return -1;
+	}
+	int res = ReadSync(m_pendingBuffer, m_pendingSector, m_pendingCount);
+	m_pendingBuffer = NULL;
 	return res;
 }
 
 void CsoFileReader::CancelRead() {
-	// TODO: No async read support yet.
+	// The frames already queued stay useful to the next read.
+	m_pendingBuffer = NULL;
 }
@@ -15,22 +15,24 @@
 
 #pragma once
 
-// Based on testing, the overhead of using this cache is high.
-//
-// The test was done with CSO files using a block size of 16KB.
-// Cache hit rates were observed in the range of 25%.
-// Cache overhead added 35% to the overall read time.
-//
-// For this reason, it's currently disabled.
-#define CSO_USE_CHUNKSCACHE 0
-
 #include "AsyncFileReader.h"
-#include "ChunksCache.h"
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 struct CsoHeader;
 typedef struct z_stream_s z_stream;
 
-static const uint CSO_CHUNKCACHE_SIZE_MB = 200;
+// Decompressed frames are kept in a cache keyed by frame number. A few worker
+// threads fill it ahead of the read position, so that sequential reads (FMVs,
+// streamed audio) find their frames already inflated.
+static const uint CSO_FRAMECACHE_SIZE_MB = 32;
+static const uint CSO_READ_AHEAD_SIZE = 512 * 1024;
+static const uint CSO_DECOMPRESS_THREADS = 2;
 
 class CsoFileReader : public AsyncFileReader
 {
@@ -41,16 +43,20 @@ public:
 		m_frameShift(0),
 		m_indexShift(0),
 		m_readBuffer(0),
-		m_zlibBuffer(0),
-		m_zlibBufferFrame(0),
+		m_readBufferSize(0),
 		m_index(0),
+		m_numFrames(0),
 		m_totalSize(0),
 		m_src(0),
 		m_z_stream(0),
-#if CSO_USE_CHUNKSCACHE
-		m_cache(CSO_CHUNKCACHE_SIZE_MB),
-#endif
-		m_bytesRead(0) {
+		m_cacheFrames(0),
+		m_readAheadFrames(0),
+		m_readAheadStart(0),
+		m_readAheadEnd(0),
+		m_quit(false),
+		m_pendingBuffer(0),
+		m_pendingSector(0),
+		m_pendingCount(0) {
 		m_blocksize = 2048;
 	};
 
@@ -75,28 +81,69 @@ public:
 	virtual void SetDataOffset(int bytes) { m_dataoffset = bytes; }
 
 private:
+	// A decompression thread, with its own file handle and zlib state.
+	struct Worker {
+		Worker() : src(0), stream(0), readBuffer(0) {}
+		FILE* src;
+		z_stream* stream;
+		u8* readBuffer;
+		std::thread thread;
+	};
+
+	struct CachedFrame {
+		CachedFrame() : data(0), ready(false) {}
+		// NULL once ready if the frame failed to decompress.
+		u8* data;
+		bool ready;
+		// Position in m_lru, set once ready.
+		std::list<u32>::iterator lru;
+	};
+
 	static bool ValidateHeader(const CsoHeader& hdr);
 	bool ReadFileHeader();
 	bool InitializeBuffers();
+	bool InitializeStream(z_stream*& stream);
+	void StartWorkers();
+	void StopWorkers();
+	void WorkerLoop(Worker* worker);
 	int ReadFromFrame(u8 *dest, u64 pos, int maxBytes);
-	bool DecompressFrame(u32 frame, u32 readBufferSize);
+	bool ReadCachedFrame(u8 *dest, u32 frame, u32 offset, u32 bytes);
+	void ReadAhead(u32 frame);
+	void FinishFrame(u32 frame, u8* data);
+	bool DecompressFrame(FILE* src, z_stream* stream, u8* readBuffer, u32 frame, u8* dest) const;
 
 	u32 m_frameSize;
 	u8 m_frameShift;
 	u8 m_indexShift;
 	u8* m_readBuffer;
-	u8 *m_zlibBuffer;
-	u32 m_zlibBufferFrame;
+	u32 m_readBufferSize;
 	u32 *m_index;
+	u32 m_numFrames;
 	u64 m_totalSize;
 	// The actual source cso file handle.
 	FILE* m_src;
 	z_stream* m_z_stream;
 
-#if CSO_USE_CHUNKSCACHE
-	ChunksCache m_cache;
-#endif
-
-	// The result of a read is stored here between BeginRead() and FinishRead().
-	int m_bytesRead;
+	// Everything below up to m_quit is guarded by m_cacheMutex.
+	std::unordered_map<u32, CachedFrame> m_frames;
+	// Ready frames, most recently used first.
+	std::list<u32> m_lru;
+	u32 m_cacheFrames;
+	// Frames waiting for a worker, in read order.
+	std::deque<u32> m_queue;
+	u32 m_readAheadFrames;
+	// The frames read ahead for the last read, so that a jump can be told apart.
+	u32 m_readAheadStart;
+	u32 m_readAheadEnd;
+	bool m_quit;
+	std::mutex m_cacheMutex;
+	std::condition_variable m_work;
+	std::condition_variable m_frameDone;
+	std::vector<Worker*> m_workers;
+
+	// The read requested by BeginRead(), done by FinishRead() once the workers
+	// have had a head start on its frames.
+	void* m_pendingBuffer;
+	uint m_pendingSector;
+	uint m_pendingCount;
 };
@@ -15,6 +15,7 @@
 
 #include "PrecompiledHeader.h"
 #include <fstream>
+#include <vector>
 #include <wx/stdpaths.h>
 #include "AppConfig.h"
 #include "ChunksCache.h"
@@ -24,6 +25,9 @@
 
 #define CLAMP(val, minval, maxval) (std::min(maxval, std::max(minval, val)))
 
+#define PTT clock_t
+#define NOW() (clock() / (CLOCKS_PER_SEC / 1000))
+
 static s64 fsize(const wxString& filename) {
 	if (!wxFileName::FileExists(filename))
 		return -1;
@@ -74,6 +78,7 @@ static Access* ReadIndexFromFile(const wxString& filename) {
 	infile.read(buffer, datasize);
 	infile.close();
 	index->list = (Point*)buffer; // adjust list pointer
+	index->size = index->have;    // as allocated, points may be added (see RefineIndex)
 	return index;
 }
 
@@ -86,10 +91,9 @@ static void WriteIndexToFile(Access* index, const wxString filename) {
 	std::ofstream outfile(PX_wfilename(filename), std::ofstream::binary);
 	outfile.write(GZIP_ID, GZIP_ID_LEN);
 
-	Point* tmp = index->list;
-	index->list = 0; // current pointer is useless on disk, normalize it as 0.
-	outfile.write((char*)index, sizeof(Access));
-	index->list = tmp;
+	Access header = *index;
+	header.list = 0; // current pointer is useless on disk, normalize it as 0.
+	outfile.write((char*)&header, sizeof(Access));
 
 	outfile.write((char*)index->list, sizeof(Point) * index->have);
 	outfile.close();
@@ -102,6 +106,64 @@ static void WriteIndexToFile(Access* index, const wxString filename) {
 	}
 }
 
+// The image size has to be known when the disc is mounted, long before a
+// background index build gets to the end of the stream. The gzip trailer has
+// it modulo 4GB, the ISO9660 primary volume descriptor has it in full: when
+// they agree, that's the size. Returns -1 otherwise (e.g. dual layer images,
+// whose descriptor only covers the first layer).
+static PX_off_t ProbeUncompressedSize(FILE* in) {
+	unsigned char trailer[4];
+	if (PX_fseeko(in, -4, SEEK_END) != 0 || fread(trailer, 1, 4, in) != 4)
+		return -1;
+	u32 isize = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((u32)trailer[3] << 24);
+
+	static const int pvdOffset = 16 * 2048;
+	std::vector<unsigned char> head(pvdOffset + 2048);
+	unsigned char input[16 * 1024];
+	z_stream strm = {};
+	if (inflateInit2(&strm, 47) != Z_OK)
+		return -1;
+	PX_fseeko(in, 0, SEEK_SET);
+	strm.next_out = head.data();
+	strm.avail_out = head.size();
+	int ret = Z_OK;
+	while (strm.avail_out && ret == Z_OK) {
+		if (!strm.avail_in) {
+			strm.avail_in = fread(input, 1, sizeof(input), in);
+			strm.next_in = input;
+			if (!strm.avail_in)
+				break;
+		}
+		ret = inflate(&strm, Z_NO_FLUSH);
+	}
+	bool complete = strm.avail_out == 0;
+	inflateEnd(&strm);
+	if (!complete)
+		return -1;
+
+	const unsigned char* pvd = &head[pvdOffset];
+	if (pvd[0] != 1 || memcmp(pvd + 1, "CD001", 5))
+		return -1;
+	u32 blocks = pvd[80] | (pvd[81] << 8) | (pvd[82] << 16) | ((u32)pvd[83] << 24);
+	PX_off_t size = (PX_off_t)blocks * 2048;
+	if ((u32)size != isize)
+		return -1;
+	return size;
+}
+
+// Makes room for one more access point. addpoint() would do it, but frees
+// the whole index when out of memory.
+static bool GrowIndex(Access* index) {
+	if (index->have < index->size)
+		return true;
+	Point* list = (Point*)realloc(index->list, sizeof(Point) * index->size * 2);
+	if (!list)
+		return false;
+	index->list = list;
+	index->size *= 2;
+	return true;
+}
+
 static wxString INDEX_TEMPLATE_KEY(L"$(f)");
 // template:
 // must contain one and only one instance of '$(f)' (without the quotes)
@@ -181,8 +243,17 @@ GzippedFileReader::GzippedFileReader(void) :
 	mBytesRead(0),
 	m_pIndex(0),
 	m_zstates(0),
+	m_zstatesCount(0),
 	m_src(0),
-	m_cache(GZFILE_CACHE_SIZE_MB) {
+	m_uncompressedSize(0),
+	m_cache(GZFILE_CACHE_SIZE_MB, GZFILE_READ_CHUNK_SIZE),
+	m_prefetchNext(0),
+	m_prefetchEnd(0),
+	m_indexComplete(false),
+	m_indexFailed(false),
+	m_hotPoints(0),
+	m_indexSrc(0),
+	m_quit(false) {
 	m_blocksize = 2048;
 	AsyncPrefetchReset();
 };
@@ -191,13 +262,14 @@ void GzippedFileReader::InitZstates() {
 	if (m_zstates) {
 		delete[] m_zstates;
 		m_zstates = 0;
+		m_zstatesCount = 0;
 	}
 	if (!m_pIndex)
 		return;
 
 	// having another extra element helps avoiding logic for last (so 2+ instead of 1+)
-	int size = 2 + m_pIndex->uncompressed_size / m_pIndex->span;
-	m_zstates = new Czstate[size]();
+	m_zstatesCount = 2 + m_uncompressedSize / m_pIndex->span;
+	m_zstates = new Czstate[m_zstatesCount]();
 }
 
 #ifndef _WIN32
@@ -290,6 +362,10 @@ bool GzippedFileReader::OkIndex() {
 	wxString indexfile = iso2indexname(m_filename);
 	if (indexfile.length() == 0)
 		return false; // iso2indexname(...) will print errors if it can't apply the template
+	m_indexFile = indexfile;
+
+	if (!(m_indexSrc = PX_fopen_rb(m_filename)))
+		return false;
 
 	if (wxFileName::FileExists(indexfile) && (m_pIndex = ReadIndexFromFile(indexfile))) {
 		Console.WriteLn(Color_Green, L"OK: Gzip quick access index read from disk: '%s'", WX_STR(indexfile));
@@ -299,33 +375,175 @@ bool GzippedFileReader::OkIndex() {
 			Console.Warning(L"It will work fine, but if you want to generate a new index with default intervals, delete this index file.");
 			Console.Warning(L"(smaller intervals mean bigger index file and quicker but more frequent decompressions)");
 		}
+		m_indexComplete = true;
+		m_uncompressedSize = m_pIndex->uncompressed_size;
+		m_indexThread = std::thread(&GzippedFileReader::IndexThread, this);
 		InitZstates();
 		return true;
 	}
 
-	// No valid index file. Generate an index
-	Console.Warning(L"This may take a while (but only once). Scanning compressed file to generate a quick access index...");
+	// No valid index file. Build one in the background, starting with an empty list.
+	m_pIndex = (Access*)malloc(sizeof(Access));
+	m_pIndex->list = (Point*)malloc(sizeof(Point) * 8);
+	m_pIndex->size = 8;
+	m_pIndex->have = 0;
+	m_pIndex->span = GZFILE_SPAN_DEFAULT;
+	m_pIndex->uncompressed_size = 0;
+	m_uncompressedSize = ProbeUncompressedSize(m_indexSrc);
+	m_indexThread = std::thread(&GzippedFileReader::IndexThread, this);
+
+	if (m_uncompressedSize >= 0) {
+		Console.WriteLn(Color_Green, L"Generating a quick access index for the gzipped ISO in the background.");
+	} else {
+		// Without the size the disc can't be mounted, wait for the index to tell.
+		Console.Warning(L"This may take a while (but only once). Scanning compressed file to generate a quick access index...");
+		std::unique_lock<std::mutex> lock(m_indexMutex);
+		m_indexCond.wait(lock, [this] { return m_indexComplete || m_indexFailed; });
+		if (m_indexFailed)
+			return false;
+		m_uncompressedSize = m_pIndex->uncompressed_size;
+	}
 
-	Access *index;
-	FILE* infile = PX_fopen_rb(m_filename);
-	int len = build_index(infile, GZFILE_SPAN_DEFAULT, &index);
-	printf("\n"); // build_index prints progress without \n's
-	fclose(infile);
+	InitZstates();
+	return true;
+}
 
-	if (len >= 0) {
-		m_pIndex = index;
-		WriteIndexToFile((Access*)m_pIndex, indexfile);
-	} else {
-		Console.Error(L"ERROR (%d): index could not be generated for file '%s'", len, WX_STR(m_filename));
-		free_index(index);
-		InitZstates();
+void GzippedFileReader::IndexThread() {
+	if (!m_indexComplete && !BuildIndex())
+		return;
+
+	std::unique_lock<std::mutex> lock(m_indexMutex);
+	while (true) {
+		m_indexCond.wait(lock, [this] { return m_quit || !m_refineQueue.empty(); });
+		if (m_quit)
+			return;
+
+		std::pair<PX_off_t, PX_off_t> span = m_refineQueue.front();
+		m_refineQueue.pop_front();
+		lock.unlock();
+		RefineIndex(span.first, span.second);
+		lock.lock();
+	}
+}
+
+bool GzippedFileReader::BuildIndex() {
+	PTT s = NOW();
+	PX_off_t size = index_walk(m_indexSrc, NULL, -1, GZFILE_SPAN_DEFAULT, AddBuiltPoint, this);
+
+	std::unique_lock<std::mutex> lock(m_indexMutex);
+	if (size < 0 || !m_pIndex->have) {
+		if (!m_quit)
+			Console.Error(L"ERROR (%d): index could not be generated for file '%s'", (int)size, WX_STR(m_filename));
+		m_indexFailed = true;
+		m_indexCond.notify_all();
 		return false;
 	}
 
-	InitZstates();
+	m_pIndex->uncompressed_size = size;
+	m_indexComplete = true;
+	m_indexCond.notify_all();
+	if (m_uncompressedSize >= 0 && m_uncompressedSize != size)
+		Console.Error(L"ERROR: the gzipped ISO is %lld bytes instead of the %lld expected from its header, expect read errors.",
+		              (long long)size, (long long)m_uncompressedSize);
+	lock.unlock();
+
+	// Only this thread changes the list from now on (see RefineIndex), and not before it's saved.
+	Console.WriteLn(Color_Green, L"OK: Gzip quick access index generated in %1.1f s.", (float)(NOW() - s) / 1000);
+	WriteIndexToFile(m_pIndex, m_indexFile);
 	return true;
 }
 
+int GzippedFileReader::AddBuiltPoint(void* ctx, int bits, PX_off_t in, PX_off_t out, unsigned left, unsigned char* window) {
+	GzippedFileReader* reader = (GzippedFileReader*)ctx;
+	std::lock_guard<std::mutex> lock(reader->m_indexMutex);
+	if (reader->m_quit)
+		return 0;
+	if (!GrowIndex(reader->m_pIndex))
+		return 0;
+	addpoint(reader->m_pIndex, bits, in, out, left, window);
+	reader->m_indexCond.notify_all();
+	return 1;
+}
+
+// Adds a point to the access points between out and end, which some reads
+// are far from, at tighter spacing than the index was built with.
+void GzippedFileReader::RefineIndex(PX_off_t out, PX_off_t end) {
+	Point* from = (Point*)malloc(sizeof(Point));
+	{
+		std::lock_guard<std::mutex> lock(m_indexMutex);
+		int i = m_pIndex->have;
+		while (--i > 0 && m_pIndex->list[i].out > out);
+		memcpy(from, &m_pIndex->list[i], sizeof(Point));
+	}
+	index_walk(m_indexSrc, from, end, GZFILE_HOT_SPAN, AddHotPoint, this);
+	free(from);
+}
+
+int GzippedFileReader::AddHotPoint(void* ctx, int bits, PX_off_t in, PX_off_t out, unsigned left, unsigned char* window) {
+	GzippedFileReader* reader = (GzippedFileReader*)ctx;
+	std::lock_guard<std::mutex> lock(reader->m_indexMutex);
+	Access* index = reader->m_pIndex;
+	if (reader->m_quit || reader->m_hotPoints >= GZFILE_HOT_POINTS_MAX || !GrowIndex(index))
+		return 0;
+
+	// Keep the list sorted: find where the point goes, and make room there.
+	int pos = index->have;
+	while (pos > 0 && index->list[pos - 1].out > out)
+		pos--;
+	if (pos > 0 && index->list[pos - 1].out == out)
+		return 1;
+	Point* list = index->list;
+	int have = index->have;
+	memmove(list + pos + 1, list + pos, sizeof(Point) * (have - pos));
+	// let addpoint() fill in list[pos] as if it were the end of the list
+	index->list = list + pos;
+	index->have = 0;
+	addpoint(index, bits, in, out, left, window);
+	index->list = list;
+	index->have = have + 1;
+
+	reader->m_hotPoints++;
+	return 1;
+}
+// Copies the access point reads of offset start from (see index_walk) to
+// m_extractPoint, waiting for the first one if the index is still being built.
+// Called with m_readMutex held.
+bool GzippedFileReader::CopyAccessPoint(PX_off_t offset, PX_off_t& nextOut) {
+	std::unique_lock<std::mutex> lock(m_indexMutex);
+	m_indexCond.wait(lock, [this] { return m_pIndex->have || m_indexComplete || m_indexFailed; });
+	if (!m_pIndex->have)
+		return false;
+
+	// Last point at or before offset. Points past the first one added to a span
+	// make the list uneven, hence a search rather than offset / span.
+	int lo = 0, hi = m_pIndex->have - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (m_pIndex->list[mid].out <= offset)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	memcpy(&m_extractPoint, &m_pIndex->list[lo], sizeof(Point));
+	if (lo + 1 < m_pIndex->have)
+		nextOut = m_pIndex->list[lo + 1].out;
+	else
+		nextOut = m_indexComplete ? m_pIndex->uncompressed_size : -1;
+	return true;
+}
+
+// A read had to inflate a long way from its access point. The second time
+// it happens between the same two points, add more points in between.
+void GzippedFileReader::NoteSlowRead(PX_off_t out, PX_off_t nextOut) {
+	std::lock_guard<std::mutex> lock(m_indexMutex);
+	if (nextOut < 0 || m_hotPoints >= GZFILE_HOT_POINTS_MAX)
+		return;
+	if (++m_slowReads[out] == 2) {
+		m_refineQueue.push_back(std::make_pair(out, nextOut));
+		m_indexCond.notify_all();
+	}
+}
+
 bool GzippedFileReader::Open(const wxString& fileName) {
 	Close();
 	m_filename = fileName;
@@ -335,6 +553,7 @@ bool GzippedFileReader::Open(const wxString& fileName) {
 	};
 
 	AsyncPrefetchOpen();
+	m_prefetchThread = std::thread(&GzippedFileReader::PrefetchThread, this);
 	return true;
 };
 
@@ -350,18 +569,63 @@ int GzippedFileReader::FinishRead(void) {
 	return res;
 };
 
-#define PTT clock_t
-#define NOW() (clock() / (CLOCKS_PER_SEC / 1000))
-
 int GzippedFileReader::ReadSync(void* pBuffer, uint sector, uint count) {
 	PX_off_t offset = (s64)sector * m_blocksize + m_dataoffset;
 	int bytesToRead = count * m_blocksize;
+
+	std::unique_lock<std::mutex> lock(m_readMutex);
 	int res = _ReadSync(pBuffer, offset, bytesToRead);
 	if (res < 0)
 		Console.Error(L"Error: iso-gzip read unsuccessful.");
+
+	// Have the chunks after this read extracted while the game works on it.
+	PX_off_t next = (offset + bytesToRead + GZFILE_READ_CHUNK_SIZE - 1) / GZFILE_READ_CHUNK_SIZE * GZFILE_READ_CHUNK_SIZE;
+	if (res > 0) {
+		if (next < m_prefetchNext || next > m_prefetchEnd)
+			m_prefetchNext = next;
+		m_prefetchEnd = std::min(next + GZFILE_PREFETCH_CHUNKS * GZFILE_READ_CHUNK_SIZE, m_uncompressedSize);
+	}
+	lock.unlock();
+	m_prefetchCond.notify_one();
 	return res;
 }
 
+void GzippedFileReader::PrefetchThread() {
+	unsigned char dummy;
+	std::unique_lock<std::mutex> lock(m_readMutex);
+	while (true) {
+		m_prefetchCond.wait(lock, [this] { return m_quit || m_prefetchNext < m_prefetchEnd; });
+		if (m_quit)
+			return;
+
+		PX_off_t offset = m_prefetchNext;
+		m_prefetchNext += GZFILE_READ_CHUNK_SIZE;
+		// Reading a byte of an uncached chunk extracts all of it into the cache.
+		if (!m_cache.Contains(offset, 1))
+			_ReadSync(&dummy, offset, 1);
+
+		// Let a read waiting for the lock go first.
+		lock.unlock();
+		std::this_thread::yield();
+		lock.lock();
+	}
+}
+
+void GzippedFileReader::StopThreads() {
+	{
+		std::lock_guard<std::mutex> lock(m_readMutex);
+		std::lock_guard<std::mutex> lock2(m_indexMutex);
+		m_quit = true;
+	}
+	m_prefetchCond.notify_all();
+	m_indexCond.notify_all();
+	if (m_prefetchThread.joinable())
+		m_prefetchThread.join();
+	if (m_indexThread.joinable())
+		m_indexThread.join();
+	m_quit = false;
+}
+
 // If we have a valid and adequate zstate for this span, use it, else, use the index
 PX_off_t GzippedFileReader::GetOptimalExtractionStart(PX_off_t offset) {
 	int span = m_pIndex->span;
@@ -375,12 +639,16 @@ PX_off_t GzippedFileReader::GetOptimalExtractionStart(PX_off_t offset) {
 	if (span % GZFILE_READ_CHUNK_SIZE)
 		return offset / GZFILE_READ_CHUNK_SIZE * GZFILE_READ_CHUNK_SIZE;
 
-	return span * (offset / span); // index direct access boundaries
+	// index direct access boundaries, or the first chunk after the access point if
+	// that's later (the index may have points past the span boundary, see RefineIndex)
+	PX_off_t start = span * (offset / span);
+	PX_off_t point = (m_extractPoint.out + GZFILE_READ_CHUNK_SIZE - 1) / GZFILE_READ_CHUNK_SIZE * GZFILE_READ_CHUNK_SIZE;
+	return std::max(start, point);
 }
 
 int GzippedFileReader::_ReadSync(void* pBuffer, PX_off_t offset, uint bytesToRead) {
-	if (!OkIndex())
-		return -1;
+	if (!m_pIndex || offset / m_pIndex->span >= m_zstatesCount - 1)
+		return offset >= m_uncompressedSize ? 0 : -1;
 
 	// Without all the caching, chunking and states, this would be enough:
 	// return extract(m_src, m_pIndex, offset, (unsigned char*)pBuffer, bytesToRead);
@@ -405,23 +673,43 @@ int GzippedFileReader::_ReadSync(void* pBuffer, PX_off_t offset, uint bytesToRea
 	if (res >= 0)
 		return res;
 
+	// The index may still be in the works, so extract() gets the one access
+	// point it needs rather than the index itself.
+	PX_off_t chunkStart = offset - offset % GZFILE_READ_CHUNK_SIZE;
+	PX_off_t nextOut;
+	if (!CopyAccessPoint(chunkStart, nextOut))
+		return -1;
+	Access index = {};
+	index.list = &m_extractPoint;
+	index.have = index.size = 1;
+	index.span = m_pIndex->span;
+
 	// Not available from cache. Decompress from optimal starting
 	// point in GZFILE_READ_CHUNK_SIZE chunks and cache each chunk.
 	PTT s = NOW();
 	PX_off_t extractOffset = GetOptimalExtractionStart(offset); // guaranteed in GZFILE_READ_CHUNK_SIZE boundaries
 	int size = offset + maxInChunk - extractOffset;
-	unsigned char* extracted = (unsigned char*)malloc(size);
+	// a single chunk is extracted straight into a cache buffer
+	bool single = size <= GZFILE_READ_CHUNK_SIZE;
+	unsigned char* extracted = single ? (unsigned char*)m_cache.Acquire() : (unsigned char*)malloc(size);
 
 	int span = m_pIndex->span;
 	int spanix = extractOffset / span;
+	bool fromState = m_zstates[spanix].state.isValid && m_zstates[spanix].state.out_offset == extractOffset;
 	AsyncPrefetchCancel();
-	res = extract(m_src, m_pIndex, extractOffset, extracted, size, &(m_zstates[spanix].state));
+	res = extract(m_src, &index, extractOffset, extracted, size, &(m_zstates[spanix].state));
 	if (res < 0) {
-		free(extracted);
+		if (single)
+			m_cache.Release(extracted);
+		else
+			free(extracted);
 		return res;
 	}
 	AsyncPrefetchChunk(getInOffset(&(m_zstates[spanix].state)));
 
+	if (!fromState && offset - m_extractPoint.out > GZFILE_HOT_DISTANCE)
+		NoteSlowRead(m_extractPoint.out, nextOut);
+
 	int copied = ChunksCache::CopyAvailable(extracted, extractOffset, res, pBuffer, offset, bytesToRead);
 
 	if (m_zstates[spanix].state.isValid && (extractOffset + res) / span != offset / span) {
@@ -438,12 +726,12 @@ int GzippedFileReader::_ReadSync(void* pBuffer, PX_off_t offset, uint bytesToRea
 		m_zstates[spanix].Kill();
 	}
 
-	if (size <= GZFILE_READ_CHUNK_SIZE)
+	if (single)
 		m_cache.Take(extracted, extractOffset, res, size);
 	else { // split into cacheable chunks
 		for (int i = 0; i < size; i += GZFILE_READ_CHUNK_SIZE) {
 			int available = CLAMP(res - i, 0, GZFILE_READ_CHUNK_SIZE);
-			void* chunk = available ? malloc(available) : 0;
+			void* chunk = available ? m_cache.Acquire() : 0;
 			if (available)
 				memcpy(chunk, extracted + i, available);
 			m_cache.Take(chunk, extractOffset + i, available, std::min(size - i, GZFILE_READ_CHUNK_SIZE));
@@ -463,19 +751,39 @@ int GzippedFileReader::_ReadSync(void* pBuffer, PX_off_t offset, uint bytesToRea
 }
 
 void GzippedFileReader::Close() {
+	StopThreads();
 	m_filename.Empty();
 	if (m_pIndex) {
 		free_index((Access*)m_pIndex);
 		m_pIndex = 0;
 	}
+	m_indexComplete = false;
+	m_indexFailed = false;
+	m_slowReads.clear();
+	m_refineQueue.clear();
+	m_hotPoints = 0;
+	m_prefetchNext = 0;
+	m_prefetchEnd = 0;
+	m_uncompressedSize = 0;
 
 	InitZstates(); // results in delete because no index
+
+	// To tell whether GZFILE_CACHE_SIZE_MB suits this title.
+	ChunksCache::Stats stats = m_cache.GetStats();
+	if (stats.hits + stats.misses)
+		Console.WriteLn(Color_Gray, L"gunzip: cache hits %llu, misses %llu (%1.1f%% hit), evictions %llu, peak %1.1f of %1.1f MB",
+		                stats.hits, stats.misses, 100.0 * stats.hits / (stats.hits + stats.misses), stats.evictions,
+		                (float)stats.peakSize / 1024 / 1024, (float)stats.limit / 1024 / 1024);
 	m_cache.Clear();
 
 	if (m_src) {
 		fclose(m_src);
 		m_src = 0;
 	}
+	if (m_indexSrc) {
+		fclose(m_indexSrc);
+		m_indexSrc = 0;
+	}
 
 	AsyncPrefetchClose();
 }
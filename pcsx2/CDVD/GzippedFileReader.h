@@ -20,10 +20,20 @@ typedef struct zstate Zstate;
 #include "AsyncFileReader.h"
 #include "ChunksCache.h"
 #include "zlib_indexed.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
 
 #define GZFILE_SPAN_DEFAULT (1048576L * 4)   /* distance between direct access points when creating a new index */
 #define GZFILE_READ_CHUNK_SIZE (256 * 1024)  /* zlib extraction chunks size (at 0-based boundaries) */
 #define GZFILE_CACHE_SIZE_MB 200             /* cache size for extracted data. must be at least GZFILE_READ_CHUNK_SIZE (in MB)*/
+#define GZFILE_PREFETCH_CHUNKS 4             /* chunks extracted in the background past the last read */
+#define GZFILE_HOT_DISTANCE (1024 * 1024)    /* reads which inflate this far from their access point are slow */
+#define GZFILE_HOT_SPAN (256 * 1024)         /* access point spacing added where slow reads repeat */
+#define GZFILE_HOT_POINTS_MAX 512            /* limit on added access points (32K each), they aren't saved */
 
 class GzippedFileReader : public AsyncFileReader
 {
@@ -47,7 +57,7 @@ public:
 	virtual uint GetBlockCount(void) const {
 		// type and formula copied from FlatFileReader
 		// FIXME? : Shouldn't it be uint and (size - m_dataoffset) / m_blocksize ?
-		return (int)((m_pIndex ? m_pIndex->uncompressed_size : 0) / m_blocksize);
+		return (int)(m_uncompressedSize / m_blocksize);
 	};
 
 	virtual void SetBlockSize(uint bytes) { m_blocksize = bytes; }
@@ -65,18 +75,60 @@ private:
 		Zstate state;
 	};
 
-	bool	OkIndex();  // Verifies that we have an index, or try to create one
+	bool	OkIndex();  // Reads the index, or starts building one
 	PX_off_t GetOptimalExtractionStart(PX_off_t offset);
 	int     _ReadSync(void* pBuffer, PX_off_t offset, uint bytesToRead);
 	void	InitZstates();
 
+	// The index is built on a background thread while the game already runs:
+	// reads inflate from the last access point found so far. Once built, the
+	// same thread adds access points to spans which keep being read far from
+	// their access point.
+	void	IndexThread();
+	bool	BuildIndex();
+	void	RefineIndex(PX_off_t out, PX_off_t end);
+	static int AddBuiltPoint(void* ctx, int bits, PX_off_t in, PX_off_t out, unsigned left, unsigned char* window);
+	static int AddHotPoint(void* ctx, int bits, PX_off_t in, PX_off_t out, unsigned left, unsigned char* window);
+	// Copies the last access point at or before offset to m_extractPoint,
+	// and sets nextOut to where the next one is (-1 if not known yet).
+	bool	CopyAccessPoint(PX_off_t offset, PX_off_t& nextOut);
+	void	NoteSlowRead(PX_off_t out, PX_off_t nextOut);
+
+	// Extracts the chunks following the last read into the cache.
+	void	PrefetchThread();
+	void	StopThreads();
+
 	int		mBytesRead; // Temp sync read result when simulating async read
 	Access* m_pIndex;   // Quick access index
 	Czstate* m_zstates;
+	int		m_zstatesCount;
 	FILE*	m_src;
+	PX_off_t m_uncompressedSize;
 
 	ChunksCache m_cache;
 
+	// Guards m_src, m_zstates, m_cache, m_extractPoint and the prefetch range.
+	std::mutex m_readMutex;
+	Point	m_extractPoint;
+	PX_off_t m_prefetchNext;
+	PX_off_t m_prefetchEnd;
+	std::condition_variable m_prefetchCond;
+	std::thread m_prefetchThread;
+
+	// Guards m_pIndex and everything below up to the thread.
+	std::mutex m_indexMutex;
+	std::condition_variable m_indexCond;
+	bool	m_indexComplete;
+	bool	m_indexFailed;
+	std::map<PX_off_t, int> m_slowReads; // by access point
+	std::deque<std::pair<PX_off_t, PX_off_t>> m_refineQueue;
+	int		m_hotPoints;
+	FILE*	m_indexSrc;
+	wxString m_indexFile;
+	std::thread m_indexThread;
+
+	std::atomic<bool> m_quit;
+
 #ifdef _WIN32
 	// Used by async prefetch
 	HANDLE hOverlappedFile;
@@ -45,6 +45,8 @@ int InputIsoFile::ReadSync(u8* dst, uint lsn)
 		return -1;
 	}
 
+	FinishPendingRead();
+
 	return m_reader->ReadSync(dst+m_blockofs, lsn, 1);
 }
 
@@ -60,24 +62,97 @@ void InputIsoFile::BeginRead2(uint lsn)
 		return;
 	}
 
-	if(lsn >= m_read_lsn && lsn < (m_read_lsn+m_read_count))
+	const ReadWindow& front = m_window[m_front];
+	if (front.Contains(lsn))
 	{
 		// Already buffered
 		return;
 	}
 
-	m_read_lsn = lsn;
-	m_read_count = 1;
+	// The drive is streaming when it runs off the end of the front window;
+	// the window grows with every step so long runs go in a few large reads.
+	// Anything else is a seek, which starts again from a small window.
+	uint back = m_front ^ 1;
+	bool sequential = (lsn == front.lsn + front.count);
+	m_streaming = sequential;
+	m_window_size = sequential ? std::min(m_window_size * 2, MaxReadUnit) : MinReadUnit;
+
+	if (m_window[back].Contains(lsn))
+	{
+		// Read ahead, or left over from before the last step. If the read
+		// is still in progress FinishRead3 waits for it.
+		m_front = back;
+		return;
+	}
+
+	// The one read in progress must end before the next can start. It is
+	// usually a read ahead the seek made useless, but the reader has no
+	// portable way to cancel it.
+	FinishPendingRead();
+
+	StartRead(back, lsn);
+	m_front = back;
+}
+
+// Reads the window starting at lsn. Only one read may be in progress at a time.
+void InputIsoFile::StartRead(uint window, uint lsn)
+{
+	ReadWindow& w = m_window[window];
+
+	w.lsn = lsn;
+	w.count = 1;
 
 	if(ReadUnit > 1)
 	{
-		//m_read_lsn   = lsn - (lsn % ReadUnit);
+		w.count = std::min(std::min(m_window_size, ReadUnit), m_blocks - lsn);
+	}
 
-		m_read_count = std::min(ReadUnit, m_blocks - m_read_lsn);
+	// Mapped images are read in place; the hint gets the pages in while the
+	// drive works through the window in front.
+	if (const u8* mapped = m_reader->GetBlockPointer(w.lsn, w.count))
+	{
+		m_reader->AdviseRead(w.lsn, w.count, m_streaming);
+		w.buffer = mapped;
+		return;
 	}
 
-	m_reader->BeginRead(m_readbuffer, m_read_lsn, m_read_count);
-	m_read_inprogress = true;
+	w.buffer = m_readbuffer[window];
+	m_reader->BeginRead(m_readbuffer[window], w.lsn, w.count);
+	m_inflight = window;
+}
+
+// Waits for the read in progress, if any. A window whose read failed is
+// emptied so the next access to it reads it again.
+int InputIsoFile::FinishPendingRead()
+{
+	if (m_inflight < 0)
+		return 0;
+
+	int ret = m_reader->FinishRead();
+	if (ret < 0)
+		m_window[m_inflight].count = 0;
+
+	m_inflight = -1;
+	return ret;
+}
+
+// While the drive streams, reads the window after the front one so that it
+// is ready by the time the drive gets there. Compressed images prefetch
+// on their own and block dumps aren't read in windows, so this only runs
+// for flat images.
+void InputIsoFile::ReadAhead()
+{
+	if (!m_streaming || ReadUnit <= 1 || m_inflight >= 0)
+		return;
+
+	const ReadWindow& front = m_window[m_front];
+	uint back = m_front ^ 1;
+	uint next = front.lsn + front.count;
+
+	if (next >= m_blocks || m_window[back].Contains(next))
+		return;
+
+	StartRead(back, next);
 }
 
 int InputIsoFile::FinishRead3(u8* dst, uint mode)
@@ -93,14 +168,15 @@ int InputIsoFile::FinishRead3(u8* dst, uint mode)
 	int length = 0;
 	int ret = 0;
 
-	if(m_read_inprogress)
+	if(m_inflight == (int)m_front)
 	{
-		ret = m_reader->FinishRead();
-		m_read_inprogress = false;
+		ret = FinishPendingRead();
 
 		if(ret < 0)
 			return ret;
 	}
+
+	ReadAhead();
 		
 	switch (mode)
 	{
@@ -141,8 +217,9 @@ int InputIsoFile::FinishRead3(u8* dst, uint mode)
 
 	length = end - _offset;
 
-	uint read_offset = (m_current_lsn - m_read_lsn) * m_blocksize;
-	memcpy(dst + diff, m_readbuffer + ndiff + read_offset, length);
+	const ReadWindow& front = m_window[m_front];
+	uint read_offset = (m_current_lsn - front.lsn) * m_blocksize;
+	memcpy(dst + diff, front.buffer + ndiff + read_offset, length);
 	
 	if (m_type == ISOTYPE_CD && diff >= 12)
 	{
@@ -173,12 +250,21 @@ void InputIsoFile::_init()
 	m_blocksize		= 0;
 	m_blocks		= 0;
 	
-	m_read_inprogress = false;
-	m_read_count = 0;
 	ReadUnit = 0;
 	m_current_lsn = -1;
-	m_read_lsn = -1;
 	m_reader = NULL;
+
+	for (uint i = 0; i < 2; i++)
+	{
+		m_window[i].lsn = 0;
+		m_window[i].count = 0;
+		m_window[i].buffer = m_readbuffer[i];
+	}
+
+	m_front = 0;
+	m_inflight = -1;
+	m_window_size = MinReadUnit;
+	m_streaming = false;
 }
 
 // Tests the specified filename to see if it is a supported ISO type.  This function typically
@@ -280,6 +366,9 @@ bool InputIsoFile::Open( const wxString& srcfile, bool testOnly )
 
 void InputIsoFile::Close()
 {
+	if (m_reader)
+		FinishPendingRead();
+
 	delete m_reader;
 	m_reader = NULL;
 	
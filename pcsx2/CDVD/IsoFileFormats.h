@@ -40,6 +40,9 @@ class InputIsoFile
 	DeclareNoncopyableObject( InputIsoFile );
 	
 	 static const uint MaxReadUnit = 128;
+	 // Size of the first read after a seek; the window doubles each time the
+	 // drive streams into the next one, up to ReadUnit.
+	 static const uint MinReadUnit = 16;
 
 protected:
 	 uint ReadUnit;
@@ -60,10 +63,23 @@ protected:
 	// total number of blocks in the ISO image (including all parts)
 	u32			m_blocks;
 		
-	bool		m_read_inprogress;
-	uint		m_read_lsn;
-	uint		m_read_count;
-	u8			m_readbuffer[MaxReadUnit * CD_FRAMESIZE_RAW];
+	// Sectors are served from a ring of two windows: the one the drive is
+	// reading from, and the one after it, read ahead while the drive streams.
+	struct ReadWindow
+	{
+		uint	lsn;
+		uint	count;
+		const u8*	buffer;		// m_readbuffer, or the image itself if the reader maps it
+
+		bool Contains(uint sector) const { return sector >= lsn && sector - lsn < count; }
+	};
+
+	ReadWindow	m_window[2];
+	uint		m_front;			// window the drive is reading from
+	int			m_inflight;			// window with a read in progress, or -1
+	uint		m_window_size;		// sectors in the next read
+	bool		m_streaming;		// the drive ran into the next window without seeking
+	u8			m_readbuffer[2][MaxReadUnit * CD_FRAMESIZE_RAW];
 	
 public:	
 	InputIsoFile();
@@ -93,6 +109,10 @@ public:
 protected:
 	void _init();
 
+	void StartRead(uint window, uint lsn);
+	int FinishPendingRead();
+	void ReadAhead();
+
 	bool tryIsoType(u32 _size, s32 _offset, s32 _blockofs);
 	void FindParts();
 };
@@ -0,0 +1,244 @@
+/*  PCSX2 - PS2 Emulator for PCs
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU Lesser General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with PCSX2.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PrecompiledHeader.h"
+#include "IopCommon.h"
+#include "IsoFileFormats.h"
+#include "SectorTrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+// records written to the file at a time
+static const uint TraceBatchRecords = 4096;
+// longest emulated pause a paced replay waits out; loading screens idle for far longer
+static const u64 ReplayMaxPauseMs = 1000;
+
+SectorTraceWriter::SectorTraceWriter()
+{
+	m_trackPending = false;
+}
+
+SectorTraceWriter::~SectorTraceWriter()
+{
+	Close();
+}
+
+bool SectorTraceWriter::Open( const wxString& filename )
+{
+	Close();
+
+	if (!m_file.Open(filename, L"wb"))
+		return false;
+
+	SectorTraceHeader header = {};
+	memcpy(header.magic, "CDTR", 4);
+	header.version			= SectorTraceVersion;
+	header.tick_frequency	= GetTickFrequency();
+	header.iop_clock		= PSXCLK;
+	m_file.Write(&header, sizeof(header));
+
+	m_records.reserve(TraceBatchRecords);
+	Console.WriteLn(Color_StrongBlue, L"Tracing CDVD reads to %s", WX_STR(filename));
+	return true;
+}
+
+void SectorTraceWriter::Close()
+{
+	if (!IsOpened())
+		return;
+
+	FinishTrack(0);
+	Flush();
+	m_file.Close();
+}
+
+void SectorTraceWriter::Record( SectorTraceKind kind, u32 lsn, int mode, u64 latency )
+{
+	SectorTraceRecord rec = {};
+	rec.lsn		= lsn;
+	rec.cycle	= psxRegs.cycle;
+	rec.latency	= latency;
+	rec.count	= 1;
+	rec.mode	= (u8)mode;
+	rec.kind	= (u8)kind;
+
+	m_records.push_back(rec);
+	if (m_records.size() >= TraceBatchRecords)
+		Flush();
+}
+
+void SectorTraceWriter::BeginTrack( u32 lsn, int mode, u64 latency )
+{
+	// A track whose buffer was never fetched still cost its readTrack.
+	FinishTrack(0);
+
+	m_track = SectorTraceRecord();
+	m_track.lsn		= lsn;
+	m_track.cycle	= psxRegs.cycle;
+	m_track.latency	= latency;
+	m_track.count	= 1;
+	m_track.mode	= (u8)mode;
+	m_track.kind	= SectorTrace_Track;
+	m_trackPending	= true;
+}
+
+void SectorTraceWriter::FinishTrack( u64 latency )
+{
+	if (!m_trackPending)
+		return;
+
+	m_track.latency += latency;
+	m_trackPending = false;
+
+	m_records.push_back(m_track);
+	if (m_records.size() >= TraceBatchRecords)
+		Flush();
+}
+
+void SectorTraceWriter::Flush()
+{
+	if (m_records.empty())
+		return;
+
+	m_file.Write(m_records.data(), m_records.size() * sizeof(SectorTraceRecord));
+	m_records.clear();
+}
+
+// --------------------------------------------------------------------------------------
+//  SectorTraceReplay
+// --------------------------------------------------------------------------------------
+static uint SectorBytes( int mode )
+{
+	switch (mode)
+	{
+		case CDVD_MODE_2352:	return 2352;
+		case CDVD_MODE_2340:	return 2340;
+		case CDVD_MODE_2328:	return 2328;
+		default:				return 2048;
+	}
+}
+
+static void LogReads( const wxChar* label, std::vector<u64>& latencies, u64 frequency, u64 bytes, u64 busy )
+{
+	if (latencies.empty())
+		return;
+
+	std::sort(latencies.begin(), latencies.end());
+	auto us = [frequency](u64 ticks) { return ticks * 1000000.0 / frequency; };
+	double seconds = (double)busy / frequency;
+
+	Console.WriteLn(L"%s: %u reads, %.1f MB in %.3f s (%.1f MB/s); latency p50 %.0f us, p99 %.0f us, max %.0f us",
+		label, (uint)latencies.size(), bytes / (1024.0 * 1024.0), seconds,
+		seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0,
+		us(latencies[latencies.size() / 2]),
+		us(latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)]),
+		us(latencies.back()));
+}
+
+bool SectorTraceReplay( const wxString& traceFile, const wxString& imageFile, bool paced )
+{
+	wxFFile file(traceFile, L"rb");
+	SectorTraceHeader header;
+	if (!file.IsOpened() || file.Read(&header, sizeof(header)) != sizeof(header)
+		|| memcmp(header.magic, "CDTR", 4) != 0 || header.version != SectorTraceVersion)
+	{
+		Console.Error(L"CDVD trace: %s is not a sector trace.", WX_STR(traceFile));
+		return false;
+	}
+
+	std::vector<SectorTraceRecord> records;
+	SectorTraceRecord rec;
+	while (file.Read(&rec, sizeof(rec)) == sizeof(rec))
+		records.push_back(rec);
+
+	std::unique_ptr<InputIsoFile> iso(new InputIsoFile());
+	try
+	{
+		iso->Open(imageFile);
+	}
+	catch (BaseException& ex)
+	{
+		Console.Error(L"CDVD trace: " + ex.FormatDiagnosticMessage());
+		return false;
+	}
+
+	Console.WriteLn(Color_StrongBlue, L"CDVD trace: replaying %u reads of %s on %s%s",
+		(uint)records.size(), WX_STR(traceFile), WX_STR(imageFile), paced ? L", paced" : L"");
+
+	// What the drive saw when the trace was recorded, for comparison.
+	std::vector<u64> latencies;
+	u64 bytes = 0;
+	u64 busy = 0;
+	for (const SectorTraceRecord& r : records)
+	{
+		latencies.push_back(r.latency);
+		bytes += r.count * SectorBytes(r.mode);
+		busy += r.latency;
+	}
+	LogReads(L"recorded", latencies, header.tick_frequency, bytes, busy);
+
+	uint skipped = 0;
+	u8 buffer[CD_FRAMESIZE_RAW];
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		latencies.clear();
+		bytes = 0;
+		busy = 0;
+
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			const SectorTraceRecord& r = records[i];
+			if (r.lsn + r.count > iso->GetBlockCount())
+			{
+				// traced on another disc or image, or a read past the end
+				skipped += pass == 0;
+				continue;
+			}
+
+			if (paced && i > 0 && header.iop_clock)
+			{
+				u64 pause = (u64)(u32)(r.cycle - records[i - 1].cycle) * 1000000 / header.iop_clock;
+				std::this_thread::sleep_for(std::chrono::microseconds(std::min(pause, ReplayMaxPauseMs * 1000)));
+			}
+
+			u64 start = GetCPUTicks();
+			for (uint s = 0; s < r.count; s++)
+			{
+				if (r.kind == SectorTrace_Track)
+				{
+					iso->BeginRead2(r.lsn + s);
+					iso->FinishRead3(buffer, r.mode);
+				}
+				else
+					iso->ReadSync(buffer, r.lsn + s);
+			}
+			u64 latency = GetCPUTicks() - start;
+
+			latencies.push_back(latency);
+			bytes += r.count * SectorBytes(r.mode);
+			busy += latency;
+		}
+
+		LogReads(pass == 0 ? L"first pass" : L"second pass", latencies, GetTickFrequency(), bytes, busy);
+	}
+
+	if (skipped)
+		Console.Warning(L"CDVD trace: %u reads were past the end of the image and skipped.", skipped);
+
+	return true;
+}
@@ -0,0 +1,87 @@
+/*  PCSX2 - PS2 Emulator for PCs
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU Lesser General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with PCSX2.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <wx/ffile.h>
+#include <vector>
+
+// --------------------------------------------------------------------------------------
+//  Sector traces
+// --------------------------------------------------------------------------------------
+// Every sector the emulated drive reads (see CdvdTraceReads), with the IOP cycle it was
+// asked for at and the host time the CDVD source spent on it. Replaying a trace against
+// an image tells slow seek emulation, which shows in the cycles, apart from a slow reader
+// or cache, which shows in the latencies.
+
+enum SectorTraceKind
+{
+	SectorTrace_Track = 0,		// readTrack followed by getBuffer, the path games use
+	SectorTrace_Sector,			// synchronous readSector
+};
+
+struct SectorTraceHeader
+{
+	u8		magic[4];			// "CDTR"
+	u32		version;
+	u64		tick_frequency;		// host ticks per second, for the latencies
+	u64		iop_clock;			// IOP cycles per second, for the cycles
+};
+
+struct SectorTraceRecord
+{
+	u32		lsn;
+	u32		cycle;				// psxRegs.cycle when the read was asked for
+	u64		latency;			// host ticks spent in the CDVD source
+	u16		count;
+	u8		mode;				// CDVD_MODE_*
+	u8		kind;				// SectorTraceKind
+	u32		reserved;
+};
+
+static const u32 SectorTraceVersion = 1;
+
+class SectorTraceWriter
+{
+	DeclareNoncopyableObject( SectorTraceWriter );
+
+protected:
+	wxFFile		m_file;
+	std::vector<SectorTraceRecord> m_records;	// written out in batches
+	SectorTraceRecord m_track;					// between readTrack and getBuffer
+	bool		m_trackPending;
+
+public:
+	SectorTraceWriter();
+	virtual ~SectorTraceWriter();
+
+	bool Open( const wxString& filename );
+	void Close();
+	bool IsOpened() const { return m_file.IsOpened(); }
+
+	void Record( SectorTraceKind kind, u32 lsn, int mode, u64 latency );
+	// A track read counts the time spent in both halves, not the emulated wait between them.
+	void BeginTrack( u32 lsn, int mode, u64 latency );
+	void FinishTrack( u64 latency );
+
+protected:
+	void Flush();
+};
+
+// Reads the sectors of a trace from an image, in the order the drive did, and logs the
+// throughput and latencies of a first and a second pass, the latter mostly from cache.
+// When paced, the emulated time between reads is waited out, which gives read-ahead the
+// time it had in the emulator.
+extern bool SectorTraceReplay( const wxString& traceFile, const wxString& imageFile, bool paced );
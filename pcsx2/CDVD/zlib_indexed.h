@@ -49,6 +49,8 @@ Comments) 1950 to 1952 in the files http://tools.ietf.org/html/rfc1950
       (Thanks to Mark Adler for suggesting the approach)
   - build_index(...) - added progress prints
   - CHUNK changed from 16k to 512k
+  - index_walk(...) - build_index generalized to start from an access point, stop at an
+      offset and hand out points as they're found (background builds, added access points)
  */
 
 /* Illustrate the use of Z_BLOCK, inflatePrime(), and inflateSetDictionary()
@@ -325,6 +327,114 @@ local int build_index(FILE *in, PX_off_t span, struct access **built)
     return ret;
 }
 
+/* PCSX2: build_index() generalized, to build an index in the background or to
+   add access points to an existing one.  Inflates from the access point from,
+   or from the start of the stream if from is NULL, up to the uncompressed
+   offset end, or the end of the stream if end is negative.  Each access point
+   found about every span bytes (other than from itself) is passed to add(),
+   which returns zero to stop the walk.  Returns the uncompressed offset
+   reached, or negative for error as build_index() does, or Z_BUF_ERROR if
+   add() stopped the walk. */
+typedef int (*index_point_cb)(void *ctx, int bits, PX_off_t in, PX_off_t out,
+                              unsigned left, unsigned char *window);
+
+local PX_off_t index_walk(FILE *in, const struct point *from, PX_off_t end,
+                          PX_off_t span, index_point_cb add, void *ctx)
+{
+    int ret;
+    PX_off_t totin, totout;     /* our own total counters to avoid 4GB limit */
+    PX_off_t last;              /* totout value of last access point */
+    z_stream strm;
+    unsigned char input[CHUNK];
+    unsigned char window[WINSIZE];
+
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_in = Z_NULL;
+    if (from == NULL) {
+        ret = inflateInit2(&strm, 47);      /* automatic zlib or gzip decoding */
+        if (ret != Z_OK)
+            return ret;
+        totin = totout = last = 0;
+        PX_fseeko(in, 0, SEEK_SET);
+    } else {
+        ret = inflateInit2(&strm, -15);     /* raw inflate */
+        if (ret != Z_OK)
+            return ret;
+        if (PX_fseeko(in, from->in - (from->bits ? 1 : 0), SEEK_SET) == -1) {
+            ret = Z_ERRNO;
+            goto index_walk_error;
+        }
+        if (from->bits) {
+            ret = getc(in);
+            if (ret == -1) {
+                ret = ferror(in) ? Z_ERRNO : Z_DATA_ERROR;
+                goto index_walk_error;
+            }
+            inflatePrime(&strm, from->bits, ret >> (8 - from->bits));
+        }
+        inflateSetDictionary(&strm, from->window, WINSIZE);
+        /* the sliding window starts out as the dictionary, oldest byte first,
+           which is what it holds when about to wrap around */
+        memcpy(window, from->window, WINSIZE);
+        totin = from->in;
+        totout = last = from->out;
+    }
+
+    strm.avail_out = 0;
+    do {
+        /* get some compressed data from input file */
+        strm.avail_in = fread(input, 1, CHUNK, in);
+        if (ferror(in)) {
+            ret = Z_ERRNO;
+            goto index_walk_error;
+        }
+        if (strm.avail_in == 0) {
+            ret = Z_DATA_ERROR;
+            goto index_walk_error;
+        }
+        strm.next_in = input;
+
+        /* process all of that, or until end of stream (same as build_index) */
+        do {
+            if (strm.avail_out == 0) {
+                strm.avail_out = WINSIZE;
+                strm.next_out = window;
+            }
+
+            totin += strm.avail_in;
+            totout += strm.avail_out;
+            ret = inflate(&strm, Z_BLOCK);      /* return at end of block */
+            totin -= strm.avail_in;
+            totout -= strm.avail_out;
+            if (ret == Z_NEED_DICT)
+                ret = Z_DATA_ERROR;
+            if (ret == Z_MEM_ERROR || ret == Z_DATA_ERROR)
+                goto index_walk_error;
+            if (ret == Z_STREAM_END)
+                break;
+
+            if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+                ((from == NULL && totout == 0) || totout - last > span)) {
+                if (!add(ctx, strm.data_type & 7, totin, totout, strm.avail_out, window)) {
+                    ret = Z_BUF_ERROR;
+                    goto index_walk_error;
+                }
+                last = totout;
+            }
+        } while (strm.avail_in != 0 && (end < 0 || totout < end));
+    } while (ret != Z_STREAM_END && (end < 0 || totout < end));
+
+    (void)inflateEnd(&strm);
+    return totout;
+
+  index_walk_error:
+    (void)inflateEnd(&strm);
+    return ret;
+}
+
 typedef struct zstate {
     PX_off_t out_offset;
     PX_off_t in_offset;
@@ -245,9 +245,12 @@ struct Pcsx2Config
 			bool
 				StackFrameChecks:1,
 				PreBlockCheckEE	:1,
-				PreBlockCheckIOP:1;
+				PreBlockCheckIOP:1,
+				ProfileBlocksEE	:1,		// counts and times every EE block, see recProfileReport
+				InterpretColdEE	:1;		// interprets EE blocks the first times they run, see recInterpretCold
 			bool
-				EnableEECache   :1;
+				EnableEECache   :1,
+				EnableVUCache	:1;		// saves microVU programs per game and recompiles them on the next run
 		BITFIELD_END
 
 		RecompilerOptions();
@@ -340,6 +343,28 @@ struct Pcsx2Config
 
 	};
 
+	// ------------------------------------------------------------------------
+	struct RewindOptions
+	{
+		bool	Enabled;
+
+		int		Interval;		// vsyncs between two captured states
+		int		BufferSize;		// memory budget for captured states, in megabytes
+
+		RewindOptions();
+		void LoadSave( IniInterface& conf );
+
+		bool operator ==( const RewindOptions& right ) const
+		{
+			return OpEqu( Enabled ) && OpEqu( Interval ) && OpEqu( BufferSize );
+		}
+
+		bool operator !=( const RewindOptions& right ) const
+		{
+			return !this->operator ==( right );
+		}
+	};
+
 	// ------------------------------------------------------------------------
 	// NOTE: The GUI's GameFixes panel is dependent on the order of bits in this structure.
 	struct GamefixOptions
@@ -453,6 +478,7 @@ struct Pcsx2Config
 			CdvdVerboseReads	:1,		// enables cdvd read activity verbosely dumped to the console
 			CdvdDumpBlocks		:1,		// enables cdvd block dumping
 			CdvdShareWrite		:1,		// allows the iso to be modified while it's loaded
+			CdvdTraceReads		:1,		// records cdvd sector reads and their timing to a trace file
 			EnablePatches		:1,		// enables patch detection and application
 			EnableCheats		:1,		// enables cheat detection and application
 			EnableWideScreenPatches		:1,
@@ -475,6 +501,7 @@ struct Pcsx2Config
 
 	CpuOptions			Cpu;
 	GSOptions			GS;
+	RewindOptions		Rewind;
 	SpeedhackOptions	Speedhacks;
 	GamefixOptions		Gamefixes;
 	ProfilerOptions		Profiler;
@@ -500,6 +527,7 @@ struct Pcsx2Config
 			OpEqu( bitset )		&&
 			OpEqu( Cpu )		&&
 			OpEqu( GS )			&&
+			OpEqu( Rewind )		&&
 			OpEqu( Speedhacks )	&&
 			OpEqu( Gamefixes )	&&
 			OpEqu( Profiler )	&&
@@ -390,13 +390,26 @@ void frameLimitReset()
 	m_iStart = GetCPUTicks();
 }
 
+// Set while the VM re-simulates frames that were already presented (netplay rollback).
+// Those frames must run as fast as possible, so the limiter is skipped entirely and the
+// timer is re-based once regular frames resume.
+static bool m_bypassLimit = false;
+
+void frameLimitBypass( bool bypass )
+{
+	if( m_bypassLimit == bypass ) return;
+
+	m_bypassLimit = bypass;
+	if( !bypass ) frameLimitReset();
+}
+
 // Framelimiter - Measures the delta time between calls and stalls until a
 // certain amount of time passes if such time hasn't passed yet.
 // See the GS FrameSkip function for details on why this is here and not in the GS.
 static __fi void frameLimit()
 {
 	// 999 means the user would rather just have framelimiting turned off...
-	if( !EmuConfig.GS.FrameLimitEnable ) return;
+	if( !EmuConfig.GS.FrameLimitEnable || m_bypassLimit ) return;
 
 	u64 uExpectedEnd	= m_iStart + m_iTicks;
 	u64 iEnd			= GetCPUTicks();
@@ -0,0 +1,203 @@
+/*  PCSX2 - PS2 Emulator for PCs
+ *  Copyright (C) 2002-2010  PCSX2 Dev Team
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU Lesser General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with PCSX2.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PrecompiledHeader.h"
+#include "DeltaState.h"
+
+// --------------------------------------------------------------------------------------
+//  DeltaStateRing  (implementations)
+// --------------------------------------------------------------------------------------
+DeltaStateRing::DeltaStateRing( uint capacity )
+	: m_snapshots( capacity )
+{
+	pxAssert( capacity > 0 );
+
+	m_oldest	= 0;
+	m_count		= 0;
+	m_oldestSeq	= 0;
+
+	m_intervalPages	= 0;
+	m_highWater		= 0;
+	m_lostSeq		= -1;
+}
+
+DeltaStateRing::~DeltaStateRing()
+{
+	mmap_DisarmWriteTracking( this );
+}
+
+DeltaStateRing::Snapshot& DeltaStateRing::GetSnapshot( s64 seq )
+{
+	pxAssert( Contains( seq ) );
+	return m_snapshots[(m_oldest + (seq - m_oldestSeq)) % m_snapshots.size()];
+}
+
+bool DeltaStateRing::Contains( s64 seq ) const
+{
+	return seq >= m_oldestSeq && seq < m_oldestSeq + m_count;
+}
+
+s64 DeltaStateRing::Save()
+{
+	if( m_count == m_snapshots.size() )
+		DropOldest();
+
+	Snapshot& snap = m_snapshots[(m_oldest + m_count) % m_snapshots.size()];
+
+	// Buffers are kept between laps of the ring, so once every slot has been used a save
+	// no longer needs to grow its allocation.
+	if( !snap.state )
+		snap.state.reset( new VmStateBuffer( L"Delta Savestate" ) );
+
+	memSavingState( snap.state.get() ).ExcludeMainRam().FreezeAll();
+	++m_count;
+
+	// Pages written from here on are logged to the new snapshot.
+	ReserveUndo( snap );
+	mmap_ArmWriteTracking( this );
+
+	return m_oldestSeq + m_count - 1;
+}
+
+bool DeltaStateRing::Load( s64 seq )
+{
+	if( !Contains( seq ) ) return false;
+
+	// Loading clears the recompilers, but pages that are still tracked stay protected; tracking
+	// is stopped before rolling main memory back so the restore itself doesn't get logged.
+	memLoadingState( GetSnapshot( seq ).state.get() ).ExcludeMainRam().FreezeAll();
+	mmap_DisarmWriteTracking( this );
+
+	// Roll back from the newest log: a page written in several intervals ends up with the
+	// contents from its oldest log at or after the snapshot being loaded.
+	for( s64 s = m_oldestSeq + m_count - 1; s >= seq; --s )
+	{
+		Snapshot& snap = GetSnapshot( s );
+		for( const PageCopy& page : snap.undo )
+			memcpy( &eeMem->Main[page.rampage << 12], page.data, __pagesize );
+
+		ReleaseUndo( snap );
+	}
+
+	m_count = (uint)(seq - m_oldestSeq + 1);
+	ReserveUndo( GetSnapshot( seq ) );
+	mmap_ArmWriteTracking( this );
+
+	return true;
+}
+
+void DeltaStateRing::Clear()
+{
+	mmap_DisarmWriteTracking( this );
+	DropAll();
+}
+
+uint DeltaStateRing::GetUndoPageCount() const
+{
+	uint pages = 0;
+	for( const Snapshot& snap : m_snapshots )
+		pages += snap.undo.size();
+	return pages;
+}
+
+// Called from the page fault handler, so nothing here may allocate (see ReserveUndo).
+void DeltaStateRing::OnFirstWrite( uint rampage, const u8* contents )
+{
+	++m_intervalPages;
+
+	// The snapshot of this interval was lost already; nothing to log until the next save.
+	if( !m_count ) return;
+
+	// Out of reserved pages: the oldest snapshots are the least likely to be loaded, so they
+	// go first.  Every snapshot is rolled back through the log of this interval, though, so
+	// once it is the only one left, a page missing from it loses the snapshot as well.
+	while( m_freePages.empty() )
+	{
+		m_lostSeq = m_oldestSeq;
+		if( m_count == 1 )
+		{
+			DropAll();
+			return;
+		}
+		DropOldest();
+	}
+
+	Snapshot& snap = GetSnapshot( m_oldestSeq + m_count - 1 );
+
+	PageCopy page = { rampage, m_freePages.back() };
+	m_freePages.pop_back();
+	memcpy( page.data, contents, __pagesize );
+
+	snap.undo.push_back( page );
+}
+
+void DeltaStateRing::OnTrackingLost()
+{
+	DropAll();
+}
+
+void DeltaStateRing::ReleaseUndo( Snapshot& snap )
+{
+	for( const PageCopy& page : snap.undo )
+		m_freePages.push_back( page.data );
+
+	snap.undo.clear();
+}
+
+void DeltaStateRing::DropOldest()
+{
+	ReleaseUndo( m_snapshots[m_oldest] );
+	m_oldest = (m_oldest + 1) % m_snapshots.size();
+	++m_oldestSeq;
+	--m_count;
+}
+
+// Drops every snapshot.  Sequence numbers keep counting so that stale ones held by the caller
+// aren't mistaken for new snapshots.
+void DeltaStateRing::DropAll()
+{
+	for( Snapshot& snap : m_snapshots )
+		ReleaseUndo( snap );
+
+	m_oldestSeq += m_count;
+	m_count = 0;
+}
+
+// Makes room for the undo log of the given snapshot, which is about to be armed: free pages
+// for twice the busiest interval so far, and room in its list for every page of main memory.
+void DeltaStateRing::ReserveUndo( Snapshot& snap )
+{
+	const uint MaxPages = Ps2MemSize::MainRam / __pagesize;
+	const uint MinPages = MaxPages / 8;		// covers the first intervals, before any are measured
+
+	m_highWater = std::max( m_highWater, m_intervalPages );
+	m_intervalPages = 0;
+
+	const uint reserve = std::min( std::max( m_highWater * 2, MinPages ), MaxPages );
+	while( m_freePages.size() < reserve )
+	{
+		m_pageChunks.emplace_back( new u8[PagesPerChunk * __pagesize] );
+
+		// Released pages go back on the free list from the fault handler too, so it must
+		// already hold every page of the pool.
+		m_freePages.reserve( m_pageChunks.size() * PagesPerChunk );
+
+		u8* chunk = m_pageChunks.back().get();
+		for( uint i = 0; i < PagesPerChunk; ++i )
+			m_freePages.push_back( chunk + i * __pagesize );
+	}
+
+	snap.undo.reserve( MaxPages );
+}
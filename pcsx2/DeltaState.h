@@ -0,0 +1,109 @@
+/*  PCSX2 - PS2 Emulator for PCs
+ *  Copyright (C) 2002-2010  PCSX2 Dev Team
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU Lesser General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with PCSX2.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "Memory.h"
+#include "SaveState.h"
+
+#include <memory>
+#include <vector>
+
+// --------------------------------------------------------------------------------------
+//  DeltaStateRing
+// --------------------------------------------------------------------------------------
+// A ring of in-memory savestates that share the live copy of EE main memory.  Each snapshot
+// holds the rest of the machine state in full (IOP ram, VU memory, registers, plugins), plus
+// an undo log of the main memory pages written between it and the next snapshot.  Pages are
+// caught on their first write through the page fault handler (see mmap_ArmWriteTracking),
+// so a save only costs the pages the game actually touched since the previous one.  Loading
+// a snapshot rolls the undo logs back from the newest snapshot down to the requested one.
+//
+// Snapshots are identified by a sequence number that increases with every save.  Loading a
+// snapshot drops every snapshot newer than it.
+//
+// Undo pages are logged from the page fault handler, which can't allocate, so the pages for
+// an interval are set aside when tracking is armed, sized from the most pages any interval
+// has needed so far.  If they still run out, the oldest snapshots give their pages up first;
+// only when the interval being logged is the last one left is its own snapshot lost.
+//
+// Threading: Save and Load must be called from the context of the core thread; Save from
+// within a vsync and Load from outside of CPU execution (see SysCoreThread::LoadStateInThread).
+//
+class DeltaStateRing : public MainRamWriteTracker
+{
+public:
+	DeltaStateRing( uint capacity );
+	virtual ~DeltaStateRing();
+
+	// Saves the current machine state as the newest snapshot, discarding the oldest one if
+	// the ring is full.  Returns the snapshot's sequence number.
+	s64 Save();
+
+	// Restores the given snapshot.  Returns false if it isn't in the ring anymore.
+	bool Load( s64 seq );
+
+	bool Contains( s64 seq ) const;
+	void Clear();
+
+	uint GetCapacity() const { return m_snapshots.size(); }
+	uint GetCount() const { return m_count; }
+
+	// Number of main memory pages currently held by undo logs.
+	uint GetUndoPageCount() const;
+
+	// Sequence number of the newest snapshot dropped because the undo pages ran out, or -1.
+	s64 GetLostSeq() const { return m_lostSeq; }
+	// Sequence number the next save will get.
+	s64 GetNextSeq() const { return m_oldestSeq + m_count; }
+
+protected:
+	static const uint PagesPerChunk = 256;		// 1 meg of undo pages per pool allocation
+
+	struct PageCopy
+	{
+		uint rampage;
+		u8* data;
+	};
+
+	struct Snapshot
+	{
+		std::unique_ptr<VmStateBuffer> state;
+		std::vector<PageCopy> undo;
+	};
+
+	std::vector<Snapshot> m_snapshots;
+	uint m_oldest;		// slot of the oldest snapshot
+	uint m_count;		// snapshots currently in the ring
+	s64 m_oldestSeq;	// sequence number of the oldest snapshot
+
+	// Pooled 4k blocks for undo pages.  Blocks are never freed back to the heap while the
+	// ring is alive, so steady-state saves don't allocate.
+	std::vector<std::unique_ptr<u8[]>> m_pageChunks;
+	std::vector<u8*> m_freePages;
+
+	uint m_intervalPages;	// pages written since tracking was last armed
+	uint m_highWater;		// most pages written in a single interval
+	s64 m_lostSeq;
+
+	void OnFirstWrite( uint rampage, const u8* contents );
+	void OnTrackingLost();
+
+	Snapshot& GetSnapshot( s64 seq );
+	void ReleaseUndo( Snapshot& snap );
+	void DropOldest();
+	void DropAll();
+	void ReserveUndo( Snapshot& snap );
+};
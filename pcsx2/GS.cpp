@@ -351,12 +351,28 @@ void gsIrq() {
 //   functions are performed by the EE, which itself uses thread sleep logic to avoid spin
 //   waiting as much as possible (maximizes CPU resource availability for the GS).
 
+// Forced skipping is requested by the EE thread while frames are being re-simulated for
+// netplay rollback; those frames have already been presented once.
+static std::atomic<bool> s_forceFrameSkip( false );
+
+void gsForceFrameSkip( bool skip )
+{
+	s_forceFrameSkip = skip;
+}
+
 __fi void gsFrameSkip()
 {
 	static int consec_skipped = 0;
 	static int consec_drawn = 0;
 	static bool isSkipping = false;
 
+	if( s_forceFrameSkip )
+	{
+		GSsetFrameSkip( true );
+		isSkipping = true;
+		return;
+	}
+
 	if( !EmuConfig.GS.FrameSkipEnable )
 	{
 		if( isSkipping )
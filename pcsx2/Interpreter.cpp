@@ -223,6 +223,13 @@ void __fastcall intDoBranch(u32 target)
 	}
 }
 
+void intExecuteBlock()
+{
+	branch2 = 0;
+	while (!branch2)
+		execI();
+}
+
 void intSetBranch()
 {
 	branch2 = /*cpuRegs.branch =*/ 1;
@@ -516,6 +523,11 @@ static void intExecute()
 	do {
 		instruction_was_cancelled = false;
 		try {
+			if (eeEventTestResume)
+			{
+				eeEventTestResume = false;
+				intEventTest();
+			}
 			// The execution was splited in three parts so it is easier to
 			// resume it after a cancelled instruction.
 			switch (state) {
@@ -593,6 +605,11 @@ static void intClear(u32 Addr, u32 Size)
 {
 }
 
+static bool intSuspendPage(u32 Addr)
+{
+	return false;
+}
+
 static void intShutdown() {
 }
 
@@ -630,6 +647,7 @@ R5900cpu intCpu =
 	intThrowException,
 	intThrowException,
 	intClear,
+	intSuspendPage,
 
 	intGetCacheReserve,
 	intSetCacheReserve,
@@ -15,12 +15,51 @@
 
 #include "PrecompiledHeader.h"
 #include "AsyncFileReader.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+// Large reads are split into several requests submitted together, so the
+// kernel can keep more than one of them in flight.
+static const u32 AioRequestSize = 64 * 1024;
+static const int AioMaxRequests = 8;
+
+// Images past this size are read through AIO rather than mapped.
+static const u64 MaxMappingSize = 16ULL * _1gb;
+
+// Pages of a file on a network share can vanish or fail to read at any time,
+// which a mapping only reports through SIGBUS.
+static bool IsNetworkFilesystem(int fd)
+{
+	struct statfs fs;
+	if (fstatfs(fd, &fs) != 0)
+		return true;
+
+	switch ((u32)fs.f_type)
+	{
+		case 0x6969:		// NFS
+		case 0x517B:		// SMB
+		case 0xFF534D42:	// CIFS
+		case 0xFE534D42:	// SMB2
+		case 0x65735546:	// FUSE (sshfs and the like)
+		case 0x00C36400:	// Ceph
+		case 0x5346414F:	// AFS
+		case 0x73757245:	// Coda
+			return true;
+	}
+	return false;
+}
 
 FlatFileReader::FlatFileReader(bool shareWrite) : shareWrite(shareWrite)
 {
 	m_blocksize = 2048;
 	m_fd = -1;
 	m_aio_context = 0;
+	m_aio_requests = 0;
+	m_aio_requested = 0;
+	m_mapping = NULL;
+	m_mapping_size = 0;
+	m_mapping_sequential = false;
 }
 
 FlatFileReader::~FlatFileReader(void)
@@ -36,8 +75,32 @@ bool FlatFileReader::Open(const wxString& fileName)
 	if (err) return false;
 
     m_fd = wxOpen(fileName, O_RDONLY, 0);
+	if (m_fd == -1)
+		return false;
+
+	// Map the whole image so sectors can be served in place. If the image
+	// may be written to while it is mounted a shrinking file would fault
+	// the reads, a 32-bit process would give up the address space later
+	// allocations need, and network shares fail reads with SIGBUS; those
+	// all use AIO.
+#ifdef __M_X86_64
+	struct stat st;
+	if (!shareWrite && fstat(m_fd, &st) == 0 && st.st_size > 0 && (u64)st.st_size <= MaxMappingSize
+		&& !IsNetworkFilesystem(m_fd))
+	{
+		void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+		if (mapping != MAP_FAILED)
+		{
+			m_mapping = (u8*)mapping;
+			m_mapping_size = st.st_size;
+			madvise(m_mapping, m_mapping_size, MADV_RANDOM);
+		}
+		else
+			DevCon.WriteLn("FlatFileReader: mmap failed (%s), reading through AIO.", strerror(errno));
+	}
+#endif
 
-	return (m_fd != -1);
+	return true;
 }
 
 int FlatFileReader::ReadSync(void* pBuffer, uint sector, uint count)
@@ -53,25 +116,130 @@ void FlatFileReader::BeginRead(void* pBuffer, uint sector, uint count)
 
 	u32 bytesToRead = count * m_blocksize;
 
-	struct iocb iocb;
-	struct iocb* iocbs = &iocb;
+	if (const u8* mapped = GetBlockPointer(sector, count))
+	{
+		memcpy(pBuffer, mapped, bytesToRead);
+		m_aio_requests = -1;
+		return;
+	}
+
+	u32 requestSize = std::max(AioRequestSize, (bytesToRead + AioMaxRequests - 1) / AioMaxRequests);
+
+	struct iocb iocb[AioMaxRequests];
+	struct iocb* iocbs[AioMaxRequests];
+	int requests = 0;
+
+	for (u32 done = 0; done < bytesToRead; done += requestSize)
+	{
+		u32 size = std::min(requestSize, bytesToRead - done);
+		io_prep_pread(&iocb[requests], m_fd, (u8*)pBuffer + done, size, offset + done);
+		iocbs[requests] = &iocb[requests];
+		requests++;
+	}
 
-	io_prep_pread(&iocb, m_fd, pBuffer, bytesToRead, offset);
-	io_submit(m_aio_context, 1, &iocbs);
+	int submitted = 0;
+	while (submitted < requests)
+	{
+		int ret = io_submit(m_aio_context, requests - submitted, iocbs + submitted);
+		if (ret < 1)
+			break;
+		submitted += ret;
+	}
+	m_aio_requests = submitted;
+	m_aio_requested = requests;
 }
 
 int FlatFileReader::FinishRead(void)
 {
-	int min_nr = 1;
-	int max_nr = 1;
-	struct io_event events[max_nr];
+	struct io_event events[AioMaxRequests];
+	int ret = 1;
+
+	if (m_aio_requests < 0)
+	{
+		// Copied from the mapping
+		m_aio_requests = 0;
+		return 1;
+	}
 
-	int event = io_getevents(m_aio_context, min_nr, max_nr, events, NULL);
-	if (event < 1) {
+	if (m_aio_requests == 0)
 		return -1;
+
+	// Part of the buffer is left unread if io_submit didn't take every request
+	if (m_aio_requests < m_aio_requested)
+		ret = -1;
+
+	while (m_aio_requests > 0)
+	{
+		int event = io_getevents(m_aio_context, m_aio_requests, m_aio_requests, events, NULL);
+		if (event < 1) {
+			m_aio_requests = 0;
+			return -1;
+		}
+
+		for (int i = 0; i < event; i++)
+		{
+			if ((long)events[i].res < 0)
+				ret = -1;
+		}
+		m_aio_requests -= event;
+	}
+
+	return ret;
+}
+
+const u8* FlatFileReader::GetBlockPointer(uint sector, uint count)
+{
+	if (!m_mapping)
+		return NULL;
+
+	s64 offset = sector * (s64)m_blocksize + m_dataoffset;
+	u64 size = (u64)count * m_blocksize;
+	if (offset < 0 || (u64)offset + size > m_mapping_size)
+		return NULL;
+
+	// Only sectors already in memory are served in place: a fault on the
+	// others would stall the CDVD thread on the disk, and a failed read
+	// would raise SIGBUS. Those go through AIO while the kernel reads
+	// them in for next time.
+	uptr page = getpagesize();
+	uptr start = (uptr)(m_mapping + offset) & ~(page - 1);
+	uptr end = (uptr)(m_mapping + offset + size);
+	unsigned char resident[128];
+	uptr pages = (end - start + page - 1) / page;
+	bool inMemory = pages <= ArraySize(resident) && mincore((void*)start, end - start, resident) == 0;
+	for (uptr i = 0; inMemory && i < pages; i++)
+		inMemory = resident[i] & 1;
+
+	if (!inMemory)
+	{
+		madvise((void*)start, end - start, MADV_WILLNEED);
+		return NULL;
 	}
 
-	return 1;
+	return m_mapping + offset;
+}
+
+void FlatFileReader::AdviseRead(uint sector, uint count, bool sequential)
+{
+	if (!m_mapping)
+		return;
+
+	// Kernel read-ahead on faults only pays off while the drive streams;
+	// after a seek the window below is all that's wanted.
+	if (sequential != m_mapping_sequential)
+	{
+		madvise(m_mapping, m_mapping_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+		m_mapping_sequential = sequential;
+	}
+
+	s64 offset = sector * (s64)m_blocksize + m_dataoffset;
+	s64 end = std::min(offset + (s64)count * m_blocksize, (s64)m_mapping_size);
+	if (offset < 0 || offset >= end)
+		return;
+
+	uptr page = getpagesize();
+	uptr start = (uptr)(m_mapping + offset) & ~(page - 1);
+	madvise((void*)start, (uptr)(m_mapping + end) - start, MADV_WILLNEED);
 }
 
 void FlatFileReader::CancelRead(void)
@@ -85,12 +253,19 @@ void FlatFileReader::CancelRead(void)
 void FlatFileReader::Close(void)
 {
 
+	if (m_mapping) munmap(m_mapping, m_mapping_size);
+
 	if (m_fd != -1) close(m_fd);
 
 	io_destroy(m_aio_context);
 
 	m_fd = -1;
 	m_aio_context = 0;
+	m_aio_requests = 0;
+	m_aio_requested = 0;
+	m_mapping = NULL;
+	m_mapping_size = 0;
+	m_mapping_sequential = false;
 }
 
 uint FlatFileReader::GetBlockCount(void) const
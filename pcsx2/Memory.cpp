@@ -668,6 +668,8 @@ public:
 
 static mmap_PageFaultHandler* mmap_faultHandler = NULL;
 
+static void mmap_DropWriteTracking();
+
 EEVM_MemoryAllocMess* eeMem = NULL;
 __pagealigned u8 eeHw[Ps2MemSize::Hardware];
 
@@ -729,6 +731,7 @@ void eeMemoryReserve::Reset()
 		mmap_faultHandler = new mmap_PageFaultHandler();
 	}
 	
+	mmap_DropWriteTracking();
 	_parent::Reset();
 
 	// Note!!  Ideally the vtlb should only be initialized once, and then subsequent
@@ -852,6 +855,7 @@ void eeMemoryReserve::Reset()
 
 void eeMemoryReserve::Decommit()
 {
+	mmap_DropWriteTracking();
 	_parent::Decommit();
 	eeMem = NULL;
 }
@@ -890,6 +894,18 @@ void eeMemoryReserve::Release()
 // is 4096 (4k), which is why you'll see a lot of 0xfff's, >><< 12's, and 0x1000's in the
 // code below.
 //
+// Sub-page tracking:
+// A write fault only tells us that something in the page was written, and most of the
+// time that something is data sitting next to the code.  So a faulting page isn't cleared
+// right away: its blocks are suspended instead (see R5900cpu::SuspendPage), and whichever
+// of them still match their code when the page is next run are kept.  Each page also keeps
+// a mask of the 128 byte granules its blocks were compiled from; a write landing in one of
+// those is most likely code being patched, and clears the blocks there straight away.
+// Pages that fault again soon after one fault go to manual protection, as they always did.
+//
+
+static const uint CodeGranuleShift = 7;			// 32 granules of 128 bytes per page
+static const u32 PageFaultCooldown = 0x100000;	// EE cycles a page must go without faulting to stay counted
 
 struct vtlb_PageProtectionInfo
 {
@@ -901,10 +917,23 @@ struct vtlb_PageProtectionInfo
 	u32 ReverseRamMap;
 
 	vtlb_ProtectionMode Mode;
+
+	// Granules of the page holding recompiled code, one bit per (1 << CodeGranuleShift)
+	// bytes.  Blocks aren't taken out when cleared, so this can over-report.
+	u32 CodeMask;
+
+	// EE cycle of the last write fault, if the page had one since block tracking was reset.
+	u32 FaultCycle;
+	bool Faulted;
 };
 
 static __aligned16 vtlb_PageProtectionInfo m_PageProtectInfo[Ps2MemSize::MainRam >> 12];
 
+// Write tracking for delta savestates.  Pages flagged here are write-protected regardless
+// of their block tracking mode, and are reported to the tracker on their first write.
+static MainRamWriteTracker* m_WriteTracker = NULL;
+static bool m_PageWriteTracked[Ps2MemSize::MainRam >> 12];
+
 
 // returns:
 //  ProtMode_NotRequired - unchecked block (resides in ROM, thus is integrity is constant)
@@ -928,10 +957,12 @@ vtlb_ProtectionMode mmap_GetRamPageInfo( u32 paddr )
 }
 
 // paddr - physically mapped PS2 address
-void mmap_MarkCountedRamPage( u32 paddr )
+// size - size in words of the code at paddr that's been recompiled, 0 if none.
+void mmap_MarkCountedRamPage( u32 paddr, u32 size )
 {
 	pxAssert( eeMem );
-	
+
+	const u32 inpage = paddr & 0xfff;
 	paddr &= ~0xfff;
 
 	uptr ptr = (uptr)PSM( paddr );
@@ -942,6 +973,13 @@ void mmap_MarkCountedRamPage( u32 paddr )
 
 	m_PageProtectInfo[rampage].ReverseRamMap = paddr;
 
+	if( size )
+	{
+		const u32 first = inpage >> CodeGranuleShift;
+		const u32 last = std::min<u32>( inpage + size*4 - 1, 0xfff ) >> CodeGranuleShift;
+		m_PageProtectInfo[rampage].CodeMask |= ((2u << last) - 1) & ~((1u << first) - 1);
+	}
+
 	if( m_PageProtectInfo[rampage].Mode == ProtMode_Write )
 		return;		// skip town if we're already protected.
 
@@ -954,23 +992,46 @@ void mmap_MarkCountedRamPage( u32 paddr )
 	HostSys::MemProtect( &eeMem->Main[rampage<<12], __pagesize, PageAccess_ReadOnly() );
 }
 
-// offset - offset of address relative to psM.
-// All recompiled blocks belonging to the page are cleared, and any new blocks recompiled
-// from code residing in this page will use manual protection.
+// offset - offset of the written address relative to psM.
+// Recompiled blocks in the written granule are cleared, and the rest of the page's blocks
+// are suspended until it is run again.  If the page faults too often for that to pay off,
+// all its blocks are cleared, and any new blocks recompiled from code residing in this page
+// will use manual protection.
 static __fi void mmap_ClearCpuBlock( uint offset )
 {
 	pxAssert( eeMem );
 
 	int rampage = offset >> 12;
+	vtlb_PageProtectionInfo& info = m_PageProtectInfo[rampage];
 
 	// Assertion: This function should never be run on a block that's already under
 	// manual protection.  Indicates a logic error in the recompiler or protection code.
-	pxAssertMsg( m_PageProtectInfo[rampage].Mode != ProtMode_Manual,
+	pxAssertMsg( info.Mode != ProtMode_Manual,
 		"Attempted to clear a block that is already under manual protection." );
 
 	HostSys::MemProtect( &eeMem->Main[rampage<<12], __pagesize, PageAccess_ReadWrite() );
-	m_PageProtectInfo[rampage].Mode = ProtMode_Manual;
-	Cpu->Clear( m_PageProtectInfo[rampage].ReverseRamMap, 0x400 );
+
+	const bool busy = info.Faulted && (cpuRegs.cycle - info.FaultCycle) < PageFaultCooldown;
+	info.FaultCycle = cpuRegs.cycle;
+	info.Faulted = true;
+
+	if( !busy )
+	{
+		const uint granule = (offset & 0xfff) >> CodeGranuleShift;
+		if( info.CodeMask & (1u << granule) )
+			Cpu->Clear( info.ReverseRamMap + (granule << CodeGranuleShift), (1 << CodeGranuleShift) / 4 );
+
+		if( Cpu->SuspendPage( info.ReverseRamMap ) )
+		{
+			eeRecPerfLog.Write( "Suspended page @ 0x%05x (write @ 0x%03x)", info.ReverseRamMap>>12, offset & 0xfff );
+			info.Mode = ProtMode_None;
+			return;
+		}
+	}
+
+	info.Mode = ProtMode_Manual;
+	info.CodeMask = 0;
+	Cpu->Clear( info.ReverseRamMap, 0x400 );
 }
 
 void mmap_PageFaultHandler::OnPageFaultEvent( const PageFaultInfo& info, bool& handled )
@@ -981,10 +1042,91 @@ void mmap_PageFaultHandler::OnPageFaultEvent( const PageFaultInfo& info, bool& h
 	uptr offset = info.addr - (uptr)eeMem->Main;
 	if( offset >= Ps2MemSize::MainRam ) return;
 
+	int rampage = offset >> 12;
+
+	if( m_PageWriteTracked[rampage] )
+	{
+		m_PageWriteTracked[rampage] = false;
+		m_WriteTracker->OnFirstWrite( rampage, &eeMem->Main[rampage<<12] );
+
+		// Pages that weren't protected for block tracking only need write access restored.
+		if( m_PageProtectInfo[rampage].Mode != ProtMode_Write )
+		{
+			HostSys::MemProtect( &eeMem->Main[rampage<<12], __pagesize, PageAccess_ReadWrite() );
+			handled = true;
+			return;
+		}
+	}
+
 	mmap_ClearCpuBlock( offset );
 	handled = true;
 }
 
+// Write-protects all of EE main memory and reports the first write to each page to the
+// given tracker.  Re-arming resets every page, so pages already reported will be reported
+// again on their next write.  Only one tracker can be armed at a time; a previously armed
+// tracker is told its tracking was lost.
+void mmap_ArmWriteTracking( MainRamWriteTracker* tracker )
+{
+	pxAssert( eeMem && tracker );
+
+	if( m_WriteTracker && m_WriteTracker != tracker )
+	{
+		MainRamWriteTracker* previous = m_WriteTracker;
+		m_WriteTracker = NULL;
+		previous->OnTrackingLost();
+	}
+
+	m_WriteTracker = tracker;
+	memset( m_PageWriteTracked, true, sizeof(m_PageWriteTracked) );
+	HostSys::MemProtect( eeMem->Main, Ps2MemSize::MainRam, PageAccess_ReadOnly() );
+}
+
+// Stops write tracking if the given tracker is the armed one.  Pages not under block
+// tracking protection are restored to full access.
+void mmap_DisarmWriteTracking( MainRamWriteTracker* tracker )
+{
+	if( !m_WriteTracker || m_WriteTracker != tracker ) return;
+
+	m_WriteTracker = NULL;
+	if( eeMem ) for( uint rampage = 0; rampage < ArraySize(m_PageWriteTracked); ++rampage )
+	{
+		if( m_PageWriteTracked[rampage] && m_PageProtectInfo[rampage].Mode != ProtMode_Write )
+			HostSys::MemProtect( &eeMem->Main[rampage<<12], __pagesize, PageAccess_ReadWrite() );
+	}
+	memzero( m_PageWriteTracked );
+}
+
+// Write-protects all pages still pending their first write, in runs of adjacent pages.
+static void mmap_ProtectTrackedPages()
+{
+	const uint count = ArraySize(m_PageWriteTracked);
+
+	for( uint rampage = 0; rampage < count; )
+	{
+		if( !m_PageWriteTracked[rampage] ) { ++rampage; continue; }
+
+		uint end = rampage + 1;
+		while( end < count && m_PageWriteTracked[end] ) ++end;
+
+		HostSys::MemProtect( &eeMem->Main[rampage<<12], (end-rampage) << 12, PageAccess_ReadOnly() );
+		rampage = end;
+	}
+}
+
+// Ends write tracking because EE memory is being reset or released; the tracker is told
+// its log can no longer account for every write.
+static void mmap_DropWriteTracking()
+{
+	memzero( m_PageWriteTracked );
+
+	if( MainRamWriteTracker* tracker = m_WriteTracker )
+	{
+		m_WriteTracker = NULL;
+		tracker->OnTrackingLost();
+	}
+}
+
 // Clears all block tracking statuses, manual protection flags, and write protection.
 // This does not clear any recompiler blocks.  It is assumed (and necessary) for the caller
 // to ensure the EErec is also reset in conjunction with calling this function.
@@ -994,4 +1136,8 @@ void mmap_ResetBlockTracking()
 	//DbgCon.WriteLn( "vtlb/mmap: Block Tracking reset..." );
 	memzero( m_PageProtectInfo );
 	if (eeMem) HostSys::MemProtect( eeMem->Main, Ps2MemSize::MainRam, PageAccess_ReadWrite() );
+
+	// Write tracking outlives recompiler resets (including the one done by loading a state);
+	// pages that haven't been written yet must stay protected.
+	if (eeMem && m_WriteTracker) mmap_ProtectTrackedPages();
 }
@@ -125,9 +125,31 @@ enum vtlb_ProtectionMode
 };
 
 extern vtlb_ProtectionMode mmap_GetRamPageInfo( u32 paddr );
-extern void mmap_MarkCountedRamPage( u32 paddr );
+extern void mmap_MarkCountedRamPage( u32 paddr, u32 size );
 extern void mmap_ResetBlockTracking();
 
+// --------------------------------------------------------------------------------------
+//  MainRamWriteTracker
+// --------------------------------------------------------------------------------------
+// Receives EE main memory pages on their first write after mmap_ArmWriteTracking().  Used
+// by delta savestates to keep an undo log of main memory instead of copying all 32 megs.
+// Callbacks are issued from the page fault handler, in the context of the faulting thread.
+class MainRamWriteTracker
+{
+public:
+	virtual ~MainRamWriteTracker() = default;
+
+	// Called with the contents of the page as they were prior to the faulting write.
+	virtual void OnFirstWrite( uint rampage, const u8* contents )=0;
+
+	// Called when tracking had to be dropped (EE memory reset or released, or another tracker
+	// was armed); any page may have been written since without notice.
+	virtual void OnTrackingLost()=0;
+};
+
+extern void mmap_ArmWriteTracking( MainRamWriteTracker* tracker );
+extern void mmap_DisarmWriteTracking( MainRamWriteTracker* tracker );
+
 #define memRead8 vtlb_memRead<mem8_t>
 #define memRead16 vtlb_memRead<mem16_t>
 #define memRead32 vtlb_memRead<mem32_t>
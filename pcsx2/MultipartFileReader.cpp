@@ -241,3 +241,26 @@ void MultipartFileReader::SetBlockSize(uint bytes)
 	}
 }
 
+const u8* MultipartFileReader::GetBlockPointer(uint sector, uint count)
+{
+	// Sectors can only be handed out in place if they are all in one part
+	uint i = GetFirstPart(sector);
+	if (sector + count > m_parts[i].end)
+		return NULL;
+
+	return m_parts[i].reader->GetBlockPointer(sector - m_parts[i].start, count);
+}
+
+void MultipartFileReader::AdviseRead(uint sector, uint count, bool sequential)
+{
+	for(uint i = GetFirstPart(sector); i < m_numparts && count > 0; i++)
+	{
+		uint num = std::min(count, m_parts[i].end - sector);
+
+		m_parts[i].reader->AdviseRead(sector - m_parts[i].start, num, sequential);
+
+		sector += num;
+		count -= num;
+	}
+}
+
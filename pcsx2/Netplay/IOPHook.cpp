@@ -180,4 +180,36 @@ void UnhookIOP()
 	g_log.close();
 #endif
 	g_active = false;
-}
\ No newline at end of file
+}
+
+void VsyncIOPHook()
+{
+	if (g_IOPHook)
+		g_IOPHook->Vsync();
+}
+
+IOPHookState GetIOPHookState()
+{
+	IOPHookState state;
+	state.currentCommand = g_currentCommand;
+	state.pollPort = g_pollPort;
+	state.pollSlot[0] = g_pollSlot[0];
+	state.pollSlot[1] = g_pollSlot[1];
+	state.pollIndex = g_pollIndex;
+	state.hookFrameNum = g_hookFrameNum;
+	state.sendPad = g_sendPad;
+	memcpy(state.vibrationRemap, g_vibrationRemap, sizeof(g_vibrationRemap));
+	return state;
+}
+
+void SetIOPHookState(const IOPHookState& state)
+{
+	g_currentCommand = state.currentCommand;
+	g_pollPort = state.pollPort;
+	g_pollSlot[0] = state.pollSlot[0];
+	g_pollSlot[1] = state.pollSlot[1];
+	g_pollIndex = state.pollIndex;
+	g_hookFrameNum = state.hookFrameNum;
+	g_sendPad = state.sendPad;
+	memcpy(g_vibrationRemap, state.vibrationRemap, sizeof(g_vibrationRemap));
+}
@@ -9,6 +9,20 @@ public:
 	virtual void NextFrame() = 0;
 	virtual void AcceptInput(int side) = 0;
 	virtual int RemapVibrate(int pad) = 0;
+	virtual void Vsync() = 0;
+};
+
+// Pad polling position, which lives outside of the VM savestate.
+// Rollback has to restore it alongside the state it reloads.
+struct IOPHookState
+{
+	int currentCommand;
+	int pollPort;
+	int pollSlot[2];
+	int pollIndex;
+	int hookFrameNum;
+	int sendPad;
+	u8 vibrationRemap[8][2];
 };
 
 u8 CALLBACK NETPADstartPoll(int port);
@@ -16,4 +30,8 @@ u8 CALLBACK NETPADpoll(u8 value);
 s32 CALLBACK NETPADsetSlot(u8 port, u8 slot);
 
 void HookIOP(IOPHook* hook);
-void UnhookIOP();
\ No newline at end of file
+void UnhookIOP();
+void VsyncIOPHook();
+
+IOPHookState GetIOPHookState();
+void SetIOPHookState(const IOPHookState& state);
\ No newline at end of file
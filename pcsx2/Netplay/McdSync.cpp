@@ -0,0 +1,238 @@
+#include "PrecompiledHeader.h"
+#include "McdSync.h"
+#include "zlib\zlib.h"
+
+namespace McdSync
+{
+	u64 Hash(const u8* data, size_t size)
+	{
+		uLong crc = crc32(0L, data, size);
+		uLong adler = adler32(1L, data, size);
+		return ((u64)crc << 32) | (u32)adler;
+	}
+
+	hash_list HashBlocks(const block_type& mcd)
+	{
+		hash_list hashes(mcd.size() / BlockSize);
+		for(size_t i = 0; i < hashes.size(); i++)
+			hashes[i] = Hash(mcd.data() + i * BlockSize, BlockSize);
+		return hashes;
+	}
+
+	StreamWriter::StreamWriter(size_t chunk_size, const chunk_handler& handler)
+		: _chunk_size(chunk_size), _handler(handler)
+	{
+		_chunk.reserve(chunk_size);
+	}
+
+	void StreamWriter::Write(const void* data, size_t size)
+	{
+		const char* p = (const char*)data;
+		while(size)
+		{
+			size_t n = std::min(size, _chunk_size - _chunk.size());
+			_chunk.insert(_chunk.end(), p, p + n);
+			p += n;
+			size -= n;
+			if(_chunk.size() == _chunk_size)
+				Flush();
+		}
+	}
+
+	void StreamWriter::Flush()
+	{
+		if(_chunk.empty())
+			return;
+		_handler(_chunk.data(), _chunk.size());
+		_chunk.clear();
+	}
+
+	BlockCompressor::BlockCompressor(const block_type& mcd, const std::vector<u32>& blocks)
+		: _mcd(mcd), _blocks(blocks), _compressed(blocks.size()), _raw(blocks.size()), _ready(blocks.size()), _next(0)
+	{
+		size_t count = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), 4);
+		count = std::min(count, blocks.size());
+		for(size_t i = 0; i < count; i++)
+			_workers.emplace_back(&BlockCompressor::Worker, this);
+	}
+
+	BlockCompressor::~BlockCompressor()
+	{
+		// let the workers run out of blocks
+		_next = _blocks.size();
+		for(auto& worker : _workers)
+			worker.join();
+	}
+
+	void BlockCompressor::Worker()
+	{
+		while(true)
+		{
+			size_t i = _next++;
+			if(i >= _blocks.size())
+				return;
+
+			const u8* src = _mcd.data() + _blocks[i] * BlockSize;
+			block_type block(src, src + BlockSize);
+			block_type& compressed = _compressed[i];
+			bool raw = !Utilities::Compress(block, compressed) || compressed.size() >= BlockSize;
+			if(raw)
+				compressed.swap(block);
+
+			std::lock_guard<std::mutex> lock(_mutex);
+			_raw[i] = raw;
+			_ready[i] = true;
+			_cond.notify_all();
+		}
+	}
+
+	const block_type& BlockCompressor::Get(size_t i, bool& raw)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_cond.wait(lock, [&]() { return _ready[i] != 0; });
+		raw = _raw[i] != 0;
+		return _compressed[i];
+	}
+
+	BlockReceiver::BlockReceiver(block_type& mcd)
+		: _mcd(mcd), _complete(false), _changed(0)
+	{
+	}
+
+	void BlockReceiver::Feed(const char* data, size_t size)
+	{
+		if(_complete)
+			throw std::exception("data after the end of the memory card stream");
+		_pending.insert(_pending.end(), data, data + size);
+
+		size_t pos = 0;
+		while(_pending.size() - pos >= 8)
+		{
+			u32 block, length;
+			memcpy(&block, &_pending[pos], 4);
+			memcpy(&length, &_pending[pos + 4], 4);
+
+			if(block == EndOfStream)
+			{
+				if(_pending.size() - pos < 16)
+					break;
+				u64 hash;
+				memcpy(&hash, &_pending[pos + 8], 8);
+				if(length != _mcd.size() / BlockSize || hash != Hash(_mcd.data(), _mcd.size()))
+					throw std::exception("memory card differs from the host's after synchronization");
+				_complete = true;
+				pos += 16;
+				break;
+			}
+
+			bool raw = (length & RawBlock) != 0;
+			length &= ~RawBlock;
+			if(block >= _mcd.size() / BlockSize || length > BlockSize)
+				throw std::exception("invalid memory card block");
+			if(_pending.size() - pos - 8 < length)
+				break;
+
+			u8* dest = _mcd.data() + block * BlockSize;
+			const u8* src = &_pending[pos + 8];
+			if(raw)
+			{
+				if(length != BlockSize)
+					throw std::exception("invalid memory card block");
+				std::copy(src, src + length, dest);
+			}
+			else
+			{
+				block_type compressed(src, src + length);
+				block_type uncompressed(BlockSize);
+				if(!Utilities::Uncompress(compressed, uncompressed) || uncompressed.size() != BlockSize)
+					throw std::exception("unable to decompress memory card block");
+				std::copy(uncompressed.begin(), uncompressed.end(), dest);
+			}
+			_changed++;
+			pos += 8 + length;
+		}
+		_pending.erase(_pending.begin(), _pending.begin() + pos);
+	}
+
+	void WriteCard(const block_type& mcd, StreamWriter& writer)
+	{
+		std::vector<u32> blocks(mcd.size() / BlockSize);
+		for(u32 i = 0; i < blocks.size(); i++)
+			blocks[i] = i;
+
+		writer.Write((u32)blocks.size());
+		BlockCompressor compressor(mcd, blocks);
+		for(size_t i = 0; i < blocks.size(); i++)
+		{
+			bool raw;
+			auto& compressed = compressor.Get(i, raw);
+			writer.Write(blocks[i]);
+			writer.Write((u32)compressed.size() | (raw ? RawBlock : 0));
+			writer.Write(compressed.data(), compressed.size());
+		}
+		writer.Write(EndOfStream);
+		writer.Write((u32)blocks.size());
+		writer.Write(Hash(mcd.data(), mcd.size()));
+		writer.Flush();
+	}
+
+	CardReceiver::CardReceiver()
+	{
+	}
+
+	void CardReceiver::Feed(const char* data, size_t size)
+	{
+		if(_receiver)
+		{
+			_receiver->Feed(data, size);
+			return;
+		}
+
+		_pending.insert(_pending.end(), data, data + size);
+		if(_pending.size() < 4)
+			return;
+		u32 count;
+		memcpy(&count, &_pending[0], 4);
+		if(count > (1 << 16))
+			throw std::exception("invalid memory card size");
+		_mcd.assign(count * BlockSize, 0);
+		_receiver.reset(new BlockReceiver(_mcd));
+		if(_pending.size() > 4)
+			_receiver->Feed(&_pending[4], _pending.size() - 4);
+		_pending.clear();
+	}
+
+	HashReceiver::HashReceiver()
+		: _has_count(false), _count(0)
+	{
+	}
+
+	void HashReceiver::Feed(const char* data, size_t size)
+	{
+		_pending.insert(_pending.end(), data, data + size);
+
+		size_t pos = 0;
+		if(!_has_count && _pending.size() >= 4)
+		{
+			memcpy(&_count, &_pending[0], 4);
+			if(_count > (1 << 20))
+				throw std::exception("invalid memory card hash list");
+			_has_count = true;
+			_hashes.reserve(_count);
+			pos = 4;
+		}
+		while(_has_count && _hashes.size() < _count && _pending.size() - pos >= 8)
+		{
+			u64 hash;
+			memcpy(&hash, &_pending[pos], 8);
+			_hashes.push_back(hash);
+			pos += 8;
+		}
+		_pending.erase(_pending.begin(), _pending.begin() + pos);
+	}
+
+	bool HashReceiver::IsComplete() const
+	{
+		return _has_count && _hashes.size() == _count;
+	}
+}
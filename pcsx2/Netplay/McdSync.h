@@ -0,0 +1,125 @@
+#pragma once
+#include "App.h"
+#include "Utilities.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Memory card sync by erase block. The client sends the host a hash of every
+// erase block of its card, the host answers with only the blocks that differ,
+// each compressed on its own, followed by a hash of the whole card to check
+// the result against. Both directions are byte streams cut into Data messages.
+//
+// Host -> client stream: records of [u32 block][u32 length][length bytes],
+// the length has RawBlock set if the block is stored uncompressed. The stream
+// ends with [EndOfStream][u32 block count][u64 card hash].
+// Client -> host stream: [u32 block count][u64 hash per block].
+// Host -> observer stream: [u32 block count] followed by the host -> client
+// stream carrying every block, as observers have no card to start from.
+namespace McdSync
+{
+	typedef Utilities::block_type block_type;
+	typedef std::vector<u64> hash_list;
+
+	static const size_t BlockSize = 528 * 16;
+	static const u32 RawBlock = 0x80000000;
+	static const u32 EndOfStream = 0xFFFFFFFF;
+
+	u64 Hash(const u8* data, size_t size);
+	hash_list HashBlocks(const block_type& mcd);
+
+	// Cuts a byte stream into chunks of at most chunk_size bytes.
+	class StreamWriter
+	{
+	public:
+		typedef std::function<void(const char*, size_t)> chunk_handler;
+
+		StreamWriter(size_t chunk_size, const chunk_handler& handler);
+		void Write(const void* data, size_t size);
+		template<typename T> void Write(const T& value) { Write(&value, sizeof(value)); }
+		void Flush();
+	protected:
+		size_t _chunk_size;
+		chunk_handler _handler;
+		std::vector<char> _chunk;
+	};
+
+	// Compresses the listed blocks of a card on worker threads. Blocks are
+	// handed out in list order as soon as they are ready, so the caller can
+	// send the first ones while the rest are still being compressed.
+	class BlockCompressor
+	{
+	public:
+		BlockCompressor(const block_type& mcd, const std::vector<u32>& blocks);
+		~BlockCompressor();
+
+		// Waits for the i-th listed block. raw is set if it didn't compress.
+		const block_type& Get(size_t i, bool& raw);
+	protected:
+		void Worker();
+
+		const block_type& _mcd;
+		std::vector<u32> _blocks;
+		std::vector<block_type> _compressed;
+		std::vector<char> _raw;
+		std::vector<char> _ready;
+		std::atomic<size_t> _next;
+		std::mutex _mutex;
+		std::condition_variable _cond;
+		std::vector<std::thread> _workers;
+	};
+
+	// Rebuilds the host's card from its record stream on top of the local card.
+	class BlockReceiver
+	{
+	public:
+		BlockReceiver(block_type& mcd);
+
+		// Feeds the next chunk of the stream. Throws on a malformed stream.
+		void Feed(const char* data, size_t size);
+		bool IsComplete() const { return _complete; }
+		// Number of blocks replaced.
+		size_t Changed() const { return _changed; }
+	protected:
+		block_type& _mcd;
+		std::vector<u8> _pending;
+		bool _complete;
+		size_t _changed;
+	};
+
+	// Writes the whole card as an observer stream.
+	void WriteCard(const block_type& mcd, StreamWriter& writer);
+
+	// Reads an observer stream.
+	class CardReceiver
+	{
+	public:
+		CardReceiver();
+		void Feed(const char* data, size_t size);
+		bool IsComplete() const { return _receiver && _receiver->IsComplete(); }
+		const block_type& Card() const { return _mcd; }
+	protected:
+		std::vector<char> _pending;
+		block_type _mcd;
+		std::unique_ptr<BlockReceiver> _receiver;
+	};
+
+	// Reads a client's hash stream.
+	class HashReceiver
+	{
+	public:
+		HashReceiver();
+		void Feed(const char* data, size_t size);
+		bool IsComplete() const;
+		const hash_list& Hashes() const { return _hashes; }
+	protected:
+		std::vector<u8> _pending;
+		bool _has_count;
+		u32 _count;
+		hash_list _hashes;
+	};
+}
@@ -22,3 +22,30 @@ void Message::deserialize(shoryu::iarchive& a)
 {
 	a.read(input, NETPLAY_SYNC_NUM_INPUTS);
 }
+void Message::serialize_delta(shoryu::oarchive& a, const Message& base) const
+{
+	uint8_t mask = 0;
+	for(int i = 0; i < NETPLAY_SYNC_NUM_INPUTS; i++)
+		if(input[i] != base.input[i])
+			mask |= 1 << i;
+	a << mask;
+	for(int i = 0; i < NETPLAY_SYNC_NUM_INPUTS; i++)
+		if(mask & (1 << i))
+			a.write((char*)&input[i], 1);
+}
+void Message::deserialize_delta(shoryu::iarchive& a, const Message& base)
+{
+	uint8_t mask;
+	a >> mask;
+	for(int i = 0; i < NETPLAY_SYNC_NUM_INPUTS; i++)
+	{
+		if(mask & (1 << i))
+			a.read(&input[i], 1);
+		else
+			input[i] = base.input[i];
+	}
+}
+bool Message::operator==(const Message& other) const
+{
+	return std::equal(input, input + NETPLAY_SYNC_NUM_INPUTS, other.input);
+}
@@ -9,4 +9,11 @@ struct Message
 	char input[6];
 	void serialize(shoryu::oarchive& a) const;
 	void deserialize(shoryu::iarchive& a);
+
+	// Writes a change mask followed by the input bytes that differ from base.
+	void serialize_delta(shoryu::oarchive& a, const Message& base) const;
+	void deserialize_delta(shoryu::iarchive& a, const Message& base);
+
+	bool operator==(const Message& other) const;
+	bool operator!=(const Message& other) const { return !(*this == other); }
 };
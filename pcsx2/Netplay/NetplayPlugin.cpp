@@ -9,10 +9,18 @@
 #include "Netplay/INetplayDialog.h"
 
 #include "shoryu/session.h"
+#include "shoryu/relay.h"
 #include "Message.h"
 #include "Replay.h"
 #include "NetplaySettings.h"
 #include "Utilities.h"
+#include "Rollback.h"
+#include "Telemetry.h"
+#include "McdSync.h"
+#include "StateChecksum.h"
+#include "GS.h"
+#include "Counters.h"
+#include "ConsoleLogger.h"
 
 
 //#define CONNECTION_TEST
@@ -20,18 +28,22 @@
 class NetplayPlugin : public INetplayPlugin
 {
 	typedef shoryu::session<Message, EmulatorSyncState> session_type;
+	typedef shoryu::relay<Message, EmulatorSyncState> relay_type;
 	std::shared_ptr<session_type> _session;
+	// observers can pass the session on to spectators
+	std::unique_ptr<relay_type> _relay;
 	std::shared_ptr<std::thread> _connect_thread;
 
 public:
 	NetplayPlugin()
-		: _is_initialized(false), _is_stopped(false), _dialog(nullptr)
+		: _is_initialized(false), _is_stopped(false), _dialog(nullptr), _resimulate_until(-1), _confirmed_frame(0), _next_keyframe(0), _has_overlay(false)
 	{
 	}
 
 	void HandleUsernames(const std::vector<userinfo> &usernames)
 	{
         int num_players = _session->num_players();
+		_usernames = usernames;
 		if (_dialog)
 			_dialog->SetUserlist(usernames, num_players);
 	}
@@ -65,7 +77,7 @@ public:
 		}
 
 		// FIXME: change to assert, UI shouldn't allow this
-		if( settings.Mode == ConnectMode && settings.HostAddress.Len() == 0 )
+		if( (settings.Mode == ConnectMode || settings.Mode == ObserveMode) && settings.HostAddress.Len() == 0 )
 		{
 			Stop();
 			ConsoleErrorMT(wxT("NETPLAY: Invalid hostname."));
@@ -84,6 +96,16 @@ public:
 		_session.reset(new session_type());
 		_session->userlist_handler([&](const std::vector<userinfo> &usernames) {HandleUsernames(usernames); });
 		_session->set_chatmessage_handler([&](const std::string &username, const std::string &message) {HandleChatMessage(username, message); });
+
+		// keep enough inputs and snapshots to re-simulate a full rollback window;
+		// observers only ever get confirmed inputs
+		if(settings.Rollback && settings.Mode != ObserveMode)
+		{
+			_session->history(settings.RollbackFrames + 2);
+			_rollback.reset(new RollbackBuffer(settings.RollbackFrames + 2));
+		}
+		else
+			_rollback.reset();
 #ifdef CONNECTION_TEST
 		_session->send_delay_min(40);
 		_session->send_delay_max(80);
@@ -108,7 +130,7 @@ public:
 			std::function<bool()> connection_func;
 
 			if(settings.Mode == ConnectMode || settings.Mode == ObserveMode)
-				connection_func = [this, settings]() { return Join(settings.HostAddress, settings.HostPort, 0); };
+				connection_func = [this, settings]() { return Join(settings.HostAddress, settings.HostPort, 0, settings.Mode == ObserveMode); };
 			else
 				connection_func = [this]() { return Host(); };
 
@@ -128,7 +150,8 @@ public:
 		{
 			lock.unlock();
 			Stop();
-			ConsoleErrorMT(wxString::Format(wxT("NETPLAY: Unable to bind port %u."), localPort));
+			ConsoleErrorMT(wxString::Format(wxT("NETPLAY: Unable to bind port %u: "), localPort) +
+				wxString(zed_net_get_error(), wxConvLocal) + wxT("."));
 		}
 	}
 
@@ -151,6 +174,23 @@ public:
 		EndSession();
 		Utilities::RestoreSettings();
 
+		if(_rollback)
+		{
+			gsForceFrameSkip(false);
+			frameLimitBypass(false);
+			_resimulate_until = -1;
+			_rollback.reset();
+		}
+
+		if(_telemetry)
+		{
+			if(g_Conf->Netplay.ShowStats)
+				ConsoleInfoMT(_telemetry->Summary());
+			_telemetry.reset();
+			std::lock_guard<std::mutex> lock(_overlay_mutex);
+			_has_overlay = false;
+		}
+
 		if(_mcd_backup.size())
 		{
 			Utilities::WriteMCD(0,0,_mcd_backup);
@@ -159,33 +199,16 @@ public:
 
 		if(_replay)
 		{
-			if(_state == SSRunning)
+			try
 			{
-				try
-				{
-					wxDirName dir = (wxDirName)wxFileName(wxStandardPaths::Get().GetExecutablePath()).GetPath();
-					dir = dir.Combine(wxDirName("replays"));
-					wxString replayName = _game_name + wxT(".rep");
-					replayName.Replace(wxT("<"),wxT("-"));
-					replayName.Replace(wxT(">"),wxT("-"));
-					replayName.Replace(wxT(":"),wxT("-"));
-					replayName.Replace(wxT("\""),wxT("-"));
-					replayName.Replace(wxT("/"),wxT("-"));
-					replayName.Replace(wxT("\\"),wxT("-"));
-					replayName.Replace(wxT("|"),wxT("-"));
-					replayName.Replace(wxT("?"),wxT("-"));
-					replayName.Replace(wxT("*"),wxT("-"));
-					wxString file = ( dir + replayName ).GetFullPath();
-					ConsoleInfoMT(wxT("Saving replay to ") + file);
-					_replay->SaveToFile(file);
-				}
-				catch(std::exception& e)
-				{
-					Stop();
-					ConsoleErrorMT(wxT("REPLAY: ") + wxString(e.what(), wxConvLocal));
-				}
+				_replay->EndRecording();
+			}
+			catch(std::exception& e)
+			{
+				ConsoleErrorMT(wxT("REPLAY: ") + wxString(e.what(), wxConvLocal));
 			}
 			_replay.reset();
+			_pending_keyframe = Replay::PendingKeyframe();
 		}
 
 		Utilities::ExecuteOnMainThread([&]() {
@@ -193,6 +216,35 @@ public:
 		});
 	}
 
+	// replays are streamed to the disk from the first frame, so that a crash loses little
+	void BeginReplay()
+	{
+		try
+		{
+			wxDirName dir = (wxDirName)wxFileName(wxStandardPaths::Get().GetExecutablePath()).GetPath();
+			dir = dir.Combine(wxDirName("replays"));
+			wxString replayName = _game_name + wxT(".rep");
+			replayName.Replace(wxT("<"),wxT("-"));
+			replayName.Replace(wxT(">"),wxT("-"));
+			replayName.Replace(wxT(":"),wxT("-"));
+			replayName.Replace(wxT("\""),wxT("-"));
+			replayName.Replace(wxT("/"),wxT("-"));
+			replayName.Replace(wxT("\\"),wxT("-"));
+			replayName.Replace(wxT("|"),wxT("-"));
+			replayName.Replace(wxT("?"),wxT("-"));
+			replayName.Replace(wxT("*"),wxT("-"));
+			wxString file = ( dir + replayName ).GetFullPath();
+			ConsoleInfoMT(wxT("Saving replay to ") + file);
+			_replay->BeginRecording(file, g_Conf->Netplay.ReplayKeyframeInterval * 60);
+			_next_keyframe = 0;
+		}
+		catch(std::exception& e)
+		{
+			ConsoleErrorMT(wxT("REPLAY: ") + wxString(e.what(), wxConvLocal));
+			_replay.reset();
+		}
+	}
+
 	void ConsoleInfoMT(const wxString& message)
 	{
 		Utilities::ExecuteOnMainThread([&]() {
@@ -214,97 +266,207 @@ public:
 		});
 	}
 
+	// Waits for the next Data message of a side, keeping the session sending meanwhile.
+	// Returns false if the session ended or timed out.
+	bool mcd_receive(int side, shoryu::message_data& data, shoryu::msec timeout_timestamp)
+	{
+		while (true) {
+			{
+				recursive_lock lock(_mutex);
+				if (!_session || _session->state() != shoryu::MessageType::Ready || _session->end_session_request())
+					return false;
+				_session->send();
+				if (_session->get_data(side, data, 50))
+					return true;
+			}
+			if (timeout_timestamp < shoryu::time_ms()) {
+				ConsoleErrorMT(wxT("NETPLAY: Timeout while synchronizing memory cards."));
+				return false;
+			}
+		}
+	}
+
+	McdSync::StreamWriter::chunk_handler mcd_sender(int side)
+	{
+		return [this, side](const char* p, size_t size) {
+			shoryu::message_data data;
+			data.data_length = size;
+			std::copy(p, p + size, data.p);
+			recursive_lock lock(_mutex);
+			if (_session && _session->state() == shoryu::MessageType::Ready) {
+				_session->queue_data(side, data);
+				_session->send();
+			}
+		};
+	}
+
 	bool mcd_sync(const wxString &caller)
-    {
-        if (caller == "host") {
-
-            _dialog->SetStatus(wxT("Waiting for memory card synchronization..."));
-
-            auto uncompressed_mcd = Utilities::ReadMCD(0, 0);
-            if (_replay)
-                _replay->Data(uncompressed_mcd);
-            size_t mcd_size = Utilities::GetMCDSize(0, 0);
-            Utilities::block_type compressed_mcd(mcd_size);
-            if (g_Conf->Netplay.ReadonlyMemcard)
-                _mcd_backup = uncompressed_mcd;
-            if (!Utilities::Compress(uncompressed_mcd, compressed_mcd)) {
-                ConsoleErrorMT(wxT("NETPLAY: Unable to compress MCD buffer."));
-                return false;
-            }
+	{
+		shoryu::msec timeout_timestamp = shoryu::time_ms() + 480000;
+		try
+		{
+			if (caller == "host") {
+
+				_dialog->SetStatus(wxT("Waiting for memory card synchronization..."));
+
+				auto mcd = Utilities::ReadMCD(0, 0);
+				if (_replay)
+					_replay->Data(mcd);
+				if (g_Conf->Netplay.ReadonlyMemcard)
+					_mcd_backup = mcd;
+				auto hashes = McdSync::HashBlocks(mcd);
+
+				// collect the block hashes of every client
+				int num_players = _session->num_players();
+				std::vector<McdSync::HashReceiver> remote(num_players);
+				for (int side = 1; side < num_players; side++) {
+					while (!remote[side].IsComplete()) {
+						shoryu::message_data data;
+						if (!mcd_receive(side, data, timeout_timestamp))
+							return false;
+						remote[side].Feed(data.p, data.data_length);
+					}
+				}
 
-            {
-                recursive_lock lock(_mutex);
-                if (!_session || _session->state() != shoryu::MessageType::Ready)
-                    return false;
-                size_t blockSize = 128;
-                for (size_t i = 0; i < compressed_mcd.size(); i += blockSize) {
-                    shoryu::message_data data;
-                    data.data_length = compressed_mcd.size() - i;
-                    if (data.data_length > blockSize)
-                        data.data_length = blockSize;
-                    data.p.reset(new char[data.data_length]);
-                    std::copy(compressed_mcd.data() + i, compressed_mcd.data() + i + data.data_length, data.p.get());
-                    _session->queue_data(data);
-                }
-                shoryu::message_data data;
-                data.data_length = 9;
-                data.p.reset(new char[data.data_length]);
-                char *blockEndMsg = "BLOCK_END";
-                std::copy(blockEndMsg, blockEndMsg + data.data_length, data.p.get());
-                _session->queue_data(data);
-            }
-        } else {
-            _dialog->SetStatus(wxT("Synchronizing memory card with the host..."));
-
-            _mcd_backup = Utilities::ReadMCD(0, 0);
-
-            shoryu::msec timeout_timestamp = shoryu::time_ms() + 480000;
-            size_t mcd_size = Utilities::GetMCDSize(0, 0);
-            Utilities::block_type compressed_mcd(mcd_size);
-            size_t pos = 0;
-            while (true) {
-                bool ready;
-                shoryu::message_data data;
-                {
-                    recursive_lock lock(_mutex);
-                    if (!_session || _session->end_session_request())
-                        return false;
-                    _session->send();
-                    ready = _session->get_data(0, data, 50);
-                }
-                if (!ready) {
-                    if (timeout_timestamp < shoryu::time_ms()) {
-                        ConsoleErrorMT(wxT("NETPLAY: Timeout while synchronizing memory cards."));
-                        return false;
-                    }
-                } else {
-                    if (data.data_length != 9 || memcmp(data.p.get(), "BLOCK_END", 9) != 0) {
-                        std::copy(data.p.get(), data.p.get() + data.data_length, compressed_mcd.data() + pos);
-                        pos += data.data_length;
-                    } else {
-                        compressed_mcd.resize(pos);
-                        Utilities::block_type uncompressed_mcd(mcd_size);
-
-                        if (!Utilities::Uncompress(compressed_mcd, uncompressed_mcd)) {
-                            ConsoleErrorMT(wxT("NETPLAY: Unable to decompress MCD buffer."));
-                            return false;
-                        }
-                        if (uncompressed_mcd.size() != mcd_size) {
-                            ConsoleErrorMT(wxT("NETPLAY: Invalid MCD received from host."));
-                            return false;
-                        }
-                        Utilities::WriteMCD(0, 0, uncompressed_mcd);
-                        if (_replay)
-                            _replay->Data(uncompressed_mcd);
-                        break;
-                    }
-                }
-            }
-        }
-        return true;
-    }
+				// blocks any client is missing, each compressed once for all of them
+				std::vector<std::vector<char>> needs(hashes.size(), std::vector<char>(num_players));
+				std::vector<u32> blocks;
+				for (u32 block = 0; block < hashes.size(); block++) {
+					bool needed = false;
+					for (int side = 1; side < num_players; side++) {
+						auto& theirs = remote[side].Hashes();
+						if (theirs.size() != hashes.size() || theirs[block] != hashes[block]) {
+							needs[block][side] = true;
+							needed = true;
+						}
+					}
+					if (needed)
+						blocks.push_back(block);
+				}
+				ConsoleInfoMT(wxString::Format(wxT("NETPLAY: Sending %u of %u memory card blocks."), (uint)blocks.size(), (uint)hashes.size()));
+
+				std::vector<McdSync::StreamWriter> writers;
+				for (int side = 0; side < num_players; side++)
+					writers.emplace_back(shoryu::message_data::max_length, mcd_sender(side));
+
+				// blocks go out as soon as they're compressed
+				McdSync::BlockCompressor compressor(mcd, blocks);
+				for (size_t i = 0; i < blocks.size(); i++) {
+					bool raw;
+					auto& compressed = compressor.Get(i, raw);
+					u32 length = compressed.size() | (raw ? McdSync::RawBlock : 0);
+					for (int side = 1; side < num_players; side++) {
+						if (!needs[blocks[i]][side])
+							continue;
+						writers[side].Write(blocks[i]);
+						writers[side].Write(length);
+						writers[side].Write(compressed.data(), compressed.size());
+					}
+				}
+
+				u32 count = hashes.size();
+				u64 hash = McdSync::Hash(mcd.data(), mcd.size());
+				for (int side = 1; side < num_players; side++) {
+					writers[side].Write(McdSync::EndOfStream);
+					writers[side].Write(count);
+					writers[side].Write(hash);
+					writers[side].Flush();
+				}
+			} else {
+				_dialog->SetStatus(wxT("Synchronizing memory card with the host..."));
+
+				_mcd_backup = Utilities::ReadMCD(0, 0);
+				auto mcd = _mcd_backup;
+
+				// tell the host what we have
+				auto hashes = McdSync::HashBlocks(mcd);
+				McdSync::StreamWriter writer(shoryu::message_data::max_length, mcd_sender(0));
+				writer.Write((u32)hashes.size());
+				writer.Write(hashes.data(), hashes.size() * sizeof(u64));
+				writer.Flush();
+
+				McdSync::BlockReceiver receiver(mcd);
+				while (!receiver.IsComplete()) {
+					shoryu::message_data data;
+					if (!mcd_receive(0, data, timeout_timestamp))
+						return false;
+					receiver.Feed(data.p, data.data_length);
+				}
+
+				if (receiver.Changed())
+					Utilities::WriteMCD(0, 0, mcd);
+				if (_replay)
+					_replay->Data(mcd);
+			}
+		}
+		catch (std::exception& e)
+		{
+			ConsoleErrorMT(wxT("NETPLAY: Unable to synchronize memory cards: ") + wxString(e.what(), wxConvLocal));
+			return false;
+		}
+		return true;
+	}
+
+	// observers take the host's card as it is, and hand it on to the relay
+	bool mcd_observe()
+	{
+		_dialog->SetStatus(wxT("Receiving the host's memory card..."));
+		shoryu::msec timeout_timestamp = shoryu::time_ms() + 480000;
+		try
+		{
+			_mcd_backup = Utilities::ReadMCD(0, 0);
+			_session->observer_ready();
+
+			McdSync::CardReceiver receiver;
+			while (!receiver.IsComplete()) {
+				shoryu::message_data data;
+				if (!mcd_receive(0, data, timeout_timestamp))
+					return false;
+				receiver.Feed(data.p, data.data_length);
+				if (_relay)
+					_relay->add_data(data);
+			}
+
+			Utilities::WriteMCD(0, 0, receiver.Card());
+			if (_replay)
+				_replay->Data(receiver.Card());
+		}
+		catch (std::exception& e)
+		{
+			ConsoleErrorMT(wxT("NETPLAY: Unable to receive the host's memory card: ") + wxString(e.what(), wxConvLocal));
+			return false;
+		}
+		return true;
+	}
+
+	void mcd_send_observers()
+	{
+		ConsoleInfoMT(wxString::Format(wxT("NETPLAY: Sending the memory card to %u observer(s)."), (uint)_session->num_observers()));
+		auto mcd = Utilities::ReadMCD(0, 0);
+		McdSync::StreamWriter writer(shoryu::message_data::max_length, mcd_sender(0));
+		McdSync::WriteCard(mcd, writer);
+	}
+
+	// watches the session of the host and passes it on to spectators
+	void StartRelay(const EmulatorSyncState& state)
+	{
+		NetplaySettings& settings = g_Conf->Netplay;
+		_relay.reset(new relay_type());
+		if(!_relay->start(settings.RelayPort, state, settings.RelayDelay * 1000,
+			[&](const EmulatorSyncState& s1, const EmulatorSyncState& s2) -> bool
+			{return CheckSyncStates(s1, s2);}))
+		{
+			_relay.reset();
+			ConsoleErrorMT(wxString::Format(wxT("NETPLAY: Unable to relay the session on port %u: "), settings.RelayPort) +
+				wxString(zed_net_get_error(), wxConvLocal) + wxT("."));
+			return;
+		}
+		relay_type* relay = _relay.get();
+		_session->frame_handler([relay](int side, int64_t frame, const Message& f) { relay->push(side, frame, f); });
+		ConsoleInfoMT(wxString::Format(wxT("NETPLAY: Relaying the session on port %u with a delay of %u s."), settings.RelayPort, settings.RelayDelay));
+	}
 
-	bool Join(const wxString& ip, unsigned short port, int timeout)
+	bool Join(const wxString& ip, unsigned short port, int timeout, bool observe)
 	{
 		std::unique_lock<std::mutex> connection_lock(_connection_mutex);
 
@@ -322,7 +484,7 @@ public:
 
 			if(!_session || !_session->join(ep, *state,
 				[&](const EmulatorSyncState& s1, const EmulatorSyncState& s2) -> bool
-				{return CheckSyncStates(s1, s2);}, timeout))
+				{return CheckSyncStates(s1, s2);}, timeout, observe))
 				return false;
 
 			_game_name = wxDateTime::Now().Format(wxT("[%Y.%m.%d %H-%M] "))  + wxT("[") + Utilities::GetCurrentDiscName() + wxT("]");
@@ -342,8 +504,15 @@ public:
             if (delay <= 0)
                 return false;
 
+            if (observe && g_Conf->Netplay.RelayPort)
+                StartRelay(*state);
+
             // Start the mcd sync
-            if (_session->mcd_sync()) {
+            if (observe) {
+                if (!mcd_observe())
+                    return false;
+                _dialog->SetStatus(wxT("Received. Waiting for host..."));
+            } else if (_session->mcd_sync()) {
                 mcd_sync("client");
                 _dialog->SetStatus(wxT("Synchronized. Waiting for host..."));
             } else {
@@ -353,6 +522,9 @@ public:
             // Wait for the delay signal
             _session->wait_for_start(ep);
 
+            if (_relay)
+                _relay->begin(_session->num_players(), _session->delay(), _usernames);
+
             _dialog->SetStatus(wxT("Game started."));
             return true;
 		}
@@ -401,6 +573,11 @@ public:
             if (_session->mcd_sync())
                 mcd_sync("host");
 
+            // Observers get the whole card, whether the players sync theirs or not
+            _session->wait_for_observers(10000);
+            if (_session->num_observers())
+                mcd_send_observers();
+
 			// Start the mcd send loop
 			mcd_send_thread.reset(new std::thread(&NetplayPlugin::mcd_send_loop, this));
 
@@ -490,6 +667,13 @@ public:
 			_connect_thread.reset();
 		}
 
+		// give spectators the frames still held back; the ones further behind miss the end
+		if(_relay)
+		{
+			_relay->finish(std::min<uint>(g_Conf->Netplay.RelayDelay, 8) * 1000 + 2000);
+			_relay.reset();
+		}
+
 		_session.reset();
 	}
 
@@ -524,9 +708,317 @@ public:
 				_connect_thread.reset();
 			}
 			_state = SSRunning;
+
+			_predictions.assign(_session->num_players(), prediction_map());
+			_last_confirmed.assign(_session->num_players(), Message());
+			_resimulate_until = -1;
+			_confirmed_frame = 0;
+			_pending_checksums.clear();
+			_pending_keyframe = Replay::PendingKeyframe();
+			_delay_controller.reset();
+			_peer_blocked_ms.assign(_session->num_players(), 0);
+			OpenTelemetry();
+			if(_replay)
+				BeginReplay();
+		}
+
+		if(_state == SSRunning && _session->is_host() && g_Conf->Netplay.AdaptiveDelay)
+			AdaptDelay();
+
+		if(_state == SSRunning && _telemetry)
+			RecordTelemetry();
+	}
+
+	void OpenTelemetry()
+	{
+		NetplaySettings& settings = g_Conf->Netplay;
+		if(!settings.ShowStats && !settings.SaveStats)
+			return;
+
+		_telemetry.reset(new NetplayTelemetry());
+		if(settings.SaveStats)
+		{
+			wxString name = wxDateTime::Now().Format(wxT("netplay_%Y%m%d_%H%M%S.csv"));
+			wxString file = Path::Combine(GetLogFolder().ToString(), name);
+			if(_telemetry->OpenTimeline(file))
+				ConsoleInfoMT(wxT("NETPLAY: Writing stats timeline to ") + file);
+			else
+				ConsoleErrorMT(wxT("NETPLAY: Unable to open stats timeline ") + file);
 		}
 	}
 
+	void RecordTelemetry()
+	{
+		_stats.frame = _session->frame();
+		_stats.blocked_ms = _session->blocked_ms();
+		_stats.delay = _session->delay();
+		_stats.advantage = 0;
+		for(int side = 0; side < _session->num_players(); side++)
+			_stats.advantage = std::max<s64>(_stats.advantage, _session->frame_advantage(side));
+
+		// read in place under the transport's lock, the vector keeps its capacity between frames;
+		// sides are looked up afterwards as side_of takes the connection lock
+		_stats.peers.clear();
+		_session->for_each_peer([this](const session_type::peer_data_type& p)
+		{
+			NetplayPeerStats peer;
+			peer.ep = p.ep;
+			peer.rtt = p.rtt_avg;
+			peer.jitter = p.rtt_jitter;
+			peer.ack_latency = p.ack_latency;
+			peer.packets_sent = p.packets_sent;
+			peer.packets_received = p.packets_received;
+			peer.msgs_resent = p.msgs_resent;
+			peer.queue_depth = p.queue_depth;
+			_stats.peers.push_back(peer);
+		});
+		for(NetplayPeerStats& peer : _stats.peers)
+			peer.side = _session->side_of(peer.ep);
+
+		_telemetry->Record(_stats);
+		if(_telemetry->HasWindow())
+		{
+			std::lock_guard<std::mutex> lock(_overlay_mutex);
+			_overlay = _telemetry->Window();
+			_has_overlay = true;
+			_telemetry->ClearWindow();
+		}
+	}
+
+	void UpdateOverlay()
+	{
+		if(!g_Conf->Netplay.ShowStats)
+			return;
+
+		std::lock_guard<std::mutex> lock(_overlay_mutex);
+		if(!_has_overlay)
+			return;
+
+		OSDmonitor(Color_StrongGreen, "Delay:", std::to_string(_overlay.delay));
+		OSDmonitor(Color_StrongGreen, "Stall:", std::to_string(_overlay.blocked_ms) + " ms/s");
+		OSDmonitor(Color_StrongGreen, "Adv:", std::to_string(_overlay.advantage));
+		for(const NetplayPeerStats& p : _overlay.peers)
+		{
+			std::ostringstream out;
+			out << p.rtt << "+-" << p.jitter << " ms, ack " << p.ack_latency << " ms, "
+				<< p.msgs_resent << " resent/s, queue " << p.queue_depth;
+			std::string label = p.side < 0
+				? "Observer " + std::string(zed_net_host_to_str(p.ep.host)) + ":" + std::to_string(p.ep.port) + ":"
+				: "Player " + std::to_string(p.side + 1) + ":";
+			OSDmonitor(Color_StrongGreen, label, out.str());
+		}
+	}
+
+	// host only: moves the delay with the connection, switching a second ahead
+	// so that every player gets the change in time
+	void AdaptDelay()
+	{
+		if(!_delay_controller.next_frame())
+			return;
+
+		// a client stalling calls for more delay as much as the host does;
+		// the worst client of the window counts
+		int64_t peer_stall = 0;
+		for(int side = 0; side < _session->num_players(); side++)
+		{
+			if(side == _session->side())
+				continue;
+			uint64_t blocked = _session->blocked_ms(side);
+			peer_stall = std::max<int64_t>(peer_stall, blocked - _peer_blocked_ms[side]);
+			_peer_blocked_ms[side] = blocked;
+		}
+		_delay_controller.add_stall(peer_stall);
+
+		int delay = _session->delay();
+		int next = _delay_controller.update(delay, _session->padded_rtt());
+		if(next == delay)
+			return;
+
+		try
+		{
+			_session->schedule_delay(next, _session->frame() + 60);
+			ConsoleInfoMT(wxString::Format(wxT("NETPLAY: Input delay changes from %d to %d."), delay, next));
+		}
+		catch(std::exception& e)
+		{
+			Stop();
+			ConsoleErrorMT(wxT("NETPLAY: ") + wxString(e.what(), wxConvLocal));
+		}
+	}
+
+	// called at the start of every vsync, from the EE thread
+	void Vsync()
+	{
+		if(_is_stopped || !_session || _state != SSRunning) return;
+
+		auto frame = _session->frame();
+
+		if(!_rollback)
+		{
+			CheckState(frame);
+			SaveKeyframe(frame);
+			return;
+		}
+
+		if(_resimulate_until >= 0 && frame >= _resimulate_until)
+		{
+			_resimulate_until = -1;
+			gsForceFrameSkip(false);
+			frameLimitBypass(false);
+		}
+
+		// check predictions against the inputs that arrived since
+		int64_t mispredicted = -1;
+		for(size_t side = 0; side < _predictions.size(); side++)
+		{
+			auto& predicted = _predictions[side];
+			while(!predicted.empty())
+			{
+				auto it = predicted.begin();
+				Message confirmed;
+				if(!_session->try_get(side, confirmed, it->first))
+					break;
+				if(memcmp(confirmed.input, it->second.input, sizeof(confirmed.input)))
+				{
+					if(mispredicted < 0 || it->first < mispredicted)
+						mispredicted = it->first;
+				}
+				predicted.erase(it);
+			}
+		}
+
+		if(mispredicted >= 0)
+		{
+			// the snapshot must predate the poll of the mispredicted frame
+			int64_t snapshot_frame;
+			IOPHookState hook;
+			if(_rollback->Rewind(mispredicted - 1, snapshot_frame, hook))
+			{
+				for(auto& predicted : _predictions)
+					predicted.erase(predicted.upper_bound(snapshot_frame), predicted.end());
+				_pending_checksums.erase(_pending_checksums.upper_bound(snapshot_frame), _pending_checksums.end());
+				if(_pending_keyframe.state && _pending_keyframe.frame > (u64)snapshot_frame)
+					_pending_keyframe = Replay::PendingKeyframe();
+
+				// frames up to the current one have already been shown, run them silently
+				if(_resimulate_until < frame)
+					_resimulate_until = frame;
+				gsForceFrameSkip(true);
+				frameLimitBypass(true);
+
+				_session->frame(snapshot_frame);
+				SetIOPHookState(hook);
+				return;
+			}
+
+			// a game writing more memory than ever before can cost the snapshots;
+			// play on, the desync check tells if the misprediction mattered
+			if(!_rollback->Overflowed())
+			{
+				Stop();
+				ConsoleErrorMT(wxString::Format(wxT("NETPLAY: Frame %d was mispredicted outside of the rollback window."), (int)mispredicted));
+				return;
+			}
+			ConsoleWarningMT(wxString::Format(wxT("NETPLAY: Frame %d was mispredicted after its snapshot was dropped for lack of memory."), (int)mispredicted));
+		}
+
+		_rollback->Save(frame);
+
+		// checksums and keyframes must not depend on predicted inputs: they're taken now
+		// and handed on once every input up to their frame is confirmed
+		uint interval = g_Conf->Netplay.DesyncCheckInterval;
+		if(interval && frame % interval == 0 && frame >= _confirmed_frame)
+			_pending_checksums[frame] = StateChecksum::Compute(frame, (uint)(frame / interval));
+		if(!_pending_keyframe.state && KeyframeDue(frame))
+			_pending_keyframe = _replay->CaptureKeyframe(frame);
+
+		ConfirmFrames(frame);
+
+		while(!_pending_checksums.empty() && _pending_checksums.begin()->first < _confirmed_frame)
+		{
+			_session->set_checksum(_pending_checksums.begin()->second);
+			_pending_checksums.erase(_pending_checksums.begin());
+		}
+		CheckDesync();
+
+		if(_pending_keyframe.state && (int64_t)_pending_keyframe.frame < _confirmed_frame)
+		{
+			_replay->WriteKeyframe(_pending_keyframe);
+			_next_keyframe = _pending_keyframe.frame + _replay->KeyframeInterval();
+			_pending_keyframe = Replay::PendingKeyframe();
+		}
+	}
+
+	// moves _confirmed_frame past the frames every side has sent the input of, once their
+	// predictions have been checked, and records them
+	void ConfirmFrames(int64_t frame)
+	{
+		const int players = _session->num_players();
+		while(_confirmed_frame <= frame)
+		{
+			Message input;
+			int side = 0;
+			while(side < players && !_predictions[side].count(_confirmed_frame) && _session->try_get(side, input, _confirmed_frame))
+				side++;
+			if(side < players)
+				break;
+
+			if(_replay)
+			{
+				for(side = 0; side < players; side++)
+				{
+					_session->try_get(side, input, _confirmed_frame);
+					_replay->Write(side, input);
+				}
+			}
+			_confirmed_frame++;
+		}
+	}
+
+	// hands a checksum of the machine to the session every few frames and
+	// stops at the first frame a peer's checksum disagrees with ours
+	void CheckState(int64_t frame)
+	{
+		uint interval = g_Conf->Netplay.DesyncCheckInterval;
+		if(!interval)
+			return;
+
+		if(frame % interval == 0)
+			_session->set_checksum(StateChecksum::Compute(frame, (uint)(frame / interval)));
+
+		CheckDesync();
+	}
+
+	void CheckDesync()
+	{
+		uint interval = g_Conf->Netplay.DesyncCheckInterval;
+		if(!interval)
+			return;
+
+		int64_t desync_frame;
+		int side;
+		u32 parts;
+		if(_session->desync(desync_frame, side, parts))
+		{
+			Stop();
+			ConsoleErrorMT(wxString::Format(wxT("NETPLAY: Desync with player %d on frame %d, mismatch in "), side + 1, (int)desync_frame) +
+				StateChecksum::Describe(parts, (uint)(desync_frame / interval)) + wxT("."));
+		}
+	}
+
+	bool KeyframeDue(int64_t frame)
+	{
+		return _replay && _replay->IsRecording() && _replay->KeyframeInterval() && frame >= _next_keyframe;
+	}
+
+	void SaveKeyframe(int64_t frame)
+	{
+		if(!KeyframeDue(frame))
+			return;
+		_replay->SaveKeyframe(frame);
+		_next_keyframe = frame + _replay->KeyframeInterval();
+	}
+
 	// called when IOPHook has a frame ready to send
 	void AcceptInput(int side)
 	{
@@ -534,7 +1026,8 @@ public:
 
 		try
 		{
-			_session->set(_my_frame);
+			if(!_session->is_observer())
+				_session->set(_my_frame);
 		}
 		catch(std::exception& e)
 		{
@@ -542,7 +1035,8 @@ public:
 			ConsoleErrorMT(wxT("NETPLAY: ") + wxString(e.what(), wxConvLocal) + wxT(". Interrupting session."));
 		}
 
-		if(_replay)
+		// with rollback, confirmed inputs are recorded from Vsync()
+		if(_replay && !_rollback)
 		{
 			Message f;
 			_session->get(side, f, 0);
@@ -622,9 +1116,58 @@ public:
 		if(side == 0)
 			_my_frame.input[index] = value;
 
+		if(_rollback)
+			frame = RollbackInput(side);
+		else
+			WaitForInput(side, _session->frame(), frame);
+
+		value = frame.input[index];
+		return value;
+	}
+
+	// returns the confirmed input of the current frame, or a prediction if it hasn't arrived yet
+	Message RollbackInput(int side)
+	{
+		auto current = _session->frame();
+		Message frame;
+		try
+		{
+			if(_session->try_get(side, frame, current))
+			{
+				_last_confirmed[side] = frame;
+				return frame;
+			}
+		}
+		catch(std::exception& e)
+		{
+			Stop();
+			ConsoleErrorMT(wxT("NETPLAY: ") + wxString(e.what(), wxConvLocal));
+			return frame;
+		}
+
+		auto& predicted = _predictions[side];
+		auto it = predicted.find(current);
+		if(it != predicted.end())
+			return it->second;
+
+		// don't predict further than we can roll back, wait for the oldest prediction instead
+		if(!predicted.empty() && current - predicted.begin()->first >= (int64_t)_rollback->Capacity() - 2)
+		{
+			Message confirmed;
+			WaitForInput(side, predicted.begin()->first, confirmed);
+		}
+
+		// assume the player keeps holding what was last seen
+		predicted[current] = _last_confirmed[side];
+		return _last_confirmed[side];
+	}
+
+	void WaitForInput(int side, int64_t frame_id, Message& frame)
+	{
 		// wait up to 10 seconds for input
 		// this is probably overkill, but you never know
-		auto timeout = shoryu::time_ms() + 10000;
+		auto start = shoryu::time_ms();
+		auto timeout = start + 10000;
 		try
 		{
 			while(true)
@@ -633,7 +1176,7 @@ public:
 				if (until_timeout < 1)
 					until_timeout = 1;
 
-				if (_session->get(side, frame, until_timeout))
+				if (_session->get(side, frame, frame_id, until_timeout))
 					break;
 
 				_session->send();
@@ -656,9 +1199,7 @@ public:
 			Stop();
 			ConsoleErrorMT(wxT("NETPLAY: ") + wxString(e.what(), wxConvLocal));
 		}
-
-		value = frame.input[index];
-		return value;
+		_delay_controller.add_stall(shoryu::time_ms() - start);
 	}
 
 	void SendChatText(const std::string &message)
@@ -732,8 +1273,31 @@ protected:
 	wxString _game_name;
 	Message _my_frame;
 	Utilities::block_type _mcd_backup;
+	std::vector<userinfo> _usernames;
 	std::shared_ptr<Replay> _replay;
 	INetplayDialog* _dialog;
+
+	typedef std::map<int64_t, Message> prediction_map;
+	std::unique_ptr<RollbackBuffer> _rollback;
+	shoryu::delay_controller _delay_controller;
+	// stall totals the clients reported at the end of the last window
+	std::vector<uint64_t> _peer_blocked_ms;
+	std::unique_ptr<NetplayTelemetry> _telemetry;
+	NetplayFrameStats _stats;
+	// last one-second window, shown by UpdateOverlay() on the main thread
+	std::mutex _overlay_mutex;
+	NetplayFrameStats _overlay;
+	bool _has_overlay;
+	std::vector<prediction_map> _predictions;
+	std::vector<Message> _last_confirmed;
+	int64_t _resimulate_until;
+	// every input before it is confirmed and checked against its prediction
+	int64_t _confirmed_frame;
+	// checksums of frames that aren't confirmed yet
+	std::map<int64_t, shoryu::state_checksum> _pending_checksums;
+	// keyframe of a frame that isn't confirmed yet, if state is set
+	Replay::PendingKeyframe _pending_keyframe;
+	int64_t _next_keyframe;
 	std::recursive_mutex _mutex;
 	typedef std::unique_lock<std::recursive_mutex> recursive_lock;
 };
@@ -17,4 +17,6 @@ public:
 	virtual bool IsInit() = 0;
 	virtual void EndSession() = 0;
 	virtual void Close() = 0;
+	// Shows the live session stats on the GS overlay, called from the main thread.
+	virtual void UpdateOverlay() = 0;
 };
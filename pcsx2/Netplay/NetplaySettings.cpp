@@ -11,7 +11,16 @@ NetplaySettings::NetplaySettings()
 	ClientOnlyDelay = true;
 	MemcardSync = true;
 	SaveReplay = false;
+	ReplayKeyframeInterval = 10;
 	NumPlayers = 2;
+	Rollback = false;
+	RollbackFrames = 8;
+	AdaptiveDelay = false;
+	ShowStats = false;
+	SaveStats = false;
+	DesyncCheckInterval = 10;
+	RelayPort = 0;
+	RelayDelay = 1;
 }
 
 void NetplaySettings::LoadSave( IniInterface& ini )
@@ -27,7 +36,16 @@ void NetplaySettings::LoadSave( IniInterface& ini )
 	IniEntry( ClientOnlyDelay );
 	IniEntry( MemcardSync );
 	IniEntry( SaveReplay );
+	IniEntry( ReplayKeyframeInterval );
 	IniEntry( NumPlayers );
+	IniEntry( Rollback );
+	IniEntry( RollbackFrames );
+	IniEntry( AdaptiveDelay );
+	IniEntry( ShowStats );
+	IniEntry( SaveStats );
+	IniEntry( DesyncCheckInterval );
+	IniEntry( RelayPort );
+	IniEntry( RelayDelay );
 
 	int mode = Mode;
 	ini.Entry(wxT("Mode"), mode, mode);
@@ -45,4 +63,14 @@ void NetplaySettings::SanityCheck()
 		NumPlayers = 2;
 	if(NumPlayers > 8)
 		NumPlayers = 8;
+	if(RollbackFrames < 1)
+		RollbackFrames = 1;
+	if(RollbackFrames > 30)
+		RollbackFrames = 30;
+	if(ReplayKeyframeInterval > 600)
+		ReplayKeyframeInterval = 600;
+	if(RelayPort > 65535)
+		RelayPort = 0;
+	if(RelayDelay > 600)
+		RelayDelay = 600;
 }
@@ -18,10 +18,19 @@ struct NetplaySettings
 	wxString HostAddress;
 	uint ListenPort;
 	bool SaveReplay;
+	uint ReplayKeyframeInterval;
 	bool ReadonlyMemcard;
 	bool ClientOnlyDelay;
 	bool MemcardSync;
 	uint NumPlayers;
+	bool Rollback;
+	uint RollbackFrames;
+	bool AdaptiveDelay;
+	bool ShowStats;
+	bool SaveStats;
+	uint DesyncCheckInterval;
+	uint RelayPort;
+	uint RelayDelay;
 	
 	NetplaySettings();
 	void LoadSave( IniInterface& conf );
@@ -1,141 +1,600 @@
 #include "PrecompiledHeader.h"
 #include "Replay.h"
-#include <fstream>
+#include "SaveState.h"
+#include "zlib\zlib.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <sstream>
 #include <streambuf>
-
-Replay::Replay() : _playback_frame(0), _mode(None), _length(0) {}
+#include <thread>
 
 static const char Header[] = "PCSX2REPV1";
+static const char HeaderV2[] = "PCSX2REPV2";
+static const char Trailer[8] = { 'R', 'E', 'P', 'I', 'N', 'D', 'E', 'X' };
 
-bool Replay::LoadFromFile(const wxString& path, bool compressed)
+static u32 MakeTag(const char (&name)[5])
 {
-	wxFile file(path);
-	bool validFile = false;
-	Mode(None);
-	if(file.IsOpened())
+	return (u8)name[0] | ((u8)name[1] << 8) | ((u8)name[2] << 16) | ((u8)name[3] << 24);
+}
+
+static const u32 TagInfo = MakeTag("INFO");
+static const u32 TagMcd = MakeTag("MCD ");
+static const u32 TagInput = MakeTag("INPT");
+static const u32 TagKeyframe = MakeTag("KEYF");
+static const u32 TagIndex = MakeTag("INDX");
+
+// frames of inputs per INPT chunk, about 10 seconds
+static const u64 InputChunkFrames = 600;
+
+namespace
+{
+	typedef Replay::block_type block_type;
+
+	struct IndexEntry
+	{
+		u32 tag;
+		u64 frame;
+		u64 offset;
+	};
+
+	void Append(block_type& block, const void* data, size_t size)
+	{
+		const u8* p = (const u8*)data;
+		block.insert(block.end(), p, p + size);
+	}
+
+	template<typename T> void Append(block_type& block, const T& value)
+	{
+		Append(block, &value, sizeof(value));
+	}
+
+	// Appends [u32 size][zlib stream] to a payload.
+	void Pack(block_type& payload, const u8* data, size_t size, int level)
+	{
+		Append(payload, (u32)size);
+		if(!size)
+			return;
+		uLongf length = compressBound(size);
+		size_t start = payload.size();
+		payload.resize(start + length);
+		if(compress2(payload.data() + start, &length, data, size, level) != Z_OK)
+			throw std::exception("Unable to compress data");
+		payload.resize(start + length);
+	}
+
+	// Reads the fields of a chunk payload in order.
+	class PayloadReader
 	{
-		size_t size;
-		std::istringstream ss;
-		if(compressed)
+	public:
+		PayloadReader(const block_type& payload) : _payload(payload), _pos(0) {}
+
+		bool Read(void* data, size_t size)
 		{
-			if(file.Read((char*)&size,sizeof(size)) != sizeof(size))
-				return false;
-			block_type uncompressed(size);
-			size = file.Length() - sizeof(size);
-			block_type compressed(size);
-			if(file.Read(compressed.data(), size) != size)
+			if(_payload.size() - _pos < size)
 				return false;
+			memcpy(data, _payload.data() + _pos, size);
+			_pos += size;
+			return true;
+		}
 
-			if(!Utilities::Uncompress(compressed, uncompressed))
-				return false;
-			ss.str(std::string(uncompressed.begin(), uncompressed.end()));
+		template<typename T> bool Read(T& value)
+		{
+			return Read(&value, sizeof(value));
 		}
-		else
+
+		// Reads what Pack() appended, it has to be the end of the payload.
+		bool Unpack(block_type& data)
 		{
-			if(file.Read((char*)&size,sizeof(size)) != sizeof(size))
+			u32 size;
+			if(!Read(size))
 				return false;
-			block_type block(size);
-			if(file.Read(block.data(), size) != size)
-				return false;
-			ss.str(std::string(block.begin(), block.end()));
+			data.resize(size);
+			if(!size)
+				return true;
+			uLongf length = size;
+			int r = uncompress(data.data(), &length, _payload.data() + _pos, _payload.size() - _pos);
+			_pos = _payload.size();
+			return r == Z_OK && length == size;
 		}
-		
-		char header_test[sizeof(Header)];
-		if(!ss.read(header_test, sizeof(Header)))
-			return false;
-		if(memcmp(header_test, Header, sizeof(Header)))
-			return false;
-		if(!ss.read(_state.biosVersion, sizeof(_state.biosVersion)))
+	protected:
+		const block_type& _payload;
+		size_t _pos;
+	};
+
+	bool ReadChunk(wxFile& file, u64 offset, u32& tag, block_type& payload)
+	{
+		u32 size;
+		if(file.Seek(offset) != (wxFileOffset)offset)
 			return false;
-		if(!ss.read(_state.discId, sizeof(_state.discId)))
+		if(file.Read(&tag, sizeof(tag)) != sizeof(tag) || file.Read(&size, sizeof(size)) != sizeof(size))
 			return false;
-		if(!ss.read((char*)&size, sizeof(size)))
+		if(offset + 8 + size > (u64)file.Length())
 			return false;
-		_data.clear();
-		_data.resize(size);
-		if(size)
+		payload.resize(size);
+		return !size || file.Read(payload.data(), size) == size;
+	}
+}
+
+// Appends chunks to the replay file from its own thread, so that compressing
+// a keyframe doesn't hold up the emulator. Jobs run in the order they're queued.
+class ReplayWriter
+{
+public:
+	typedef std::function<void(ReplayWriter&)> job_type;
+
+	ReplayWriter(const wxString& path) : _file(path, wxFile::write), _done(false), _failed(false)
+	{
+		if(!_file.IsOpened())
+			throw std::exception("Cannot open file");
+		_file.Write(HeaderV2, sizeof(HeaderV2));
+		_thread = std::thread(&ReplayWriter::Run, this);
+	}
+
+	~ReplayWriter()
+	{
+		Close();
+	}
+
+	void Queue(const job_type& job)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_jobs.push_back(job);
+		_cond.notify_one();
+	}
+
+	// Called by the jobs, on the writer thread.
+	void WriteChunk(u32 tag, u64 frame, const block_type& payload)
+	{
+		IndexEntry entry = { tag, frame, (u64)_file.Tell() };
+		u32 size = payload.size();
+		if(_file.Write(&tag, sizeof(tag)) != sizeof(tag) || _file.Write(&size, sizeof(size)) != sizeof(size)
+			|| _file.Write(payload.data(), size) != size)
+			throw std::exception("Unable to write replay file");
+		_index.push_back(entry);
+	}
+
+	// Runs the queued jobs, then writes the index and closes the file.
+	void Close()
+	{
 		{
-			if(!ss.read((char*)_data.data(), size))
-				return false;
+			std::lock_guard<std::mutex> lock(_mutex);
+			if(_done)
+				return;
+			_done = true;
+			_cond.notify_one();
 		}
-		if(!ss.read((char*)&size, sizeof(size)))
-			return false;
-		_input.clear();
-		_input.resize(size);
-		if(size)
+		_thread.join();
+
+		if(!_failed)
 		{
-			for(size_t i = 0; i < _input.size(); i++)
+			try
 			{
-				if(!ss.read((char*)&size, sizeof(size)))
-					return false;
-				if(size)
+				block_type index;
+				Append(index, (u32)_index.size());
+				for(auto& entry : _index)
 				{
-					for(size_t j = 0; j < size; j++)
-					{
-						Message m;
-						if(!ss.read(m.input, sizeof(m.input)))
-							return false;
-						_input[i].push_back(m);
-					}
+					Append(index, entry.tag);
+					Append(index, entry.frame);
+					Append(index, entry.offset);
 				}
+				u64 offset = _file.Tell();
+				WriteChunk(TagIndex, 0, index);
+				_file.Write(&offset, sizeof(offset));
+				_file.Write(Trailer, sizeof(Trailer));
+			}
+			catch(std::exception& e)
+			{
+				_error = e.what();
+				_failed = true;
 			}
 		}
-		_length = Length();
+		_file.Close();
 	}
-	else
-		throw std::exception("Cannot open file");
-	return true;
-}
 
-u64 Replay::Pos() const
+	bool Failed() const { return _failed; }
+	const std::string& Error() const { return _error; }
+protected:
+	void Run()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		while(true)
+		{
+			_cond.wait(lock, [&]() { return _done || !_jobs.empty(); });
+			if(_jobs.empty())
+				return;
+			job_type job = _jobs.front();
+			_jobs.pop_front();
+			lock.unlock();
+
+			// after a failed write the rest of the file is of no use
+			if(!_failed)
+			{
+				try
+				{
+					job(*this);
+				}
+				catch(std::exception& e)
+				{
+					_error = e.what();
+					_failed = true;
+				}
+			}
+			lock.lock();
+		}
+	}
+
+	wxFile _file;
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	std::deque<job_type> _jobs;
+	bool _done;
+	std::atomic<bool> _failed;
+	std::string _error;
+	std::vector<IndexEntry> _index;
+};
+
+// Keyframe buffers are tens of megabytes each. Once a keyframe is written its buffer
+// comes back here instead of being freed, so recording only allocates as many as are
+// in flight at once.
+class KeyframePool : public std::enable_shared_from_this<KeyframePool>
 {
-	return _playback_frame;
-}
+public:
+	std::shared_ptr<VmStateBuffer> Get()
+	{
+		VmStateBuffer* buffer = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if(!_free.empty())
+			{
+				buffer = _free.back().release();
+				_free.pop_back();
+			}
+		}
+		if(!buffer)
+			buffer = new VmStateBuffer(L"Replay keyframe");
+
+		// the writer thread may hold the last reference
+		auto pool = shared_from_this();
+		return std::shared_ptr<VmStateBuffer>(buffer, [pool](VmStateBuffer* released) {
+			std::lock_guard<std::mutex> lock(pool->_mutex);
+			pool->_free.emplace_back(released);
+		});
+	}
+protected:
+	std::mutex _mutex;
+	std::vector<std::unique_ptr<VmStateBuffer>> _free;
+};
+
+Replay::Replay() : _playback_frame(0), _mode(None), _length(0), _keyframe_interval(0), _flushed(0), _keyframe_pool(std::make_shared<KeyframePool>()) {}
 
-const Replay& Replay::SaveToFile(const wxString& path, bool compress) const
+bool Replay::LoadFromFile(const wxString& path)
 {
-	wxFile file(path, wxFile::write);
-	if(file.IsOpened())
+	wxFile file(path);
+	Mode(None);
+	if(!file.IsOpened())
+		throw std::exception("Cannot open file");
+
+	char header_test[sizeof(HeaderV2)];
+	if(file.Read(header_test, sizeof(HeaderV2)) != sizeof(HeaderV2) || memcmp(header_test, HeaderV2, sizeof(HeaderV2)))
 	{
-		std::ostringstream ss;
-		ss.write(Header, sizeof(Header));
-		ss.write(_state.biosVersion, sizeof(_state.biosVersion));
-		ss.write(_state.discId, sizeof(_state.discId));
-		size_t size = _data.size();
-		ss.write((const char*)&size, sizeof(size));
-		ss.write((const char*)_data.data(), size);
-		size = _input.size();
-		ss.write((const char*)&size, sizeof(size));
-		for(size_t i = 0; i < _input.size(); i++)
+		file.Seek(0);
+		return LoadLegacy(file);
+	}
+
+	_path = path;
+	_keyframe_interval = 0;
+	_keyframes.clear();
+	_data.clear();
+	_input.clear();
+	_length = 0;
+
+	u64 length = file.Length();
+	u32 tag;
+	block_type payload;
+	bool has_info = false;
+
+	// the index points at every chunk, so the keyframes can be skipped without being read
+	bool indexed = false;
+	u64 index_offset;
+	char trailer_test[sizeof(Trailer)];
+	if(length >= sizeof(HeaderV2) + sizeof(index_offset) + sizeof(Trailer) &&
+		file.Seek(length - sizeof(index_offset) - sizeof(Trailer)) != wxInvalidOffset &&
+		file.Read(&index_offset, sizeof(index_offset)) == sizeof(index_offset) &&
+		file.Read(trailer_test, sizeof(Trailer)) == sizeof(Trailer) &&
+		!memcmp(trailer_test, Trailer, sizeof(Trailer)) &&
+		ReadChunk(file, index_offset, tag, payload) && tag == TagIndex)
+	{
+		block_type index = payload;
+		PayloadReader reader(index);
+		u32 count;
+		indexed = reader.Read(count);
+		for(u32 i = 0; indexed && i < count; i++)
+		{
+			IndexEntry entry;
+			if(!reader.Read(entry.tag) || !reader.Read(entry.frame) || !reader.Read(entry.offset))
+				indexed = false;
+			else if(entry.tag == TagKeyframe)
+			{
+				Keyframe keyframe = { entry.frame, entry.offset };
+				_keyframes.push_back(keyframe);
+			}
+			else if(!ReadChunk(file, entry.offset, tag, payload) || tag != entry.tag || !LoadChunk(tag, payload))
+				indexed = false;
+			else if(tag == TagInfo)
+				has_info = true;
+		}
+		if(!indexed)
 		{
-			size = _input[i].size();
-			ss.write((const char*)&size, sizeof(size));
-			for(size_t j = 0; j < size; j++)
-				ss.write(_input[i][j].input, sizeof(_input[i][j].input));
+			_keyframes.clear();
+			_data.clear();
+			_input.clear();
+			has_info = false;
 		}
-		std::string data = ss.str();
-		if(compress)
+	}
+
+	// no index, the recording was cut short: walk the chunks up to the last complete one
+	if(!indexed)
+	{
+		u64 offset = sizeof(HeaderV2);
+		u32 size;
+		while(offset + 8 <= length)
 		{
-			block_type uncompressed(data.begin(), data.end());
-			block_type compressed;
-			if(!Utilities::Compress(uncompressed, compressed))
-				throw std::exception("Unable to compress data");
-			size = uncompressed.size();
-			file.Write((char*)&size,sizeof(size));
-			file.Write(compressed.data(), compressed.size());
+			if(file.Seek(offset) == wxInvalidOffset || file.Read(&tag, sizeof(tag)) != sizeof(tag) ||
+				file.Read(&size, sizeof(size)) != sizeof(size) || offset + 8 + size > length)
+				break;
+			if(tag == TagKeyframe)
+			{
+				Keyframe keyframe = { 0, offset };
+				if(file.Read(&keyframe.frame, sizeof(keyframe.frame)) != sizeof(keyframe.frame))
+					break;
+				_keyframes.push_back(keyframe);
+			}
+			else if(tag != TagIndex)
+			{
+				if(!ReadChunk(file, offset, tag, payload) || !LoadChunk(tag, payload))
+					break;
+				if(tag == TagInfo)
+					has_info = true;
+			}
+			offset += 8 + size;
 		}
-		else
+	}
+
+	// keyframes past the last input are of no use
+	u64 frames = Length();
+	_keyframes.erase(std::remove_if(_keyframes.begin(), _keyframes.end(), [&](const Keyframe& k) {
+		return k.frame >= frames;
+	}), _keyframes.end());
+	std::sort(_keyframes.begin(), _keyframes.end(), [](const Keyframe& a, const Keyframe& b) {
+		return a.frame < b.frame;
+	});
+	return has_info;
+}
+
+bool Replay::LoadChunk(u32 tag, const block_type& payload)
+{
+	PayloadReader reader(payload);
+	if(tag == TagInfo)
+	{
+		return reader.Read(_state.biosVersion) && reader.Read(_state.discId) && reader.Read(_keyframe_interval);
+	}
+	else if(tag == TagMcd)
+	{
+		return reader.Unpack(_data);
+	}
+	else if(tag == TagInput)
+	{
+		u64 first;
+		u32 count, sides;
+		block_type raw;
+		if(!reader.Read(first) || !reader.Read(count) || !reader.Read(sides) || !reader.Unpack(raw))
+			return false;
+		if(raw.size() != (size_t)count * sides * sizeof(Message().input))
+			return false;
+		if(_input.empty())
+			_input.resize(sides);
+		// chunks are written in order, anything else is a broken file
+		if(_input.size() != sides || first != Length())
+			return false;
+
+		const u8* p = raw.data();
+		for(u32 i = 0; i < count; i++)
 		{
-			size = data.length();
-			file.Write((char*)&size,sizeof(size));
-			file.Write(data.data(), data.length());
+			for(u32 side = 0; side < sides; side++)
+			{
+				Message m;
+				memcpy(m.input, p, sizeof(m.input));
+				p += sizeof(m.input);
+				_input[side].push_back(m);
+			}
 		}
+		return true;
 	}
-	else
-		throw std::exception("Cannot open file");
+	return true;
+}
+
+bool Replay::LoadLegacy(wxFile& file)
+{
+	size_t size;
+	std::istringstream ss;
+	if(file.Read((char*)&size,sizeof(size)) != sizeof(size))
+		return false;
+	block_type uncompressed(size);
+	size = file.Length() - sizeof(size);
+	block_type compressed(size);
+	if(file.Read(compressed.data(), size) != size)
+		return false;
+
+	if(!Utilities::Uncompress(compressed, uncompressed))
+		return false;
+	ss.str(std::string(uncompressed.begin(), uncompressed.end()));
+
+	char header_test[sizeof(Header)];
+	if(!ss.read(header_test, sizeof(Header)))
+		return false;
+	if(memcmp(header_test, Header, sizeof(Header)))
+		return false;
+	if(!ss.read(_state.biosVersion, sizeof(_state.biosVersion)))
+		return false;
+	if(!ss.read(_state.discId, sizeof(_state.discId)))
+		return false;
+	if(!ss.read((char*)&size, sizeof(size)))
+		return false;
+	_data.clear();
+	_data.resize(size);
+	if(size)
+	{
+		if(!ss.read((char*)_data.data(), size))
+			return false;
+	}
+	if(!ss.read((char*)&size, sizeof(size)))
+		return false;
+	_input.clear();
+	_input.resize(size);
+	if(size)
+	{
+		for(size_t i = 0; i < _input.size(); i++)
+		{
+			if(!ss.read((char*)&size, sizeof(size)))
+				return false;
+			if(size)
+			{
+				for(size_t j = 0; j < size; j++)
+				{
+					Message m;
+					if(!ss.read(m.input, sizeof(m.input)))
+						return false;
+					_input[i].push_back(m);
+				}
+			}
+		}
+	}
+	_keyframes.clear();
+	_keyframe_interval = 0;
+	_length = Length();
+	return true;
+}
+
+Replay& Replay::BeginRecording(const wxString& path, u32 keyframe_interval)
+{
+	if(_mode != Recording)
+		throw std::exception("Write operation while not in Recording mode");
+	_writer = std::make_shared<ReplayWriter>(path);
+	_path = path;
+	_keyframe_interval = keyframe_interval;
+	_flushed = Length();
+
+	block_type info;
+	Append(info, _state.biosVersion);
+	Append(info, _state.discId);
+	Append(info, _keyframe_interval);
+	block_type data = _data;
+	_writer->Queue([info, data](ReplayWriter& writer) {
+		block_type mcd;
+		Pack(mcd, data.data(), data.size(), Z_DEFAULT_COMPRESSION);
+		writer.WriteChunk(TagInfo, 0, info);
+		writer.WriteChunk(TagMcd, 0, mcd);
+	});
+	return *this;
+}
+
+Replay& Replay::EndRecording()
+{
+	if(!_writer)
+		return *this;
+	if(Length() > _flushed)
+		FlushInput(Length());
+
+	auto writer = _writer;
+	_writer.reset();
+	writer->Close();
+	if(writer->Failed())
+		throw std::exception(writer->Error().c_str());
 	return *this;
 }
+
+bool Replay::IsRecording() const
+{
+	return (bool)_writer;
+}
+
+u32 Replay::KeyframeInterval() const
+{
+	return _keyframe_interval;
+}
+
+// hands the frames from the last flush up to end over to the writer
+void Replay::FlushInput(u64 end)
+{
+	u64 first = _flushed;
+	u32 count = end - first;
+	u32 sides = _input.size();
+	block_type raw;
+	raw.reserve((size_t)count * sides * sizeof(Message().input));
+	for(u64 frame = first; frame < end; frame++)
+		for(u32 side = 0; side < sides; side++)
+			Append(raw, _input[side][frame].input, sizeof(Message().input));
+	_flushed = end;
+
+	_writer->Queue([first, count, sides, raw](ReplayWriter& writer) {
+		block_type payload;
+		Append(payload, first);
+		Append(payload, count);
+		Append(payload, sides);
+		Pack(payload, raw.data(), raw.size(), Z_DEFAULT_COMPRESSION);
+		writer.WriteChunk(TagInput, first, payload);
+	});
+}
+
+Replay& Replay::SaveKeyframe(u64 frame)
+{
+	if(!_writer)
+		return *this;
+	return WriteKeyframe(CaptureKeyframe(frame));
+}
+
+Replay::PendingKeyframe Replay::CaptureKeyframe(u64 frame)
+{
+	PendingKeyframe keyframe;
+	keyframe.frame = frame;
+	keyframe.hook = GetIOPHookState();
+	keyframe.state = _keyframe_pool->Get();
+	memSavingState saving(*keyframe.state);
+	saving.FreezeAll();
+	keyframe.size = saving.GetCurrentPos();
+	return keyframe;
+}
+
+Replay& Replay::WriteKeyframe(const PendingKeyframe& keyframe)
+{
+	if(!_writer)
+		return *this;
+
+	u64 frame = keyframe.frame;
+	IOPHookState hook = keyframe.hook;
+	std::shared_ptr<VmStateBuffer> state = keyframe.state;
+	u32 size = keyframe.size;
+
+	// compressed for speed, a keyframe is tens of megabytes
+	_writer->Queue([frame, hook, state, size](ReplayWriter& writer) {
+		block_type payload;
+		Append(payload, frame);
+		Append(payload, hook);
+		Pack(payload, state->GetPtr(), size, Z_BEST_SPEED);
+		writer.WriteChunk(TagKeyframe, frame, payload);
+	});
+	return *this;
+}
+
+u64 Replay::Pos() const
+{
+	return _playback_frame;
+}
+
 ReplayMode Replay::Mode() const
 {
 	return _mode;
@@ -180,6 +639,8 @@ Replay& Replay::Write(u8 side, const Message& msg)
 	if(_input.size() <= side)
 		_input.resize(side+1);
 	_input[side].push_back(msg);
+	if(_writer && Length() >= _flushed + InputChunkFrames)
+		FlushInput(Length());
 	return *this;
 }
 u64 Replay::Length()
@@ -211,12 +672,41 @@ Replay& Replay::Rewind()
 	_playback_frame = 0;
 	return *this;
 }
-Replay& Replay::Seek(u64 position)
+u64 Replay::Seek(u64 position)
 {
 	if(_mode != Playback)
 		throw std::exception("Seek operation while not in Playback mode");
-	_playback_frame = position;
-	return *this;
+
+	auto it = std::upper_bound(_keyframes.begin(), _keyframes.end(), position, [](u64 frame, const Keyframe& k) {
+		return frame < k.frame;
+	});
+	const Keyframe* keyframe = it == _keyframes.begin() ? nullptr : &*(it - 1);
+
+	// running on from here beats loading a keyframe we're already past
+	if(_playback_frame <= position && (!keyframe || keyframe->frame <= _playback_frame))
+		return _playback_frame;
+	if(!keyframe)
+		throw std::exception("No keyframe to seek back to");
+
+	wxFile file(_path);
+	u32 tag;
+	block_type payload;
+	if(!file.IsOpened() || !ReadChunk(file, keyframe->offset, tag, payload) || tag != TagKeyframe)
+		throw std::exception("Unable to read keyframe");
+
+	PayloadReader reader(payload);
+	u64 frame;
+	IOPHookState hook;
+	block_type raw;
+	if(!reader.Read(frame) || !reader.Read(hook) || !reader.Unpack(raw))
+		throw std::exception("Keyframe is corrupted");
+
+	std::shared_ptr<VmStateBuffer> state(new VmStateBuffer((int)raw.size(), L"Replay keyframe"));
+	memcpy(state->GetPtr(), raw.data(), raw.size());
+	GetCoreThread().LoadStateInThread([state]() { memLoadingState(state.get()).FreezeAll(); });
+	SetIOPHookState(hook);
+	_playback_frame = frame;
+	return frame;
 }
 Replay& Replay::NextFrame()
 {
@@ -224,4 +714,4 @@ Replay& Replay::NextFrame()
 		throw std::exception("NextFrame operation while not in Playback mode");
 	++_playback_frame;
 	return *this;
-}
\ No newline at end of file
+}
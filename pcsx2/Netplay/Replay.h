@@ -3,6 +3,8 @@
 #include "EmulatorState.h"
 #include "Utilities.h"
 #include "Message.h"
+#include "IOPHook.h"
+#include <memory>
 
 enum ReplayMode
 {
@@ -11,7 +13,20 @@ enum ReplayMode
 	Playback
 };
 
-// TODO: use boost::serialization here
+class ReplayWriter;
+class KeyframePool;
+
+// Replay file, version 2: a header followed by chunks of [u32 tag][u32 size][payload].
+//   INFO  sync state and keyframe interval
+//   MCD   memory card the session started with
+//   INPT  inputs of every side for a run of frames
+//   KEYF  savestate taken at the vsync before a frame, with the pad polling position
+//   INDX  tag, frame and offset of every other chunk, followed by the trailer
+// Chunks are appended while recording, so a replay cut short by a crash still
+// loads up to its last complete chunk. The index is written when recording
+// ends and lets the loader skip over the keyframes, which are only read when
+// playback seeks to them. Version 1 replays still load, without keyframes.
+// Keyframes don't include the memory card, same as regular savestates.
 class Replay
 {
 public:
@@ -19,10 +34,32 @@ public:
 	typedef std::vector<Message> input_type;
 	typedef std::deque<input_type> input_container;
 
+	// Keyframe captured at a vsync and not written yet.
+	struct PendingKeyframe
+	{
+		u64 frame;
+		IOPHookState hook;
+		std::shared_ptr<VmStateBuffer> state;
+		u32 size;
+	};
+
 	Replay();
 
-	bool LoadFromFile(const wxString& path, bool compressed = true);
-	const Replay& SaveToFile(const wxString& path, bool compress = true) const;
+	bool LoadFromFile(const wxString& path);
+	// Starts streaming the replay to a file. Sync state and memory card have to be set,
+	// inputs and keyframes are appended as they come.
+	Replay& BeginRecording(const wxString& path, u32 keyframe_interval);
+	// Writes the remaining inputs and the index, and closes the file.
+	Replay& EndRecording();
+	bool IsRecording() const;
+	// Frames between two keyframes, 0 if there are none.
+	u32 KeyframeInterval() const;
+	// Captures the VM as the keyframe of the given frame. Call from the EE thread at vsync.
+	Replay& SaveKeyframe(u64 frame);
+	// Same, in two steps: for keyframes that may still be rolled back before they're written.
+	// Buffers are reused once written, or once a capture that is never written is released.
+	PendingKeyframe CaptureKeyframe(u64 frame);
+	Replay& WriteKeyframe(const PendingKeyframe& keyframe);
 	ReplayMode Mode() const;
 	Replay& Mode(ReplayMode mode);
 	const EmulatorSyncState& SyncState() const;
@@ -35,13 +72,35 @@ public:
 	u64 Pos() const;
 	int Sides() const;
 	Replay& Rewind();
-	Replay& Seek(u64 position);
+	// Jumps to the newest keyframe at or before the given frame, unless playback is
+	// already between it and the frame. The keyframe is loaded by the core thread at
+	// its next state check, so call from the EE thread. Returns the frame playback
+	// resumes from; the frames left up to position have to be run.
+	u64 Seek(u64 position);
 	Replay& NextFrame();
 protected:
+	struct Keyframe
+	{
+		u64 frame;
+		u64 offset;
+	};
+
+	bool LoadLegacy(wxFile& file);
+	bool LoadChunk(u32 tag, const block_type& payload);
+	void FlushInput(u64 end);
+
 	ReplayMode _mode;
 	EmulatorSyncState _state;
 	block_type _data;
 	input_container _input;
 	u64 _playback_frame;
 	u64 _length;
-};
\ No newline at end of file
+
+	wxString _path;
+	u32 _keyframe_interval;
+	std::vector<Keyframe> _keyframes;
+	// frames already handed to the writer
+	u64 _flushed;
+	std::shared_ptr<ReplayWriter> _writer;
+	std::shared_ptr<KeyframePool> _keyframe_pool;
+};
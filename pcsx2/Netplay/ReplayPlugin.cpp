@@ -1,14 +1,18 @@
 #include "PrecompiledHeader.h"
 #include "ReplayPlugin.h"
 #include "Replay.h"
+#include "ReplayReport.h"
 #include "Utilities.h"
 #include "App.h"
+#include "GS.h"
+#include "Counters.h"
+#include <atomic>
 #include <sstream>
 
 class ReplayPlugin : public IReplayPlugin
 {
 public:
-	ReplayPlugin() : _is_init(false) {}
+	ReplayPlugin() : _is_init(false), _seek_request(0), _seek_until(-1) {}
 	void Init()
 	{
 		_is_init = true;
@@ -20,7 +24,9 @@ public:
 		try
 		{
 			_console = Console;
-			Utilities::ExecuteOnMainThread([&] { Console_SetActiveHandler(ConsoleWriter_Null); });
+			// batch runs keep the console, it's all there is to watch
+			if(g_Conf->Replay.ReportPath.IsEmpty())
+				Utilities::ExecuteOnMainThread([&] { Console_SetActiveHandler(ConsoleWriter_Null); });
 			if(_replay.LoadFromFile(g_Conf->Replay.FilePath))
 			{
 				_replay.Mode(Playback);
@@ -74,6 +80,13 @@ public:
 				}
 				_mcd_backup = Utilities::ReadMCD(0,0);
 				Utilities::WriteMCD(0,0,_replay.Data());
+				if(!g_Conf->Replay.ReportPath.IsEmpty())
+				{
+					_report.reset(new ReplayReport());
+					if(!_report->Open(g_Conf->Replay.ReportPath))
+						_console.Warning(L"REPLAY: can't write to " + g_Conf->Replay.ReportPath);
+					frameLimitBypass(true);
+				}
 			}
 			else
 			{
@@ -90,6 +103,21 @@ public:
 	void Close()
 	{
 		_is_init = false;
+		if(_seek_until >= 0)
+		{
+			gsForceFrameSkip(false);
+			frameLimitBypass(false);
+			_seek_until = -1;
+		}
+		_seek_request = 0;
+		if(_report)
+		{
+			_report->Close();
+			_console.WriteLn(Color_StrongGreen, _report->Summary());
+			_report.reset();
+			frameLimitBypass(false);
+		}
+		g_Conf->Replay.ReportPath.Clear();
 		_replay = Replay();
 		Utilities::RestoreSettings();
 		if(_mcd_backup.size())
@@ -115,8 +143,10 @@ public:
 	}
 	void NextFrame()
 	{
-		if(!_replay.Pos())
-			_console.WriteLn(Color_StrongGreen, "REPLAY: starting playback. Press F4 to fast-forward.");
+		if(!_replay.Pos() && _report)
+			_console.WriteLn(Color_StrongGreen, "REPLAY: starting batch playback of %u frames.", (uint)_replay.Length());
+		else if(!_replay.Pos())
+			_console.WriteLn(Color_StrongGreen, "REPLAY: starting playback. Press F4 to fast-forward, Page Up/Page Down to seek.");
 
 		if(_replay.Pos() >= _replay.Length())
 		{
@@ -127,11 +157,58 @@ public:
 			_replay.NextFrame();
 	}
 	void AcceptInput(int){}
+	void RequestSeek(s64 frames)
+	{
+		// a batch run hashes every frame in order
+		if(_report)
+			return;
+		_seek_request += frames;
+	}
+	// called at the start of every vsync, from the EE thread
+	void Vsync()
+	{
+		if(_report && _replay.Pos() < _replay.Length())
+			_report->Record(_replay.Pos());
+
+		if(_seek_until >= 0 && (s64)_replay.Pos() >= _seek_until)
+		{
+			_seek_until = -1;
+			gsForceFrameSkip(false);
+			frameLimitBypass(false);
+		}
+
+		s64 frames = _seek_request.exchange(0);
+		if(!frames || _replay.Mode() != Playback || !_replay.Length())
+			return;
+
+		s64 target = (s64)_replay.Pos() + frames;
+		target = std::max<s64>(0, std::min<s64>(target, _replay.Length() - 1));
+		try
+		{
+			// the frames between the keyframe and the target are run without being shown
+			s64 from = _replay.Seek(target);
+			if(from < target)
+			{
+				_seek_until = target;
+				gsForceFrameSkip(true);
+				frameLimitBypass(true);
+			}
+			_console.WriteLn(Color_StrongGreen, "REPLAY: seeking to %d:%02d.", (int)(target / 3600), (int)(target / 60 % 60));
+		}
+		catch(std::exception& e)
+		{
+			_console.Warning("REPLAY: %s", e.what());
+		}
+	}
 	void Stop()
 	{
-		Utilities::ExecuteOnMainThread([&]() {
+		bool exit = !g_Conf->Replay.ReportPath.IsEmpty() && !wxGetApp().HasGUI();
+		Utilities::ExecuteOnMainThread([exit]() {
 			CoreThread.Reset();
 			UI_EnableEverything();
+			// a batch run started with --nogui is over with its replay
+			if(exit)
+				wxGetApp().PostIdleAppMethod(&Pcsx2App::PrepForExit);
 		});
 	}
 	bool IsInit()
@@ -142,7 +219,12 @@ protected:
 	IConsoleWriter _console;
 	bool _is_init;
 	Replay _replay;
+	// set for a batch run (see --replayreport)
+	std::unique_ptr<ReplayReport> _report;
 	Utilities::block_type _mcd_backup;
+	std::atomic<s64> _seek_request;
+	// frame a seek is running to, -1 if none
+	s64 _seek_until;
 };
 
 IReplayPlugin* IReplayPlugin::instance = 0;
@@ -13,4 +13,6 @@ public:
 	virtual void Init() = 0;
 	virtual bool IsInit() = 0;
 	virtual void Close() = 0;
+	// Moves playback by the given number of frames at the next vsync. Can be called from any thread.
+	virtual void RequestSeek(s64 frames) = 0;
 };
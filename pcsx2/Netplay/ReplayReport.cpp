@@ -0,0 +1,74 @@
+#include "PrecompiledHeader.h"
+#include "ReplayReport.h"
+#include "StateChecksum.h"
+#include <iomanip>
+
+static const int WindowFrames = 60;
+
+ReplayReport::ReplayReport()
+	: _start(0), _last(0), _window_start(0), _window_frames(0), _frames(0), _slowest(0), _fastest(0)
+{
+}
+
+bool ReplayReport::Open(const wxString& path)
+{
+	_file.open(path.mb_str(), std::ios::out | std::ios::trunc);
+	if(!_file.is_open())
+		return false;
+	_file << "frame,registers,ee_ram,iop_ram\n";
+	return true;
+}
+
+void ReplayReport::Record(u64 frame)
+{
+	u64 now = GetCPUTicks();
+	if(!_frames)
+	{
+		_start = now;
+		_window_start = now;
+	}
+	_last = now;
+	_frames++;
+
+	if(++_window_frames >= WindowFrames)
+	{
+		double seconds = (double)(now - _window_start) / GetTickFrequency();
+		if(seconds > 0)
+		{
+			double fps = WindowFrames / seconds;
+			if(!_slowest || fps < _slowest)
+				_slowest = fps;
+			if(fps > _fastest)
+				_fastest = fps;
+		}
+		_window_start = now;
+		_window_frames = 0;
+	}
+
+	if(!_file.is_open())
+		return;
+	shoryu::state_checksum checksum = StateChecksum::Compute(frame, (uint)(frame % StateChecksum::Slices));
+	_file << frame << std::hex << std::setfill('0');
+	for(int i = 0; i < checksum.parts; i++)
+		_file << ',' << std::setw(16) << checksum.part[i];
+	_file << std::dec << '\n';
+}
+
+wxString ReplayReport::Summary() const
+{
+	if(!_frames)
+		return wxT("REPLAY: no frames played.");
+
+	double seconds = (double)(_last - _start) / GetTickFrequency();
+	double fps = seconds > 0 ? (_frames - 1) / seconds : 0;
+	return wxString::Format(wxT("REPLAY: %llu frames in %.2f s, %.1f fps on average, %.1f fps in the slowest second, %.1f fps in the fastest."),
+		_frames, seconds, fps, _slowest, _fastest);
+}
+
+void ReplayReport::Close()
+{
+	if(!_file.is_open())
+		return;
+	_file << "# " << Summary().mb_str() << '\n';
+	_file.close();
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "App.h"
+#include <fstream>
+
+// Output of a batch replay run (see --replayreport): a CSV with the state
+// hashes of every frame, followed by the emulation speed over the run.
+// Hashes are StateChecksum digests of the registers and one slice of main
+// memory, so two runs of a replay agree line for line as long as emulation
+// is deterministic, and the first line that differs names the frame.
+class ReplayReport
+{
+public:
+	ReplayReport();
+
+	// Starts writing to the given file. Returns false if it can't be opened.
+	bool Open(const wxString& path);
+	// Hashes the machine for the given frame. Call from the EE thread at vsync.
+	void Record(u64 frame);
+	// Average speed of the run, and of its slowest and fastest second.
+	wxString Summary() const;
+	// Appends the summary to the file and closes it.
+	void Close();
+protected:
+	std::ofstream _file;
+	u64 _start;				// ticks at the first frame
+	u64 _last;				// ticks at the latest frame
+	u64 _window_start;
+	int _window_frames;
+	u64 _frames;
+	double _slowest;
+	double _fastest;
+};
@@ -7,5 +7,7 @@ struct ReplaySettings
 	bool FastForward;
 
 	wxString FilePath;
+	// set for a batch run: where the frame hashes and speed go (see ReplayReport)
+	wxString ReportPath;
 	ReplaySettings();
 };
\ No newline at end of file
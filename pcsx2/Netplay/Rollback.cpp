@@ -0,0 +1,66 @@
+#include "PrecompiledHeader.h"
+#include "Rollback.h"
+
+RollbackBuffer::RollbackBuffer(size_t capacity) : _states(new DeltaStateRing(capacity)) {}
+
+void RollbackBuffer::Save(s64 frame)
+{
+	Prune();
+
+	// the frame a rewind resumes from is already saved, and
+	// the VM hasn't moved since it was loaded
+	if(!_snapshots.empty() && _snapshots.back().frame == frame)
+		return;
+
+	Snapshot s;
+	s.frame = frame;
+	s.hook = GetIOPHookState();
+	s.seq = _states->Save();
+	_snapshots.push_back(s);
+}
+
+bool RollbackBuffer::Rewind(s64 frame, s64& snapshot_frame, IOPHookState& hook)
+{
+	Prune();
+	while(!_snapshots.empty() && _snapshots.back().frame > frame)
+		_snapshots.pop_back();
+	if(_snapshots.empty())
+		return false;
+
+	auto& found = _snapshots.back();
+	snapshot_frame = found.frame;
+	hook = found.hook;
+
+	auto states = _states;
+	auto seq = found.seq;
+	GetCoreThread().LoadStateInThread([states, seq]()
+	{
+		if(!states->Load(seq))
+			throw std::exception("Rollback snapshot is no longer available.");
+	});
+	return true;
+}
+
+void RollbackBuffer::Clear()
+{
+	_states->Clear();
+	_snapshots.clear();
+}
+
+size_t RollbackBuffer::Capacity() const
+{
+	return _states->GetCapacity();
+}
+
+bool RollbackBuffer::Overflowed() const
+{
+	s64 lost = _states->GetLostSeq();
+	return lost >= 0 && lost + (s64)Capacity() >= _states->GetNextSeq();
+}
+
+// forgets snapshots the ring has dropped
+void RollbackBuffer::Prune()
+{
+	while(!_snapshots.empty() && !_states->Contains(_snapshots.front().seq))
+		_snapshots.pop_front();
+}
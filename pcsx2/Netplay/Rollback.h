@@ -0,0 +1,40 @@
+#pragma once
+#include "App.h"
+#include "IOPHook.h"
+#include "DeltaState.h"
+#include <deque>
+#include <memory>
+
+// Ring of in-memory savestates taken at vsync, keyed by netplay frame.
+// Used to rewind the VM when a predicted remote input turns out to be wrong.
+// Snapshots are delta savestates, so only the EE memory pages written
+// between two frames are copied on each save.
+class RollbackBuffer
+{
+public:
+	RollbackBuffer(size_t capacity);
+
+	// Saves the current VM state for the given frame, replacing the oldest snapshot.
+	void Save(s64 frame);
+	// Finds the newest snapshot taken at or before the given frame, drops every
+	// snapshot after it and schedules it to be loaded by the core thread.
+	// Returns false if no such snapshot is left.
+	bool Rewind(s64 frame, s64& snapshot_frame, IOPHookState& hook);
+	void Clear();
+	size_t Capacity() const;
+	// True if snapshots of the last Capacity() saves were dropped because the
+	// delta states ran out of undo pages, rather than aged out of the window.
+	bool Overflowed() const;
+protected:
+	struct Snapshot
+	{
+		s64 frame;
+		s64 seq;
+		IOPHookState hook;
+	};
+	void Prune();
+
+	// shared with the pending load, which may run after the buffer is gone
+	std::shared_ptr<DeltaStateRing> _states;
+	std::deque<Snapshot> _snapshots;
+};
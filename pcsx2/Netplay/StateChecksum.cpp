@@ -0,0 +1,166 @@
+#include "PrecompiledHeader.h"
+#include "StateChecksum.h"
+#include "IopCommon.h"
+#include "VU.h"
+#include <emmintrin.h>
+
+namespace StateChecksum
+{
+	static const u64 Prime1 = 0x9E3779B185EBCA87ULL;
+	static const u64 Prime2 = 0xC2B2AE3D27D4EB4FULL;
+	static const u32 Prime32 = 0x9E3779B1U;
+
+	// the lanes are scrambled after every block of stripes, and each stripe of a
+	// block gets its own keys, so moving data around changes the hash
+	static const int StripeSize = 64;
+	static const int StripesPerBlock = 16;
+
+	static __aligned16 u64 s_keys[StripesPerBlock][StripeSize / 8];
+
+	static bool InitKeys()
+	{
+		u64 x = Prime1;
+		for(int i = 0; i < StripesPerBlock; i++)
+		{
+			for(int j = 0; j < StripeSize / 8; j++)
+			{
+				// splitmix64
+				x += Prime1;
+				u64 z = x;
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+				s_keys[i][j] = z ^ (z >> 31);
+			}
+		}
+		return true;
+	}
+
+	static const bool s_keys_ready = InitKeys();
+
+	static __fi u64 Mix(u64 h)
+	{
+		h ^= h >> 33;
+		h *= Prime2;
+		h ^= h >> 29;
+		h *= Prime1;
+		h ^= h >> 32;
+		return h;
+	}
+
+	static __fi void Accumulate(__m128i (&acc)[4], const u8* p, const u64* keys)
+	{
+		for(int i = 0; i < 4; i++)
+		{
+			__m128i data = _mm_loadu_si128((const __m128i*)p + i);
+			__m128i key = _mm_xor_si128(data, _mm_load_si128((const __m128i*)keys + i));
+			// 32x32->64 product of the low and high half of every keyed lane
+			__m128i product = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+			acc[i] = _mm_add_epi64(acc[i], _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)));
+			acc[i] = _mm_add_epi64(acc[i], product);
+		}
+	}
+
+	static __fi void Scramble(__m128i (&acc)[4])
+	{
+		const __m128i prime = _mm_set1_epi32((int)Prime32);
+		for(int i = 0; i < 4; i++)
+		{
+			__m128i a = _mm_xor_si128(acc[i], _mm_srli_epi64(acc[i], 47));
+			// 64x32 multiply out of two 32x32 ones
+			__m128i lo = _mm_mul_epu32(a, prime);
+			__m128i hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+			acc[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+		}
+	}
+
+	u64 Hash(const void* data, size_t size)
+	{
+		const u8* p = (const u8*)data;
+		__aligned16 u64 lanes[8];
+		for(int i = 0; i < 8; i++)
+			lanes[i] = Prime1 * (i + 1);
+		__m128i acc[4];
+		for(int i = 0; i < 4; i++)
+			acc[i] = _mm_load_si128((const __m128i*)lanes + i);
+
+		size_t stripes = size / StripeSize;
+		for(size_t s = 0; s < stripes; s++, p += StripeSize)
+		{
+			Accumulate(acc, p, s_keys[s % StripesPerBlock]);
+			if(s % StripesPerBlock == StripesPerBlock - 1)
+				Scramble(acc);
+		}
+
+		for(int i = 0; i < 4; i++)
+			_mm_store_si128((__m128i*)lanes + i, acc[i]);
+
+		u64 h = size * Prime1;
+		for(int i = 0; i < 8; i++)
+			h = Mix(h ^ lanes[i]) * Prime2;
+
+		size_t tail = size % StripeSize;
+		for(; tail >= 8; tail -= 8, p += 8)
+		{
+			u64 v;
+			memcpy(&v, p, 8);
+			h = Mix(h ^ (v * Prime1));
+		}
+		for(; tail; tail--, p++)
+			h = Mix(h ^ (*p * Prime2));
+		return h;
+	}
+
+	static u64 HashRegisters()
+	{
+		// the register files only, the structs also hold host pointers
+		u64 h = Hash(&cpuRegs, offsetof(cpuRegisters, code));
+		h = Mix(h ^ Hash(&cpuRegs.cycle, sizeof(cpuRegs.cycle)));
+		h = Mix(h ^ Hash(&fpuRegs, sizeof(fpuRegs)));
+		for(int i = 0; i < 2; i++)
+		{
+			h = Mix(h ^ Hash(vuRegs[i].VF, sizeof(vuRegs[i].VF)));
+			h = Mix(h ^ Hash(vuRegs[i].VI, sizeof(vuRegs[i].VI)));
+		}
+		h = Mix(h ^ Hash(&psxRegs, offsetof(psxRegisters, code)));
+		h = Mix(h ^ Hash(&psxRegs.cycle, sizeof(psxRegs.cycle)));
+		return h;
+	}
+
+	shoryu::state_checksum Compute(int64_t frame, uint slice)
+	{
+		const uint ee_slice = Ps2MemSize::MainRam / Slices;
+		const uint iop_slice = Ps2MemSize::IopRam / Slices;
+
+		shoryu::state_checksum checksum;
+		checksum.frame = frame;
+		checksum.parts = PartCount;
+		checksum.part[Registers] = HashRegisters();
+		checksum.part[EeRam] = Hash(eeMem->Main + (slice % Slices) * ee_slice, ee_slice);
+		checksum.part[IopRam] = Hash(iopMem->Main + (slice % Slices) * iop_slice, iop_slice);
+		return checksum;
+	}
+
+	wxString Describe(u32 parts, uint slice)
+	{
+		const uint ee_slice = Ps2MemSize::MainRam / Slices;
+		const uint iop_slice = Ps2MemSize::IopRam / Slices;
+		slice %= Slices;
+
+		wxString s;
+		if(parts & (1 << Registers))
+			s += wxT("CPU/VU registers");
+		if(parts & (1 << EeRam))
+		{
+			if(!s.IsEmpty())
+				s += wxT(", ");
+			s += wxString::Format(wxT("EE RAM 0x%08x-0x%08x"), slice * ee_slice, (slice + 1) * ee_slice - 1);
+		}
+		if(parts & (1 << IopRam))
+		{
+			if(!s.IsEmpty())
+				s += wxT(", ");
+			s += wxString::Format(wxT("IOP RAM 0x%06x-0x%06x"), slice * iop_slice, (slice + 1) * iop_slice - 1);
+		}
+		return s;
+	}
+}
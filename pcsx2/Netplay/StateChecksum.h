@@ -0,0 +1,33 @@
+#pragma once
+#include "App.h"
+#include "shoryu/session.h"
+
+// Digests of the emulated machine, exchanged between netplay peers to catch
+// a desync at the frame it happens instead of when the game visibly diverges.
+//
+// A check hashes the CPU and VU registers in full, plus one slice of EE and
+// IOP main memory; the slice moves on with every check, so all of memory is
+// covered every Slices checks while each check stays around half a megabyte.
+// Since the slice follows from the frame number, every peer hashes the same
+// addresses on the same frame, and a mismatch points at the region that differs.
+namespace StateChecksum
+{
+	enum Part
+	{
+		Registers,
+		EeRam,
+		IopRam,
+		PartCount
+	};
+
+	static const uint Slices = 64;
+
+	// 64-bit hash of a block, four SSE2 lanes wide.
+	u64 Hash(const void* data, size_t size);
+
+	// Digest of the machine as it is now, taken for the given frame.
+	shoryu::state_checksum Compute(int64_t frame, uint slice);
+
+	// Names the parts set in the mask, with the addresses of the slice.
+	wxString Describe(u32 parts, uint slice);
+}
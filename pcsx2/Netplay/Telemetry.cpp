@@ -0,0 +1,155 @@
+#include "PrecompiledHeader.h"
+#include "Telemetry.h"
+#include <algorithm>
+
+static const int WindowFrames = 60;
+
+// The sample of the same peer in another frame, if it was there.
+static const NetplayPeerStats* FindPeer(const NetplayFrameStats& stats, const NetplayPeerStats& peer)
+{
+	for(const NetplayPeerStats& p : stats.peers)
+	{
+		if(p.ep.host == peer.ep.host && p.ep.port == peer.ep.port)
+			return &p;
+	}
+	return nullptr;
+}
+
+static wxString PeerName(const NetplayPeerStats& p)
+{
+	wxString ep = wxString::Format(wxT("%s:%u"), wxString(zed_net_host_to_str(p.ep.host), wxConvLocal), (uint)p.ep.port);
+	if(p.side < 0)
+		return wxT("observer ") + ep;
+	return wxString::Format(wxT("player %d "), p.side + 1) + ep;
+}
+
+NetplayTelemetry::NetplayTelemetry()
+	: _window_advantage(0), _window_ready(false), _window_frames(0), _worst_advantage(0), _worst_stall(0), _frames(0)
+{
+}
+
+bool NetplayTelemetry::OpenTimeline(const wxString& path)
+{
+	_timeline.open(path.mb_str(), std::ios::out | std::ios::trunc);
+	if(!_timeline.is_open())
+		return false;
+	_timeline << "frame,delay,blocked_ms,advantage,peer,side,rtt,jitter,ack_latency,sent,received,resent,queue\n";
+	return true;
+}
+
+void NetplayTelemetry::Record(const NetplayFrameStats& stats)
+{
+	if(!_frames)
+	{
+		_first = stats;
+		_last = stats;
+		_window_start = stats;
+	}
+
+	u64 blocked = stats.blocked_ms - _last.blocked_ms;
+	if(blocked > _worst_stall)
+		_worst_stall = blocked;
+	if(stats.advantage > _worst_advantage)
+		_worst_advantage = stats.advantage;
+
+	if(_timeline.is_open())
+	{
+		for(const NetplayPeerStats& p : stats.peers)
+		{
+			const NetplayPeerStats* prev = FindPeer(_last, p);
+			_timeline << stats.frame << ',' << stats.delay << ',' << blocked << ',' << stats.advantage << ','
+				<< zed_net_host_to_str(p.ep.host) << ':' << p.ep.port << ',' << p.side << ','
+				<< p.rtt << ',' << p.jitter << ',' << p.ack_latency << ','
+				<< (p.packets_sent - (prev ? prev->packets_sent : 0)) << ','
+				<< (p.packets_received - (prev ? prev->packets_received : 0)) << ','
+				<< (p.msgs_resent - (prev ? prev->msgs_resent : 0)) << ','
+				<< p.queue_depth << '\n';
+		}
+	}
+
+	_last = stats;
+	_frames++;
+
+	AddToWindow(stats);
+	if(++_window_frames >= WindowFrames)
+		CloseWindow(stats);
+}
+
+void NetplayTelemetry::AddToWindow(const NetplayFrameStats& stats)
+{
+	_window_advantage += stats.advantage;
+	for(const NetplayPeerStats& p : stats.peers)
+	{
+		auto it = std::find_if(_window_sums.begin(), _window_sums.end(), [&](const PeerSums& sums)
+		{
+			return sums.ep.host == p.ep.host && sums.ep.port == p.ep.port;
+		});
+		if(it == _window_sums.end())
+		{
+			PeerSums sums = {};
+			sums.ep = p.ep;
+			it = _window_sums.insert(_window_sums.end(), sums);
+		}
+		if(p.rtt >= 0)
+		{
+			it->rtt += p.rtt;
+			it->jitter += p.jitter;
+			it->rtt_samples++;
+		}
+		if(p.ack_latency >= 0)
+		{
+			it->ack_latency += p.ack_latency;
+			it->ack_samples++;
+		}
+		it->queue_depth += p.queue_depth;
+		it->samples++;
+	}
+}
+
+void NetplayTelemetry::CloseWindow(const NetplayFrameStats& stats)
+{
+	// peers of the window are the ones of its last frame, counters become deltas
+	_window = stats;
+	_window.advantage = _window_advantage / _window_frames;
+	_window.blocked_ms = stats.blocked_ms - _window_start.blocked_ms;
+	for(NetplayPeerStats& p : _window.peers)
+	{
+		for(const PeerSums& sums : _window_sums)
+		{
+			if(sums.ep.host != p.ep.host || sums.ep.port != p.ep.port)
+				continue;
+			p.rtt = sums.rtt_samples ? (s32)(sums.rtt / sums.rtt_samples) : -1;
+			p.jitter = sums.rtt_samples ? (s32)(sums.jitter / sums.rtt_samples) : -1;
+			p.ack_latency = sums.ack_samples ? (s32)(sums.ack_latency / sums.ack_samples) : -1;
+			p.queue_depth = (u32)(sums.queue_depth / sums.samples);
+			break;
+		}
+		// peers seen for the first time in the window keep their totals
+		const NetplayPeerStats* start = FindPeer(_window_start, p);
+		if(!start)
+			continue;
+		p.packets_sent -= start->packets_sent;
+		p.packets_received -= start->packets_received;
+		p.msgs_resent -= start->msgs_resent;
+	}
+	_window_start = stats;
+	_window_sums.clear();
+	_window_advantage = 0;
+	_window_frames = 0;
+	_window_ready = true;
+}
+
+wxString NetplayTelemetry::Summary() const
+{
+	if(!_frames)
+		return wxEmptyString;
+
+	wxString s = wxString::Format(wxT("NETPLAY: %llu frames, %llu ms blocked waiting for inputs (worst frame %llu ms), worst frame advantage %lld."),
+		_frames, _last.blocked_ms - _first.blocked_ms, _worst_stall, _worst_advantage);
+	for(const NetplayPeerStats& p : _last.peers)
+	{
+		s += wxT("\n  ") + PeerName(p) + wxString::Format(wxT(": rtt %d ms (jitter %d), ack %d ms, %u packets sent, %u received, %u messages resent."),
+			p.rtt, p.jitter, p.ack_latency, p.packets_sent, p.packets_received, p.msgs_resent);
+	}
+	return s;
+}
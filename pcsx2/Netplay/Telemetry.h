@@ -0,0 +1,80 @@
+#pragma once
+#include "App.h"
+#include "shoryu/zed_net.h"
+#include <fstream>
+#include <vector>
+
+// Counters of one peer as the session sees them, counters are totals.
+// Peers come and go (observers, dropped players), so samples are matched
+// by endpoint rather than by position.
+struct NetplayPeerStats
+{
+	zed_net_address_t ep;
+	s32 side;			// -1 for observers
+	s32 rtt;
+	s32 jitter;
+	s32 ack_latency;
+	u32 packets_sent;
+	u32 packets_received;
+	u32 msgs_resent;
+	u32 queue_depth;
+};
+
+// Everything sampled once per netplay frame.
+struct NetplayFrameStats
+{
+	s64 frame;
+	u64 blocked_ms;		// total time spent waiting for inputs
+	s64 advantage;		// frames our inputs run ahead of the slowest side
+	s32 delay;
+	std::vector<NetplayPeerStats> peers;
+};
+
+// Turns per-frame samples into a CSV timeline (one row per frame and peer,
+// counters as per-frame deltas) and a once-a-second summary, shown on the
+// GS overlay and dumped to the console when the session ends.
+class NetplayTelemetry
+{
+public:
+	NetplayTelemetry();
+
+	// Starts writing the timeline to the given file. Returns false if it can't be opened.
+	bool OpenTimeline(const wxString& path);
+	void Record(const NetplayFrameStats& stats);
+	// Totals since the first sample, for the console.
+	wxString Summary() const;
+
+	// Set by Record() when a new one-second window has been closed.
+	bool HasWindow() const { return _window_ready; }
+	// The last closed window, for the overlay: frame advantage and the peers' rtt,
+	// jitter, ack latency and queue depth averaged over the window, counters and
+	// blocked time as totals over it, delay and frame as sampled at its end.
+	const NetplayFrameStats& Window() const { return _window; }
+	void ClearWindow() { _window_ready = false; }
+protected:
+	// Gauges of one peer summed over the current window. Latencies are -1 until
+	// the first measurement, such samples are left out.
+	struct PeerSums
+	{
+		zed_net_address_t ep;
+		s64 rtt, jitter, ack_latency, queue_depth;
+		u32 rtt_samples, ack_samples, samples;
+	};
+
+	void AddToWindow(const NetplayFrameStats& stats);
+	void CloseWindow(const NetplayFrameStats& stats);
+
+	std::ofstream _timeline;
+
+	NetplayFrameStats _first;
+	NetplayFrameStats _last;
+	NetplayFrameStats _window_start;
+	NetplayFrameStats _window;
+	std::vector<PeerSums> _window_sums;
+	s64 _window_advantage;
+	bool _window_ready;
+	int _window_frames;
+	s64 _worst_advantage;
+	u64 _worst_stall;
+	u64 _frames;
+};
@@ -115,7 +115,6 @@ NetplaySettingsPanelBase::NetplaySettingsPanelBase( wxWindow* parent, wxWindowID
 	fgSizer31->Add( m_hostPortSpinCtrl, 0, wxALL|wxEXPAND, 5 );
 
 	m_observeCheckBox = new wxCheckBox( m_connect, wxID_ANY, _("Observe"), wxDefaultPosition, wxDefaultSize, 0 );
-	m_observeCheckBox->Enable( false );
 
 	fgSizer31->Add( m_observeCheckBox, 0, wxALL, 5 );
 
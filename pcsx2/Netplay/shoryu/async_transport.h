@@ -2,6 +2,7 @@
 #include <cstdint>
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <unordered_map>
 #include <thread>
 #include <system_error>
@@ -48,14 +49,10 @@ namespace shoryu
 			std::array<transaction_data<Operation,BufferSize>, BufferQueueSize> buffer;
 			transaction_data<Operation,BufferSize>& next()
 			{
-				std::unique_lock<std::mutex> lock(m_mutex);
-				uint32_t i = m_next_buffer;
-				m_next_buffer = ++m_next_buffer % BufferQueueSize;
-				return buffer[i];
+				return buffer[m_next_buffer.fetch_add(1, std::memory_order_relaxed) % BufferQueueSize];
 			}
 		protected:
-			volatile uint32_t m_next_buffer;
-			std::mutex m_mutex;
+			std::atomic<uint32_t> m_next_buffer;
 		};
 
 	template<class DataType, int BufferQueueSize = 256, int BufferSize = 1024>
@@ -72,7 +69,7 @@ namespace shoryu
 #ifdef ATPORT_ENABLE_LOG
 		std::fstream log;
 #endif
-		async_transport() : m_is_running(false)
+		async_transport() : m_is_running(false), m_is_open(false)
 		{
 #ifdef ATPORT_ENABLE_LOG
 			std::string filename = "atport.";
@@ -87,22 +84,38 @@ namespace shoryu
 			stop();
 		}
 		//Not thread-safe. Avoid concurrent calls with other methods
-		void start(unsigned short port, int thread_num = 3)
+		//Returns false if the socket can't be opened (see zed_net_get_error)
+		bool start(unsigned short port, int thread_num = 3)
 		{
+			if (zed_net_udp_socket_open(&m_socket, port, true) != 0)
+				return false;
+			if (zed_net_poller_open(&m_poller, &m_socket) != 0)
+			{
+				zed_net_socket_close(&m_socket);
+				return false;
+			}
 			m_is_running = true;
-			zed_net_udp_socket_open(&m_socket, port, false);
+			m_is_open = true;
 			recv_thread.reset(new std::thread(&async_transport::receive_loop, this));
+			return true;
 		}
 		//Not thread-safe. Avoid concurrent calls with other methods
 		void stop()
 		{
 			m_is_running = false;
-			zed_net_socket_close(&m_socket);
+			if (m_is_open)
+				zed_net_poller_wake(&m_poller);
 			if (recv_thread && recv_thread->joinable())
 			{
 				recv_thread->join();
 				recv_thread.reset();
 			}
+			if (m_is_open)
+			{
+				zed_net_poller_close(&m_poller);
+				zed_net_socket_close(&m_socket);
+				m_is_open = false;
+			}
 			m_peers.clear();
 		}
 
@@ -138,13 +151,30 @@ namespace shoryu
 				return send_impl(ep);
 			return -1;
 		}
+		//Sends the queued messages of several peers in one batch
+		template<class EndpointRange>
+		int send(const EndpointRange& eps)
+		{
+			if(m_is_running)
+				return send_many_impl(eps);
+			return -1;
+		}
 		inline const peer_list_type peers()
 		{
+			std::unique_lock<std::mutex> lock(m_mutex);
 			peer_list_type list;
 			for (auto& kv : m_peers)
 				list.push_back(kv.second->data);
 			return list;
 		}
+		//Calls f with the data of every peer under the lock, without copying the list
+		template<class F>
+		inline void for_each_peer(F f)
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			for (auto& kv : m_peers)
+				f((const peer_data_type&)kv.second->data);
+		}
 		inline const peer_data_type& peer(const zed_net_address_t& ep)
 		{
 			return m_peers[ep]->data;
@@ -175,6 +205,45 @@ namespace shoryu
 
 			return send_n;
 		}
+		template<class EndpointRange>
+		int send_many_impl(const EndpointRange& eps)
+		{
+			std::array<zed_net_datagram_t, ZED_NET_BATCH_MAX> datagrams;
+			int count = 0;
+			int send_n = 0;
+			for (auto& ep : eps)
+			{
+				if ((size_t)count == datagrams.size())
+				{
+					send_batch(datagrams.data(), count);
+					count = 0;
+				}
+				transaction_data<OperationType::Send,BufferSize>& t = m_send_buffer.next();
+				t.ep = ep;
+				oarchive oa(t.buffer.data(), t.buffer.data() + t.buffer.size());
+				send_n += find_peer(ep).serialize_datagram(oa);
+				t.buffer_length = oa.pos();
+
+				zed_net_datagram_t& d = datagrams[count++];
+				d.address = ep;
+				d.data = t.buffer.data();
+				d.size = d.length = (int)t.buffer_length;
+			}
+			send_batch(datagrams.data(), count);
+			return send_n;
+		}
+		void send_batch(const zed_net_datagram_t* datagrams, int count)
+		{
+			if (count && zed_net_udp_socket_send_many(&m_socket, datagrams, count) != count)
+			{
+				if (m_err_handler)
+					m_err_handler(std::error_code());
+			}
+#ifdef ATPORT_ENABLE_LOG
+			for (int i = 0; i < count; i++)
+				log << "[" << time_ms() << "] send " << datagrams[i].length << " " << zed_net_host_to_str(datagrams[i].address.host) << ":" << datagrams[i].address.port << "\n";
+#endif
+		}
 		inline uint64_t queue_impl(const zed_net_address_t& ep, const DataType& data)
 		{
 			return find_peer(ep).queue_msg(data);
@@ -187,37 +256,51 @@ namespace shoryu
 		inline peer_type& find_peer(const zed_net_address_t& ep)
 		{
 			std::unique_lock<std::mutex> lock(m_mutex);
-			if(m_peers.find(ep) == m_peers.end())
+			std::shared_ptr<peer_type>& p = m_peers[ep];
+			if(!p)
 			{
-				m_peers[ep].reset(new peer_type());
-				m_peers[ep]->data.ep = ep;
+				p.reset(new peer_type());
+				p->data.ep = ep;
 			}
-			return *m_peers[ep];
+			return *p;
 		}
 
+		// Sleeps until the socket is readable or stop() wakes it up, then drains
+		// every pending datagram in batches before waiting again.
 		void receive_loop()
 		{
+			std::array<zed_net_datagram_t, ZED_NET_BATCH_MAX> datagrams;
+			for (size_t i = 0; i < datagrams.size(); i++)
+			{
+				datagrams[i].data = m_recv_buffer[i].buffer.data();
+				datagrams[i].size = BufferSize;
+			}
+
 			while (m_is_running)
 			{
-				transaction_data<OperationType::Recv,BufferSize>& t = m_recv_buffer.next();
-				int size;
-				
-				while(m_is_running && (size = zed_net_udp_socket_receive(&m_socket, &t.ep, t.buffer.data(), BufferSize)) <= 0)
+				int ready = zed_net_poller_wait(&m_poller, -1);
+				if (ready < 0)
 				{
-					if (size < 0)
+					if (m_err_handler)
 						m_err_handler(std::error_code());
-
-					//std::this_thread::yield();
+					// don't spin on a persistent error
 					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					continue;
 				}
 
-				if (size > 0)
+				int n;
+				while (m_is_running && (n = zed_net_udp_socket_receive_many(&m_socket, datagrams.data(), (int)datagrams.size())) > 0)
 				{
+					for (int i = 0; i < n; i++)
+					{
+						transaction_data<OperationType::Recv,BufferSize>& t = m_recv_buffer[i];
+						t.ep = datagrams[i].address;
+						t.buffer_length = datagrams[i].length;
 #ifdef ATPORT_ENABLE_LOG
-				log << "[" << time_ms() << "] recv " << size << " " << zed_net_host_to_str(t.ep.host) << ":" << t.ep.port << "\n";
+						log << "[" << time_ms() << "] recv " << t.buffer_length << " " << zed_net_host_to_str(t.ep.host) << ":" << t.ep.port << "\n";
 #endif
-					t.buffer_length = size;
-					finalize(t);
+						finalize(t);
+					}
 				}
 			}
 		}
@@ -249,14 +332,17 @@ namespace shoryu
 		receive_handler_type m_recv_handler;
 
 		volatile bool m_is_running;
+		bool m_is_open;
 
 		zed_net_socket_t m_socket;
+		zed_net_poller_t m_poller;
 		std::unique_ptr<std::thread> recv_thread;
 
 		peer_map_type m_peers;
 
 		transaction_buffer<OperationType::Send,BufferSize, BufferQueueSize> m_send_buffer;
-		transaction_buffer<OperationType::Recv,BufferSize, BufferQueueSize> m_recv_buffer;
+		//Only used by the receive thread, one per datagram of a batch
+		std::array<transaction_data<OperationType::Recv,BufferSize>, ZED_NET_BATCH_MAX> m_recv_buffer;
 
 		std::mutex m_mutex;
 	};
@@ -28,9 +28,7 @@ namespace std
 	{
 		size_t operator()(const zed_net_address_t &ep) const
 		{
-			string s(zed_net_host_to_str(ep.host));
-			s += ":" + to_string(ep.port);
-			return hash<string>{}(s);
+			return hash<uint64_t>{}(((uint64_t)ep.host << 16) | ep.port);
 		}
 	};
 
@@ -7,7 +7,7 @@
 namespace shoryu
 {
 	//protocol id should be defined at session-level
-	#define PROTOCOL_ID "PCS2OV4"
+	#define PROTOCOL_ID "PCS2OV8"
 	const size_t PROTOCOL_ID_LEN = sizeof(PROTOCOL_ID)/sizeof(char);
 
 	struct datagram_header
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+#include <algorithm>
+
+namespace shoryu
+{
+	// Picks the input delay of a running session from the connection quality.
+	// The host counts frames and the time the game spent stalled waiting for
+	// inputs, its own and the worst client's as reported with their inputs; at
+	// the end of every window it hands over the worst round trip among the
+	// peers, padded by their jitter, and gets the delay to use next.
+	//
+	// Delay goes up by a frame as soon as the padded round trip calls for it or
+	// the game stalled, so it is added before the stalls pile up. It comes down
+	// by a frame only after several calm windows in a row, so it doesn't
+	// oscillate around a borderline connection.
+	class delay_controller
+	{
+	public:
+		delay_controller(int window = 60, int calm_windows = 5, int min_delay = 1, int max_delay = 15)
+			: _window(window), _calm_windows(calm_windows), _min_delay(min_delay), _max_delay(max_delay)
+		{
+			reset();
+		}
+
+		// Delay needed to cover a round trip, at 60 frames per second.
+		static int delay_for_rtt(int32_t rtt)
+		{
+			return (rtt / 32) + 1;
+		}
+
+		void reset()
+		{
+			_frames = 0;
+			_stall_ms = 0;
+			_calm = 0;
+		}
+
+		void add_stall(int64_t ms)
+		{
+			_stall_ms += ms;
+		}
+
+		// Counts a frame. Returns true when the window is over and update()
+		// should be called.
+		bool next_frame()
+		{
+			return ++_frames >= _window;
+		}
+
+		// Ends the window. rtt is the worst padded round trip among the peers,
+		// or negative if none was measured yet.
+		int update(int delay, int32_t rtt)
+		{
+			int target = rtt < 0 ? delay : delay_for_rtt(rtt);
+			// more than a frame's worth of waiting per window
+			bool stalled = _stall_ms > 1000 / 60;
+			int next = delay;
+
+			if((target > delay || stalled) && delay < _max_delay)
+			{
+				next = delay + 1;
+				_calm = 0;
+			}
+			else if(target < delay && !_stall_ms && delay > _min_delay)
+			{
+				if(++_calm >= _calm_windows)
+				{
+					next = delay - 1;
+					_calm = 0;
+				}
+			}
+			else
+				_calm = 0;
+
+			_frames = 0;
+			_stall_ms = 0;
+			return next;
+		}
+	private:
+		int _window;
+		int _calm_windows;
+		int _min_delay;
+		int _max_delay;
+
+		int _frames;
+		int64_t _stall_ms;
+		int _calm;
+	};
+}
@@ -1,10 +1,11 @@
 #pragma once
 
-#include <list>
-#include <deque>
+#include <array>
+#include <vector>
 #include <memory>
 #include <mutex>
 #include <algorithm>
+#include <cstdlib>
 
 #include "datagram_header.h"
 #include "zed_net.h"
@@ -15,7 +16,8 @@ namespace shoryu
 	struct peer_data
 	{
 		peer_data()
-			: rtt_avg(-1),rtt_max(-1),rtt_min(-1),remote_time(0),recv_time(0)
+			: rtt_avg(-1),rtt_max(-1),rtt_min(-1),rtt_jitter(-1),remote_time(0),recv_time(0),
+			packets_sent(0),packets_received(0),msgs_resent(0),ack_latency(-1),queue_depth(0)
 		{
 		}
 		zed_net_address_t ep;
@@ -25,6 +27,15 @@ namespace shoryu
 		int32_t rtt_avg;
 		int32_t rtt_max;
 		int32_t rtt_min;
+		// smoothed deviation of the samples from rtt_avg
+		int32_t rtt_jitter;
+
+		// telemetry, counters are totals since the peer was first seen
+		uint32_t packets_sent;
+		uint32_t packets_received;
+		uint32_t msgs_resent;
+		int32_t ack_latency;	// smoothed time from a message's first send to its ack
+		uint32_t queue_depth;	// messages waiting for an ack
 	};
 
 	template<typename MsgType>
@@ -34,6 +45,7 @@ namespace shoryu
 		struct msg_wrapper
 		{
 			int64_t id;
+			uint64_t sent_time;	// first send, 0 until then
 			MsgType data;
 			inline void serialize(oarchive& a) const
 			{
@@ -46,63 +58,100 @@ namespace shoryu
 				data.deserialize(a);
 			}
 		};
-		typedef std::list<msg_wrapper> container_type;
+		// Pending messages live in the first queue_size slots. Slots are kept
+		// when messages are acknowledged, so queueing a message only copies it
+		// into storage from an earlier one; the pool grows only when more
+		// messages are pending than ever before (memory card sync).
+		typedef std::vector<msg_wrapper> container_type;
+		static const int received_window = 32;
 	public:
-		peer() : received_msgs(),next_id(1){}
+		peer() : next_id(1), queue_size(0), received_count(0), received_next(0), received_size(0) {}
 		peer_data<MsgType> data;
 
 		inline uint64_t queue_msg(const MsgType& msg)
 		{
 			std::unique_lock<std::mutex> lock(_mutex);
-			msg_wrapper m;
+			if(queue_size == msg_queue.size())
+				msg_queue.emplace_back();
+			msg_queue[queue_size].data = msg;
+
+			// drop the pending messages the new one carries along
+			size_t n = 0;
+			for(size_t i = 0; i < queue_size; i++)
+			{
+				if(msg_queue[queue_size].data.supersede(msg_queue[i].data))
+					continue;
+				if(n != i)
+					std::swap(msg_queue[n], msg_queue[i]);
+				++n;
+			}
+			if(n != queue_size)
+				std::swap(msg_queue[n], msg_queue[queue_size]);
+			queue_size = n;
+
+			msg_wrapper& m = msg_queue[queue_size++];
+			data.queue_depth = queue_size;
+			m.sent_time = 0;
 			m.id = next_id;
 			++next_id;
-			m.data = msg;
-			msg_queue.push_back(m);
 			return m.id;
 		}
 		inline void clear_queue()
 		{
 			std::unique_lock<std::mutex> lock(_mutex);
-			msg_queue.clear();
+			queue_size = 0;
 		}
 
+		// Called from the receive thread only.
 		template<typename Pred>
 		inline void deserialize_datagram(iarchive& ia, Pred& yield)
 		{
-			std::list<MsgType> data_list;
+			received_size = 0;
 			{
 				std::unique_lock<std::mutex> lock(_mutex);
 				data.recv_time = time_ms();
 				datagram_header header;
 				header.deserialize(ia);
 				data.remote_time = header.time;
-				msg_queue.remove_if([&](const msg_wrapper& msg) { return header.is_acknoledged(msg.id);});
+				data.packets_received++;
+				auto pending_end = std::remove_if(msg_queue.begin(), msg_queue.begin() + queue_size,
+					[&](const msg_wrapper& msg) -> bool {
+						if(!header.is_acknoledged(msg.id))
+							return false;
+						if(msg.sent_time)
+							estimate_ack_latency((int32_t)(data.recv_time - msg.sent_time));
+						return true;
+					});
+				queue_size = pending_end - msg_queue.begin();
+				data.queue_depth = queue_size;
 				
 				if(header.rtt != 0)
 					estimate_rtt( (int32_t)(time_ms() - header.rtt));
 
 				while(true)
 				{
-					msg_wrapper msg;
+					if(received_size == received.size())
+						received.emplace_back();
+					msg_wrapper& msg = received[received_size];
 					try
 					{
 						msg.deserialize(ia);
 					}
 					catch(std::ios_base::failure&){ break; }
 
-					// TODO: Optimize here
-					if(std::find(received_msgs.begin(), received_msgs.end(), msg.id) == received_msgs.end())
+					auto received_end = received_ids.begin() + received_count;
+					if(std::find(received_ids.begin(), received_end, msg.id) == received_end)
 					{
-						if (received_msgs.size() == 32)
-							received_msgs.pop_front();
-						received_msgs.push_back(msg.id);
-						data_list.push_back(msg.data);
+						received_ids[received_next] = msg.id;
+						received_next = (received_next + 1) % received_window;
+						if(received_count < received_window)
+							++received_count;
+						++received_size;
 					}
 				}
 			}
-			for (auto& data : data_list)
-				yield(data);
+			for (size_t i = 0; i < received_size; i++)
+				yield(received[i].data);
 		}
 
 		inline int serialize_datagram(oarchive& oa)
@@ -110,31 +159,32 @@ namespace shoryu
 			std::unique_lock<std::mutex> lock(_mutex);
 			datagram_header header;
 			header.set_defaults();
-			if(received_msgs.begin() != received_msgs.end())
+			if(received_count)
 			{
-				std::sort(received_msgs.begin(), received_msgs.end());
-				received_msgs_type::value_type min = *received_msgs.begin();
-				for(auto it = received_msgs.begin(); it != received_msgs.end(); ++it)
+				std::array<uint64_t, received_window> ids = received_ids;
+				std::sort(ids.begin(), ids.begin() + received_count);
+				uint64_t min = ids[0];
+				for(int i = 0; i < received_count; ++i)
 				{
-					if(*it - min> 31)
+					if(ids[i] - min > 31)
 						break;
-					header.acknoledge(*it);
+					header.acknoledge(ids[i]);
 				}
 			}
 			if(data.remote_time != 0)
 				header.rtt = data.remote_time + (time_ms() - data.recv_time);
 
 			header.serialize(oa);
-			container_type::size_type size = msg_queue.size();
+			container_type::size_type size = queue_size;
 			container_type::size_type i = 0;
 
-			std::vector<msg_wrapper*> msg_shuffle;
-			msg_shuffle.reserve(size);
-			for (auto& msg : msg_queue)
-				msg_shuffle.push_back(&msg);
+			msg_shuffle.clear();
+			for (size_t n = 0; n < queue_size; n++)
+				msg_shuffle.push_back(&msg_queue[n]);
 			
 			std::random_shuffle(msg_shuffle.begin(), msg_shuffle.end());
 
+			uint64_t now = time_ms();
 			for (auto& msg : msg_shuffle)
 			{
 				try
@@ -142,8 +192,13 @@ namespace shoryu
 					msg->serialize(oa);
 				}
 				catch(std::ios_base::failure&) { break; }
+				if(msg->sent_time)
+					data.msgs_resent++;
+				else
+					msg->sent_time = now;
 				++i;
 			}
+			data.packets_sent++;
 			if(size && !i)
 				throw std::runtime_error("Unable to serialize message: packet is too long.");
 
@@ -151,9 +206,18 @@ namespace shoryu
 		}
 	private:
 		container_type msg_queue;
-		typedef std::deque<uint64_t> received_msgs_type;
-		received_msgs_type received_msgs;
+		size_t queue_size;
+		std::vector<msg_wrapper*> msg_shuffle;
 		uint64_t next_id;
+
+		// ids of the last messages received, acknowledged with every datagram
+		std::array<uint64_t, received_window> received_ids;
+		int received_count;
+		int received_next;
+
+		// messages of the datagram being deserialized, receive thread only
+		container_type received;
+		size_t received_size;
 		inline void estimate_rtt(int32_t rtt)
 		{
 			if(data.rtt_min > rtt || data.rtt_min < 0)
@@ -162,9 +226,22 @@ namespace shoryu
 				data.rtt_max = rtt;
 
 			if(data.rtt_avg < 0)
+			{
 				data.rtt_avg = rtt;
+				data.rtt_jitter = rtt / 2;
+			}
 			else
+			{
+				data.rtt_jitter = (3*std::abs(rtt - data.rtt_avg) + 7*data.rtt_jitter)/10;
 				data.rtt_avg = (3*rtt + 7*data.rtt_avg)/10;
+			}
+		}
+		inline void estimate_ack_latency(int32_t latency)
+		{
+			if(data.ack_latency < 0)
+				data.ack_latency = latency;
+			else
+				data.ack_latency = (3*latency + 7*data.ack_latency)/10;
 		}
 		std::mutex _mutex;
 	};
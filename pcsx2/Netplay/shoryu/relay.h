@@ -0,0 +1,359 @@
+#pragma once
+#include <deque>
+#include <map>
+#include "session.h"
+
+namespace shoryu
+{
+	// Passes a session watched as an observer on to any number of spectators,
+	// so that the players only ever send to one observer. Spectators join the
+	// relay like an observer joins the host: they get the memory card stream,
+	// then the inputs of every side, each frame held back until it has been
+	// complete for the relay delay. A spectator that joins late starts from the
+	// first frame. Inputs are kept until every spectator has acknowledged them;
+	// once the first ones are dropped, new spectators are turned away.
+	template<typename FrameType, typename StateType>
+	class relay : std::noncopyable
+	{
+		typedef message<FrameType, StateType> message_type;
+		typedef std::function<bool(const StateType&, const StateType&)> state_check_handler_type;
+
+		enum SpectatorState
+		{
+			Joined,		// sent Info, waiting for the first Ready
+			Card,		// sent the memory card, waiting for the second Ready
+			Watching
+		};
+		struct spectator
+		{
+			SpectatorState state;
+			int64_t next_frame;		// next frame to queue
+			int64_t acked_frame;	// frames before it have been acknowledged
+			bool ended;
+		};
+		typedef std::map<zed_net_address_t, spectator> spectator_map;
+
+		// frames queued to a spectator per pass, and how many messages may wait
+		// for its acknowledgement before it gets more
+		static const int frames_per_pass = 8;
+		static const uint32_t max_queue_depth = 32;
+		static const int spectator_timeout = 10000;
+	public:
+		relay() : _running(false), _started(false), _finished(false), _first_frame(0), _base(0), _delay_ms(0), _delay(0)
+		{
+		}
+		~relay()
+		{
+			stop();
+		}
+
+		// Starts listening. Spectators are kept waiting until begin().
+		// Returns false if the port can't be opened.
+		bool start(int port, const StateType& state, int delay_ms, const state_check_handler_type& handler)
+		{
+			_state = state;
+			_delay_ms = delay_ms;
+			_state_check_handler = handler;
+			_async.receive_handler([&](const zed_net_address_t& ep, message_type& msg){recv_hdl(ep, msg);});
+			if(!_async.start(port, 2))
+				return false;
+			_running = true;
+			_thread.reset(new std::thread(&relay::loop, this));
+			return true;
+		}
+		void stop()
+		{
+			_running = false;
+			if(_thread && _thread->joinable())
+			{
+				_thread->join();
+				_thread.reset();
+			}
+			_async.stop();
+		}
+
+		// Appends a chunk of the memory card stream, before begin().
+		void add_data(const message_data& data)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_card.push_back(data);
+		}
+
+		// The watched session has started with the given input delay; inputs of
+		// the frames before it are never sent, by any side.
+		void begin(int num_players, int delay, const std::vector<userinfo>& usernames)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_inputs.resize(num_players);
+			_early.resize(num_players);
+			_usernames = usernames;
+			_delay = delay;
+			_first_frame = delay;
+			for(int side = 0; side < num_players; side++)
+				drain_early(side);
+			_started = true;
+		}
+
+		// Takes an input of the watched session, in any order, repeats included.
+		void push(int side, int64_t frame, const FrameType& f)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			if(side < 0 || (size_t)side >= _early.size())
+			{
+				// inputs can come in before begin()
+				if(_started || side < 0 || side >= 8)
+					return;
+				_early.resize(side + 1);
+			}
+			if(frame - _first_frame < (_started ? _base + (int64_t)_inputs[side].size() : 0))
+				return;
+			_early[side][frame] = f;
+			if(_started)
+				drain_early(side);
+		}
+
+		// The watched session is over: releases the frames still held back and
+		// ends the session of every spectator once it has them all. Waits up to
+		// timeout ms for the spectators to acknowledge, then stops.
+		void finish(int timeout)
+		{
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_finished = true;
+			}
+			msec end = time_ms() + timeout;
+			while(time_ms() < end)
+			{
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+					bool done = true;
+					for(auto& kv : _spectators)
+					{
+						if(!kv.second.ended || _async.peer(kv.first).queue_depth)
+							done = false;
+					}
+					if(done)
+						break;
+				}
+				sleep(17);
+			}
+			stop();
+		}
+
+		size_t num_spectators()
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			return _spectators.size();
+		}
+	protected:
+		// moves the inputs of a side that now follow on from the ones before; _mutex must be held
+		void drain_early(int side)
+		{
+			auto& inputs = _inputs[side];
+			auto& early = _early[side];
+			for(auto it = early.begin(); it != early.end();)
+			{
+				int64_t index = it->first - _first_frame - _base;
+				if(index > (int64_t)inputs.size())
+					break;
+				if(index == (int64_t)inputs.size())
+					inputs.push_back(it->second);
+				it = early.erase(it);
+			}
+
+			size_t complete = inputs.size();
+			for(auto& i : _inputs)
+				complete = std::min(complete, i.size());
+			while(_complete_time.size() < complete)
+				_complete_time.push_back(time_ms());
+		}
+
+		// frames that spectators may get; _mutex must be held
+		int64_t released()
+		{
+			if(_finished)
+				return _base + (int64_t)_complete_time.size();
+			msec now = time_ms();
+			auto it = std::upper_bound(_complete_time.begin(), _complete_time.end(), now - _delay_ms);
+			return _base + (it - _complete_time.begin());
+		}
+
+		// drops the inputs every spectator has acknowledged, but for the ones still
+		// sent along as history of the next frames; _mutex must be held
+		void trim()
+		{
+			if(_spectators.empty())
+				return;
+			int64_t acked = INT64_MAX;
+			for(auto& kv : _spectators)
+				acked = std::min(acked, kv.second.acked_frame);
+			while(_base < acked - message_type::max_history && !_complete_time.empty())
+			{
+				for(auto& inputs : _inputs)
+					inputs.pop_front();
+				_complete_time.pop_front();
+				_base++;
+			}
+		}
+
+		void loop()
+		{
+			std::vector<zed_net_address_t> eps;
+			while(_running)
+			{
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+					int64_t end = released();
+					eps.clear();
+					for(auto it = _spectators.begin(); it != _spectators.end();)
+					{
+						const zed_net_address_t& ep = it->first;
+						spectator& s = it->second;
+						if(_async.peer(ep).recv_time + spectator_timeout < time_ms())
+						{
+							it = _spectators.erase(it);
+							continue;
+						}
+						if(s.state == Watching && !_async.peer(ep).queue_depth)
+							s.acked_frame = s.next_frame;
+						if(s.state == Watching && _async.peer(ep).queue_depth < max_queue_depth)
+						{
+							for(int n = 0; n < frames_per_pass && s.next_frame < end; n++)
+								queue_frame(ep, s.next_frame++);
+							if(_finished && !s.ended && s.next_frame == end)
+							{
+								_async.queue(ep, message_type(MessageType::EndSession));
+								s.ended = true;
+							}
+						}
+						eps.push_back(ep);
+						++it;
+					}
+					trim();
+				}
+				if(!eps.empty())
+					_async.send(eps);
+				sleep(8);
+			}
+		}
+
+		// queues the inputs of every side for the index-th frame; _mutex must be held
+		void queue_frame(const zed_net_address_t& ep, int64_t index)
+		{
+			for(size_t side = 0; side < _inputs.size(); side++)
+			{
+				auto& inputs = _inputs[side];
+				int64_t kept = index - _base;
+				message_type msg(MessageType::Frame);
+				msg.side = (uint8_t)side;
+				msg.frame_id = _first_frame + index;
+				msg.frame = inputs[kept];
+				// let the next message take this one over (see message::supersede)
+				for(int i = 0; i < message_type::max_history && i < kept; i++)
+					msg.history[msg.history_available++] = inputs[kept - 1 - i];
+				_async.queue(ep, msg);
+			}
+		}
+
+		void recv_hdl(const zed_net_address_t& ep, message_type& msg)
+		{
+			// replies are queued under the lock and sent once it is released
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				if(!queue_reply(ep, msg))
+					return;
+			}
+			_async.send(ep);
+		}
+
+		// queues the answer to a spectator's message; returns false if there is none. _mutex must be held
+		bool queue_reply(const zed_net_address_t& ep, message_type& msg)
+		{
+			// let spectators retry until the session has started
+			if(!_started)
+				return false;
+
+			auto it = _spectators.find(ep);
+			if(msg.cmd == MessageType::Join && msg.observer)
+			{
+				if(!_state_check_handler(_state, msg.state))
+				{
+					message_type deny(MessageType::Deny);
+					deny.state = _state;
+					_async.queue(ep, deny);
+					return true;
+				}
+				if(it == _spectators.end())
+				{
+					// a spectator has to start from the first frame
+					if(_base > 0)
+						return false;
+					spectator s;
+					s.state = Joined;
+					s.next_frame = 0;
+					s.acked_frame = 0;
+					s.ended = false;
+					_spectators[ep] = s;
+				}
+
+				message_type info(MessageType::Info);
+				info.rand_seed = (uint32_t)time(0);
+				info.state = _state;
+				info.mcdsync = true;
+				info.num_players = (uint8_t)_inputs.size();
+				info.usernames = _usernames;
+				info.usernames.resize(_inputs.size());
+				info.observer = true;
+				_async.queue(ep, info);
+				_async.queue(ep, message_type(MessageType::MCDSync));
+				return true;
+			}
+			else if(msg.cmd == MessageType::Ready && it != _spectators.end())
+			{
+				spectator& s = it->second;
+				if(s.state == Joined)
+				{
+					for(size_t i = 0; i < _card.size(); i++)
+					{
+						message_type data(MessageType::Data);
+						data.frame_id = i;
+						data.data = _card[i];
+						_async.queue(ep, data);
+					}
+					s.state = Card;
+				}
+				else if(s.state == Card)
+				{
+					message_type delay(MessageType::Delay);
+					delay.delay = _delay;
+					_async.queue(ep, delay);
+					s.state = Watching;
+				}
+				return true;
+			}
+			return false;
+		}
+
+		async_transport<message_type> _async;
+		std::unique_ptr<std::thread> _thread;
+		volatile bool _running;
+		bool _started;
+		bool _finished;
+
+		StateType _state;
+		state_check_handler_type _state_check_handler;
+		std::vector<userinfo> _usernames;
+		std::vector<message_data> _card;
+
+		int64_t _first_frame;
+		int64_t _base;											// frames dropped from the front of _inputs
+		int _delay_ms;
+		int _delay;
+		std::vector<std::deque<FrameType>> _inputs;				// per side, from _first_frame + _base on
+		std::vector<std::map<int64_t, FrameType>> _early;		// per side, ahead of _inputs
+		std::deque<msec> _complete_time;						// when each frame from _base on had every side
+
+		spectator_map _spectators;
+		std::mutex _mutex;
+	};
+}
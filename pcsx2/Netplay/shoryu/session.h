@@ -2,6 +2,7 @@
 #include <iomanip>
 #include <map>
 #include "async_transport.h"
+#include "delay_controller.h"
 #include "zed_net.h"
 
 //#define SHORYU_ENABLE_LOG
@@ -20,7 +21,7 @@ namespace shoryu
 		Join,
 		Deny,
 		Info, //side, all endpoints, delay
-		Delay, //set delay
+		Delay, //set delay, from frame_id on
 		Ready, //send to eps, after all eps answered - start the game
 		MCDSync,
 		EndSession,
@@ -43,20 +44,65 @@ namespace shoryu
 	};
 
 
+	// Payload of a Data message. It is stored inline so that messages can be
+	// copied through the peer queues without touching the heap.
 	struct message_data
 	{
-		std::shared_ptr<char> p;
+		static const uint32_t max_length = 256;
+		char p[max_length];
 		uint32_t data_length;
 	};
 
+	// Reads a length-prefixed string body, checking the length against the
+	// archive before sizing the string so a bad datagram can't make us allocate.
+	inline void read_string(shoryu::iarchive& a, std::string& str, size_t length)
+	{
+		if(length > a.length() - a.pos())
+			throw std::ios_base::failure("read_string: buffer overflow");
+		str.resize(length);
+		if(length)
+			a.read(&str[0], length);
+	}
+
+	// Digest of the emulated machine at a frame, in up to max_parts independent
+	// parts so that a mismatch can be narrowed down. Frame messages carry the
+	// newest one along for the peers to compare (see session::set_checksum).
+	struct state_checksum
+	{
+		static const int max_parts = 4;
+
+		state_checksum() : frame(-1), parts(0) {}
+		int64_t frame;
+		uint8_t parts;
+		std::array<uint64_t, max_parts> part;
+
+		// Mask of the parts that differ.
+		uint32_t compare(const state_checksum& other) const
+		{
+			uint32_t mask = 0;
+			for(int i = 0; i < max_parts; i++)
+			{
+				if(i < parts || i < other.parts)
+				{
+					if(i >= parts || i >= other.parts || part[i] != other.part[i])
+						mask |= 1 << i;
+				}
+			}
+			return mask;
+		}
+	};
+
 	template<typename T, typename StateType>
 	struct message
 	{
 		typedef std::vector<zed_net_address_t> endpoint_container;
 
-		message() : frame_id(0), side(0) {}
+		// Number of older inputs a Frame message can carry along with its own.
+		static const int max_history = 8;
+
+		message() : frame_id(0), side(0), observer(false), history_length(0), history_available(0), blocked_ms(0) {}
 
-		message(MessageType type) : cmd(type), frame_id(0), side(0)
+		message(MessageType type) : cmd(type), frame_id(0), side(0), observer(false), history_length(0), history_available(0), blocked_ms(0)
 		{
 		}
 		MessageType cmd;
@@ -69,7 +115,18 @@ namespace shoryu
 		uint8_t side;
         bool mcdsync;
 		uint8_t num_players;
+		// Join: asks to watch instead of play. Info: the receiver watches.
+		bool observer;
 		T frame;
+		// Inputs of the frames before frame_id, newest first: history[i] belongs to
+		// frame_id - 1 - i. Only history_length of them are sent; the rest are there
+		// so the message can take over older queued ones (see supersede).
+		std::array<T, max_history> history;
+		uint8_t history_length;
+		uint8_t history_available;
+		state_checksum checksum;
+		// Frame: total time the sender has stalled waiting for inputs
+		uint32_t blocked_ms;
 		message_data data;
 		std::string username;
 		std::string lobby_message;
@@ -87,10 +144,11 @@ namespace shoryu
 				a << length;
 				if(length)
 					a.write((char*)username.c_str(), username.length());
+				a << observer;
 				break;
 			case MessageType::Data:
 				a << frame_id << data.data_length;
-				a.write(data.p.get(), data.data_length);
+				a.write(data.p, data.data_length);
 			case MessageType::Deny:
 				a << state;
 				break;
@@ -106,6 +164,35 @@ namespace shoryu
 				framePart = (frame_id >> 16) & 0xFF;
 				a << framePart;
 				frame.serialize(a);
+				// The history is sent newest first, each input delta-encoded against the
+				// one after it and runs of unchanged inputs collapsed into a count.
+				a << history_length;
+				{
+					const T* ref = &frame;
+					for(int i = 0; i < history_length;)
+					{
+						uint8_t run = 0;
+						while(i < history_length && history[i] == *ref)
+						{
+							++run;
+							++i;
+						}
+						a << run;
+						if(i < history_length)
+						{
+							history[i].serialize_delta(a, *ref);
+							ref = &history[i++];
+						}
+					}
+				}
+				a << checksum.parts;
+				if(checksum.parts)
+				{
+					a << checksum.frame;
+					for(int i = 0; i < checksum.parts; i++)
+						a << checksum.part[i];
+				}
+				a << blocked_ms;
 				break;
 			case MessageType::Info:
 				a << rand_seed << side << mcdsync << num_players;
@@ -123,10 +210,10 @@ namespace shoryu
 
                     a << usernames[i].side;
 				}
-				a << state;
+				a << state << observer;
 				break;
 			case MessageType::Delay:
-				a << delay;
+				a << delay << frame_id;
 				break;
 			case MessageType::Chat:
 				length = username.length();
@@ -157,17 +244,14 @@ namespace shoryu
 				host_ep.port = port;
 				size_t length;
 				a >> length;
-				if(length > 0)
-				{
-					std::auto_ptr<char> str(new char[length]);
-					a.read(str.get(), length);
-					username.assign(str.get(), str.get()+length);
-				}
+				read_string(a, username, length);
+				a >> observer;
 				break;
 			case MessageType::Data:
 				a >> frame_id >> data.data_length;
-				data.p.reset(new char[data.data_length], std::default_delete<char[]>());
-				a.read(data.p.get(), data.data_length);
+				if(data.data_length > message_data::max_length)
+					throw std::ios_base::failure("message: data too long");
+				a.read(data.p, data.data_length);
 			case MessageType::Deny:
 				a >> state;
 				break;
@@ -183,6 +267,37 @@ namespace shoryu
 				a >> framePart;
 				frame_id |= framePart << 16;
 				frame.deserialize(a);
+				a >> history_length;
+				if(history_length > max_history)
+					throw std::ios_base::failure("message: frame history too long");
+				{
+					const T* ref = &frame;
+					for(int i = 0; i < history_length;)
+					{
+						uint8_t run;
+						a >> run;
+						if(run > history_length - i)
+							throw std::ios_base::failure("message: frame history overrun");
+						for(; run; --run)
+							history[i++] = *ref;
+						if(i < history_length)
+						{
+							history[i].deserialize_delta(a, *ref);
+							ref = &history[i++];
+						}
+					}
+				}
+				history_available = history_length;
+				a >> checksum.parts;
+				if(checksum.parts > state_checksum::max_parts)
+					throw std::ios_base::failure("message: too many checksum parts");
+				if(checksum.parts)
+				{
+					a >> checksum.frame;
+					for(int i = 0; i < checksum.parts; i++)
+						a >> checksum.part[i];
+				}
+				a >> blocked_ms;
 				break;
 			case MessageType::Info:
 				a >> rand_seed >> side >> mcdsync >> num_players;
@@ -191,45 +306,118 @@ namespace shoryu
 					size_t length;
                     userinfo _userinfo;
 					a >> length;
-					if(length > 0)
-					{
-						std::auto_ptr<char> str(new char[length]);
-						a.read(str.get(), length);
-                        _userinfo.name = std::string(str.get(), str.get() + length);
+					read_string(a, _userinfo.name, length);
 
-						a >> length;
-                        str.reset(new char[length]);
-                        a.read(str.get(), length);
-                        _userinfo.ping = std::string(str.get(), str.get() + length);
+					a >> length;
+					read_string(a, _userinfo.ping, length);
 
-						a >> _userinfo.side;
-                        usernames.push_back(_userinfo);
-                    }
-					else
-                        usernames.push_back(_userinfo);
+					a >> _userinfo.side;
+                    usernames.push_back(_userinfo);
 				}
-				a >> state;
+				a >> state >> observer;
 				break;
 			case MessageType::Delay:
-				a >> delay;
+				a >> delay >> frame_id;
 				break;
 			case MessageType::Chat:
 			{
 				a >> length;
-				std::auto_ptr<char> str(new char[length]);
-				a.read(str.get(), length);
-				username.assign(str.get(), str.get() + length);
+				read_string(a, username, length);
 
 				a >> length;
-				str.reset(new char[length]);
-				a.read(str.get(), length);
-				lobby_message.assign(str.get(), str.get() + length);
+				read_string(a, lobby_message, length);
 			}
 				break;
 			default:
 				break;
 			}
 		}
+
+		// Called when this message is queued behind an older one to the same peer.
+		// A Frame message replaces an older Frame message of the same side if its
+		// history reaches back over every input the older one carries; the history
+		// sent is stretched to cover them, and the checksum of the older one is
+		// taken over unless both carry one. Returns true if the older message can
+		// be dropped from the queue.
+		inline bool supersede(const message& older)
+		{
+			if(cmd != MessageType::Frame || older.cmd != MessageType::Frame)
+				return false;
+			if(side != older.side || older.frame_id >= frame_id)
+				return false;
+			if(checksum.parts && older.checksum.parts && checksum.frame != older.checksum.frame)
+				return false;
+			int64_t needed = frame_id - (older.frame_id - older.history_length);
+			if(needed > history_available)
+				return false;
+			if(needed > history_length)
+				history_length = (uint8_t)needed;
+			if(!checksum.parts)
+				checksum = older.checksum;
+			return true;
+		}
+	};
+
+	// Frames of one side, indexed by frame id modulo Size. Only a few frames
+	// around the current one are alive at any time (input delay plus rollback
+	// history), so a fixed ring replaces the per-frame node allocations of a map.
+	// A slot holds a frame only if its id matches, which also makes frames that
+	// were never erased fall out as soon as their slot is reused.
+	template<typename FrameType, int Size = 256>
+	class frame_ring
+	{
+	public:
+		frame_ring()
+		{
+			clear();
+		}
+		inline bool contains(int64_t frame) const
+		{
+			return slot(frame).id == frame;
+		}
+		inline const FrameType* find(int64_t frame) const
+		{
+			const entry& e = slot(frame);
+			return e.id == frame ? &e.frame : nullptr;
+		}
+		// Stores a frame unless its slot already holds a newer one, which a late
+		// resend of a frame Size ids back would otherwise overwrite.
+		inline bool set(int64_t frame, const FrameType& f)
+		{
+			entry& e = slot(frame);
+			if(e.id != empty && frame < e.id)
+				return false;
+			e.id = frame;
+			e.frame = f;
+			return true;
+		}
+		inline void erase(int64_t frame)
+		{
+			entry& e = slot(frame);
+			if(e.id == frame)
+				e.id = empty;
+		}
+		inline void clear()
+		{
+			for(auto& e : _entries)
+				e.id = empty;
+		}
+	private:
+		static const int64_t empty = INT64_MIN;
+		struct entry
+		{
+			int64_t id;
+			FrameType frame;
+		};
+		inline entry& slot(int64_t frame)
+		{
+			return _entries[(uint64_t)frame % Size];
+		}
+		inline const entry& slot(int64_t frame) const
+		{
+			return _entries[(uint64_t)frame % Size];
+		}
+		std::array<entry, Size> _entries;
 	};
 
 	template<typename FrameType, typename StateType>
@@ -237,7 +425,7 @@ namespace shoryu
 	{
 		typedef message<FrameType, StateType> message_type;
 		typedef std::vector<zed_net_address_t> endpoint_container;
-		typedef std::unordered_map<int64_t, FrameType> frame_map;
+		typedef frame_ring<FrameType> frame_map;
 		typedef std::vector<frame_map> frame_table;
 		typedef std::function<bool(const StateType&, const StateType&)> state_check_handler_type;
 		typedef std::vector<std::unordered_map<int64_t, message_data>> data_table;
@@ -246,7 +434,7 @@ namespace shoryu
 		std::fstream log;
 		msec log_start;
 #endif
-		session() 
+		session() : _history(0)
 		{
 #ifdef SHORYU_ENABLE_LOG
 			std::string filename;
@@ -263,8 +451,7 @@ namespace shoryu
 
 		bool bind(int port)
 		{
-			_async.start(port, 2);
-			return true;
+			return _async.start(port, 2);
 		}
 		void unbind()
 		{
@@ -301,6 +488,14 @@ namespace shoryu
 							i_ep++;
 					}
 
+					for (auto i_ep = m_observerEndpoints.begin(); i_ep != m_observerEndpoints.end();)
+					{
+						if (_async.peer(*i_ep).recv_time + 5000 < time_ms())
+							i_ep = m_observerEndpoints.erase(i_ep);
+						else
+							i_ep++;
+					}
+
 					// requeue info if player numbers changed
 					if (old_player_num != m_num_players)
 						queue_info();
@@ -447,11 +642,13 @@ namespace shoryu
 
 			return connected;
 		}
-		bool join(zed_net_address_t ep, const StateType& state, const state_check_handler_type& handler, int timeout = 0)
+		// An observer gets the inputs of every player and sends none of its own.
+		bool join(zed_net_address_t ep, const StateType& state, const state_check_handler_type& handler, int timeout = 0, bool observer = false)
 		{
 			_shutdown = false;
 			try_prepare();
 			m_host = false;
+			m_observer = observer;
 			_state = state;
 			_state_check_handler = handler;
 			_async.receive_handler([&](const zed_net_address_t& ep, message_type& msg){join_recv_handler(ep, msg);});
@@ -493,6 +690,8 @@ namespace shoryu
 				log << " (" << i << ") " << zed_net_host_to_str(m_clientEndpoints[i].host) << ":" << (int)m_clientEndpoints[i].port;
 #endif
 				}
+				for (auto &ep : m_observerEndpoints)
+					_async.queue(ep, msg);
 			}
 
 #ifdef SHORYU_ENABLE_LOG
@@ -511,6 +710,7 @@ namespace shoryu
 			}
 			else
 			{
+				// observers may still be taking the memory card
 				for (auto &ep : m_clientEndpoints)
 					_async.clear_queue(ep);
 			}
@@ -542,9 +742,42 @@ namespace shoryu
 			send();
 		}
 
+		// Host only: switches every player to a new delay on the given frame. A
+		// player that gets the message late switches on arrival; inputs carry
+		// their frame ids, so that only costs a stall, not a desync.
+		inline void schedule_delay(int d, int64_t frame)
+		{
+			if(_current_state == MessageType::None)
+				throw std::exception("invalid state");
+			std::unique_lock<std::mutex> lock(_mutex);
+			message_type msg(MessageType::Delay);
+			msg.delay = d;
+			msg.frame_id = frame;
+			_pending_delay = d;
+			_pending_delay_frame = frame;
+
+			queue_message(msg);
+			send();
+		}
+
+		// Worst round trip among the peers, padded by four times its jitter, or -1
+		// if nothing was measured yet.
+		int32_t padded_rtt()
+		{
+			int32_t rtt = -1;
+			for(auto& p : _async.peers())
+			{
+				if(p.rtt_avg >= 0)
+					rtt = std::max(rtt, p.rtt_avg + 4 * std::max(p.rtt_jitter, 0));
+			}
+			return rtt;
+		}
+
 		inline void announce_mcd()
         {
             std::unique_lock<std::mutex> lock(_mutex);
+			// the clients answer with their block hashes before the session starts
+			prepare_tables();
             message_type msg(MessageType::MCDSync);
 
             queue_message(msg);
@@ -575,18 +808,65 @@ namespace shoryu
 				log << "[" << time_ms() - log_start << "] Info --^ " << zed_net_host_to_str(ep.host) << ":" << ep.port << "\n";
 #endif
 			}
+			msg.side = 0;
+			msg.observer = true;
+			for (auto &ep : m_observerEndpoints)
+				_async.queue(ep, msg);
 		}
 
-		inline void queue_data(message_data& data)
+		// Host only: waits up to timeout ms for every observer to ask for the
+		// memory card (see observer_ready), drops the ones that didn't and turns
+		// away observers that join from now on.
+		void wait_for_observers(int timeout)
+		{
+			std::unique_lock<std::mutex> lock(_connection_mutex);
+			auto ready = [&](const zed_net_address_t& ep) -> bool {
+				return std::find(m_ready_list.begin(), m_ready_list.end(), ep) != m_ready_list.end();
+			};
+			auto pred = [&]() -> bool {
+				if (_current_state != MessageType::Ready)
+					return true;
+				return std::all_of(m_observerEndpoints.begin(), m_observerEndpoints.end(), ready);
+			};
+			_connection_cv.wait_for(lock, std::chrono::milliseconds(timeout), pred);
+			m_observerEndpoints.erase(std::remove_if(m_observerEndpoints.begin(), m_observerEndpoints.end(),
+				[&](const zed_net_address_t& ep) { return !ready(ep); }), m_observerEndpoints.end());
+			m_observers_closed = true;
+		}
+
+		// Observer only: the session is set up, the host can send the memory card.
+		inline void observer_ready()
+		{
+			_async.queue(_host_ep, message_type(MessageType::Ready));
+			send(_host_ep);
+		}
+
+		// Data messages form one ordered stream per pair of sides. The host
+		// sends to the given side only; a client always sends to the host.
+		// Side 0 of the host is the stream every observer gets.
+		inline void queue_data(int side, message_data& data)
 		{
 			if(_current_state == MessageType::None)
 				throw std::exception("invalid state");
 			std::unique_lock<std::mutex> lock(_mutex);
+			if(!m_host)
+				side = 0;
+			if(side < 0 || (size_t)side >= _data_send_index.size())
+				throw std::exception("invalid side");
 			message_type msg(MessageType::Data);
 			msg.data = data;
-			msg.frame_id = _data_index++;
+			msg.side = _side;
+			msg.frame_id = _data_send_index[side]++;
 
-			queue_message(msg);
+			if(m_host && side == 0)
+			{
+				for(auto& ep : m_observerEndpoints)
+					_async.queue(ep, msg);
+			}
+			else if(m_host)
+				_async.queue(m_clientEndpoints[side - 1], msg);
+			else
+				_async.queue(_host_ep, msg);
 		}
 
 		inline bool get_data(int side, message_data& data, int timeout = 0)
@@ -597,7 +877,7 @@ namespace shoryu
 			std::unique_lock<std::mutex> lock(_mutex);
 			auto pred = [&]() -> bool {
 				if(_current_state != MessageType::None)
-					return _data_table[side].find(_data_index) != _data_table[side].end();
+					return _data_table[side].find(_data_index[side]) != _data_table[side].end();
 				else
 					return true;
 			};
@@ -611,15 +891,15 @@ namespace shoryu
 
 			if(_current_state == MessageType::None)
 				throw std::exception("invalid state");
-			data = _data_table[side][_data_index];
-			_data_table[side].erase(_data_index);
-			++_data_index;
+			data = _data_table[side][_data_index[side]];
+			_data_table[side].erase(_data_index[side]);
+			++_data_index[side];
 			return true;
 		}
 		
 		inline void set(const FrameType& frame)
 		{
-			if(_current_state == MessageType::None)
+			if(_current_state == MessageType::None || m_observer)
 				throw std::exception("invalid state");
 			std::unique_lock<std::mutex> lock(_mutex);
 
@@ -631,11 +911,39 @@ namespace shoryu
                 destFrame += _delay;
             }
 
-			_frame_table[_side][destFrame] = frame;
+			// inputs are immutable once sent, re-simulated frames must not resend them;
+			// this also drops an input when the delay goes down
+			if(destFrame <= _last_set_frame)
+				return;
+
+			// when the delay goes up, repeat this input over the frames it skipped
+			int64_t firstFrame = _last_set_frame < 0 ? destFrame : _last_set_frame + 1;
+			_last_set_frame = destFrame;
+
+			for(int64_t f = firstFrame; f <= destFrame; f++)
+			{
+				_frame_table[_side].set(f, frame);
+				_sent_frames.set(f, frame);
+			}
 			message_type msg(MessageType::Frame);
 			msg.frame_id = destFrame;
 			msg.frame = frame;
 			msg.side = _side;
+			for(int i = 0; i < message_type::max_history; i++)
+			{
+				const FrameType* f = _sent_frames.find(destFrame - 1 - i);
+				if(!f)
+					break;
+				msg.history[i] = *f;
+				msg.history_available++;
+			}
+			msg.history_length = (uint8_t)std::min<int64_t>(destFrame - firstFrame, msg.history_available);
+			if(_pending_checksum.parts)
+			{
+				msg.checksum = _pending_checksum;
+				_pending_checksum = state_checksum();
+			}
+			msg.blocked_ms = (uint32_t)_blocked_ms;
 			queue_message(msg);
 			send();
 		}
@@ -648,8 +956,9 @@ namespace shoryu
 			}
 			else
 			{
-				for (auto &ep : m_clientEndpoints)
-					n += send(ep);
+				n += _async.send(m_clientEndpoints);
+				if (!m_observerEndpoints.empty())
+					n += _async.send(m_observerEndpoints);
 			}
 			return n;
 		}
@@ -668,7 +977,7 @@ namespace shoryu
 
 			auto pred = [&]() -> bool {
 				if(_current_state != MessageType::None)
-					return _frame_table[side].find(frame) != _frame_table[side].end();
+					return _frame_table[side].contains(frame);
 				else
 					return true;
 			};
@@ -676,9 +985,17 @@ namespace shoryu
 #ifdef SHORYU_ENABLE_LOG
 			log << "[" << std::setw(12) << time_ms() - log_start << "] Waiting for frame " << frame << " side " << side << "\n";
 #endif
-			if(timeout > 0)
+			if(!pred())
 			{
-				if (!_frame_cond.wait_for(lock, std::chrono::milliseconds(timeout), pred))
+				msec wait_start = time_ms();
+				bool arrived = true;
+				if(timeout > 0)
+					arrived = _frame_cond.wait_for(lock, std::chrono::milliseconds(timeout), pred);
+				else
+					_frame_cond.wait(lock, pred);
+				_blocked_ms += time_ms() - wait_start;
+
+				if(!arrived)
 				{
 #ifdef SHORYU_ENABLE_LOG
 			log << "[" << std::setw(12) << time_ms() - log_start << "] Waiting timeout!\n";
@@ -686,8 +1003,6 @@ namespace shoryu
 					return false;
 				}
 			}
-			else
-				_frame_cond.wait(lock, pred);
 
 #ifdef SHORYU_ENABLE_LOG
 			log << "[" << std::setw(12) << time_ms() - log_start << "] Waiting success!\n";
@@ -695,11 +1010,27 @@ namespace shoryu
 
 			if(_current_state == MessageType::None)
 				throw std::exception("invalid state");
-			f = _frame_table[side][frame];
+			f = *_frame_table[side].find(frame);
 
 			// we accessed this frame, so should be safe to delete previous frame
-			_frame_table[side].erase(frame - 1);
+			if(!_history)
+				_frame_table[side].erase(frame - 1);
+
+			return true;
+		}
 
+		// Non-blocking lookup that keeps the frame around, for rollback.
+		inline bool try_get(int side, FrameType& f, int64_t frame)
+		{
+			if(_current_state == MessageType::None)
+				throw std::exception("invalid state");
+			if(frame < _delay)
+				return true;
+			std::unique_lock<std::mutex> lock(_mutex);
+			const FrameType* it = _frame_table[side].find(frame);
+			if(!it)
+				return false;
+			f = *it;
 			return true;
 		}
 
@@ -724,7 +1055,28 @@ namespace shoryu
 		}
 		void next_frame()
 		{
+			std::unique_lock<std::mutex> lock(_mutex);
 			_frame++;
+			if(_pending_delay_frame >= 0 && _frame >= _pending_delay_frame)
+			{
+				_delay = _pending_delay;
+				_pending_delay_frame = -1;
+			}
+			if(_history)
+			{
+				for(auto& table : _frame_table)
+					table.erase(_frame - _history - 1);
+			}
+		}
+		// Number of past frames kept in the frame table, so they can be read again
+		// after a rollback. 0 keeps only what hasn't been consumed by get().
+		void history(int frames)
+		{
+			_history = frames;
+		}
+		int history()
+		{
+			return _history;
 		}
 		int64_t frame()
 		{
@@ -732,6 +1084,7 @@ namespace shoryu
 		}
 		void frame(int64_t f)
 		{
+			std::unique_lock<std::mutex> lock(_mutex);
 			_frame = f;
 		}
 		int side()
@@ -762,6 +1115,92 @@ namespace shoryu
 		{
 			return m_num_players;
 		}
+		bool is_host()
+		{
+			return m_host;
+		}
+		bool is_observer()
+		{
+			return m_observer;
+		}
+		size_t num_observers()
+		{
+			std::unique_lock<std::mutex> lock(_connection_mutex);
+			return m_observerEndpoints.size();
+		}
+		// Called with every input received, before the frame is consumed, so
+		// that a relay can pass the session on (see relay.h).
+		inline void frame_handler(const std::function<void(int, int64_t, const FrameType&)>& handler)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			m_frame_handler = handler;
+		}
+		const typename async_transport<message_type>::peer_list_type peers()
+		{
+			return _async.peers();
+		}
+		typedef peer_data<message_type> peer_data_type;
+		// Calls f with every peer while the transport holds its lock; f must not call back into the session.
+		template<class F>
+		void for_each_peer(F f)
+		{
+			_async.for_each_peer(f);
+		}
+		// Side of the player at ep, -1 for observers and endpoints that aren't players.
+		int side_of(const zed_net_address_t& ep)
+		{
+			std::unique_lock<std::mutex> lock(_connection_mutex);
+			if (!m_host)
+				return ep == _host_ep ? 0 : -1;
+			auto it = std::find(m_clientEndpoints.begin(), m_clientEndpoints.end(), ep);
+			return it == m_clientEndpoints.end() ? -1 : (int)(it - m_clientEndpoints.begin()) + 1;
+		}
+		// Total time get() spent waiting for inputs.
+		uint64_t blocked_ms()
+		{
+			return _blocked_ms;
+		}
+		// Same, as last reported by a side with its inputs.
+		uint64_t blocked_ms(int side)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			if(side == _side)
+				return _blocked_ms;
+			if((size_t)side >= _reported_blocked_ms.size())
+				return 0;
+			return _reported_blocked_ms[side];
+		}
+		// How many frames our inputs run ahead of the newest ones received from
+		// a side; negative when that side is ahead of us.
+		int64_t frame_advantage(int side)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			if(side == _side || (size_t)side >= _newest_frames.size() || _newest_frames[side] < 0)
+				return 0;
+			return _last_set_frame - _newest_frames[side];
+		}
+		// Records the digest of our machine at a frame. It goes out with the next
+		// Frame message and is compared with the ones the peers send for the frame.
+		void set_checksum(const state_checksum& checksum)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_local_checksums.set(checksum.frame, checksum);
+			_pending_checksum = checksum;
+			for(int side = 0; side < (int)_remote_checksums.size(); side++)
+				compare_checksums(side, checksum.frame);
+		}
+		// Earliest frame found to differ from a side, with the mask of the
+		// checksum parts that differ. Returns false while everyone agrees.
+		bool desync(int64_t& frame, int& side, uint32_t& parts)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			if(_desync_frame < 0)
+				return false;
+			frame = _desync_frame;
+			side = _desync_side;
+			parts = _desync_parts;
+			return true;
+		}
 		int64_t first_received_frame()
 		{
 			return _first_received_frame;
@@ -824,12 +1263,29 @@ namespace shoryu
 			_first_received_frame = -1;
 			_delay = _side = /*_players =*/ 0;
 			_frame = 0;
-			_data_index = 0;
+			_last_set_frame = -1;
+			_pending_delay = 0;
+			_pending_delay_frame = -1;
+			_blocked_ms = 0;
+			_newest_frames.clear();
+			_reported_blocked_ms.clear();
+			_data_index.clear();
+			_data_send_index.clear();
 			_current_state = MessageType::None;
 			m_host = false;
+			m_observer = false;
 			m_clientEndpoints.clear();
+			m_observerEndpoints.clear();
+			m_observers_closed = false;
 			_end_session_request = false;
 			_frame_table.clear();
+			_sent_frames.clear();
+			_pending_checksum = state_checksum();
+			_local_checksums.clear();
+			_remote_checksums.clear();
+			_desync_frame = -1;
+			_desync_side = 0;
+			_desync_parts = 0;
 			_last_error = "";
 			_data_table.clear();
 			_async.error_handler(std::function<void(const std::error_code&)>());
@@ -854,14 +1310,27 @@ namespace shoryu
 #endif
 			std::unique_lock<std::mutex> lock1(_connection_mutex);
 			std::unique_lock<std::mutex> lock2(_mutex);
-			_frame_table.resize(m_num_players);
-			_data_table.resize(m_num_players);
+			prepare_tables();
 			_async.error_handler([&](const std::error_code &error){err_hdl(error);});
 			_async.receive_handler([&](const zed_net_address_t& ep, message_type& msg){recv_hdl(ep, msg);});
 		}
+		// Sizes the per side tables once the players are known. The host needs
+		// them for Data messages before the session starts. _mutex must be held.
+		void prepare_tables()
+		{
+			if(!_frame_table.empty())
+				return;
+			_frame_table.resize(m_num_players);
+			_newest_frames.assign(m_num_players, -1);
+			_reported_blocked_ms.assign(m_num_players, 0);
+			_remote_checksums.resize(m_num_players);
+			_data_table.resize(m_num_players);
+			_data_index.assign(m_num_players, 0);
+			_data_send_index.assign(m_num_players, 0);
+		}
 		int calculate_delay(uint32_t rtt)
 		{
-			return (rtt / 32) + 1;
+			return delay_controller::delay_for_rtt(rtt);
 		}
 
 		struct peer_info
@@ -905,10 +1374,13 @@ namespace shoryu
 			std::unique_lock<std::mutex> lock(_connection_mutex);
 			if(msg.cmd == MessageType::Join)
 			{
-				_username_map[ep].name = msg.username;
-                _username_map[ep].side = m_clientEndpoints.size() + 1;
+				if(!msg.observer)
+				{
+					_username_map[ep].name = msg.username;
+					_username_map[ep].side = m_clientEndpoints.size() + 1;
+				}
 
-				if(!_state_check_handler(_state, msg.state))
+				if(!_state_check_handler(_state, msg.state) || (msg.observer && m_observers_closed))
 				{
 					message_type msg(MessageType::Deny);
 					msg.state = _state;
@@ -921,7 +1393,12 @@ namespace shoryu
 					return;
 				}
 
-				if (std::find(m_clientEndpoints.begin(), m_clientEndpoints.end(), ep) == m_clientEndpoints.end())
+				if (msg.observer)
+				{
+					if (std::find(m_observerEndpoints.begin(), m_observerEndpoints.end(), ep) == m_observerEndpoints.end())
+						m_observerEndpoints.push_back(ep);
+				}
+				else if (std::find(m_clientEndpoints.begin(), m_clientEndpoints.end(), ep) == m_clientEndpoints.end())
 				{
 					m_clientEndpoints.push_back(ep);
 					m_num_players++;
@@ -950,6 +1427,17 @@ namespace shoryu
 				m_ready_list.push_back(ep);
 				_connection_cv.notify_all();
 			}
+			if (msg.cmd == MessageType::Data)
+			{
+				// memory card hashes, sent once announce_mcd() set up the tables
+				std::unique_lock<std::mutex> lock2(_mutex);
+				if ((size_t)msg.side < _data_table.size())
+				{
+					_data_table[msg.side][msg.frame_id] = msg.data;
+					_data_cond.notify_all();
+				}
+				send(ep);
+			}
 			if (msg.cmd == MessageType::Chat)
 			{
 				if (m_chatmessage_handler)
@@ -976,6 +1464,7 @@ namespace shoryu
 				msg.username = _username.name;
 				msg.host_ep = host_ep;
 				msg.state = _state;
+				msg.observer = m_observer;
 				if (!send(host_ep))
 				{
 					_async.queue(host_ep, msg);
@@ -1006,7 +1495,8 @@ namespace shoryu
 			std::unique_lock<std::mutex> lock(_connection_mutex);
 			if(msg.cmd == MessageType::Info)
 			{
-				_side = msg.side;
+				// observers have no side of their own
+				_side = m_observer ? -1 : msg.side;
                 m_mcd_sync = msg.mcdsync;
 				m_num_players = msg.num_players;
 				std::srand(msg.rand_seed);
@@ -1063,12 +1553,16 @@ namespace shoryu
 			if (!m_host && ep != _host_ep)
 				return;
 
+			// observers only acknowledge what they get
+			if (m_host && std::find(m_observerEndpoints.begin(), m_observerEndpoints.end(), ep) != m_observerEndpoints.end())
+				return;
+
 			//if(_sides.find(ep) != _sides.end())
 			{
 				int side = msg.side; //_sides[ep];
 
-				// if we're server, echo to everyone else
-				if (m_host && side != 0)
+				// if we're server, echo to everyone else; data is sent to the host only
+				if (m_host && side != 0 && msg.cmd != MessageType::Data)
 				{
 					for (size_t i = 0; i < m_clientEndpoints.size(); i++)
 					{
@@ -1077,22 +1571,51 @@ namespace shoryu
 						_async.queue(m_clientEndpoints[i], msg);
 						send(m_clientEndpoints[i]);
 					}
+					for (auto &observer : m_observerEndpoints)
+					{
+						_async.queue(observer, msg);
+						send(observer);
+					}
 				}
 
 				if(msg.cmd == MessageType::Frame)
 				{
 					std::unique_lock<std::mutex> lock(_mutex);
-					_frame_table[side][msg.frame_id] = msg.frame;
+					if(!_frame_table[side].contains(msg.frame_id) && _frame_table[side].set(msg.frame_id, msg.frame) && m_frame_handler)
+						m_frame_handler(side, msg.frame_id, msg.frame);
+					// fill in frames whose own message was lost
+					int64_t first_frame = msg.frame_id;
+					for(int i = 0; i < msg.history_length; i++)
+					{
+						first_frame = msg.frame_id - 1 - i;
+						if(!_frame_table[side].contains(first_frame) && _frame_table[side].set(first_frame, msg.history[i]) && m_frame_handler)
+							m_frame_handler(side, first_frame, msg.history[i]);
+					}
 					if(_first_received_frame < 0)
-						_first_received_frame = msg.frame_id;
-					else if(msg.frame_id < _first_received_frame)
-						_first_received_frame = msg.frame_id;
+						_first_received_frame = first_frame;
+					else if(first_frame < _first_received_frame)
+						_first_received_frame = first_frame;
+
+					if(msg.frame_id > _newest_frames[side])
+						_newest_frames[side] = msg.frame_id;
+					// messages can arrive out of order, the total only grows
+					if(msg.blocked_ms > _reported_blocked_ms[side])
+						_reported_blocked_ms[side] = msg.blocked_ms;
+
+					if(msg.checksum.parts)
+					{
+						_remote_checksums[side].set(msg.checksum.frame, msg.checksum);
+						compare_checksums(side, msg.checksum.frame);
+					}
 
 					if(_last_received_frame < 0)
 						_last_received_frame = msg.frame_id;
 					else if(msg.frame_id > _last_received_frame)
 						_last_received_frame = msg.frame_id;
 					_frame_cond.notify_all();
+					// observers send no inputs to carry the acknowledgement
+					if(m_observer)
+						send(ep);
 				}
 				if(msg.cmd == MessageType::Data)
 				{
@@ -1106,7 +1629,13 @@ namespace shoryu
 				{
 					std::unique_lock<std::mutex> lock(_mutex);
                     m_ready = true;
-					delay(msg.delay);
+					if(msg.frame_id > _frame)
+					{
+						_pending_delay = msg.delay;
+						_pending_delay_frame = msg.frame_id;
+					}
+					else
+						delay(msg.delay);
 					if (m_host || side == 0)
 						send(ep);
 				}
@@ -1124,6 +1653,23 @@ namespace shoryu
 				}
 			}
 		}
+		// _mutex must be held
+		void compare_checksums(int side, int64_t frame)
+		{
+			if(side == _side)
+				return;
+			const state_checksum* local = _local_checksums.find(frame);
+			const state_checksum* remote = _remote_checksums[side].find(frame);
+			if(!local || !remote)
+				return;
+			uint32_t parts = local->compare(*remote);
+			if(parts && (_desync_frame < 0 || frame < _desync_frame))
+			{
+				_desync_frame = frame;
+				_desync_side = side;
+				_desync_parts = parts;
+			}
+		}
 		void err_hdl(const std::error_code& error)
 		{
 			std::unique_lock<std::mutex> lock(_error_mutex);
@@ -1132,7 +1678,15 @@ namespace shoryu
 	private:
 		volatile int _delay;
 		int64_t _frame;
-		int64_t _data_index;
+		int64_t _last_set_frame;
+		int _pending_delay;
+		int64_t _pending_delay_frame;
+		uint64_t _blocked_ms;
+		std::vector<int64_t> _newest_frames;	// per side
+		std::vector<uint64_t> _reported_blocked_ms;	// per side
+		int _history;
+		std::vector<int64_t> _data_index;		// next Data message expected, per side
+		std::vector<int64_t> _data_send_index;	// next Data message sent, per side
 		bool m_host;
 		int _side;
 		bool _end_session_request;
@@ -1149,9 +1703,19 @@ namespace shoryu
 
 		async_transport<message_type> _async;
 		endpoint_container m_clientEndpoints;
+		endpoint_container m_observerEndpoints;
+		bool m_observer;
+		bool m_observers_closed;
 		int m_num_players;
         bool m_mcd_sync;
 		frame_table _frame_table;
+		frame_ring<FrameType, 16> _sent_frames;
+		state_checksum _pending_checksum;		// waiting for the next Frame message
+		frame_ring<state_checksum> _local_checksums;
+		std::vector<frame_ring<state_checksum>> _remote_checksums;	// per side
+		int64_t _desync_frame;
+		int _desync_side;
+		uint32_t _desync_parts;
 		std::mutex _mutex;
 		std::mutex _error_mutex;
 		std::condition_variable _frame_cond;
@@ -1159,6 +1723,7 @@ namespace shoryu
 		data_table _data_table;
 
 		std::function<const void(std::vector<userinfo>)> m_userlist_handler;
+		std::function<void(int, int64_t, const FrameType&)> m_frame_handler;
 		std::unique_ptr<std::thread> m_ping_thread;
 		bool m_ping_clients;
 	};
@@ -126,6 +126,64 @@ ZED_NET_DEF int zed_net_udp_socket_send(zed_net_socket_t *socket, zed_net_addres
 // Returns the number of bytes received, -1 otherwise (call 'zed_net_get_error' for more info)
 ZED_NET_DEF int zed_net_udp_socket_receive(zed_net_socket_t *socket, zed_net_address_t *sender, void *data, int size);
 
+/////////////////////////////////////////////////////////////////////////////////////////
+//
+// UDP BATCHING AND POLLING API
+//
+
+// Maximum number of datagrams moved by a single batched call
+#define ZED_NET_BATCH_MAX 32
+
+// A datagram for batched sends and receives
+//
+// 'size' is the capacity of 'data' when receiving; 'length' is the number of bytes
+// received, or the number of bytes to send
+typedef struct {
+    zed_net_address_t address;
+    void *data;
+    int size;
+    int length;
+} zed_net_datagram_t;
+
+// Receives up to 'count' datagrams without blocking (recvmmsg where available)
+//
+// Returns the number of datagrams received, 0 if none were pending,
+// -1 otherwise (call 'zed_net_get_error' for more info)
+ZED_NET_DEF int zed_net_udp_socket_receive_many(zed_net_socket_t *socket, zed_net_datagram_t *datagrams, int count);
+
+// Sends 'count' datagrams (sendmmsg where available)
+//
+// Returns the number of datagrams sent, -1 if none could be sent (call 'zed_net_get_error' for more info)
+ZED_NET_DEF int zed_net_udp_socket_send_many(zed_net_socket_t *socket, const zed_net_datagram_t *datagrams, int count);
+
+// Waits for a socket to become readable, and can be woken up from another thread
+typedef struct {
+    int handle;
+#ifdef _WIN32
+    void *events[2];
+#else
+    int wake[2];
+#endif
+} zed_net_poller_t;
+
+// Prepares a poller for the given socket; on Windows this also makes the socket non-blocking
+//
+// Returns 0 on success, -1 otherwise (call 'zed_net_get_error' for more info)
+ZED_NET_DEF int zed_net_poller_open(zed_net_poller_t *poller, zed_net_socket_t *socket);
+
+// Releases the poller; the socket itself is left open
+ZED_NET_DEF void zed_net_poller_close(zed_net_poller_t *poller);
+
+// Blocks until the socket is readable, the poller is woken up, or 'timeout_ms' elapses
+// (use a negative timeout to wait indefinitely)
+//
+// Returns 1 if the socket is readable, 0 on wake up or timeout,
+// -1 otherwise (call 'zed_net_get_error' for more info)
+ZED_NET_DEF int zed_net_poller_wait(zed_net_poller_t *poller, int timeout_ms);
+
+// Wakes up a thread blocked in 'zed_net_poller_wait'; safe to call from any thread
+ZED_NET_DEF void zed_net_poller_wake(zed_net_poller_t *poller);
+
 /////////////////////////////////////////////////////////////////////////////////////////
 //
 // TCP SOCKETS API
@@ -193,6 +251,8 @@ ZED_NET_DEF int zed_net_tcp_make_socket_ready(zed_net_socket_t *socket);
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
 #endif
 
 static const char *zed_net__g_error;
@@ -552,6 +612,225 @@ ZED_NET_DEF int zed_net_tcp_socket_receive(zed_net_socket_t *remote_socket, void
     return received_bytes;
 }
 
+ZED_NET_DEF int zed_net_udp_socket_receive_many(zed_net_socket_t *socket, zed_net_datagram_t *datagrams, int count) {
+    if (!socket) {
+        return zed_net__error("Socket is NULL");
+    }
+
+    if (count > ZED_NET_BATCH_MAX)
+        count = ZED_NET_BATCH_MAX;
+
+#if defined(__linux__)
+    struct mmsghdr msgs[ZED_NET_BATCH_MAX];
+    struct iovec iov[ZED_NET_BATCH_MAX];
+    struct sockaddr_in from[ZED_NET_BATCH_MAX];
+
+    memset(msgs, 0, sizeof(msgs[0]) * count);
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = datagrams[i].data;
+        iov[i].iov_len = datagrams[i].size;
+        msgs[i].msg_hdr.msg_name = &from[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int received = recvmmsg(socket->handle, msgs, count, MSG_DONTWAIT, NULL);
+    if (received < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
+        return zed_net__error("Failed to receive data");
+    }
+
+    for (int i = 0; i < received; i++) {
+        datagrams[i].address.host = from[i].sin_addr.s_addr;
+        datagrams[i].address.port = ntohs(from[i].sin_port);
+        datagrams[i].length = msgs[i].msg_len;
+    }
+
+    return received;
+#else
+    int received = 0;
+    while (received < count) {
+        zed_net_datagram_t *datagram = &datagrams[received];
+        int length = zed_net_udp_socket_receive(socket, &datagram->address, datagram->data, datagram->size);
+        if (length <= 0)
+            break;
+        datagram->length = length;
+        received++;
+    }
+
+    return received;
+#endif
+}
+
+ZED_NET_DEF int zed_net_udp_socket_send_many(zed_net_socket_t *socket, const zed_net_datagram_t *datagrams, int count) {
+    if (!socket) {
+        return zed_net__error("Socket is NULL");
+    }
+
+    int sent = 0;
+
+#if defined(__linux__)
+    while (sent < count) {
+        int batch = count - sent;
+        if (batch > ZED_NET_BATCH_MAX)
+            batch = ZED_NET_BATCH_MAX;
+
+        struct mmsghdr msgs[ZED_NET_BATCH_MAX];
+        struct iovec iov[ZED_NET_BATCH_MAX];
+        struct sockaddr_in to[ZED_NET_BATCH_MAX];
+
+        memset(msgs, 0, sizeof(msgs[0]) * batch);
+        for (int i = 0; i < batch; i++) {
+            const zed_net_datagram_t *datagram = &datagrams[sent + i];
+            memset(&to[i], 0, sizeof(to[i]));
+            to[i].sin_family = AF_INET;
+            to[i].sin_addr.s_addr = datagram->address.host;
+            to[i].sin_port = htons(datagram->address.port);
+            iov[i].iov_base = datagram->data;
+            iov[i].iov_len = datagram->length;
+            msgs[i].msg_hdr.msg_name = &to[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(to[i]);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int n = sendmmsg(socket->handle, msgs, batch, 0);
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+#else
+    for (int i = 0; i < count; i++) {
+        if (zed_net_udp_socket_send(socket, datagrams[i].address, datagrams[i].data, datagrams[i].length) == 0)
+            sent++;
+    }
+#endif
+
+    if (count > 0 && sent == 0) {
+        return zed_net__error("Failed to send data");
+    }
+
+    return sent;
+}
+
+ZED_NET_DEF int zed_net_poller_open(zed_net_poller_t *poller, zed_net_socket_t *socket) {
+    if (!poller || !socket) {
+        return zed_net__error("Poller or socket is NULL");
+    }
+
+    poller->handle = socket->handle;
+
+#ifdef _WIN32
+    poller->events[0] = WSACreateEvent();
+    poller->events[1] = WSACreateEvent();
+    if (poller->events[0] == WSA_INVALID_EVENT || poller->events[1] == WSA_INVALID_EVENT) {
+        zed_net_poller_close(poller);
+        return zed_net__error("Failed to create socket events");
+    }
+
+    if (WSAEventSelect(socket->handle, poller->events[0], FD_READ) != 0) {
+        zed_net_poller_close(poller);
+        return zed_net__error("Failed to select socket events");
+    }
+#else
+    if (pipe(poller->wake) != 0) {
+        poller->wake[0] = poller->wake[1] = -1;
+        return zed_net__error("Failed to create wake pipe");
+    }
+
+    fcntl(poller->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(poller->wake[1], F_SETFL, O_NONBLOCK);
+#endif
+
+    return 0;
+}
+
+ZED_NET_DEF void zed_net_poller_close(zed_net_poller_t *poller) {
+    if (!poller) {
+        return;
+    }
+
+#ifdef _WIN32
+    for (int i = 0; i < 2; i++) {
+        if (poller->events[i] && poller->events[i] != WSA_INVALID_EVENT)
+            WSACloseEvent(poller->events[i]);
+        poller->events[i] = NULL;
+    }
+#else
+    for (int i = 0; i < 2; i++) {
+        if (poller->wake[i] >= 0)
+            close(poller->wake[i]);
+        poller->wake[i] = -1;
+    }
+#endif
+}
+
+ZED_NET_DEF int zed_net_poller_wait(zed_net_poller_t *poller, int timeout_ms) {
+    if (!poller) {
+        return zed_net__error("Poller is NULL");
+    }
+
+#ifdef _WIN32
+    DWORD result = WSAWaitForMultipleEvents(2, (WSAEVENT *) poller->events, FALSE,
+        timeout_ms < 0 ? WSA_INFINITE : (DWORD) timeout_ms, FALSE);
+
+    // FD_READ is signalled again by the next receive if data is still pending,
+    // so the event can be reset before the socket is drained
+    if (result == WSA_WAIT_EVENT_0) {
+        WSAResetEvent(poller->events[0]);
+        return 1;
+    }
+    if (result == WSA_WAIT_EVENT_0 + 1) {
+        WSAResetEvent(poller->events[1]);
+        return 0;
+    }
+    if (result == WSA_WAIT_TIMEOUT)
+        return 0;
+
+    return zed_net__error("Failed to wait for socket events");
+#else
+    struct pollfd fds[2];
+    fds[0].fd = poller->handle;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = poller->wake[0];
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+
+    int result = poll(fds, 2, timeout_ms);
+    if (result < 0) {
+        if (errno == EINTR)
+            return 0;
+        return zed_net__error("Failed to poll socket");
+    }
+
+    if (fds[1].revents & POLLIN) {
+        char buffer[16];
+        while (read(poller->wake[0], buffer, sizeof(buffer)) > 0) {}
+        return 0;
+    }
+
+    return (fds[0].revents & (POLLIN | POLLERR)) ? 1 : 0;
+#endif
+}
+
+ZED_NET_DEF void zed_net_poller_wake(zed_net_poller_t *poller) {
+    if (!poller) {
+        return;
+    }
+
+#ifdef _WIN32
+    WSASetEvent(poller->events[1]);
+#else
+    char signal = 0;
+    if (write(poller->wake[1], &signal, 1) < 0) {
+        // the pipe is full, so a wake up is already pending
+    }
+#endif
+}
+
 #endif // ZED_NET_IMPLEMENTATION
 
 // vim: tabstop=4 shiftwidth=4 expandtab
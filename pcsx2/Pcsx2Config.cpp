@@ -89,6 +89,7 @@ Pcsx2Config::RecompilerOptions::RecompilerOptions()
 
 	EnableEE	= true;
 	EnableEECache = false;
+	EnableVUCache = false;
 	EnableIOP	= true;
 	EnableVU0	= true;
 	EnableVU1	= true;
@@ -147,6 +148,7 @@ void Pcsx2Config::RecompilerOptions::LoadSave( IniInterface& ini )
 	IniBitBool( EnableEE );
 	IniBitBool( EnableIOP );
 	IniBitBool( EnableEECache );
+	IniBitBool( EnableVUCache );
 	IniBitBool( EnableVU0 );
 	IniBitBool( EnableVU1 );
 
@@ -165,6 +167,8 @@ void Pcsx2Config::RecompilerOptions::LoadSave( IniInterface& ini )
 	IniBitBool( StackFrameChecks );
 	IniBitBool( PreBlockCheckEE );
 	IniBitBool( PreBlockCheckIOP );
+	IniBitBool( ProfileBlocksEE );
+	IniBitBool( InterpretColdEE );
 }
 
 Pcsx2Config::CpuOptions::CpuOptions()
@@ -249,6 +253,28 @@ int Pcsx2Config::GSOptions::GetVsync() const
 	}
 }
 
+Pcsx2Config::RewindOptions::RewindOptions()
+{
+	Enabled		= false;
+	Interval	= 30;
+	BufferSize	= 256;
+}
+
+void Pcsx2Config::RewindOptions::LoadSave( IniInterface& ini )
+{
+	ScopedIniGroup path( ini, L"Rewind" );
+
+	IniEntry( Enabled );
+	IniEntry( Interval );
+	IniEntry( BufferSize );
+
+	if( ini.IsLoading() )
+	{
+		Interval	= std::max( 1, std::min( Interval, 600 ) );
+		BufferSize	= std::max( 16, std::min( BufferSize, 4096 ) );
+	}
+}
+
 const wxChar *const tbl_GamefixNames[] =
 {
 	L"VuAddSub",
@@ -434,6 +460,7 @@ void Pcsx2Config::LoadSave( IniInterface& ini )
 	IniBitBool( CdvdVerboseReads );
 	IniBitBool( CdvdDumpBlocks );
 	IniBitBool( CdvdShareWrite );
+	IniBitBool( CdvdTraceReads );
 	IniBitBool( EnablePatches );
 	IniBitBool( EnableCheats );
 	IniBitBool( EnableWideScreenPatches );
@@ -454,6 +481,7 @@ void Pcsx2Config::LoadSave( IniInterface& ini )
 	Speedhacks		.LoadSave( ini );
 	Cpu				.LoadSave( ini );
 	GS				.LoadSave( ini );
+	Rewind			.LoadSave( ini );
 	Gamefixes		.LoadSave( ini );
 	Profiler		.LoadSave( ini );
 
@@ -55,6 +55,7 @@ bool g_GameLoading; // EELOAD has been called to load the game
 static const uint eeWaitCycles = 3072;
 
 bool eeEventTestIsActive = false;
+bool eeEventTestResume = false;
 
 u32 g_eeloadMain = 0, g_eeloadExec = 0, g_osdsys_str = 0;
 
@@ -259,6 +259,10 @@ extern __aligned16 tlbs tlb[48];
 
 extern u32 g_nextEventCycle;
 extern bool eeEventTestIsActive;
+// Set when a state captured from within a vsync is loaded without leaving the core thread
+// (netplay rollback).  The CPU re-runs the event test before dispatching any code, so that
+// execution continues exactly as it did when the state was saved.
+extern bool eeEventTestResume;
 extern u32 s_iLastCOP0Cycle;
 extern u32 s_iLastPERFCycle[2];
 
@@ -268,6 +272,10 @@ void intSetBranch();
 // parts of the Recs (namely COP0's branch codes and stuff).
 void __fastcall intDoBranch(u32 target);
 
+// Interprets from cpuRegs.pc up to the next taken branch and its delay slot, for
+// code the EE recompiler hasn't compiled yet (see InterpretColdEE).
+void intExecuteBlock();
+
 // modules loaded at hardcoded addresses by the kernel
 const u32 EEKERNEL_START	= 0;
 const u32 EENULL_START		= 0x81FC0;
@@ -391,6 +399,16 @@ struct R5900cpu
 	//   doesn't matter if we're stripping it out soon. ;)
 	//
 	void (*Clear)(u32 Addr, u32 Size);
+
+	// Called by VTLB block protection when a write faults on a page of recompiled code,
+	// before the write is done.  The page's blocks are kept, but get checked against the
+	// code they were compiled from before they run again, and the page is write protected
+	// again then.  Addr is the physical address of the page.  Returns false if the blocks
+	// can't be kept, in which case the caller clears them.
+	//
+	// Exception Throws: None.
+	//
+	bool (*SuspendPage)(u32 Addr);
 	
 	uint (*GetCacheReserve)();
 	void (*SetCacheReserve)( uint reserveInMegs );
@@ -0,0 +1,146 @@
+/*  PCSX2 - PS2 Emulator for PCs
+ *  Copyright (C) 2002-2010  PCSX2 Dev Team
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU Lesser General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with PCSX2.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "PrecompiledHeader.h"
+#include "RewindBuffer.h"
+
+// --------------------------------------------------------------------------------------
+//  XOR delta packing
+// --------------------------------------------------------------------------------------
+// A packed delta is a sequence of runs, each a header of two u32 word counts (words that are
+// equal, words that differ) followed by the XOR of the differing words.
+
+static void PackXorDelta( const u64* older, const u64* newer, uint words, std::vector<u8>& out )
+{
+	out.clear();
+
+	uint i = 0;
+	while( i < words )
+	{
+		const uint start = i;
+		while( i < words && older[i] == newer[i] ) ++i;
+		const uint diff = i;
+		while( i < words && older[i] != newer[i] ) ++i;
+
+		const u32 header[2] = { diff - start, i - diff };
+		const size_t pos = out.size();
+		out.resize( pos + sizeof(header) + header[1] * sizeof(u64) );
+
+		memcpy( &out[pos], header, sizeof(header) );
+		u64* dest = (u64*)&out[pos + sizeof(header)];
+		for( uint w = diff; w < i; ++w )
+			*dest++ = older[w] ^ newer[w];
+	}
+}
+
+static void ApplyXorDelta( u64* state, const std::vector<u8>& packed )
+{
+	const u8* src = packed.data();
+	const u8* end = src + packed.size();
+
+	u64* dest = state;
+	while( src < end )
+	{
+		u32 header[2];
+		memcpy( header, src, sizeof(header) );
+		src += sizeof(header);
+
+		dest += header[0];
+		const u64* xor_words = (const u64*)src;
+		for( uint w = 0; w < header[1]; ++w )
+			*dest++ ^= xor_words[w];
+		src += header[1] * sizeof(u64);
+	}
+}
+
+// Grows the buffer to the given size and zeroes everything past the used portion, so that
+// states of different sizes can be XORed word for word.
+static void PadState( VmStateBuffer& state, uint used, uint size )
+{
+	state.MakeRoomFor( size );
+	if( size > used )
+		memset( state.GetPtr( used ), 0, size - used );
+}
+
+// --------------------------------------------------------------------------------------
+//  RewindBuffer  (implementations)
+// --------------------------------------------------------------------------------------
+RewindBuffer::RewindBuffer( size_t budget )
+	: m_current( new VmStateBuffer( L"Rewind State" ) )
+	, m_scratch( new VmStateBuffer( L"Rewind State" ) )
+{
+	m_currentSize	= 0;
+	m_budget		= budget;
+	m_used			= 0;
+}
+
+void RewindBuffer::Capture()
+{
+	memSavingState save( m_scratch.get() );
+	save.FreezeAll();
+	const uint size = save.GetCurrentPos();
+
+	if( m_currentSize )
+	{
+		const uint words = (std::max( size, m_currentSize ) + sizeof(u64) - 1) / sizeof(u64);
+		PadState( *m_current, m_currentSize, words * sizeof(u64) );
+		PadState( *m_scratch, size, words * sizeof(u64) );
+
+		PackXorDelta( (u64*)m_current->GetPtr(), (u64*)m_scratch->GetPtr(), words, m_packed );
+
+		m_deltas.emplace_back();
+		Delta& delta = m_deltas.back();
+		delta.size = m_currentSize;
+		delta.words = words;
+		delta.data.assign( m_packed.begin(), m_packed.end() );
+		m_used += delta.data.size();
+
+		while( m_used > m_budget && !m_deltas.empty() )
+		{
+			m_used -= m_deltas.front().data.size();
+			m_deltas.pop_front();
+		}
+	}
+
+	m_current.swap( m_scratch );
+	m_currentSize = size;
+}
+
+bool RewindBuffer::Rewind()
+{
+	if( !m_currentSize ) return false;
+
+	memLoadingState( m_current.get() ).FreezeAll();
+
+	if( !m_deltas.empty() )
+	{
+		Delta& delta = m_deltas.back();
+		PadState( *m_current, m_currentSize, delta.words * sizeof(u64) );
+		ApplyXorDelta( (u64*)m_current->GetPtr(), delta.data );
+		m_currentSize = delta.size;
+
+		m_used -= delta.data.size();
+		m_deltas.pop_back();
+	}
+
+	return true;
+}
+
+void RewindBuffer::Clear()
+{
+	m_deltas.clear();
+	m_currentSize	= 0;
+	m_used			= 0;
+}
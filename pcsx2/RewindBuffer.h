@@ -0,0 +1,76 @@
+/*  PCSX2 - PS2 Emulator for PCs
+ *  Copyright (C) 2002-2010  PCSX2 Dev Team
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU Lesser General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with PCSX2.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "SaveState.h"
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+// --------------------------------------------------------------------------------------
+//  RewindBuffer
+// --------------------------------------------------------------------------------------
+// History of memory savestates captured periodically by the core thread.  Only the newest
+// state is kept in full; every older state is stored as the XOR of itself and the state
+// captured after it, packed into runs of zero and non-zero words.  Consecutive states differ
+// in little but the memory the game touched, so the deltas are mostly zero runs and pack down
+// to a small fraction of a full state.  Rewinding loads the newest state and rebuilds the one
+// before it by applying the newest delta.
+//
+// Deltas are kept within a memory budget; the oldest ones are discarded first.  The two full
+// states (newest and capture scratch) are not counted against the budget.
+//
+// Threading: all methods must be called from the context of the core thread; Capture from
+// within a vsync, and Rewind from outside of CPU execution (see SysCoreThread::LoadStateInThread).
+//
+class RewindBuffer
+{
+public:
+	RewindBuffer( size_t budget );
+	virtual ~RewindBuffer() = default;
+
+	// Captures the current machine state as the newest state.
+	void Capture();
+
+	// Loads the newest state and removes it from the history.  The oldest state is kept, so
+	// rewinding past the start of the history keeps reloading it.  Returns false if nothing has
+	// been captured yet.
+	bool Rewind();
+
+	void Clear();
+
+	bool IsEmpty() const { return m_currentSize == 0; }
+	uint GetCount() const { return IsEmpty() ? 0 : m_deltas.size() + 1; }
+	size_t GetUsedBytes() const { return m_used; }
+
+protected:
+	struct Delta
+	{
+		uint size;				// size of the older state, in bytes
+		uint words;				// length both states were padded to, in u64 words
+		std::vector<u8> data;	// packed XOR against the newer state
+	};
+
+	std::unique_ptr<VmStateBuffer> m_current;	// newest state, in full
+	std::unique_ptr<VmStateBuffer> m_scratch;	// capture target, swapped with m_current
+	uint m_currentSize;
+
+	std::deque<Delta> m_deltas;					// newest at the back
+	std::vector<u8> m_packed;					// packing scratch, reused between captures
+	size_t m_budget;
+	size_t m_used;
+};
@@ -79,6 +79,7 @@ void SaveStateBase::Init( SafeArray<u8>* memblock )
 	m_version	= g_SaveVersion;
 	m_idx		= 0;
 	m_DidBios	= false;
+	m_ExcludeMainRam = false;
 }
 
 void SaveStateBase::PrepBlock( int size )
@@ -154,11 +155,12 @@ SaveStateBase& SaveStateBase::FreezeMainMemory()
 {
 	vu1Thread.WaitVU(); // Finish VU1 just in-case...
 	if (IsLoading()) PreLoadPrep();
-	else m_memory->MakeRoomFor( m_idx + MainMemorySizeInBytes );
+	else m_memory->MakeRoomFor( m_idx + MainMemorySizeInBytes - (m_ExcludeMainRam ? Ps2MemSize::MainRam : 0) );
 
 	// First Block - Memory Dumps
 	// ---------------------------
-	FreezeMem(eeMem->Main,		Ps2MemSize::MainRam);		// 32 MB main memory
+	if( !m_ExcludeMainRam )
+		FreezeMem(eeMem->Main,	Ps2MemSize::MainRam);		// 32 MB main memory
 	FreezeMem(eeMem->Scratch,	Ps2MemSize::Scratch);		// scratch pad
 	FreezeMem(eeHw,				Ps2MemSize::Hardware);		// hardware memory
 
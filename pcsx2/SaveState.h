@@ -106,6 +106,7 @@ protected:
 	int m_idx;			// current read/write index of the allocation
 
 	bool m_DidBios;
+	bool m_ExcludeMainRam;
 
 public:
 	SaveStateBase( VmStateBuffer& memblock );
@@ -131,6 +132,14 @@ public:
 	virtual SaveStateBase& FreezeInternals();
 	virtual SaveStateBase& FreezePlugins();
 
+	// Leaves EE main memory out of FreezeMainMemory.  Used by delta savestates, which keep
+	// main memory as an undo log of written pages instead (see DeltaState.h).
+	SaveStateBase& ExcludeMainRam( bool exclude=true )
+	{
+		m_ExcludeMainRam = exclude;
+		return *this;
+	}
+
 	// Loads or saves an arbitrary data type.  Usable on atomic types, structs, and arrays.
 	// For dynamically allocated pointers use FreezeMem instead.
 	template<typename T>
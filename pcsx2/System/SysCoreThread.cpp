@@ -24,6 +24,7 @@
 #include "Patch.h"
 #include "SysThreads.h"
 #include "MTVU.h"
+#include "RewindBuffer.h"
 
 #include "../DebugTools/MIPSAnalyst.h"
 #include "../DebugTools/SymbolMap.h"
@@ -49,8 +50,11 @@ SysCoreThread::SysCoreThread()
 	m_resetProfilers		= true;
 	m_resetVsyncTimers		= true;
 	m_resetVirtualMachine	= true;
+	m_resetRewind			= true;
 
 	m_hasActiveMachine		= false;
+	m_rewindVsyncs			= 0;
+	m_rewindRequested		= false;
 }
 
 SysCoreThread::~SysCoreThread()
@@ -148,6 +152,7 @@ void SysCoreThread::ApplySettings( const Pcsx2Config& src )
 	m_resetRecompilers		= ( src.Cpu != EmuConfig.Cpu ) || ( src.Gamefixes != EmuConfig.Gamefixes ) || ( src.Speedhacks != EmuConfig.Speedhacks );
 	m_resetProfilers		= ( src.Profiler != EmuConfig.Profiler );
 	m_resetVsyncTimers		= ( src.GS != EmuConfig.GS );
+	m_resetRewind			= ( src.Rewind != EmuConfig.Rewind );
 
 	const_cast<Pcsx2Config&>(EmuConfig) = src;
 }
@@ -161,13 +166,38 @@ void SysCoreThread::UploadStateCopy( const VmStateBuffer& copy )
 	m_resetVirtualMachine = false;
 }
 
+// Requests that the given state be loaded without pausing the thread.  Must be called from
+// the context of this thread, and the state must have been saved from within a vsync
+// (VsyncInThread); CPU execution is exited at the next state check and the state is uploaded
+// before execution resumes from that vsync.  The buffer must remain valid until then.
+void SysCoreThread::LoadStateInThread( const VmStateBuffer& copy )
+{
+	const VmStateBuffer* state = &copy;
+	LoadStateInThread( [state]() { memLoadingState( state ).FreezeAll(); } );
+}
+
+// Same as above, for states that aren't held in a single buffer (delta savestates).  The
+// loader is run from StateCheckInThread, outside of recompiled code.
+void SysCoreThread::LoadStateInThread( const std::function<void()>& loader )
+{
+	AffinityAssert_AllowFromSelf( pxDiagSpot );
+	m_pendingStateLoad = loader;
+}
+
+// Requests that the newest rewind state be loaded at the next vsync.  Can be called from
+// any thread; does nothing if rewind is disabled or no state has been captured yet.
+void SysCoreThread::RequestRewind()
+{
+	m_rewindRequested = true;
+}
+
 // --------------------------------------------------------------------------------------
 //  SysCoreThread *Worker* Implementations
 //    (Called from the context of this thread only)
 // --------------------------------------------------------------------------------------
 bool SysCoreThread::HasPendingStateChangeRequest() const
 {
-	return !m_hasActiveMachine || GetMTGS().HasPendingException() || _parent::HasPendingStateChangeRequest();
+	return !m_hasActiveMachine || (bool)m_pendingStateLoad || GetMTGS().HasPendingException() || _parent::HasPendingStateChangeRequest();
 }
 
 void SysCoreThread::_reset_stuff_as_needed()
@@ -188,6 +218,17 @@ void SysCoreThread::_reset_stuff_as_needed()
 		m_resetProfilers		= false;
 	}
 
+	// Captured states belong to the machine being reset, so they go along with it.
+	if( m_resetRewind || m_resetVirtualMachine )
+	{
+		const Pcsx2Config::RewindOptions& opts = EmuConfig.Rewind;
+		m_rewind.reset( opts.Enabled ? new RewindBuffer( (size_t)opts.BufferSize * _1mb ) : NULL );
+		m_rewindVsyncs			= 0;
+		m_rewindRequested		= false;
+
+		m_resetRewind			= false;
+	}
+
 	if( m_resetVirtualMachine )
 	{
 		DoCpuReset();
@@ -225,6 +266,29 @@ void SysCoreThread::DoCpuReset()
 void SysCoreThread::VsyncInThread()
 {
 	ApplyLoadedPatches(PPT_CONTINUOUSLY);
+	RewindInThread();
+}
+
+// Captures a rewind state every Rewind.Interval vsyncs, or schedules the newest one to be
+// loaded if a rewind was requested.  States are captured and restored at the same point of
+// a vsync, so emulation resumes exactly where the capture was taken.
+void SysCoreThread::RewindInThread()
+{
+	if( !m_rewind ) return;
+
+	if( m_rewindRequested.exchange( false ) && !m_rewind->IsEmpty() )
+	{
+		std::shared_ptr<RewindBuffer> rewind( m_rewind );
+		LoadStateInThread( [rewind]() { rewind->Rewind(); } );
+		m_rewindVsyncs = 0;
+		return;
+	}
+
+	if( ++m_rewindVsyncs >= EmuConfig.Rewind.Interval )
+	{
+		m_rewind->Capture();
+		m_rewindVsyncs = 0;
+	}
 }
 
 void SysCoreThread::GameStartingInThread()
@@ -244,7 +308,19 @@ void SysCoreThread::GameStartingInThread()
 bool SysCoreThread::StateCheckInThread()
 {
 	GetMTGS().RethrowException();
-	return _parent::StateCheckInThread() && (_reset_stuff_as_needed(), true);
+	if( !_parent::StateCheckInThread() ) return false;
+
+	_reset_stuff_as_needed();
+
+	if( m_pendingStateLoad )
+	{
+		std::function<void()> loader;
+		loader.swap( m_pendingStateLoad );
+		loader();
+		eeEventTestResume = true;
+	}
+
+	return true;
 }
 
 // Runs CPU cycles indefinitely, until the user or another thread requests execution to break.
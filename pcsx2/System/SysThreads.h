@@ -20,6 +20,11 @@
 #include "Utilities/PersistentThread.h"
 #include "x86emitter/tools.h"
 
+#include <functional>
+#include <memory>
+
+class RewindBuffer;
+
 
 using namespace Threading;
 
@@ -169,6 +174,7 @@ protected:
 	bool			m_resetProfilers;
 	bool			m_resetVsyncTimers;
 	bool			m_resetVirtualMachine;
+	bool			m_resetRewind;
 
 	// Indicates if the system has an active virtual machine state.  Pretty much always
 	// true anytime between plugins being initialized and plugins being shutdown.  Gets
@@ -176,6 +182,16 @@ protected:
 	// occurs while trying to upload a new state into the VM.
 	std::atomic<bool> m_hasActiveMachine;
 
+	// State loader to be run at the next state check, from the context of this thread.
+	// Set by in-thread clients (netplay rollback) that cannot pause the thread themselves.
+	std::function<void()> m_pendingStateLoad;
+
+	// Periodic state captures for rewinding (see Pcsx2Config::RewindOptions).  Null when
+	// rewind is disabled.  Shared with a pending rewind load.
+	std::shared_ptr<RewindBuffer> m_rewind;
+	int				m_rewindVsyncs;
+	std::atomic<bool> m_rewindRequested;
+
 	wxString		m_elf_override;
 
 	SSE_MXCSR		m_mxcsr_saved;
@@ -198,6 +214,9 @@ public:
 
 	virtual void ApplySettings( const Pcsx2Config& src );
 	virtual void UploadStateCopy( const VmStateBuffer& copy );
+	virtual void LoadStateInThread( const VmStateBuffer& copy );
+	virtual void LoadStateInThread( const std::function<void()>& loader );
+	virtual void RequestRewind();
 
 	virtual bool HasActiveMachine() const { return m_hasActiveMachine; }
 
@@ -206,6 +225,7 @@ public:
 
 protected:
 	void _reset_stuff_as_needed();
+	void RewindInThread();
 
 	virtual void Start();
 	virtual void OnStart();
@@ -327,6 +327,11 @@ public:
 
 	wxString		GameLaunchArgs;
 
+	// Replay played back on the autorun disc, and for a batch run the file its
+	// frame hashes and speed are written to (see ReplayReport).
+	wxString		ReplayFile;
+	wxString		ReplayReport;
+
 	// Specifies the CDVD source type to use when AutoRunning
 	CDVD_SourceType CdvdSource;
 
@@ -32,6 +32,7 @@
 #include "Patch.h"
 #include "R5900Exceptions.h"
 #include "Sio.h"
+#include "Netplay/IOPHook.h"
 
 __aligned16 SysMtgsThread mtgsThread;
 __aligned16 AppCoreThread CoreThread;
@@ -575,6 +576,7 @@ void AppCoreThread::OnCleanupInThread()
 void AppCoreThread::VsyncInThread()
 {
 	wxGetApp().LogicalVsync();
+	VsyncIOPHook();
 	_parent::VsyncInThread();
 }
 
@@ -25,6 +25,8 @@
 #include "Dialogs/ModalPopups.h"
 
 #include "Debugger/DisassemblyDialog.h"
+#include "CDVD/BciConverter.h"
+#include "CDVD/SectorTrace.h"
 
 #ifndef DISABLE_RECORDING
 #	include "Recording/VirtualPad.h"
@@ -260,6 +262,12 @@ void Pcsx2App::OnInitCmdLine( wxCmdLineParser& parser )
 	parser.AddSwitch( wxEmptyString,L"fullboot",	_("disables fast booting") );
 	parser.AddOption( wxEmptyString,L"gameargs",	_("passes the specified space-delimited string of launch arguments to the game"), wxCMD_LINE_VAL_STRING);
 
+	parser.AddOption( wxEmptyString,L"replay",		_("plays back the specified replay on the booted disc"), wxCMD_LINE_VAL_STRING );
+	parser.AddOption( wxEmptyString,L"replayreport",	_("with --replay: runs uncapped and writes per-frame state hashes and the framerate to the specified file; with --nogui, exits when done"), wxCMD_LINE_VAL_STRING );
+	parser.AddOption( wxEmptyString,L"bci",			_("compresses the ISO image given on the command line to the specified .bci file, then exits"), wxCMD_LINE_VAL_STRING );
+	parser.AddOption( wxEmptyString,L"cdtrace",		_("replays the specified CDVD read trace on the ISO image given on the command line, reports its speed, then exits"), wxCMD_LINE_VAL_STRING );
+	parser.AddSwitch( wxEmptyString,L"cdtracepaced",	_("with --cdtrace: waits out the emulated time between reads") );
+
 	parser.AddOption( wxEmptyString,L"cfgpath",		_("changes the configuration file path"), wxCMD_LINE_VAL_STRING );
 	parser.AddOption( wxEmptyString,L"cfg",			_("specifies the PCSX2 configuration file to use"), wxCMD_LINE_VAL_STRING );
 	parser.AddSwitch( wxEmptyString,L"forcewiz",	AddAppName(_("forces %s to start the First-time Wizard")) );
@@ -357,6 +365,27 @@ bool Pcsx2App::OnCmdLineParsed( wxCmdLineParser& parser )
 
 	if( !ParseOverrides(parser) ) return false;
 
+	wxString bci_file;
+	if (parser.Found(L"bci", &bci_file) && !bci_file.IsEmpty())
+	{
+		// Conversion only; the emulator doesn't start.
+		if (parser.GetParamCount() < 1)
+			Console.Error(L"--bci needs the ISO image to compress.");
+		else
+			BciConverter::Convert(parser.GetParam(0), bci_file);
+		return false;
+	}
+
+	wxString cdtrace_file;
+	if (parser.Found(L"cdtrace", &cdtrace_file) && !cdtrace_file.IsEmpty())
+	{
+		if (parser.GetParamCount() < 1)
+			Console.Error(L"--cdtrace needs the ISO image to read from.");
+		else
+			SectorTraceReplay(cdtrace_file, parser.GetParam(0), parser.Found(L"cdtracepaced"));
+		return false;
+	}
+
 	// --- Parse Startup/Autoboot options ---
 
 	Startup.NoFastBoot		= parser.Found(L"fullboot");
@@ -385,6 +414,9 @@ bool Pcsx2App::OnCmdLineParsed( wxCmdLineParser& parser )
 	if (parser.Found(L"gameargs", &game_args) && !game_args.IsEmpty())
 		Startup.GameLaunchArgs = game_args;
 
+	parser.Found(L"replay", &Startup.ReplayFile);
+	parser.Found(L"replayreport", &Startup.ReplayReport);
+
 	if( parser.Found(L"usecd") )
 	{
 		Startup.CdvdSource	= CDVD_SourceType::Plugin;
@@ -523,6 +555,12 @@ bool Pcsx2App::OnInit()
 			g_Conf->CdvdSource = Startup.CdvdSource;
 			if (Startup.CdvdSource == CDVD_SourceType::Iso)
 				SysUpdateIsoSrcFile( Startup.IsoFile );
+			if( !Startup.ReplayFile.IsEmpty() )
+			{
+				g_Conf->Replay.IsEnabled = true;
+				g_Conf->Replay.FilePath = Startup.ReplayFile;
+				g_Conf->Replay.ReportPath = Startup.ReplayReport;
+			}
 			sApp.SysExecute( Startup.CdvdSource );
 			g_Conf->CurrentGameArgs = Startup.GameLaunchArgs;
 		}
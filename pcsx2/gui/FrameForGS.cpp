@@ -23,6 +23,7 @@
 #include "MSWstuff.h"
 
 #include "ConsoleLogger.h"
+#include "Netplay/NetplayPlugin.h"
 
 #ifndef DISABLE_RECORDING
 #	include "Recording/InputRecording.h"
@@ -52,6 +53,7 @@ void GSPanel::InitDefaultAccelerators()
 	m_Accels->Map( AAC( WXK_F1 ),				"States_FreezeCurrentSlot" );
 	m_Accels->Map( AAC( WXK_F3 ),				"States_DefrostCurrentSlot");
 	m_Accels->Map( AAC( WXK_F3 ).Shift(),		"States_DefrostCurrentSlotBackup");
+	m_Accels->Map( AAC( WXK_BACK ),				"States_Rewind" );
 	m_Accels->Map( AAC( WXK_F2 ),				"States_CycleSlotForward" );
 	m_Accels->Map( AAC( WXK_F2 ).Shift(),		"States_CycleSlotBackward" );
 
@@ -84,6 +86,9 @@ void GSPanel::InitDefaultAccelerators()
 	m_Accels->Map( AAC( WXK_F11 ),				"Sys_FreezeGS" );
 	m_Accels->Map( AAC( WXK_F12 ),				"Sys_RecordingToggle" );
 
+	m_Accels->Map( AAC( WXK_PAGEDOWN ),			"Replay_SeekForward" );
+	m_Accels->Map( AAC( WXK_PAGEUP ),			"Replay_SeekBackward" );
+
 	m_Accels->Map( FULLSCREEN_TOGGLE_ACCELERATOR_GSPANEL,		"FullscreenToggle" );
 }
 
@@ -694,6 +699,9 @@ void GSFrame::OnUpdateTitle( wxTimerEvent& evt )
 	out << std::fixed << std::setprecision(2) << fps;
 	OSDmonitor(Color_StrongGreen, "FPS:", out.str());
 
+	if (g_Conf->Netplay.IsEnabled)
+		INetplayPlugin::GetInstance().UpdateOverlay();
+
 #ifdef __linux__
 	// Important Linux note: When the title is set in fullscreen the window is redrawn. Unfortunately
 	// an intermediate white screen appears too which leads to a very annoying flickering.
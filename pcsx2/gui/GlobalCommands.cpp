@@ -21,6 +21,7 @@
 
 #include "AppAccelerators.h"
 #include "AppSaveStates.h"
+#include "Netplay/ReplayPlugin.h"
 
 #ifndef DISABLE_RECORDING
 #	include "Recording/RecordingControls.h"
@@ -468,6 +469,19 @@ namespace Implementations
 		if( GSFrame* gsframe = wxGetApp().GetGsFramePtr() )
 			gsframe->ShowFullScreen( !gsframe->IsFullScreen() );
 	}
+
+	// replay playback jumps through the keyframes of the file, 10 seconds at a time
+	void Replay_SeekForward()
+	{
+		if( g_Conf->Replay.IsEnabled )
+			IReplayPlugin::GetInstance().RequestSeek( 600 );
+	}
+
+	void Replay_SeekBackward()
+	{
+		if( g_Conf->Replay.IsEnabled )
+			IReplayPlugin::GetInstance().RequestSeek( -600 );
+	}
 #ifndef DISABLE_RECORDING
 	void FrameAdvance()
 	{
@@ -638,6 +652,13 @@ static const GlobalCommandDescriptor CommandDeclarations[] =
 		false,
 	},
 
+	{	"States_Rewind",
+		States_Rewind,
+		pxL( "Rewind" ),
+		pxL( "Steps the virtual machine back to the previous rewind state." ),
+		false,
+	},
+
 	{	"States_CycleSlotForward",
 		States_CycleSlotForward,
 		pxL( "Cycle to next slot" ),
@@ -766,6 +787,20 @@ static const GlobalCommandDescriptor CommandDeclarations[] =
 		false,
 	},
 
+	{	"Replay_SeekForward",
+		Implementations::Replay_SeekForward,
+		NULL,
+		NULL,
+		false,
+	},
+
+	{	"Replay_SeekBackward",
+		Implementations::Replay_SeekBackward,
+		NULL,
+		NULL,
+		false,
+	},
+
 #ifndef DISABLE_RECORDING
 	{ "FrameAdvance"				, Implementations::FrameAdvance,				NULL, NULL, false },
 	{ "TogglePause"					, Implementations::TogglePause,					NULL, NULL, false },
@@ -117,6 +117,17 @@ void States_DefrostCurrentSlotBackup()
 	_States_DefrostCurrentSlot(true);
 }
 
+void States_Rewind()
+{
+	if (!g_Conf->EmuOptions.Rewind.Enabled)
+	{
+		Console.WriteLn("Rewind is disabled.");
+		return;
+	}
+
+	GetCoreThread().RequestRewind();
+}
+
 // I'd keep an eye on this function, as it may still be problematic.
 void Sstates_updateLoadBackupMenuItem(bool isBeforeSave)
 {
@@ -129,6 +129,7 @@ public:
 extern std::array<Saveslot,10> saveslot_cache;
 extern void States_DefrostCurrentSlotBackup();
 extern void States_DefrostCurrentSlot();
+extern void States_Rewind();
 extern void States_FreezeCurrentSlot();
 extern void States_CycleSlotForward();
 extern void States_CycleSlotBackward();
@@ -19,13 +19,18 @@
 
 BASEBLOCKEX* BaseBlocks::New(u32 startpc, uptr fnptr)
 {
-	std::pair<linkiter_t, linkiter_t> range = links.equal_range(startpc);
-	for (linkiter_t i = range.first; i != range.second; ++i)
-		*(u32*)i->second = fnptr - (i->second + 4);
+	Relink(startpc, fnptr);
 	
 	return blocks.insert(startpc, fnptr);;
 }
 
+void BaseBlocks::Relink(u32 startpc, uptr target)
+{
+	std::pair<linkiter_t, linkiter_t> range = links.equal_range(startpc);
+	for (linkiter_t i = range.first; i != range.second; ++i)
+		*(u32*)i->second = target - (i->second + 4);
+}
+
 int BaseBlocks::LastIndex(u32 startpc) const
 {
 	if (0 == blocks.size())
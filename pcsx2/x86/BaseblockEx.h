@@ -220,6 +220,8 @@ public:
 	}
 
 	void Link(u32 pc, s32* jumpptr);
+	// Points every jump linked to startpc at the given address.
+	void Relink(u32 startpc, uptr target);
 
 	__fi void Reset()
 	{
@@ -33,7 +33,11 @@
 #include "Elfheader.h"
 
 #include "../DebugTools/Breakpoints.h"
+#include "../DebugTools/SymbolMap.h"
 #include "Patch.h"
+#include "AppConfig.h"
+
+#include <unordered_map>
 
 #if !PCSX2_SEH
 #	include <csetjmp>
@@ -110,7 +114,9 @@ static u32 dumplog = 0;
 #endif
 
 static void iBranchTest(u32 newpc = 0xffffffff);
+static void recLinkBlock(u32 pc, s32* jumpptr);
 static void ClearRecLUT(BASEBLOCK* base, int count);
+void recClear(u32 addr, u32 size);
 static u32 scaleblockcycles();
 
 void _eeFlushAllUnused()
@@ -317,6 +323,7 @@ void recCall( void (*func)() )
 static void __fastcall recRecompile( const u32 startpc );
 static void __fastcall dyna_block_discard(u32 start,u32 sz);
 static void __fastcall dyna_page_reset(u32 start,u32 sz);
+static void __fastcall recResumeBlock(u32 pc);
 
 // Recompiled code buffer for EE recompiler dispatchers!
 static u8 __pagealigned eeRecDispatchers[__pagesize];
@@ -327,6 +334,7 @@ static DynGenFunc* DispatcherEvent		= NULL;
 static DynGenFunc* DispatcherReg		= NULL;
 static DynGenFunc* JITCompile			= NULL;
 static DynGenFunc* JITCompileInBlock	= NULL;
+static DynGenFunc* JITResume			= NULL;
 static DynGenFunc* EnterRecompiledCode	= NULL;
 static DynGenFunc* ExitRecompiledCode	= NULL;
 static DynGenFunc* DispatchBlockDiscard = NULL;
@@ -363,6 +371,16 @@ static DynGenFunc* _DynGen_JITCompileInBlock()
 	return (DynGenFunc*)retval;
 }
 
+// The address for all blocks of suspended pages.  It checks the blocks of the page
+// and then dispatches to the current pc, recompiling it if its block had changed.
+static DynGenFunc* _DynGen_JITResume()
+{
+	u8* retval = xGetAlignedCallTarget();
+	xFastCall((void*)recResumeBlock, ptr[&cpuRegs.pc] );
+	xJMP( (void*)DispatcherReg );
+	return (DynGenFunc*)retval;
+}
+
 // called when jumping to variable pc address
 static DynGenFunc* _DynGen_DispatcherReg()
 {
@@ -443,6 +461,7 @@ static void _DynGen_Dispatchers()
 
 	JITCompile           = _DynGen_JITCompile();
 	JITCompileInBlock    = _DynGen_JITCompileInBlock();
+	JITResume            = _DynGen_JITResume();
 	EnterRecompiledCode  = _DynGen_EnterRecompiledCode();
 	DispatchBlockDiscard = _DynGen_DispatchBlockDiscard();
 	DispatchPageReset    = _DynGen_DispatchPageReset();
@@ -574,6 +593,325 @@ static bool eeCpuExecuting = false;
 static bool g_resetEeScalingStats = false;
 static int g_patchesNeedRedo = 0;
 
+// --------------------------------------------------------------------------------------
+//  EE block profiler
+// --------------------------------------------------------------------------------------
+// With ProfileBlocksEE, every block starts by counting its entry and reading the TSC.
+// The ticks since the previous block was entered are charged to that block, so a block's
+// time includes the helpers and event tests it calls on its way to the next one.
+// The report goes to the logs folder each time execution stops (pause, savestates...).
+
+struct eeBlockProfile {
+	u64 ticks;		// TSC ticks from each entry of this block to the next block entered
+	u64 count;		// number of entries
+	u32 size;		// instructions, as last compiled
+	u32 compiles;	// times it was compiled, rec resets included
+};
+
+static std::unordered_map<u32, eeBlockProfile> s_blockProfile;	// by start pc
+static eeBlockProfile s_blockProfileIdle;	// charged with the time spent out of recompiled code
+static eeBlockProfile* s_blockProfileLast = &s_blockProfileIdle;
+static u32 s_blockProfileTsc;
+static u32 s_blockProfileResets;
+
+// Emits the entry counter of the block at startpc. Clobbers eax, ecx and edx.
+static void recProfileBlock(u32 startpc)
+{
+	eeBlockProfile& prof = s_blockProfile[startpc];
+	prof.compiles++;
+
+	xRDTSC();
+	xMOV(ecx, ptr32[&s_blockProfileLast]);
+	xMOV(edx, eax);
+	xSUB(eax, ptr32[&s_blockProfileTsc]);
+	xMOV(ptr32[&s_blockProfileTsc], edx);
+	xADD(ptr32[ecx + offsetof(eeBlockProfile, ticks)], eax);
+	xADC(ptr32[ecx + offsetof(eeBlockProfile, ticks) + 4], 0);
+	xMOV(ptr32[&s_blockProfileLast], (uptr)&prof);
+	xADD(ptr32[(u32*)&prof.count], 1);
+	xADC(ptr32[(u32*)&prof.count + 1], 0);
+}
+
+static std::string recProfileSymbol(u32 pc)
+{
+	u32 func = symbolMap.GetFunctionStart(pc);
+	if (func == SymbolMap::INVALID_ADDRESS)
+		return std::string();
+
+	char buf[32];
+	std::string name = symbolMap.GetLabelString(func);
+	if (name.empty())
+	{
+		snprintf(buf, sizeof(buf), "%08x", func);
+		name = buf;
+	}
+	if (pc != func)
+	{
+		snprintf(buf, sizeof(buf), "+0x%x", pc - func);
+		name += buf;
+	}
+	return name;
+}
+
+static double recProfileShare(u64 part, u64 total)
+{
+	return total ? (double)part / (double)total * 100.0 : 0.0;
+}
+
+// Writes the functions and blocks that took the most host time, and the blocks
+// compiled the most times (code that keeps getting invalidated).
+static void recProfileReport()
+{
+	if (s_blockProfile.empty())
+		return;
+
+	struct FuncProfile {
+		u64 ticks, count;
+		u32 blocks, compiles;
+	};
+
+	typedef std::pair<u32, const eeBlockProfile*> BlockEntry;
+	std::vector<BlockEntry> blocks;
+	std::unordered_map<u32, FuncProfile> funcs;
+	u64 totalTicks = 0, totalCount = 0;
+	for (const auto& it : s_blockProfile)
+	{
+		const eeBlockProfile& prof = it.second;
+		blocks.push_back(BlockEntry(it.first, &prof));
+		totalTicks += prof.ticks;
+		totalCount += prof.count;
+
+		u32 func = symbolMap.GetFunctionStart(it.first);
+		FuncProfile& fp = funcs[func];
+		fp.ticks += prof.ticks;
+		fp.count += prof.count;
+		fp.blocks++;
+		fp.compiles += prof.compiles;
+	}
+
+	FILE* f = wxFopen(Path::Combine(GetLogFolder(), L"eeBlockProfile.txt"), L"w");
+	if (!f)
+		return;
+
+	fprintf(f, "EE block profile: %u blocks, %llu entries, %llu ticks, %u recompiler resets\n",
+		(u32)blocks.size(), (unsigned long long)totalCount, (unsigned long long)totalTicks, s_blockProfileResets);
+
+	typedef std::pair<u32, FuncProfile> FuncEntry;
+	std::vector<FuncEntry> byFunc(funcs.begin(), funcs.end());
+	std::sort(byFunc.begin(), byFunc.end(), [](const FuncEntry& a, const FuncEntry& b) { return a.second.ticks > b.second.ticks; });
+
+	fprintf(f, "\nFunctions by host time\n   time%%              ticks          entries blocks compiles  function\n");
+	for (const FuncEntry& it : byFunc)
+	{
+		const FuncProfile& fp = it.second;
+		double share = recProfileShare(fp.ticks, totalTicks);
+		if (share < 0.01)
+			break;
+		std::string name = (it.first == SymbolMap::INVALID_ADDRESS) ? "(no function)" : recProfileSymbol(it.first);
+		fprintf(f, "%7.2f%% %18llu %16llu %6u %8u  %s\n", share, (unsigned long long)fp.ticks,
+			(unsigned long long)fp.count, fp.blocks, fp.compiles, name.c_str());
+	}
+
+	std::sort(blocks.begin(), blocks.end(), [](const BlockEntry& a, const BlockEntry& b) { return a.second->ticks > b.second->ticks; });
+
+	fprintf(f, "\nBlocks by host time\n      pc    time%%              ticks          entries ticks/entry insts compiles  function\n");
+	for (const BlockEntry& it : blocks)
+	{
+		const eeBlockProfile& prof = *it.second;
+		double share = recProfileShare(prof.ticks, totalTicks);
+		if (share < 0.01)
+			break;
+		fprintf(f, "%08x %7.2f%% %18llu %16llu %11.1f %5u %8u  %s\n", it.first, share, (unsigned long long)prof.ticks,
+			(unsigned long long)prof.count, prof.count ? (double)prof.ticks / prof.count : 0.0, prof.size, prof.compiles,
+			recProfileSymbol(it.first).c_str());
+	}
+
+	std::sort(blocks.begin(), blocks.end(), [](const BlockEntry& a, const BlockEntry& b) { return a.second->compiles > b.second->compiles; });
+
+	fprintf(f, "\nBlocks by compiles, beyond one per recompiler reset\n      pc compiles    time%%          entries  function\n");
+	for (const BlockEntry& it : blocks)
+	{
+		const eeBlockProfile& prof = *it.second;
+		if (prof.compiles <= s_blockProfileResets + 1)
+			break;
+		fprintf(f, "%08x %8u %7.2f%% %16llu  %s\n", it.first, prof.compiles, recProfileShare(prof.ticks, totalTicks),
+			(unsigned long long)prof.count, recProfileSymbol(it.first).c_str());
+	}
+
+	fclose(f);
+}
+
+// --------------------------------------------------------------------------------------
+//  Suspended pages
+// --------------------------------------------------------------------------------------
+// A write fault on a protected page suspends its blocks rather than clearing them (see
+// mmap_ClearCpuBlock): they stay compiled, but recLUT and the jumps linked to them lead
+// to JITResume, and a copy of the page from before the write is kept.  The next time
+// anything in the page is run or recompiled, every block is compared to that copy; the
+// ones whose code is unchanged are put back and the page is write protected again, so
+// data written next to code costs a page fault instead of a recompile.
+
+static const int SuspendedPageSlots = 64;
+
+struct eeSuspendedPage
+{
+	u32 paddr;
+	bool used;
+	u8 code[__pagesize];	// the page as its blocks were compiled from it
+};
+
+static eeSuspendedPage s_suspendedPages[SuspendedPageSlots];
+static u8 s_suspendedSlot[Ps2MemSize::MainRam >> 12];	// slot+1 of each suspended page, 0 if none
+static int s_suspendedNext = 0;							// where to look for a free slot first
+
+static void recResetSuspendedPages()
+{
+	for (int i = 0; i < SuspendedPageSlots; i++)
+		s_suspendedPages[i].used = false;
+	memzero(s_suspendedSlot);
+	s_suspendedNext = 0;
+}
+
+// Checks the blocks of a suspended page against its copy; changed blocks are cleared and
+// the others put back.
+static void recResumePage(u32 paddr)
+{
+	paddr &= ~0xfffU;
+	if (paddr >= Ps2MemSize::MainRam || !s_suspendedSlot[paddr >> 12])
+		return;
+
+	eeSuspendedPage& page = s_suspendedPages[s_suspendedSlot[paddr >> 12] - 1];
+	s_suspendedSlot[paddr >> 12] = 0;
+	page.used = false;
+
+	// Clearing a block can take out others, so look the next one up again each time.
+	u32 restored = 0, end = paddr + __pagesize;
+	while (BASEBLOCKEX* pexblock = recBlocks[recBlocks.LastIndex(end - 4)])
+	{
+		if (pexblock->startpc < paddr || pexblock->startpc >= end)
+			break;
+		end = pexblock->startpc;
+
+		BASEBLOCK* pblock = PC_GETBLOCK(pexblock->startpc);
+		if (pblock->GetFnptr() != (uptr)JITResume)
+			continue;
+
+		if (memcmp(&page.code[pexblock->startpc & 0xfff], PSM(pexblock->startpc), pexblock->size * 4))
+		{
+			eeRecPerfLog.Write( "Clearing modified block @ 0x%08X  [size=%d]", pexblock->startpc, pexblock->size*4 );
+			recClear(pexblock->startpc, pexblock->size);
+		}
+		else
+		{
+			pblock->SetFnptr(pexblock->fnptr);
+			recBlocks.Relink(pexblock->startpc, pexblock->fnptr);
+			restored++;
+		}
+	}
+
+	if (restored)
+		mmap_MarkCountedRamPage(paddr, 0);
+}
+
+// Links a jump to the block at pc.  A block of a suspended page has to be reached through
+// JITResume, like the jumps that were linked to it before it was suspended.
+static void recLinkBlock(u32 pc, s32* jumpptr)
+{
+	const u32 hwpc = HWADDR(pc);
+	recBlocks.Link(hwpc, jumpptr);
+	if (hwpc < Ps2MemSize::MainRam && s_suspendedSlot[hwpc >> 12])
+		recBlocks.Relink(hwpc, (uptr)JITResume);
+}
+
+static void __fastcall recResumeBlock(u32 pc)
+{
+	recResumePage(HWADDR(pc));
+	pxAssert(PC_GETBLOCK(pc)->GetFnptr() != (uptr)JITResume);
+}
+
+static bool recSuspendPage(u32 paddr)
+{
+	paddr &= ~0xfffU;
+	if (paddr >= Ps2MemSize::MainRam)
+		return false;
+	if (s_suspendedSlot[paddr >> 12])
+		return true;
+
+	u32 suspended = 0;
+	for (int i = recBlocks.LastIndex(paddr + __pagesize - 4); BASEBLOCKEX* pexblock = recBlocks[i]; i--)
+	{
+		if (pexblock->startpc < paddr || pexblock->startpc >= paddr + __pagesize)
+			break;
+
+		BASEBLOCK* pblock = PC_GETBLOCK(pexblock->startpc);
+		if (pblock->GetFnptr() != pexblock->fnptr)
+			continue;
+
+		pblock->SetFnptr((uptr)JITResume);
+		recBlocks.Relink(pexblock->startpc, (uptr)JITResume);
+		suspended++;
+	}
+
+	if (!suspended)
+		return true;
+
+	// Out of slots, the oldest suspended page gets cleared to make room.
+	int slot = s_suspendedNext;
+	for (int i = 0; i < SuspendedPageSlots && s_suspendedPages[slot].used; i++)
+		slot = (slot + 1) % SuspendedPageSlots;
+
+	eeSuspendedPage& page = s_suspendedPages[slot];
+	if (page.used)
+	{
+		s_suspendedSlot[page.paddr >> 12] = 0;
+		recClear(page.paddr, 0x400);
+	}
+
+	page.paddr = paddr;
+	page.used = true;
+	memcpy(page.code, PSM(paddr), __pagesize);
+	s_suspendedSlot[paddr >> 12] = slot + 1;
+	s_suspendedNext = (slot + 1) % SuspendedPageSlots;
+	return true;
+}
+
+// --------------------------------------------------------------------------------------
+//  Cold blocks
+// --------------------------------------------------------------------------------------
+// With InterpretColdEE, a block is interpreted the first times it is reached, and only
+// compiled once it runs again. Code that runs once (loaders, the setup of a new level)
+// is never compiled, which takes most of the compile time out of the frames that
+// stream in new code. Blocks cleared for being modified start cold again.
+
+static const u32 ColdBlockRuns = 2;					// interpreted runs before a block gets compiled
+static std::unordered_map<u32, u32> s_coldBlocks;	// runs so far, by HWADDR of the start pc
+
+// Returns true if the block at startpc was interpreted instead of compiled.
+static bool recInterpretCold(u32 startpc)
+{
+	if (!EmuConfig.Cpu.Recompiler.InterpretColdEE)
+		return false;
+
+	// Blocks that recRecompile hooks into, and anything the debugger watches, must be compiled
+	const u32 hwpc = HWADDR(startpc);
+	if (hwpc == EELOAD_START || (g_eeloadMain && hwpc == HWADDR(g_eeloadMain))
+		|| (g_eeloadExec && hwpc == HWADDR(g_eeloadExec)) || (g_GameLoading && hwpc == ElfEntry)
+		|| EmuConfig.Gamefixes.GoemonTlbHack
+		|| CBreakPoints::GetNumMemchecks() || !CBreakPoints::GetBreakpoints().empty())
+		return false;
+
+	u32& runs = s_coldBlocks[hwpc];
+	if (runs >= ColdBlockRuns)
+	{
+		s_coldBlocks.erase(hwpc);
+		return false;
+	}
+	runs++;
+
+	intExecuteBlock();
+	return true;
+}
+
 ////////////////////////////////////////////////////
 static void recResetRaw()
 {
@@ -588,6 +926,12 @@ static void recResetRaw()
 
 	Console.WriteLn( Color_StrongBlack, "EE/iR5900-32 Recompiler Reset" );
 
+	if (!s_blockProfile.empty())
+		s_blockProfileResets++;
+	s_blockProfileLast = &s_blockProfileIdle;
+	s_coldBlocks.clear();
+	recResetSuspendedPages();
+
 	recMem->Reset();
 	ClearRecLUT((BASEBLOCK*)recLutReserve_RAM, recLutSize);
 	memset(recRAMCopy, 0, Ps2MemSize::MainRam);
@@ -626,6 +970,11 @@ static void recShutdown()
 	safe_free( s_pInstCache );
 	s_nInstCacheSize = 0;
 
+	s_blockProfile.clear();
+	s_blockProfileResets = 0;
+	s_coldBlocks.clear();
+	recResetSuspendedPages();
+
 	// FIXME Warning thread unsafe
 	Perf::dump();
 }
@@ -685,8 +1034,14 @@ static void recExecute()
 #if PCSX2_SEH
 	eeRecIsReset = false;
 	ScopedBool executing(eeCpuExecuting);
+	s_blockProfileLast = &s_blockProfileIdle;
 
 	try {
+		if( eeEventTestResume )
+		{
+			eeEventTestResume = false;
+			recEventTest();
+		}
 		EnterRecompiledCode();
 	}
 	catch( Exception::ExitCpuExecute& )
@@ -706,6 +1061,7 @@ static void recExecute()
 	{
 		eeRecIsReset = false;
 		ScopedBool executing(eeCpuExecuting);
+		s_blockProfileLast = &s_blockProfileIdle;
 
 		// Important! Most of the console logging and such has cancel points in it.  This is great
 		// in Windows, where SEH lets us safely kill a thread from anywhere we want.  This is bad
@@ -713,6 +1069,11 @@ static void recExecute()
 		// of the cancelstate here!
 
 		pthread_setcancelstate( PTHREAD_CANCEL_DISABLE, &oldstate );
+		if( eeEventTestResume )
+		{
+			eeEventTestResume = false;
+			recEventTest();
+		}
 		EnterRecompiledCode();
 
 		// Generally unreachable code here ...
@@ -730,6 +1091,7 @@ static void recExecute()
 #endif
 
 	EE::Profiler.Print();
+	recProfileReport();
 }
 
 ////////////////////////////////////////////////////
@@ -1048,7 +1410,7 @@ static void iBranchTest(u32 newpc)
 		if (newpc == 0xffffffff)
 			xJS( DispatcherReg );
 		else
-			recBlocks.Link(HWADDR(newpc), xJcc32(Jcc_Signed));
+			recLinkBlock(newpc, xJcc32(Jcc_Signed));
 
 		xJMP( (void*)DispatcherEvent );
 	}
@@ -1489,7 +1851,7 @@ void __fastcall dyna_page_reset(u32 start,u32 sz)
 {
 	recClear(start & ~0xfffUL, 0x400);
 	manual_counter[start >> 12]++;
-	mmap_MarkCountedRamPage( start );
+	mmap_MarkCountedRamPage( start, 0 );
 }
 
 static void memory_protect_recompiled_code(u32 startpc, u32 size)
@@ -1511,7 +1873,7 @@ static void memory_protect_recompiled_code(u32 startpc, u32 size)
 
 		case ProtMode_None:
         case ProtMode_Write:
-			mmap_MarkCountedRamPage( inpage_ptr );
+			mmap_MarkCountedRamPage( inpage_ptr, size );
 			manual_page[inpage_ptr >> 12] = 0;
 			break;
 
@@ -1632,6 +1994,13 @@ static void __fastcall recRecompile( const u32 startpc )
 
 	if (eeRecNeedsReset) recResetRaw();
 
+	// The JITCompile dispatcher goes on from wherever the interpreter left cpuRegs.pc
+	if (recInterpretCold(startpc))
+		return;
+
+	// The new block may be protected along with the page, so its other blocks must be checked first
+	recResumePage(HWADDR(startpc));
+
 	xSetPtr( recPtr );
 	recPtr = xGetAlignedCallTarget();
 
@@ -1711,6 +2080,9 @@ static void __fastcall recRecompile( const u32 startpc )
 	_initX86regs();
 	_initXMMregs();
 
+	if (EmuConfig.Cpu.Recompiler.ProfileBlocksEE)
+		recProfileBlock(startpc);
+
 	if( EmuConfig.Cpu.Recompiler.PreBlockCheckEE )
 	{
 		// per-block dump checks, for debugging purposes.
@@ -2033,6 +2405,9 @@ StartRecomp:
 	pxAssert( (pc-startpc)>>2 <= 0xffff );
 	s_pCurBlockEx->size = (pc-startpc)>>2;
 
+	if (EmuConfig.Cpu.Recompiler.ProfileBlocksEE)
+		s_blockProfile[startpc].size = s_pCurBlockEx->size;
+
 	if (HWADDR(pc) <= Ps2MemSize::MainRam) {
 		BASEBLOCKEX *oldBlock;
 		int i;
@@ -2102,7 +2477,7 @@ StartRecomp:
 			{
 				xMOV( ptr32[&cpuRegs.pc], pc );
 				xADD( ptr32[&cpuRegs.cycle], scaleblockcycles() );
-				recBlocks.Link( HWADDR(pc), xJcc32() );
+				recLinkBlock( pc, xJcc32() );
 			}
 		}
 	}
@@ -2177,6 +2552,7 @@ R5900cpu recCpu =
 	recThrowException,
 	recThrowException,
 	recClear,
+	recSuspendPage,
 
 	recGetCacheReserve,
 	recSetCacheReserve,
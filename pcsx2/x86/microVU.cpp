@@ -19,6 +19,10 @@
 #include "microVU.h"
 
 #include "Utilities/Perf.h"
+#include "AppConfig.h"
+#include <wx/ffile.h>
+#include <unordered_map>
+#include <unordered_set>
 
 //------------------------------------------------------------------
 // Micro VU - Main Functions
@@ -26,6 +30,9 @@
 static u8 __pagealigned vu0_RecDispatchers[mVUdispCacheSize];
 static u8 __pagealigned vu1_RecDispatchers[mVUdispCacheSize];
 
+// Weights of the words of micro memory in the range keys (see mVUrangesKey)
+static u64 mVUkeyWeight[mProgSize];
+
 static __fi void mVUthrowHardwareDeficiency(const wxChar* extFail, int vuIndex) {
 	throw Exception::HardwareDeficiency()
 		.SetDiagMsg(pxsFmt(L"microVU%d recompiler init failed: %s is not available.", vuIndex, extFail))
@@ -51,6 +58,15 @@ void mVUinit(microVU& mVU, uint vuIndex) {
 
 	memzero(mVU.prog);
 
+	// Random odd weights (splitmix64), the same for both VUs
+	u64 seed = 0;
+	for (u32 i = 0; i < mProgSize; i++) {
+		u64 z = (seed += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		mVUkeyWeight[i] = (z ^ (z >> 31)) | 1;
+	}
+
 	mVU.index			=  vuIndex;
 	mVU.cop2			=  0;
 	mVU.vuMemSize		= (mVU.index ? 0x4000 : 0x1000);
@@ -74,6 +90,9 @@ void mVUinit(microVU& mVU, uint vuIndex) {
 // Resets Rec Data
 void mVUreset(microVU& mVU, bool resetReserve) {
 
+	// Keep the programs before they are deleted; they're saved when the game ends
+	mVUkeepProgCache(mVU);
+
 	// Restore reserve to uncommitted state
 	if (resetReserve) mVU.cache_reserve->Reset();
 
@@ -96,6 +115,7 @@ void mVUreset(microVU& mVU, bool resetReserve) {
 	mVU.prog.cur		= NULL;
 	mVU.prog.total		=  0;
 	mVU.prog.curFrame	=  0;
+	mVU.prog.microHashDirty = 0;
 
 	// Setup Dynarec Cache Limits for Each Program
 	u8* z = mVU.cache;
@@ -127,6 +147,7 @@ void mVUreset(microVU& mVU, bool resetReserve) {
 // Free Allocated Resources
 void mVUclose(microVU& mVU) {
 
+	mVUsaveProgCache(mVU);
 	safe_delete  (mVU.cache_reserve);
 
 	// Delete Programs and Block Managers
@@ -142,6 +163,11 @@ void mVUclose(microVU& mVU) {
 
 // Clears Block Data in specified range
 __fi void mVUclear(mV, u32 addr, u32 size) {
+	// Micro memory gets written after this, so the new words are summed up by the next search.
+	// A clear reaching the end of micro memory may be the first half of a split MPG, which
+	// goes on writing from address 0 without clearing it.
+	u32 first = (addr + size < mVU.microMemSize) ? addr / 4 : 0;
+	mVU.prog.microHashDirty = std::min(mVU.prog.microHashDirty, first);
 	if(!mVU.prog.cleared) {
 		mVU.prog.cleared = 1;		// Next execution searches/creates a new microprogram
 		memzero(mVU.prog.lpState); // Clear pipeline state
@@ -191,6 +217,7 @@ __ri microProgram* mVUcreateProg(microVU& mVU, int startPC) {
 __ri void mVUcacheProg(microVU& mVU, microProgram& prog) {
 	if (!mVU.index)	memcpy(prog.data, mVU.regs().Micro, 0x1000);
 	else			memcpy(prog.data, mVU.regs().Micro, 0x4000);
+	prog.rangesHashed = false;
 	mVUdumpProg(mVU, prog);
 }
 
@@ -230,6 +257,61 @@ void mVUprintUniqueRatio(microVU& mVU) {
 	DevCon.WriteLn("%d / %d [%3.1f%%]", v.size(), total, 100.-(double)v.size()/(double)total*100.);
 }
 
+// Range keys: the sum over a program's compiled ranges of each word times the
+// weight of its address. Programs whose ranges match micro memory have the same
+// key as micro memory over those ranges, so the search only has to memcmp the
+// programs whose keys match. Micro memory's key over any range comes from its
+// prefix sums, which are brought up to date from the first word written.
+
+// Words of micro memory a range covers (the same bytes mVUcmpPartial compares)
+static __fi bool mVUrangeWords(microVU& mVU, const microRange& range, u32& first, u32& last) {
+	if ((range.start < 0) || (range.end < 0)) return false;
+	first = range.start / 4;
+	last  = std::min<u32>((range.end + 8) / 4, mVU.progSize);
+	return first < last;
+}
+
+// Key of a cached program, recomputed only when its data or ranges have changed
+static u64 mVUrangesKey(microVU& mVU, microProgram& prog) {
+	if (!prog.rangesHashed) {
+		u64 key = 0;
+		u32 first, last;
+		std::deque<microRange>::const_iterator it(prog.ranges->begin());
+		for ( ; it != prog.ranges->end(); ++it) {
+			if (!mVUrangeWords(mVU, it[0], first, last)) continue;
+			for (u32 i = first; i < last; i++) {
+				key += (u64)prog.data[i] * mVUkeyWeight[i];
+			}
+		}
+		prog.rangesHash   = key;
+		prog.rangesHashed = true;
+	}
+	return prog.rangesHash;
+}
+
+// Key of micro memory over a cached program's ranges
+static u64 mVUmicroKey(microVU& mVU, microProgram& prog) {
+	const u64* sum = mVU.prog.microHash;
+	u64 key = 0;
+	u32 first, last;
+	std::deque<microRange>::const_iterator it(prog.ranges->begin());
+	for ( ; it != prog.ranges->end(); ++it) {
+		if (!mVUrangeWords(mVU, it[0], first, last)) continue;
+		key += sum[last] - sum[first];
+	}
+	return key;
+}
+
+// Updates the prefix sums of micro memory from the first word written since the last search
+static void mVUupdateMicroHash(microVU& mVU) {
+	const u32* micro = (u32*)mVU.regs().Micro;
+	u64* sum = mVU.prog.microHash;
+	for (u32 i = mVU.prog.microHashDirty; i < mVU.progSize; i++) {
+		sum[i + 1] = sum[i] + (u64)micro[i] * mVUkeyWeight[i];
+	}
+	mVU.prog.microHashDirty = mVU.progSize;
+}
+
 // Compare partial program by only checking compiled ranges...
 __ri bool mVUcmpPartial(microVU& mVU, microProgram& prog) {
 	std::deque<microRange>::const_iterator it(prog.ranges->begin());
@@ -260,9 +342,10 @@ _mVUt __fi void* mVUsearchProg(u32 startPC, uptr pState) {
 	microProgramQuick& quick = mVU.prog.quick[startPC/8];
 	microProgramList*  list  = mVU.prog.prog [startPC/8];
 	if(!quick.prog) { // If null, we need to search for new program
+		mVUupdateMicroHash(mVU);
 		std::deque<microProgram*>::iterator it(list->begin());
 		for ( ; it != list->end(); ++it) {
-			bool b = mVUcmpProg(mVU, *it[0], 0);
+			bool b = (mVUrangesKey(mVU, *it[0]) == mVUmicroKey(mVU, *it[0])) && mVUcmpProg(mVU, *it[0], 0);
 			if (EmuConfig.Gamefixes.ScarfaceIbit) {
 				if (isVU1 && ((((u32*)mVU.regs().Micro)[startPC / 4 + 1]) == 0x80200118) &&
 						     ((((u32*)mVU.regs().Micro)[startPC / 4 + 3]) == 0x81000062)) {
@@ -295,6 +378,8 @@ _mVUt __fi void* mVUsearchProg(u32 startPC, uptr pState) {
 		mVU.prog.cleared	= 0;
 		mVU.prog.isSame		= 1;
 		mVU.prog.cur		= mVUcreateProg(mVU,  startPC/8);
+		mVU.prog.cur->cacheKey = startPC/8 + mVU.prog.microHash[mVU.progSize]; // Hash is up to date from the search
+		mVUloadCachedBlocks(mVU, *mVU.prog.cur);
 		void* entryPoint	= mVUblockFetch(mVU,  startPC, pState);
 		quick.block			= mVU.prog.cur->block[startPC/8];
 		quick.prog			= mVU.prog.cur;
@@ -308,6 +393,218 @@ _mVUt __fi void* mVUsearchProg(u32 startPC, uptr pState) {
 	return mVUentryGet(mVU, quick.block, startPC, pState);
 }
 
+//------------------------------------------------------------------
+// Micro VU - Program Cache
+//------------------------------------------------------------------
+
+// With EnableVUCache, the programs of a game are saved when the recompiler is
+// closed or another game starts, and read back the first time the VU runs for
+// that game again. Whenever the recompiler creates one of those programs, all of
+// its saved blocks are compiled with it, so they're already there when the game
+// gets to them. Recompiler resets (savestate loads, rollbacks, a full rec-cache)
+// don't end the run: the programs they delete are only kept in memory until the
+// save, and are compiled again the same way once the game gets back to them.
+// What gets saved is the input of the recompiler, the program's micro memory and
+// the pipeline state each of its blocks was entered with, not x86 code: nothing
+// has to be relocated and the blocks are compiled for the current settings.
+//
+// Layout: mVUprogCacheHeader, then for each program
+//   u32 startPC, u32 blockCount, microMemSize bytes of data,
+//   blockCount times { u32 pc, microRegInfo pState }
+
+struct mVUprogCacheHeader {
+	u8  magic[4];		// "mVUC"
+	u32 version;
+	u32 crc;			// ElfCRC of the game
+	u32 index;			// VU index
+	u32 microMemSize;
+	u32 regInfoSize;	// sizeof(microRegInfo)
+	u32 progCount;
+};
+
+static const u32 mVUprogCacheVersion = 1;
+
+// Pipeline state of the block being loaded; block searches need it aligned
+static __aligned16 microRegInfo mVUcacheState;
+
+static wxString mVUprogCacheFile(microVU& mVU, u32 crc) {
+	wxDirName folder(PathDefs::GetDocuments() + wxDirName(L"cache"));
+	folder.Mkdir();
+	return Path::Combine(folder, wxFileName(wxsFormat(L"microVU%u_%08X.bin", mVU.index, crc)));
+}
+
+static void mVUappend(std::vector<u8>& out, const void* src, size_t size) {
+	out.insert(out.end(), (const u8*)src, (const u8*)src + size);
+}
+
+// A program kept for the cache file, as it is written there
+struct mVUkeptProg {
+	u32 startPC;
+	std::vector<u8> data;				// microMemSize bytes
+	std::vector<u8> blocks;				// { u32 pc, microRegInfo pState } for each block
+	std::unordered_set<u64> blockKeys;	// mVUblockKey() of each block
+};
+
+// Programs of the running game, from its cache file and from the recompiler, by
+// program key (see microProgram::cacheKey); written back when the game ends
+static std::unordered_map<u64, mVUkeptProg> mVUkeptProgs[2];
+
+// Key of a whole program: its startPC plus its data's range key over all of micro memory
+static u64 mVUprogKey(microVU& mVU, u32 startPC, const u32* data) {
+	u64 key = startPC;
+	for (u32 w = 0; w < mVU.progSize; w++) key += (u64)data[w] * mVUkeyWeight[w];
+	return key;
+}
+
+// FNV-1a of a block's pc and pipeline state; a collision only leaves a block out of the cache
+static u64 mVUblockKey(u32 pc, const microRegInfo& pState) {
+	u64 key = 14695981039346656037ULL ^ pc;
+	const u8* p = (const u8*)&pState;
+	for (size_t i = 0; i < sizeof(microRegInfo); i++) key = (key ^ p[i]) * 1099511628211ULL;
+	return key;
+}
+
+static void mVUkeepBlock(mVUkeptProg& kept, u32 pc, const microRegInfo& pState) {
+	if (!kept.blockKeys.insert(mVUblockKey(pc, pState)).second) return;
+	mVUappend(kept.blocks, &pc, sizeof(u32));
+	mVUappend(kept.blocks, &pState, sizeof(microRegInfo));
+}
+
+// Adds the current programs to the kept ones, merging the blocks of programs kept before
+void mVUkeepProgCache(microVU& mVU) {
+	if (!mVU.prog.cacheCRC || !EmuConfig.Cpu.Recompiler.EnableVUCache) return;
+
+	for (u32 i = 0; i < (mVU.progSize / 2); i++) {
+		if (!mVU.prog.prog[i]) continue;
+		std::deque<microProgram*>::iterator it(mVU.prog.prog[i]->begin());
+		for ( ; it != mVU.prog.prog[i]->end(); ++it) {
+			microProgram& prog = *it[0];
+			mVUkeptProg& kept = mVUkeptProgs[mVU.index][prog.cacheKey];
+			if (kept.data.empty()) {
+				kept.startPC = prog.startPC;
+				mVUappend(kept.data, prog.data, mVU.microMemSize);
+			}
+			else if ((kept.startPC != prog.startPC) || memcmp(kept.data.data(), prog.data, mVU.microMemSize)) {
+				continue; // Another program with the same key, the first one stays
+			}
+
+			for (u32 pc = 0; pc < (mVU.progSize / 2); pc++) {
+				if (!prog.block[pc]) continue;
+				prog.block[pc]->forEach([&](const microBlock& block) {
+					mVUkeepBlock(kept, pc, block.pState);
+				});
+			}
+			if (kept.blocks.empty()) mVUkeptProgs[mVU.index].erase(prog.cacheKey);
+		}
+	}
+}
+
+void mVUsaveProgCache(microVU& mVU) {
+	const u32 crc = mVU.prog.cacheCRC;
+	if (!crc || !EmuConfig.Cpu.Recompiler.EnableVUCache) return;
+
+	mVUkeepProgCache(mVU);
+	std::unordered_map<u64, mVUkeptProg>& kept = mVUkeptProgs[mVU.index];
+	const u32 progCount = (u32)kept.size();
+	if (!progCount) return;
+
+	const size_t blockBytes = sizeof(u32) + sizeof(microRegInfo);
+	std::vector<u8> out(sizeof(mVUprogCacheHeader));
+	for (auto it = kept.begin(); it != kept.end(); ++it) {
+		const u32 blockCount = (u32)(it->second.blocks.size() / blockBytes);
+		mVUappend(out, &it->second.startPC, sizeof(u32));
+		mVUappend(out, &blockCount, sizeof(u32));
+		mVUappend(out, it->second.data.data(), it->second.data.size());
+		mVUappend(out, it->second.blocks.data(), it->second.blocks.size());
+	}
+	kept.clear();
+
+	mVUprogCacheHeader hdr = { {'m', 'V', 'U', 'C'}, mVUprogCacheVersion, crc, mVU.index,
+							   mVU.microMemSize, sizeof(microRegInfo), progCount };
+	memcpy(out.data(), &hdr, sizeof(hdr));
+
+	wxFFile file(mVUprogCacheFile(mVU, crc), L"wb");
+	if (!file.IsOpened() || (file.Write(out.data(), out.size()) != out.size())) {
+		Console.Warning("microVU%d: Could not save the program cache.", mVU.index);
+		return;
+	}
+	DevCon.WriteLn(mVU.index ? Color_Orange : Color_Magenta, "microVU%d: Saved %d programs to the program cache.", mVU.index, progCount);
+}
+
+// Reads the cache file of the new game; nothing is compiled until the game runs its programs
+void mVUloadProgCache(microVU& mVU) {
+	// The programs of the previous game stay, but are saved under the new one from now on
+	mVUsaveProgCache(mVU);
+	mVU.prog.cacheCRC = ElfCRC;
+	if (!ElfCRC || !EmuConfig.Cpu.Recompiler.EnableVUCache) return;
+
+	const wxString path(mVUprogCacheFile(mVU, ElfCRC));
+	if (!wxFileExists(path)) return;
+	wxFFile file(path, L"rb");
+	if (!file.IsOpened()) return;
+	std::vector<u8> in((size_t)file.Length());
+	if (in.size() < sizeof(mVUprogCacheHeader) || (file.Read(in.data(), in.size()) != in.size())) return;
+
+	mVUprogCacheHeader hdr;
+	memcpy(&hdr, in.data(), sizeof(hdr));
+	if (memcmp(hdr.magic, "mVUC", 4) || (hdr.version != mVUprogCacheVersion) || (hdr.crc != ElfCRC)
+	|| (hdr.index != mVU.index) || (hdr.microMemSize != mVU.microMemSize) || (hdr.regInfoSize != sizeof(microRegInfo))) {
+		Console.Warning("microVU%d: Ignoring program cache from another version.", mVU.index);
+		return;
+	}
+
+	const size_t progBytes  = 2 * sizeof(u32) + mVU.microMemSize;
+	const size_t blockBytes = sizeof(u32) + sizeof(microRegInfo);
+	size_t pos = sizeof(hdr);
+	u32 loaded = 0;
+
+	for ( ; loaded < hdr.progCount; loaded++) {
+		u32 startPC, blockCount;
+		if ((in.size() - pos) < progBytes) break;
+		memcpy(&startPC,    &in[pos], sizeof(u32));
+		memcpy(&blockCount, &in[pos + sizeof(u32)], sizeof(u32));
+		if ((startPC >= (mVU.progSize / 2)) || ((in.size() - pos - progBytes) / blockBytes < blockCount)) break;
+
+		u32 data[mProgSize];
+		memcpy(data, &in[pos + 2 * sizeof(u32)], mVU.microMemSize);
+		pos += progBytes;
+
+		mVUkeptProg& kept = mVUkeptProgs[mVU.index][mVUprogKey(mVU, startPC, data)];
+		if (kept.data.empty()) {
+			kept.startPC = startPC;
+			mVUappend(kept.data, data, mVU.microMemSize);
+		}
+		for (u32 i = 0; i < blockCount; i++, pos += blockBytes) {
+			u32 pc;
+			memcpy(&pc, &in[pos], sizeof(u32));
+			memcpy(&mVUcacheState, &in[pos + sizeof(u32)], sizeof(microRegInfo));
+			if (pc < (mVU.progSize / 2)) mVUkeepBlock(kept, pc, mVUcacheState);
+		}
+	}
+
+	DevCon.WriteLn(mVU.index ? Color_Orange : Color_Magenta, "microVU%d: Loaded %d of %d programs from the program cache.", mVU.index, loaded, hdr.progCount);
+}
+
+// Compiles the saved blocks of a program the recompiler has just created from micro memory
+void mVUloadCachedBlocks(microVU& mVU, microProgram& prog) {
+	if (!mVU.prog.cacheCRC || !EmuConfig.Cpu.Recompiler.EnableVUCache) return;
+
+	std::unordered_map<u64, mVUkeptProg>::iterator it(mVUkeptProgs[mVU.index].find(prog.cacheKey));
+	if (it == mVUkeptProgs[mVU.index].end()) return;
+	const mVUkeptProg& kept = it->second;
+	if ((kept.startPC != prog.startPC) || memcmp(kept.data.data(), prog.data, mVU.microMemSize)) return;
+
+	// Leave half of the rec-cache to the programs that aren't cached yet
+	u8* limit = mVU.prog.x86start + (mVU.prog.x86end - mVU.prog.x86start) / 2;
+	const size_t blockBytes = sizeof(u32) + sizeof(microRegInfo);
+	for (size_t pos = 0; (pos < kept.blocks.size()) && (xGetPtr() < limit); pos += blockBytes) {
+		u32 pc;
+		memcpy(&pc, &kept.blocks[pos], sizeof(u32));
+		memcpy(&mVUcacheState, &kept.blocks[pos + sizeof(u32)], sizeof(microRegInfo));
+		mVUblockFetch(mVU, pc * 8, (uptr)&mVUcacheState);
+	}
+}
+
 //------------------------------------------------------------------
 // recMicroVU0 / recMicroVU1
 //------------------------------------------------------------------
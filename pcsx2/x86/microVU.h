@@ -29,6 +29,7 @@ using namespace x86Emitter;
 #include "GS.h"
 #include "Gif_Unit.h"
 #include "iR5900.h"
+#include "Elfheader.h"
 #include "R5900OpcodeTables.h"
 #include "System/RecTypes.h"
 #include "x86emitter/x86emitter.h"
@@ -118,6 +119,10 @@ public:
 		}
 		return NULL;
 	}
+	template<typename T> void forEach(T func) const {
+		for(microBlockLink* linkI = qBlockList; linkI != NULL; linkI = linkI->next) func(linkI->block);
+		for(microBlockLink* linkI = fBlockList; linkI != NULL; linkI = linkI->next) func(linkI->block);
+	}
 	void printInfo(int pc, bool printQuick) {
 		int listI = printQuick ? qListI : fListI;
 		if (listI < 7) return;
@@ -149,6 +154,9 @@ struct microProgram {
 	std::deque<microRange>* ranges;			   // The ranges of the microProgram that have already been recompiled
 	u32 startPC; // Start PC of this program
 	int idx;	 // Program index
+	u64 rangesHash;   // mVUrangesKey() of data over ranges (valid if rangesHashed)
+	bool rangesHashed; // Cleared whenever data or ranges change
+	u64 cacheKey;	 // startPC plus the range key of data over all of micro memory (see mVUkeepProgCache)
 };
 
 typedef std::deque<microProgram*> microProgramList;
@@ -171,6 +179,9 @@ struct microProgManager {
 	u8*					x86start;			// Start of program's rec-cache
 	u8*					x86end;				// Limit of program's rec-cache
 	microRegInfo		lpState;			// Pipeline state from where program left off (useful for continuing execution)
+	u64					microHash[mProgSize+1]; // Prefix sums of mVU.regs().Micro's weighted words (see mVUrangesKey)
+	u32					microHashDirty;		// First word of mVU.regs().Micro written since microHash was updated
+	u32					cacheCRC;			// Game whose program cache has been loaded (see mVUloadProgCache)
 };
 
 static const uint mVUdispCacheSize	= __pagesize; // Dispatcher Cache Size (in bytes)
@@ -250,6 +261,10 @@ mVUop(mVUopL);
 // Private Functions
 extern void  mVUcacheProg (microVU& mVU, microProgram&  prog);
 extern void  mVUdeleteProg(microVU& mVU, microProgram*& prog);
+extern void  mVUloadProgCache(microVU& mVU);
+extern void  mVUkeepProgCache(microVU& mVU);
+extern void  mVUsaveProgCache(microVU& mVU);
+extern void  mVUloadCachedBlocks(microVU& mVU, microProgram& prog);
 _mVUt extern void* mVUsearchProg(u32 startPC, uptr pState);
 extern void* __fastcall mVUexecuteVU0(u32 startPC, u32 cycles);
 extern void* __fastcall mVUexecuteVU1(u32 startPC, u32 cycles);
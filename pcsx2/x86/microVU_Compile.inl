@@ -61,6 +61,7 @@ void mVUsetupRange(microVU& mVU, s32 pc, bool isStartPC) {
 	}
 
 	mVUcheckIsSame(mVU);
+	mVUcurProg.rangesHashed = false; // Ranges change below
 
 	if (isStartPC) {
 		microRange mRange = {pc, -1};
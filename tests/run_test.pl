@@ -35,6 +35,8 @@ sub help {
         --test=<REGEXP>         : filter test based on their names
         --bad                   : only run blacklisted tests
         --regression            : blacklist test that are known to be broken
+        --nolocal               : skip PCSX2's own tests (the directories next to this script,
+                                  built with their Makefile against the suite's common code)
 
         --option <KEY>=<VAL>    : overload PCSX2 configuration option
 
@@ -58,9 +60,10 @@ EOS
 }
 
 my $mt_timeout :shared;
-my ($o_suite, $o_help, $o_exe, $o_cfg, $o_max_cpu, $o_timeout, $o_show_diff, $o_debug_me, $o_test_name, $o_regression, $o_dry_run, %o_pcsx2_opt, $o_cygwin, $o_bad);
+my ($o_suite, $o_help, $o_exe, $o_cfg, $o_max_cpu, $o_timeout, $o_show_diff, $o_debug_me, $o_test_name, $o_regression, $o_dry_run, %o_pcsx2_opt, $o_cygwin, $o_bad, $o_local);
 
 # default value
+$o_local = 1;
 $o_bad = 0;
 $o_regression = 0;
 $o_cygwin = 0;
@@ -87,6 +90,7 @@ my $status = Getopt::Long::GetOptions(
     'dry_run'       => \$o_dry_run,
     'exe=s'         => \$o_exe,
     'help'          => \$o_help,
+    'local!'        => \$o_local,
     'option=s'      => \%o_pcsx2_opt,
     'regression'    => \$o_regression,
     'testname=s'    => \$o_test_name,
@@ -181,6 +185,12 @@ my $cwd = getcwd();
 my $g_test_db;
 print "INFO: search tests in $o_suite and run them in $o_max_cpu CPU)\n";
 find({ wanted => \&add_test_cmd_for_elf, no_chdir => 1 },  $o_suite);
+if ($o_local) {
+    my $local_dir = dirname(abs_path($0));
+    print "INFO: build and search local tests in $local_dir\n";
+    build_local_tests($local_dir);
+    find({ wanted => \&add_test_cmd_for_elf, no_chdir => 1 },  $local_dir);
+}
 print "\n";
 
 chdir($cwd); # Just to be sure
@@ -291,6 +301,24 @@ sub extract_test_log {
     }
 }
 
+# Local tests are C files next to their .expected, built by a Makefile in their directory
+sub build_local_tests {
+    my $dir = shift;
+
+    opendir(my $dh, $dir) or return;
+    my @subdirs = grep { !/^\./ and -f File::Spec->catfile($dir, $_, "Makefile") } readdir($dh);
+    closedir($dh);
+
+    foreach my $sub (sort(@subdirs)) {
+        my @cmd = ("make", "-C", File::Spec->catdir($dir, $sub), "PS2_AUTOTESTS_ROOT=$o_suite");
+        print "INFO: @cmd\n" if $o_debug_me or $o_dry_run;
+        next if $o_dry_run;
+        if (system(@cmd) != 0) {
+            print "WARNING: failed to build the tests in $sub, they won't run\n";
+        }
+    }
+}
+
 sub add_test_cmd_for_elf {
     my $file = $_;
     my $ext = "\\.(elf|irx)";
@@ -0,0 +1,90 @@
+/*  PCSX2 - PS2 Emulator for PCs
+ *  Copyright (C) 2002-2014  PCSX2 Dev Team
+ *
+ *  PCSX2 is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU Lesser General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  PCSX2 is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with PCSX2.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Self-modifying code across pages, for the EE recompiler's suspended pages.  run_test.pl
+// builds it with the Makefile here against the suite's common code and runs it along with
+// the suite (see the Makefile for the toolchain it needs).
+//
+// A data write next to a function suspends the function's page, which leaves it writable.
+// The function is then rewritten while the page is suspended, and called from a caller in
+// another page that is compiled only afterwards, so the caller's jump is linked while the
+// function's old block is still around.  The call must see the new code.
+
+#include <common-ee.h>
+#include <kernel.h>
+
+#define LI_V0(imm)		(0x24020000 | ((imm) & 0xffff))
+#define JR_RA			0x03e00008
+#define JAL(target)		(0x0c000000 | (((u32)(target) >> 2) & 0x03ffffff))
+#define NOP				0x00000000
+
+static u32 callee_page[1024] __attribute__((aligned(4096)));
+static u32 caller_page[1024] __attribute__((aligned(4096)));
+
+typedef int (*func_t)(void);
+
+static void sync_code() {
+	FlushCache(0);
+	FlushCache(2);
+}
+
+static void write_callee(int value) {
+	callee_page[0] = LI_V0(value);
+	callee_page[1] = JR_RA;
+	callee_page[2] = NOP;
+}
+
+static void write_caller(u32 *code) {
+	code[0] = 0x27bdfff0;			// addiu sp, sp, -16
+	code[1] = 0xafbf0000;			// sw ra, 0(sp)
+	code[2] = JAL(callee_page);
+	code[3] = NOP;
+	code[4] = 0x8fbf0000;			// lw ra, 0(sp)
+	code[5] = JR_RA;
+	code[6] = 0x27bd0010;			// addiu sp, sp, 16
+}
+
+int main(int argc, char *argv[]) {
+	func_t callee = (func_t)callee_page;
+	int i;
+
+	printf("-- TEST BEGIN\n");
+
+	write_callee(1);
+	sync_code();
+	for (i = 0; i < 4; i++)
+		callee();
+	printf("callee: %d\n", callee());
+
+	// Data in the callee's page, away from its code.
+	callee_page[512] = 0x12345678;
+	printf("data: %08x\n", callee_page[512]);
+
+	// The page is writable until something in it runs again.
+	write_callee(2);
+	write_caller(caller_page);
+	sync_code();
+	printf("callee through new caller: %d\n", ((func_t)caller_page)());
+	printf("callee: %d\n", callee());
+
+	// Again with the caller compiled first and the callee rewritten afterwards.
+	callee_page[513] = 0x9abcdef0;
+	write_callee(3);
+	sync_code();
+	printf("callee through old caller: %d\n", ((func_t)caller_page)());
+
+	printf("-- TEST END\n");
+	return 0;
+}